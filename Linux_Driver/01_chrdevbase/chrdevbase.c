@@ -4,55 +4,288 @@
 #include <linux/ide.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include "chrdevbase.h"
 
 #define CHRDEVBASE_MAJOR 200
 #define CHRDEVBASE_NAME "chrdevbase"
+#define CHRDEVBASE_RING_MIN		PAGE_SIZE
+#define CHRDEVBASE_RING_MAX		(16 * 1024 * 1024)
 
-static char readbuf[100];
-static char writebuf[100];
-static char kerneldata[] = {"kernel data!"};
+static unsigned int ring_size = 1024 * 1024;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Loopback ring size in bytes, rounded up to a power of two");
+
+/* Loopback device */
+struct chrdevbase_dev {
+	struct chrdevbase_ring *ring;	/* Control page, shared with mmap users */
+	char *data;						/* Ring data, right after the control page */
+	u32 size;						/* Ring size, ring->size is only a copy for mmap users */
+	u32 mask;						/* size - 1 */
+	struct mutex rd_lock;			/* One kernel-side consumer at a time */
+	struct mutex wr_lock;			/* One kernel-side producer at a time */
+	wait_queue_head_t rd_wait;		/* Waiting for data */
+	wait_queue_head_t wr_wait;		/* Waiting for space */
+};
+
+static struct chrdevbase_dev chrdevbase;
+
+/*
+ * head and tail live in the mapped control page and can hold anything an
+ * mmap user wrote there: offsets are always masked with the kernel's own
+ * mask and the fill level clamped to the kernel's own size, so no copy can
+ * leave the data area whatever the page says.
+ */
+static inline u32 ring_used(struct chrdevbase_dev *dev)
+{
+	u32 used = smp_load_acquire(&dev->ring->head) - READ_ONCE(dev->ring->tail);
+
+	return min(used, dev->size);
+}
+
+static inline u32 ring_free(struct chrdevbase_dev *dev)
+{
+	u32 used = READ_ONCE(dev->ring->head) - smp_load_acquire(&dev->ring->tail);
+
+	return dev->size - min(used, dev->size);
+}
+
+/*
+ * Wait until the ring has data (for_write == false) or space, then take
+ * the matching lock. Returns the number of bytes available, or a negative
+ * error code with the lock not held.
+ */
+static ssize_t chrdevbase_reserve(struct chrdevbase_dev *dev, bool nonblock, bool for_write)
+{
+	struct mutex *lock = for_write ? &dev->wr_lock : &dev->rd_lock;
+	wait_queue_head_t *wq = for_write ? &dev->wr_wait : &dev->rd_wait;
+	u32 avail;
+	int ret;
+
+	for (;;) {
+		if (mutex_lock_interruptible(lock))
+			return -ERESTARTSYS;
+		avail = for_write ? ring_free(dev) : ring_used(dev);
+		if (avail)
+			return avail;
+		mutex_unlock(lock);
+
+		if (nonblock)
+			return -EAGAIN;
+		ret = wait_event_interruptible(*wq, for_write ? ring_free(dev) : ring_used(dev));
+		if (ret)
+			return ret;
+	}
+}
+
+/* Publish a new tail (consumed bytes) and wake producers */
+static void chrdevbase_consume(struct chrdevbase_dev *dev, u32 tail)
+{
+	smp_store_release(&dev->ring->tail, tail);
+	mutex_unlock(&dev->rd_lock);
+	wake_up_interruptible(&dev->wr_wait);
+}
+
+/* Publish a new head (produced bytes) and wake consumers */
+static void chrdevbase_produce(struct chrdevbase_dev *dev, u32 head)
+{
+	smp_store_release(&dev->ring->head, head);
+	mutex_unlock(&dev->wr_lock);
+	wake_up_interruptible(&dev->rd_wait);
+}
 
 /*
  * Open function for the character device.
  */
 static int chrdevbase_open(struct inode *inode, struct file *filp)
 {
+	filp->private_data = &chrdevbase;
 	return 0;
 }
 
 /*
- * Read function for the character device.
+ * Read function for the character device: plain copy_to_user path.
+ * Returns the number of bytes read, up to cnt.
  */
 static ssize_t chrdevbase_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
 {
-	int retvalue = 0;
-	
-	/* Copy kernel data to read buffer and transfer to user space */
-	memcpy(readbuf, kerneldata, sizeof(kerneldata));
-	retvalue = copy_to_user(buf, readbuf, cnt);
-	if (retvalue == 0) {
-		printk("kernel senddata ok!\n");
-	} else {
-		printk("kernel senddata failed!\n");
+	struct chrdevbase_dev *dev = filp->private_data;
+	ssize_t avail;
+	u32 tail, off, n, first;
+
+	if (cnt == 0)
+		return 0;
+
+	avail = chrdevbase_reserve(dev, filp->f_flags & O_NONBLOCK, false);
+	if (avail < 0)
+		return avail;
+
+	tail = READ_ONCE(dev->ring->tail);
+	n = min_t(size_t, avail, cnt);
+	off = tail & dev->mask;
+	first = min(n, dev->size - off);
+	if (copy_to_user(buf, dev->data + off, first) ||
+		copy_to_user(buf + first, dev->data, n - first)) {
+		mutex_unlock(&dev->rd_lock);
+		return -EFAULT;
 	}
-	return 0;
+
+	chrdevbase_consume(dev, tail + n);
+	return n;
 }
 
 /*
- * Write function for the character device.
+ * Write function for the character device: plain copy_from_user path.
+ * Returns the number of bytes written, up to cnt.
  */
 static ssize_t chrdevbase_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
 {
-	int retvalue = 0;
-	
-	/* Copy data from user space to write buffer and print it */
-	retvalue = copy_from_user(writebuf, buf, cnt);
-	if (retvalue == 0) {
-		printk("kernel recevdata:%s\n", writebuf);
-	} else {
-		printk("kernel recevdata failed!\n");
+	struct chrdevbase_dev *dev = filp->private_data;
+	ssize_t avail;
+	u32 head, off, n, first;
+
+	if (cnt == 0)
+		return 0;
+
+	avail = chrdevbase_reserve(dev, filp->f_flags & O_NONBLOCK, true);
+	if (avail < 0)
+		return avail;
+
+	head = READ_ONCE(dev->ring->head);
+	n = min_t(size_t, avail, cnt);
+	off = head & dev->mask;
+	first = min(n, dev->size - off);
+	if (copy_from_user(dev->data + off, buf, first) ||
+		copy_from_user(dev->data, buf + first, n - first)) {
+		mutex_unlock(&dev->wr_lock);
+		return -EFAULT;
+	}
+
+	chrdevbase_produce(dev, head + n);
+	return n;
+}
+
+/*
+ * Vectored read (readv, and splice_read through generic_file_splice_read).
+ */
+static ssize_t chrdevbase_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct chrdevbase_dev *dev = iocb->ki_filp->private_data;
+	bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	ssize_t avail;
+	u32 tail, off, n, first, copied;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	avail = chrdevbase_reserve(dev, nonblock, false);
+	if (avail < 0)
+		return avail;
+
+	tail = READ_ONCE(dev->ring->tail);
+	n = min_t(size_t, avail, iov_iter_count(to));
+	off = tail & dev->mask;
+	first = min(n, dev->size - off);
+	copied = copy_to_iter(dev->data + off, first, to);
+	if (copied == first && n > first)
+		copied += copy_to_iter(dev->data, n - first, to);
+	if (!copied) {
+		mutex_unlock(&dev->rd_lock);
+		return -EFAULT;
+	}
+
+	chrdevbase_consume(dev, tail + copied);
+	return copied;
+}
+
+/*
+ * Vectored write (writev, and splice_write through iter_file_splice_write).
+ */
+static ssize_t chrdevbase_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct chrdevbase_dev *dev = iocb->ki_filp->private_data;
+	bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	ssize_t avail;
+	u32 head, off, n, first, copied;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	avail = chrdevbase_reserve(dev, nonblock, true);
+	if (avail < 0)
+		return avail;
+
+	head = READ_ONCE(dev->ring->head);
+	n = min_t(size_t, avail, iov_iter_count(from));
+	off = head & dev->mask;
+	first = min(n, dev->size - off);
+	copied = copy_from_iter(dev->data + off, first, from);
+	if (copied == first && n > first)
+		copied += copy_from_iter(dev->data, n - first, from);
+	if (!copied) {
+		mutex_unlock(&dev->wr_lock);
+		return -EFAULT;
+	}
+
+	chrdevbase_produce(dev, head + copied);
+	return copied;
+}
+
+/*
+ * Poll: readable while the ring holds data, writable while it has space.
+ */
+static __poll_t chrdevbase_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct chrdevbase_dev *dev = filp->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &dev->rd_wait, wait);
+	poll_wait(filp, &dev->wr_wait, wait);
+
+	if (ring_used(dev))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (ring_free(dev))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/*
+ * Map the control page and the data area for zero-copy producers/consumers.
+ */
+static int chrdevbase_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct chrdevbase_dev *dev = filp->private_data;
+
+	return remap_vmalloc_range(vma, dev->ring, vma->vm_pgoff);
+}
+
+static long chrdevbase_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct chrdevbase_dev *dev = filp->private_data;
+
+	switch (cmd) {
+	case CHRDEVBASE_NOTIFY_CMD:
+		wake_up_interruptible(&dev->rd_wait);
+		wake_up_interruptible(&dev->wr_wait);
+		return 0;
+	case CHRDEVBASE_RESET_CMD:
+		mutex_lock(&dev->rd_lock);
+		mutex_lock(&dev->wr_lock);
+		smp_store_release(&dev->ring->tail, dev->ring->head);
+		mutex_unlock(&dev->wr_lock);
+		mutex_unlock(&dev->rd_lock);
+		wake_up_interruptible(&dev->wr_wait);
+		return 0;
+	default:
+		return -ENOTTY;
 	}
-	return 0;
 }
 
 /*
@@ -69,6 +302,14 @@ static struct file_operations chrdevbase_fops = {
 	.open = chrdevbase_open,
 	.read = chrdevbase_read,
 	.write = chrdevbase_write,
+	.read_iter = chrdevbase_read_iter,
+	.write_iter = chrdevbase_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.poll = chrdevbase_poll,
+	.mmap = chrdevbase_mmap,
+	.unlocked_ioctl = chrdevbase_unlocked_ioctl,
+	.llseek = no_llseek,
 	.release = chrdevbase_release,
 };
 
@@ -78,13 +319,33 @@ static struct file_operations chrdevbase_fops = {
 static int __init chrdevbase_init(void)
 {
 	int retvalue = 0;
-	
+	u32 size;
+
+	size = clamp_t(u32, ring_size, CHRDEVBASE_RING_MIN, CHRDEVBASE_RING_MAX);
+	size = roundup_pow_of_two(size);
+
+	/* Control page + data, zeroed and mappable to userspace */
+	chrdevbase.ring = vmalloc_user(PAGE_SIZE + size);
+	if (!chrdevbase.ring)
+		return -ENOMEM;
+	chrdevbase.ring->size = size;
+	chrdevbase.ring->data_offset = PAGE_SIZE;
+	chrdevbase.data = (char *)chrdevbase.ring + PAGE_SIZE;
+	chrdevbase.size = size;
+	chrdevbase.mask = size - 1;
+	mutex_init(&chrdevbase.rd_lock);
+	mutex_init(&chrdevbase.wr_lock);
+	init_waitqueue_head(&chrdevbase.rd_wait);
+	init_waitqueue_head(&chrdevbase.wr_wait);
+
 	/* Register the character device driver */
 	retvalue = register_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME, &chrdevbase_fops);
 	if (retvalue < 0) {
 		printk("chrdevbase driver register failed\n");
+		vfree(chrdevbase.ring);
+		return retvalue;
 	}
-	printk("chrdevbase init!\n");
+	printk("chrdevbase init, ring %u bytes\n", size);
 	return 0;
 }
 
@@ -95,6 +356,7 @@ static void __exit chrdevbase_exit(void)
 {
 	/* Unregister the character device driver */
 	unregister_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME);
+	vfree(chrdevbase.ring);
 	printk("chrdevbase exit!\n");
 }
 
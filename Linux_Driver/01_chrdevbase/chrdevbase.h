@@ -0,0 +1,44 @@
+#ifndef CHRDEVBASE_H
+#define CHRDEVBASE_H
+
+/*
+ * Userspace ABI of the chrdevbase loopback device.
+ *
+ * Bytes written to the device are read back in order from a ring buffer.
+ * mmap() of the device returns the control page followed by the data area:
+ *
+ *   offset 0                    : struct chrdevbase_ring
+ *   offset ring->data_offset    : ring->size bytes of data (power of two)
+ *
+ * head and tail are free-running byte counters; the ring holds
+ * head - tail bytes and position x lives at data[x & (size - 1)].
+ * The producer owns head, the consumer owns tail. Publish with a release
+ * store after copying data, read the other side's index with an acquire
+ * load. The kernel read()/write() paths follow the same protocol, so an
+ * mmap producer can feed a read() consumer and vice versa.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+#endif
+
+struct chrdevbase_ring {
+	__u32 head;				/* Producer index */
+	__u32 pad0[15];			/* Keep head and tail on separate cache lines */
+	__u32 tail;				/* Consumer index */
+	__u32 pad1[15];
+	__u32 size;				/* Data area size in bytes */
+	__u32 data_offset;		/* Offset of the data area in the mapping */
+};
+
+/* Wake read()/write()/poll() waiters after moving head or tail through mmap */
+#define CHRDEVBASE_NOTIFY_CMD	(_IO(0XEF, 0x20))
+/* Discard the ring contents */
+#define CHRDEVBASE_RESET_CMD	(_IO(0XEF, 0x21))
+
+#endif
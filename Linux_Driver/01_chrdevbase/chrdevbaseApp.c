@@ -37,20 +37,23 @@ int main(int argc, char *argv[])
 
 	/* Read data from driver file */
 	if(atoi(argv[2]) == 1){
-		retvalue = read(fd, readbuf, 50);
+		retvalue = read(fd, readbuf, sizeof(readbuf) - 1);	/* Blocks until data was written */
 		if(retvalue < 0){
 			printf("read file %s failed!\r\n", filename);
 		}else{
-			printf("read data:%s\r\n",readbuf);
+			readbuf[retvalue] = '\0';
+			printf("read %d bytes:%s\r\n", retvalue, readbuf);
 		}
 	}
 
 	/* Write data to driver file */
 	if(atoi(argv[2]) == 2){
 		memcpy(writebuf, usrdata, sizeof(usrdata));
-		retvalue = write(fd, writebuf, 50);
+		retvalue = write(fd, writebuf, sizeof(usrdata));
 		if(retvalue < 0){
 			printf("write file %s failed!\r\n", filename);
+		}else{
+			printf("wrote %d bytes\r\n", retvalue);
 		}
 	}
 
@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "chrdevbase.h"
+
+/*
+ * Loopback throughput benchmark for /dev/chrdevbase.
+ *
+ * Usage: ./chrdevbaseBench <dev> [-p copy|vec|splice|mmap|all] [-m MiB] [-v]
+ *
+ * A producer thread pushes -m MiB (default 64) through the ring in
+ * messages of 64 B .. 1 MiB while the main thread drains it with the same
+ * I/O path:
+ *   copy   : write() / read()
+ *   vec    : writev() / readv() with 4 iovecs per message
+ *   splice : vmsplice() + splice() into the device, splice() out to /dev/null
+ *   mmap   : both sides move head/tail in the shared mapping, no syscalls
+ * -v checks every byte on the consumer side (slower, for correctness only).
+ * Load the module with ring_size >= 1 MiB to keep 1 MiB messages whole.
+ */
+
+#define NR_IOV		4
+
+enum { PATH_COPY, PATH_VEC, PATH_SPLICE, PATH_MMAP, PATH_NR };
+static const char *path_names[PATH_NR] = { "copy", "vec", "splice", "mmap" };
+
+struct bench {
+	int fd;
+	int path;
+	size_t msg;
+	size_t total;
+	int verify;
+	struct chrdevbase_ring *ring;
+	unsigned char *data;
+	unsigned long long errors;
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Byte at stream offset x: position inside its message, truncated */
+static inline unsigned char pattern(size_t x, size_t msg)
+{
+	return (x % msg) & 0xff;
+}
+
+static void split_iov(struct iovec *iov, unsigned char *buf, size_t len)
+{
+	size_t part = len / NR_IOV;
+	int i;
+
+	for (i = 0; i < NR_IOV; i++) {
+		iov[i].iov_base = buf + i * part;
+		iov[i].iov_len = (i == NR_IOV - 1) ? len - i * part : part;
+	}
+}
+
+/* Advance an iovec array past n bytes already transferred */
+static struct iovec *skip_iov(struct iovec *iov, int *cnt, size_t n)
+{
+	while (*cnt && n >= iov->iov_len) {
+		n -= iov->iov_len;
+		iov++;
+		(*cnt)--;
+	}
+	if (*cnt) {
+		iov->iov_base = (char *)iov->iov_base + n;
+		iov->iov_len -= n;
+	}
+	return iov;
+}
+
+/* mmap producer/consumer: copy up to len bytes into or out of the ring */
+static size_t ring_push(struct bench *b, const unsigned char *src, size_t len)
+{
+	uint32_t head = b->ring->head;
+	uint32_t tail = __atomic_load_n(&b->ring->tail, __ATOMIC_ACQUIRE);
+	uint32_t size = b->ring->size, off = head & (size - 1);
+	size_t n = size - (head - tail), first;
+
+	if (n > len)
+		n = len;
+	first = n < size - off ? n : size - off;
+	memcpy(b->data + off, src, first);
+	memcpy(b->data, src + first, n - first);
+	__atomic_store_n(&b->ring->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+static size_t ring_pop(struct bench *b, unsigned char *dst, size_t len)
+{
+	uint32_t tail = b->ring->tail;
+	uint32_t head = __atomic_load_n(&b->ring->head, __ATOMIC_ACQUIRE);
+	uint32_t size = b->ring->size, off = tail & (size - 1);
+	size_t n = head - tail, first;
+
+	if (n > len)
+		n = len;
+	first = n < size - off ? n : size - off;
+	memcpy(dst, b->data + off, first);
+	memcpy(dst + first, b->data, n - first);
+	__atomic_store_n(&b->ring->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+static void *producer(void *arg)
+{
+	struct bench *b = arg;
+	struct iovec iov[NR_IOV], *cur, one;
+	unsigned char *buf;
+	size_t sent = 0, off, n, i;
+	int p[2] = { -1, -1 }, cnt;
+	ssize_t ret;
+
+	buf = malloc(b->msg);
+	if (buf == NULL)
+		return NULL;
+	for (i = 0; i < b->msg; i++)
+		buf[i] = pattern(i, b->msg);
+
+	if (b->path == PATH_SPLICE) {
+		if (pipe(p) < 0)
+			goto out;
+		fcntl(p[1], F_SETPIPE_SZ, b->msg < 65536 ? 65536 : b->msg);
+	}
+
+	while (sent < b->total) {
+		off = 0;
+		switch (b->path) {
+		case PATH_COPY:
+			while (off < b->msg) {
+				ret = write(b->fd, buf + off, b->msg - off);
+				if (ret <= 0)
+					goto out;
+				off += ret;
+			}
+			break;
+		case PATH_VEC:
+			split_iov(iov, buf, b->msg);
+			cur = iov;
+			cnt = NR_IOV;
+			while (cnt) {
+				ret = writev(b->fd, cur, cnt);
+				if (ret <= 0)
+					goto out;
+				cur = skip_iov(cur, &cnt, ret);
+			}
+			break;
+		case PATH_SPLICE:
+			while (off < b->msg) {
+				one.iov_base = buf + off;
+				one.iov_len = b->msg - off;
+				ret = vmsplice(p[1], &one, 1, 0);
+				if (ret <= 0)
+					goto out;
+				off += ret;
+				/* Drain the pipe before the pages are reused */
+				for (n = ret; n; n -= ret) {
+					ret = splice(p[0], NULL, b->fd, NULL, n, SPLICE_F_MOVE);
+					if (ret <= 0)
+						goto out;
+				}
+			}
+			break;
+		case PATH_MMAP:
+			while (off < b->msg) {
+				n = ring_push(b, buf + off, b->msg - off);
+				if (n == 0)
+					sched_yield();
+				off += n;
+			}
+			break;
+		}
+		sent += b->msg;
+	}
+
+out:
+	if (p[0] >= 0) {
+		close(p[0]);
+		close(p[1]);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Consumer side, runs in the calling thread; returns bytes received */
+static size_t consume(struct bench *b)
+{
+	struct iovec iov[NR_IOV];
+	unsigned char *buf;
+	size_t got = 0, i;
+	int q[2] = { -1, -1 }, null = -1;
+	ssize_t ret;
+
+	buf = malloc(b->msg);
+	if (buf == NULL)
+		return 0;
+
+	if (b->path == PATH_SPLICE) {
+		if (pipe(q) < 0)
+			goto out;
+		fcntl(q[1], F_SETPIPE_SZ, b->msg < 65536 ? 65536 : b->msg);
+		null = open("/dev/null", O_WRONLY);
+	}
+
+	while (got < b->total) {
+		switch (b->path) {
+		case PATH_COPY:
+			ret = read(b->fd, buf, b->msg);
+			break;
+		case PATH_VEC:
+			split_iov(iov, buf, b->msg);
+			ret = readv(b->fd, iov, NR_IOV);
+			break;
+		case PATH_SPLICE:
+			ret = splice(b->fd, NULL, q[1], NULL, b->msg, SPLICE_F_MOVE);
+			if (ret > 0 && b->verify) {
+				ret = read(q[0], buf, ret);
+			} else if (ret > 0) {
+				ssize_t left = ret, n;
+
+				while (left > 0) {
+					n = splice(q[0], NULL, null, NULL, left, SPLICE_F_MOVE);
+					if (n <= 0)
+						goto out;
+					left -= n;
+				}
+			}
+			break;
+		case PATH_MMAP:
+			ret = ring_pop(b, buf, b->msg);
+			if (ret == 0)
+				sched_yield();
+			break;
+		default:
+			ret = -1;
+			break;
+		}
+		if (ret < 0)
+			goto out;
+
+		if (b->verify) {
+			for (i = 0; i < (size_t)ret; i++)
+				if (buf[i] != pattern(got + i, b->msg))
+					b->errors++;
+		}
+		got += ret;
+	}
+
+out:
+	if (q[0] >= 0) {
+		close(q[0]);
+		close(q[1]);
+	}
+	if (null >= 0)
+		close(null);
+	free(buf);
+	return got;
+}
+
+static int run_one(struct bench *b)
+{
+	pthread_t tid;
+	uint64_t t0, t1;
+	size_t got;
+	double secs;
+
+	ioctl(b->fd, CHRDEVBASE_RESET_CMD);
+	b->errors = 0;
+
+	t0 = now_ns();
+	pthread_create(&tid, NULL, producer, b);
+	got = consume(b);
+	pthread_join(tid, NULL);
+	t1 = now_ns();
+
+	secs = (t1 - t0) / 1e9;
+	printf("path=%s size=%zu bytes=%zu time_s=%.3f MiB/s=%.1f msgs/s=%.0f errors=%llu\r\n",
+		   path_names[b->path], b->msg, got, secs, got / secs / (1024 * 1024),
+		   got / (double)b->msg / secs, b->errors);
+	return got == b->total ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t sizes[] = { 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+	struct bench b;
+	size_t mib = 64, map_len;
+	int path = -1, opt, p, i;
+
+	memset(&b, 0, sizeof(b));
+	while ((opt = getopt(argc, argv, "p:m:v")) != -1) {
+		switch (opt) {
+		case 'p':
+			for (p = 0; p < PATH_NR; p++)
+				if (!strcmp(optarg, path_names[p]))
+					path = p;
+			break;
+		case 'm':
+			mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			b.verify = 1;
+			break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (optind >= argc || mib == 0) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	b.fd = open(argv[optind], O_RDWR);
+	if (b.fd < 0) {
+		printf("Can't open file %s\r\n", argv[optind]);
+		return -1;
+	}
+
+	/* Map the control page first to learn the ring size, then the whole area */
+	b.ring = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+	if (b.ring == MAP_FAILED) {
+		printf("mmap failed\r\n");
+		close(b.fd);
+		return -1;
+	}
+	map_len = b.ring->data_offset + b.ring->size;
+	munmap(b.ring, 4096);
+	b.ring = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+	if (b.ring == MAP_FAILED) {
+		printf("mmap failed\r\n");
+		close(b.fd);
+		return -1;
+	}
+	b.data = (unsigned char *)b.ring + b.ring->data_offset;
+
+	for (p = 0; p < PATH_NR; p++) {
+		if (path >= 0 && p != path)
+			continue;
+		for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+			b.path = p;
+			b.msg = sizes[i];
+			b.total = mib << 20;
+			if (b.total < b.msg * 16)
+				b.total = b.msg * 16;
+			run_one(&b);
+		}
+	}
+
+	munmap(b.ring, map_len);
+	close(b.fd);
+	return 0;
+}
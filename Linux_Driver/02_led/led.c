@@ -38,16 +38,11 @@ static void __iomem *GPIOI_BSRR_PI;
 /* Function to switch the LED on or off */
 void led_switch(u8 sta)
 {
-	u32 val = 0;
-	if(sta == LEDON) {
-		val = readl(GPIOI_BSRR_PI);
-		val |= (1 << 16);  // Set PI0 to high to turn on LED
-		writel(val, GPIOI_BSRR_PI);
-	} else if(sta == LEDOFF) {
-		val = readl(GPIOI_BSRR_PI);
-		val |= (1 << 0);   // Set PI0 to low to turn off LED
-		writel(val, GPIOI_BSRR_PI);
-	}
+	/* BSRR is write-only: a single store sets or resets the pin atomically */
+	if (sta == LEDON)
+		writel(1 << 16, GPIOI_BSRR_PI);	/* BR0: PI0 low, LED on */
+	else if (sta == LEDOFF)
+		writel(1 << 0, GPIOI_BSRR_PI);	/* BS0: PI0 high, LED off */
 }
 
 /* Function to unmap the GPIO registers */
@@ -155,9 +150,7 @@ static int __init led_init(void)
 	writel(val, GPIOI_PUPDR_PI);
 
 	/* Turn off LED by default */
-	val = readl(GPIOI_BSRR_PI);
-	val |= (0x1 << 0);   // Set bit 0 (PI0 low)
-	writel(val, GPIOI_BSRR_PI);
+	writel(0x1 << 0, GPIOI_BSRR_PI);   // Set bit 0 (PI0 high)
 
 	/* Register character device driver */
 	retvalue = register_chrdev(LED_MAJOR, LED_NAME, &led_fops);
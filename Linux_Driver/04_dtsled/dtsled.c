@@ -43,16 +43,11 @@ struct dtsled_dev dtsled; /* LED device */
 /* Function to switch the LED on/off */
 void led_switch(u8 sta)
 {
-	u32 val = 0;
-	if (sta == LEDON) {
-		val = readl(GPIOI_BSRR_PI);
-		val |= (1 << 16);
-		writel(val, GPIOI_BSRR_PI);
-	} else if (sta == LEDOFF) {
-		val = readl(GPIOI_BSRR_PI);
-		val |= (1 << 0);
-		writel(val, GPIOI_BSRR_PI);
-	}
+	/* BSRR is write-only: a single store sets or resets the pin atomically */
+	if (sta == LEDON)
+		writel(1 << 16, GPIOI_BSRR_PI);	/* BR0: PI0 low, LED on */
+	else if (sta == LEDOFF)
+		writel(1 << 0, GPIOI_BSRR_PI);	/* BS0: PI0 high, LED off */
 }
 
 /* Function to unmap GPIO registers */
@@ -190,9 +185,7 @@ static int __init led_init(void)
 	writel(val, GPIOI_PUPDR_PI);
 
 	/* Turn off LED by default */
-	val = readl(GPIOI_BSRR_PI);
-	val |= (0x1 << 0);
-	writel(val, GPIOI_BSRR_PI);
+	writel(0x1 << 0, GPIOI_BSRR_PI);
 
 	/* Register character device driver */
 	if (dtsled.major) {
@@ -13,15 +13,37 @@
 #include <linux/of_gpio.h>
 #include <linux/platform_device.h>
 #include <linux/miscdevice.h>
+#include <linux/pwm.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
+#include "miscbeep.h"
 
 #define MISCBEEP_NAME		"miscbeep"	/* Device name */
 #define MISCBEEP_MINOR		144			/* Minor number */
 #define BEEPOFF 			0			/* Turn off the beep */
 #define BEEPON 				1			/* Turn on the beep */
 
+static bool fake_pwm;
+module_param(fake_pwm, bool, 0444);
+MODULE_PARM_DESC(fake_pwm, "Use a fake PWM provider that only records the waveform");
+
+struct miscbeep_dev;
+
+/* Tone backend: renders one note, or silence */
+struct beep_ops {
+	int id;													/* enum beep_backend_id */
+	int (*play)(struct miscbeep_dev *dev, u32 period_ns, u32 duty_ns);
+	void (*stop)(struct miscbeep_dev *dev);
+};
+
 /* miscbeep device structure */
 struct miscbeep_dev {
 	dev_t devid;			/* Device ID */
@@ -29,10 +51,230 @@ struct miscbeep_dev {
 	struct class *class;	/* Device class */
 	struct device *device;	/* Device */
 	int beep_gpio;			/* GPIO number for the beep */
+
+	const struct beep_ops *ops;			/* Selected tone backend */
+	struct pwm_device *pwm;				/* PWM channel, if any */
+	DECLARE_KFIFO(queue, struct beep_note, BEEP_QUEUE_LEN);
+	spinlock_t lock;					/* Protects queue, active and playing */
+	struct mutex wr_lock;				/* Serialises writers against flush */
+	bool active;						/* Sequencer running, cleared when the queue drains */
+	bool playing;						/* A note is sounding */
+	u32 played;							/* Finished notes */
+	u32 period_ns;						/* Current waveform, 0 = silent */
+	u32 duty_ns;
+	struct hrtimer note_timer;			/* Ends the current note */
+	struct work_struct note_work;		/* Starts the next note, may sleep */
+	struct hrtimer tone_timer;			/* GPIO backend: toggles the pin */
+	ktime_t tone_on;
+	ktime_t tone_off;
+	bool tone_level;
+	wait_queue_head_t wait;				/* Space in queue / playback done */
+	struct beep_event log[BEEP_LOG_LEN];	/* Fake backend: calls since the last BEEP_LOG_CMD */
+	u32 log_n;
+	ktime_t log_t0;
 };
 
 struct miscbeep_dev miscbeep;		/* beep device */
 
+/*
+ * @description		: PWM backend, one pwm_apply_state() per note
+ * @param - dev 	: beep device
+ * @param - period_ns : tone period, 0 for a rest
+ * @param - duty_ns : on-time per period
+ * @return			: 0 on success, negative value on failure
+ */
+static int beep_pwm_play(struct miscbeep_dev *dev, u32 period_ns, u32 duty_ns)
+{
+	struct pwm_state state;
+
+	pwm_init_state(dev->pwm, &state);
+	state.enabled = period_ns != 0;
+	if (period_ns) {
+		state.period = period_ns;
+		state.duty_cycle = duty_ns;
+	}
+	return pwm_apply_state(dev->pwm, &state);
+}
+
+static void beep_pwm_stop(struct miscbeep_dev *dev)
+{
+	pwm_disable(dev->pwm);
+}
+
+static const struct beep_ops beep_pwm_ops = {
+	.id = BEEP_BACKEND_PWM,
+	.play = beep_pwm_play,
+	.stop = beep_pwm_stop,
+};
+
+/*
+ * @description		: GPIO backend hrtimer, flips the pin every half cycle
+ * @param - t 		: tone_timer
+ * @return			: HRTIMER_RESTART
+ */
+static enum hrtimer_restart beep_tone_timer(struct hrtimer *t)
+{
+	struct miscbeep_dev *dev = container_of(t, struct miscbeep_dev, tone_timer);
+
+	dev->tone_level = !dev->tone_level;
+	gpio_set_value(dev->beep_gpio, dev->tone_level ? 0 : 1);	/* Active low */
+	hrtimer_forward_now(t, dev->tone_level ? dev->tone_on : dev->tone_off);
+	return HRTIMER_RESTART;
+}
+
+static int beep_gpio_play(struct miscbeep_dev *dev, u32 period_ns, u32 duty_ns)
+{
+	hrtimer_cancel(&dev->tone_timer);
+	gpio_set_value(dev->beep_gpio, 1);
+	if (!period_ns)
+		return 0;
+
+	dev->tone_on = ns_to_ktime(duty_ns);
+	dev->tone_off = ns_to_ktime(period_ns - duty_ns);
+	dev->tone_level = true;
+	gpio_set_value(dev->beep_gpio, 0);
+	hrtimer_start(&dev->tone_timer, dev->tone_on, HRTIMER_MODE_REL);
+	return 0;
+}
+
+static void beep_gpio_stop(struct miscbeep_dev *dev)
+{
+	hrtimer_cancel(&dev->tone_timer);
+	gpio_set_value(dev->beep_gpio, 1);
+}
+
+static const struct beep_ops beep_gpio_ops = {
+	.id = BEEP_BACKEND_GPIO,
+	.play = beep_gpio_play,
+	.stop = beep_gpio_stop,
+};
+
+/*
+ * @description		: Fake PWM provider: the sequencer runs for real, every
+ *					  backend call is logged with its time for BEEP_LOG_CMD,
+ *					  calls past BEEP_LOG_LEN are dropped
+ * @param - dev 	: beep device
+ * @param - op 		: BEEP_EV_PLAY or BEEP_EV_STOP
+ * @param - period_ns : tone period, 0 for a rest or a stop
+ * @param - duty_ns : on-time per period
+ * @return			: none
+ */
+static void beep_fake_log(struct miscbeep_dev *dev, u32 op, u32 period_ns, u32 duty_ns)
+{
+	struct beep_event *ev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->log_n < BEEP_LOG_LEN) {
+		ev = &dev->log[dev->log_n++];
+		ev->t_us = ktime_us_delta(ktime_get(), dev->log_t0);
+		ev->op = op;
+		ev->period_ns = period_ns;
+		ev->duty_ns = duty_ns;
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+static int beep_fake_play(struct miscbeep_dev *dev, u32 period_ns, u32 duty_ns)
+{
+	beep_fake_log(dev, BEEP_EV_PLAY, period_ns, duty_ns);
+	return 0;
+}
+
+static void beep_fake_stop(struct miscbeep_dev *dev)
+{
+	beep_fake_log(dev, BEEP_EV_STOP, 0, 0);
+}
+
+static const struct beep_ops beep_fake_ops = {
+	.id = BEEP_BACKEND_FAKE,
+	.play = beep_fake_play,
+	.stop = beep_fake_stop,
+};
+
+/*
+ * @description		: Start the next queued note, or go idle when the
+ *					  queue is empty. Runs in process context because
+ *					  pwm_apply_state() may sleep.
+ * @param - work 	: note_work
+ * @return			: none
+ */
+static void beep_note_work(struct work_struct *work)
+{
+	struct miscbeep_dev *dev = container_of(work, struct miscbeep_dev, note_work);
+	struct beep_note note;
+	unsigned long flags;
+	u32 period_ns = 0, duty_ns = 0;
+	bool have;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->playing)
+		dev->played++;
+	have = kfifo_get(&dev->queue, &note);
+	dev->playing = have;
+	dev->active = have;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (!have) {
+		dev->ops->stop(dev);
+		dev->period_ns = 0;
+		dev->duty_ns = 0;
+		wake_up_interruptible(&dev->wait);
+		return;
+	}
+
+	if (note.frequency_hz) {
+		period_ns = NSEC_PER_SEC / note.frequency_hz;
+		duty_ns = div_u64((u64)period_ns * (note.duty ? note.duty : 50), 100);
+	}
+	dev->period_ns = period_ns;
+	dev->duty_ns = duty_ns;
+	if (dev->ops->play(dev, period_ns, duty_ns) < 0)
+		printk("miscbeep: failed to play %u Hz\r\n", note.frequency_hz);
+
+	/* A slot has been freed */
+	wake_up_interruptible(&dev->wait);
+	hrtimer_start(&dev->note_timer, ms_to_ktime(note.duration_ms), HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart beep_note_timer(struct hrtimer *t)
+{
+	struct miscbeep_dev *dev = container_of(t, struct miscbeep_dev, note_timer);
+
+	schedule_work(&dev->note_work);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * @description		: Drop every queued note and silence the buzzer
+ * @param - dev 	: beep device
+ * @return			: none
+ */
+static void beep_flush(struct miscbeep_dev *dev)
+{
+	unsigned long flags;
+
+	mutex_lock(&dev->wr_lock);
+	spin_lock_irqsave(&dev->lock, flags);
+	kfifo_reset(&dev->queue);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	/* The work may re-arm the timer and the timer may queue the work */
+	cancel_work_sync(&dev->note_work);
+	hrtimer_cancel(&dev->note_timer);
+	cancel_work_sync(&dev->note_work);
+	dev->ops->stop(dev);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->active = false;
+	dev->playing = false;
+	dev->period_ns = 0;
+	dev->duty_ns = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	mutex_unlock(&dev->wr_lock);
+	wake_up_interruptible(&dev->wait);
+}
+
 /*
  * @description		: Initialize beep GPIO
  * @param – pdev		: pointer to struct platform_device, the platform device pointer
@@ -41,24 +283,52 @@ struct miscbeep_dev miscbeep;		/* beep device */
 static int beep_gpio_init(struct device_node *nd)
 {
 	int ret;
-	
+
 	/* Get GPIO from device tree */
 	miscbeep.beep_gpio = of_get_named_gpio(nd, "beep-gpio", 0);
 	if (!gpio_is_valid(miscbeep.beep_gpio)) {
 		printk("miscbeep: Failed to get beep-gpio\n");
 		return -EINVAL;
 	}
-	
+
 	/* Request GPIO */
 	ret = gpio_request(miscbeep.beep_gpio, "beep");
 	if (ret) {
 		printk("beep: Failed to request beep-gpio\n");
 		return ret;
 	}
-	
+
 	/* Set GPIO direction to output and initial state */
 	gpio_direction_output(miscbeep.beep_gpio, 1);
-	
+
+	return 0;
+}
+
+/*
+ * @description		: Pick the tone backend: fake, then PWM, then GPIO
+ * @param - pdev 	: platform device
+ * @return			: 0 on success, negative value on failure
+ */
+static int beep_backend_init(struct platform_device *pdev)
+{
+	struct pwm_device *pwm;
+
+	if (fake_pwm) {
+		miscbeep.ops = &beep_fake_ops;
+		return 0;
+	}
+
+	pwm = devm_pwm_get(&pdev->dev, NULL);
+	if (IS_ERR(pwm)) {
+		if (PTR_ERR(pwm) == -EPROBE_DEFER)
+			return -EPROBE_DEFER;
+		miscbeep.ops = &beep_gpio_ops;
+		printk("miscbeep: no PWM, using hrtimer GPIO toggler\r\n");
+		return 0;
+	}
+
+	miscbeep.pwm = pwm;
+	miscbeep.ops = &beep_pwm_ops;
 	return 0;
 }
 
@@ -70,11 +340,14 @@ static int beep_gpio_init(struct device_node *nd)
  */
 static int miscbeep_open(struct inode *inode, struct file *filp)
 {
+	filp->private_data = &miscbeep;
 	return 0;
 }
 
 /*
- * @description		: Write data to the device
+ * @description		: Write data to the device. One byte switches the
+ *					  beep on/off as before; an array of struct beep_note
+ *					  is queued for playback without waiting for it.
  * @param - filp 	: file structure, file descriptor opened for device
  * @param - buf 	: data to write to the device
  * @param - cnt 	: length of data to write
@@ -83,23 +356,164 @@ static int miscbeep_open(struct inode *inode, struct file *filp)
  */
 static ssize_t miscbeep_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
 {
-	int retvalue;
-	unsigned char databuf[1];
+	struct miscbeep_dev *dev = filp->private_data;
+	struct beep_note notes[8];
 	unsigned char beepstat;
+	unsigned long flags;
+	size_t total, done = 0, n, i;
+	bool kick;
+	int ret;
 
-	retvalue = copy_from_user(databuf, buf, cnt);
-	if (retvalue < 0) {
-		printk("kernel write failed!\r\n");
-		return -EFAULT;
+	if (cnt == 1) {
+		if (get_user(beepstat, buf))
+			return -EFAULT;
+
+		beep_flush(dev);
+		if (beepstat == BEEPON) {
+			gpio_set_value(dev->beep_gpio, 0);	/* Turn on the beep */
+		} else if (beepstat == BEEPOFF) {
+			gpio_set_value(dev->beep_gpio, 1);	/* Turn off the beep */
+		}
+		return 1;
 	}
 
-	beepstat = databuf[0];		/* Get status value */
-	if (beepstat == BEEPON) {	
-		gpio_set_value(miscbeep.beep_gpio, 0);	/* Turn on the beep */
-	} else if (beepstat == BEEPOFF) {
-		gpio_set_value(miscbeep.beep_gpio, 1);	/* Turn off the beep */
+	if (cnt == 0 || cnt % sizeof(struct beep_note))
+		return -EINVAL;
+	total = cnt / sizeof(struct beep_note);
+
+	if (mutex_lock_interruptible(&dev->wr_lock))
+		return -ERESTARTSYS;
+
+	while (done < total) {
+		/* Wait for queue space unless O_NONBLOCK */
+		if (kfifo_is_full(&dev->queue)) {
+			if (done)
+				break;
+			if (filp->f_flags & O_NONBLOCK) {
+				ret = -EAGAIN;
+				goto bad;
+			}
+			mutex_unlock(&dev->wr_lock);
+			ret = wait_event_interruptible(dev->wait, !kfifo_is_full(&dev->queue));
+			if (ret)
+				return ret;
+			if (mutex_lock_interruptible(&dev->wr_lock))
+				return -ERESTARTSYS;
+			continue;
+		}
+
+		n = min_t(size_t, total - done, ARRAY_SIZE(notes));
+		n = min_t(size_t, n, kfifo_avail(&dev->queue));
+		if (copy_from_user(notes, buf + done * sizeof(notes[0]), n * sizeof(notes[0]))) {
+			ret = -EFAULT;
+			goto bad;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (notes[i].duration_ms == 0 || notes[i].duty > 99 ||
+				(notes[i].frequency_hz &&
+				 (notes[i].frequency_hz < BEEP_FREQ_MIN || notes[i].frequency_hz > BEEP_FREQ_MAX))) {
+				ret = -EINVAL;
+				goto bad;
+			}
+		}
+
+		/* Only the writer that finds the sequencer idle starts it */
+		spin_lock_irqsave(&dev->lock, flags);
+		n = kfifo_in(&dev->queue, notes, n);
+		kick = !dev->active;
+		dev->active = true;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		done += n;
+
+		if (kick)
+			schedule_work(&dev->note_work);
+	}
+
+	mutex_unlock(&dev->wr_lock);
+	return done * sizeof(struct beep_note);
+
+bad:
+	mutex_unlock(&dev->wr_lock);
+	return done ? done * sizeof(struct beep_note) : ret;
+}
+
+/*
+ * @description		: Poll: POLLOUT while the queue has room, POLLIN when
+ *					  playback is done
+ * @param - filp 	: file structure
+ * @param - wait 	: poll table
+ * @return 			: poll mask
+ */
+static __poll_t miscbeep_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct miscbeep_dev *dev = filp->private_data;
+	unsigned long flags;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &dev->wait, wait);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (!kfifo_is_full(&dev->queue))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	if (!dev->active)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return mask;
+}
+
+/*
+ * @description		: ioctl: flush the queue, read the status or take the
+ *					  fake backend's log
+ * @param - filp 	: file structure
+ * @param - cmd 	: BEEP_*_CMD
+ * @param - arg 	: user argument
+ * @return 			: 0 on success, negative value on failure
+ */
+static long miscbeep_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct miscbeep_dev *dev = filp->private_data;
+	struct beep_status st;
+	struct beep_log *log;
+	unsigned long flags;
+	int ret;
+
+	switch (cmd) {
+	case BEEP_FLUSH_CMD:
+		beep_flush(dev);
+		return 0;
+	case BEEP_STATUS_CMD:
+		spin_lock_irqsave(&dev->lock, flags);
+		st.backend = dev->ops->id;
+		st.queued = kfifo_len(&dev->queue);
+		st.playing = dev->playing;
+		st.played = dev->played;
+		st.period_ns = dev->period_ns;
+		st.duty_ns = dev->duty_ns;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+			return -EFAULT;
+		return 0;
+	case BEEP_LOG_CMD:
+		if (dev->ops != &beep_fake_ops)
+			return -ENODEV;
+		log = kzalloc(sizeof(*log), GFP_KERNEL);
+		if (!log)
+			return -ENOMEM;
+		/* Take the log and start a new one from now */
+		spin_lock_irqsave(&dev->lock, flags);
+		log->count = dev->log_n;
+		memcpy(log->ev, dev->log, dev->log_n * sizeof(dev->log[0]));
+		dev->log_n = 0;
+		dev->log_t0 = ktime_get();
+		spin_unlock_irqrestore(&dev->lock, flags);
+		ret = copy_to_user((void __user *)arg, log, sizeof(*log)) ? -EFAULT : 0;
+		kfree(log);
+		return ret;
+	default:
+		return -ENOTTY;
 	}
-	return 0;
 }
 
 /* Device operations */
@@ -107,6 +521,8 @@ static struct file_operations miscbeep_fops = {
 	.owner = THIS_MODULE,
 	.open = miscbeep_open,
 	.write = miscbeep_write,
+	.poll = miscbeep_poll,
+	.unlocked_ioctl = miscbeep_unlocked_ioctl,
 };
 
 /* MISC device structure */
@@ -132,7 +548,23 @@ static int miscbeep_probe(struct platform_device *pdev)
 	ret = beep_gpio_init(pdev->dev.of_node);
 	if (ret < 0)
 		return ret;
-		
+
+	/* Tone engine */
+	INIT_KFIFO(miscbeep.queue);
+	spin_lock_init(&miscbeep.lock);
+	mutex_init(&miscbeep.wr_lock);
+	init_waitqueue_head(&miscbeep.wait);
+	INIT_WORK(&miscbeep.note_work, beep_note_work);
+	hrtimer_init(&miscbeep.note_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	miscbeep.note_timer.function = beep_note_timer;
+	hrtimer_init(&miscbeep.tone_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	miscbeep.tone_timer.function = beep_tone_timer;
+	miscbeep.log_t0 = ktime_get();
+
+	ret = beep_backend_init(pdev);
+	if (ret < 0)
+		goto free_gpio;
+
 	/* Register MISC device */
 	ret = misc_register(&beep_miscdev);
 	if (ret < 0) {
@@ -141,10 +573,10 @@ static int miscbeep_probe(struct platform_device *pdev)
 	}
 
 	return 0;
-	
+
 free_gpio:
 	gpio_free(miscbeep.beep_gpio);
-	return -EINVAL;
+	return ret;
 }
 
 /*
@@ -155,14 +587,15 @@ free_gpio:
  */
 static int miscbeep_remove(struct platform_device *dev)
 {
-	/* Turn off beep when device is removed */
+	/* Deregister MISC device first so no new notes arrive */
+	misc_deregister(&beep_miscdev);
+
+	/* Stop playback and turn off beep when device is removed */
+	beep_flush(&miscbeep);
 	gpio_set_value(miscbeep.beep_gpio, 1);
-	
+
 	/* Free GPIO */
 	gpio_free(miscbeep.beep_gpio);
-
-	/* Deregister MISC device */
-	misc_deregister(&beep_miscdev);
 	return 0;
 }
 
@@ -171,7 +604,7 @@ static int miscbeep_remove(struct platform_device *dev)
      { .compatible = "alientek,beep" },
      { /* Sentinel */ }
  };
- 
+
  /* Platform driver structure */
 static struct platform_driver beep_driver = {
      .driver     = {
@@ -0,0 +1,72 @@
+#ifndef MISCBEEP_H
+#define MISCBEEP_H
+
+/*
+ * Userspace ABI shared by miscbeep.c and miscbeepApp.c.
+ *
+ * write() of a single byte keeps the old BEEPON/BEEPOFF behaviour.
+ * write() of an array of struct beep_note queues the notes and returns at
+ * once; they are played back to back by the PWM channel, or by an hrtimer
+ * toggling the beep GPIO when no PWM is wired. poll() reports POLLOUT while
+ * the queue has room and POLLIN once the queue has drained and the last
+ * note has finished ("done"). With fake_pwm=1 nothing is driven and every
+ * backend call is logged instead; BEEP_LOG_CMD hands the log to the
+ * sequencer test of miscbeepApp.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+#endif
+
+#define BEEP_FREQ_MIN		20		/* Hz */
+#define BEEP_FREQ_MAX		20000	/* Hz */
+#define BEEP_QUEUE_LEN		64		/* Notes, power of two */
+
+struct beep_note {
+	__u32 frequency_hz;		/* 0 = rest */
+	__u32 duration_ms;
+	__u32 duty;				/* Percent on-time, 1..99, 0 = 50 */
+};
+
+enum beep_backend_id {
+	BEEP_BACKEND_GPIO = 0,	/* hrtimer GPIO toggler */
+	BEEP_BACKEND_PWM,		/* PWM channel from the "pwms" property */
+	BEEP_BACKEND_FAKE,		/* Records the requested waveform only (fake_pwm=1) */
+};
+
+struct beep_status {
+	__u32 backend;			/* enum beep_backend_id */
+	__u32 queued;			/* Notes waiting in the queue */
+	__u32 playing;			/* A note is currently sounding */
+	__u32 played;			/* Notes finished since load */
+	__u32 period_ns;		/* Waveform currently programmed, 0 = silent */
+	__u32 duty_ns;
+};
+
+/* One call into the fake backend (fake_pwm=1) */
+#define BEEP_EV_PLAY		1		/* period_ns 0 is a rest */
+#define BEEP_EV_STOP		2		/* Queue drained or flushed */
+#define BEEP_LOG_LEN		64
+
+struct beep_event {
+	__u32 t_us;				/* Since the previous BEEP_LOG_CMD */
+	__u32 op;				/* BEEP_EV_* */
+	__u32 period_ns;
+	__u32 duty_ns;
+};
+
+struct beep_log {
+	__u32 count;
+	struct beep_event ev[BEEP_LOG_LEN];
+};
+
+#define BEEP_FLUSH_CMD		(_IO(0XEF, 0x30))							/* Drop queued notes and stop */
+#define BEEP_STATUS_CMD		(_IOR(0XEF, 0x31, struct beep_status))
+#define BEEP_LOG_CMD		(_IOR(0XEF, 0x32, struct beep_log))		/* Fake backend only, clears the log */
+
+#endif
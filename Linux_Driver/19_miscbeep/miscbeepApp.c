@@ -5,16 +5,176 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "miscbeep.h"
 
 #define BEEPOFF 0
 #define BEEPON  1
 
+/* C major scale, 200 ms per note with a short rest between notes */
+static const unsigned int scale_hz[] = { 262, 294, 330, 349, 392, 440, 494, 523 };
+
+/*
+ * @description		: Queue a scale, then sleep in poll() until playback is done
+ * @param - fd 		: opened beep device
+ * @return 			: 0 on success, -1 on failure
+ */
+static int play_melody(int fd)
+{
+    struct beep_note notes[2 * sizeof(scale_hz) / sizeof(scale_hz[0])];
+    struct beep_status st;
+    struct pollfd pfd;
+    unsigned int i;
+    int n = 0;
+
+    for (i = 0; i < sizeof(scale_hz) / sizeof(scale_hz[0]); i++) {
+        notes[n].frequency_hz = scale_hz[i];
+        notes[n].duration_ms = 200;
+        notes[n].duty = 50;
+        n++;
+        notes[n].frequency_hz = 0;      /* Rest */
+        notes[n].duration_ms = 20;
+        notes[n].duty = 0;
+        n++;
+    }
+
+    if (write(fd, notes, sizeof(notes)) != sizeof(notes)) {
+        printf("queue notes failed!\r\n");
+        return -1;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 10000) <= 0) {
+        printf("playback did not finish!\r\n");
+        ioctl(fd, BEEP_FLUSH_CMD);
+        return -1;
+    }
+
+    if (ioctl(fd, BEEP_STATUS_CMD, &st) == 0)
+        printf("backend=%u played=%u\r\n", st.backend, st.played);
+    return 0;
+}
+
+/* Sequencer test pattern: tones, a rest, the default duty */
+static const struct beep_note test_notes[] = {
+    { 440, 120, 50 },
+    { 0, 40, 0 },
+    { 1000, 80, 25 },
+    { 2000, 60, 0 },
+    { 262, 100, 90 },
+};
+
+static int test_fails;
+
+static void test_check(int cond, const char *what, unsigned int i)
+{
+    if (!cond) {
+        test_fails++;
+        printf("  event %u: %s\r\n", i, what);
+    }
+}
+
+/*
+ * @description		: Check the fake backend's log against a pattern: one
+ *					  PLAY per note with its waveform, in order, each lasting
+ *					  the note's duration, then one STOP
+ * @param - log 	: log taken after playback
+ * @param - notes 	: pattern written
+ * @param - n 		: number of notes
+ * @return 			: none
+ */
+static void test_sequence(const struct beep_log *log, const struct beep_note *notes, unsigned int n)
+{
+    const struct beep_event *ev = log->ev;
+    unsigned int i, period, duty, len_us;
+
+    test_check(log->count == n + 1, "wrong number of backend calls", log->count);
+    if (log->count != n + 1)
+        return;
+
+    for (i = 0; i < n; i++) {
+        period = notes[i].frequency_hz ? 1000000000u / notes[i].frequency_hz : 0;
+        duty = period ? (unsigned long long)period * (notes[i].duty ? notes[i].duty : 50) / 100 : 0;
+        test_check(ev[i].op == BEEP_EV_PLAY, "not a PLAY", i);
+        test_check(ev[i].period_ns == period, "wrong period", i);
+        test_check(ev[i].duty_ns == duty, "wrong duty", i);
+
+        /* The note timer never fires early; work scheduling adds a little */
+        len_us = ev[i + 1].t_us - ev[i].t_us;
+        test_check(len_us >= notes[i].duration_ms * 1000, "note too short", i);
+        test_check(len_us <= notes[i].duration_ms * 1000 + 20000, "note too long", i);
+    }
+    test_check(ev[n].op == BEEP_EV_STOP, "no STOP after the last note", n);
+}
+
+/*
+ * @description		: Sequencer test against the fake backend (fake_pwm=1):
+ *					  a pattern played to the end, then a flush mid-note
+ * @param - fd 		: opened beep device
+ * @return 			: 0 on success, -1 on failure
+ */
+static int test_sequencer(int fd)
+{
+    static const struct beep_note held[] = { { 500, 500, 50 }, { 600, 500, 50 } };
+    struct beep_status st;
+    struct beep_log log;
+    struct pollfd pfd;
+
+    if (ioctl(fd, BEEP_STATUS_CMD, &st) < 0 || st.backend != BEEP_BACKEND_FAKE) {
+        printf("load the driver with fake_pwm=1\r\n");
+        return -1;
+    }
+
+    ioctl(fd, BEEP_FLUSH_CMD);
+    ioctl(fd, BEEP_LOG_CMD, &log);
+
+    /* Played to the end */
+    if (write(fd, test_notes, sizeof(test_notes)) != sizeof(test_notes)) {
+        printf("queue notes failed!\r\n");
+        return -1;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 5000) <= 0) {
+        printf("playback did not finish!\r\n");
+        ioctl(fd, BEEP_FLUSH_CMD);
+        return -1;
+    }
+    if (ioctl(fd, BEEP_LOG_CMD, &log) < 0) {
+        printf("BEEP_LOG_CMD failed!\r\n");
+        return -1;
+    }
+    test_sequence(&log, test_notes, sizeof(test_notes) / sizeof(test_notes[0]));
+
+    /* Flushed 100 ms into the first note: nothing plays after the STOP */
+    if (write(fd, held, sizeof(held)) != sizeof(held)) {
+        printf("queue notes failed!\r\n");
+        return -1;
+    }
+    usleep(100000);
+    ioctl(fd, BEEP_FLUSH_CMD);
+    usleep(700000);
+    ioctl(fd, BEEP_LOG_CMD, &log);
+    test_check(log.count == 2, "flush: wrong number of backend calls", log.count);
+    if (log.count == 2) {
+        test_check(log.ev[0].op == BEEP_EV_PLAY && log.ev[0].period_ns == 2000000, "flush: not the first note", 0);
+        test_check(log.ev[1].op == BEEP_EV_STOP, "flush: no STOP", 1);
+        test_check(log.ev[1].t_us - log.ev[0].t_us < 500000, "flush: note not cut short", 1);
+    }
+
+    printf("%s: %d failures\r\n", test_fails ? "FAIL" : "PASS", test_fails);
+    return test_fails ? -1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
     int fd, retvalue;
     char *filename;
     unsigned char databuf[1];
     
+    /* ./miscbeepApp /dev/miscbeep 0|1|melody|test */
     if (argc != 3) {
         printf("Error Usage!\r\n");
         return -1;
@@ -27,6 +187,17 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (!strcmp(argv[2], "melody")) {
+        retvalue = play_melody(fd);
+        close(fd);
+        return retvalue;
+    }
+    if (!strcmp(argv[2], "test")) {
+        retvalue = test_sequencer(fd);
+        close(fd);
+        return retvalue;
+    }
+
     databuf[0] = atoi(argv[2]);    
     retvalue = write(fd, databuf, sizeof(databuf));
     if (retvalue < 0) {
@@ -16,6 +16,7 @@
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include "ap3216creg.h"
+#include "regxfer.h"
 
 #define AP3216C_CNT     1
 #define AP3216C_NAME    "ap3216c"
@@ -23,6 +24,7 @@
 // Structure for the AP3216C device
 struct ap3216c_dev {
     struct i2c_client *client;    /* i2c device */
+    struct regxfer *rx;           /* register access, see 40_regxfer */
     dev_t devid;                  /* device number */
     struct cdev cdev;             /* cdev structure */
     struct class *class;          /* device class */
@@ -31,80 +33,18 @@ struct ap3216c_dev {
     unsigned short ir, als, ps;   /* data from three light sensors */
 };
 
-// Function to read registers from the AP3216C device
-static int ap3216c_read_regs(struct ap3216c_dev *dev, u8 reg, void *val, int len)
-{
-    int ret;
-    struct i2c_msg msg[2];
-    struct i2c_client *client = (struct i2c_client *)dev->client;
-
-    // First message to set the register address
-    msg[0].addr = client->addr;
-    msg[0].flags = 0;
-    msg[0].buf = &reg;
-    msg[0].len = 1;
-
-    // Second message to read the data
-    msg[1].addr = client->addr;
-    msg[1].flags = I2C_M_RD;
-    msg[1].buf = val;
-    msg[1].len = len;
-
-    // Perform the I2C transfer
-    ret = i2c_transfer(client->adapter, msg, 2);
-    if (ret == 2) {
-        ret = 0;
-    } else {
-        printk("i2c rd failed=%d reg=%06x len=%d\n", ret, reg, len);
-        ret = -EREMOTEIO;
-    }
-    return ret;
-}
-
-// Function to write registers to the AP3216C device
-static s32 ap3216c_write_regs(struct ap3216c_dev *dev, u8 reg, u8 *buf, u8 len)
-{
-    u8 b[256];
-    struct i2c_msg msg;
-    struct i2c_client *client = (struct i2c_client *)dev->client;
-
-    b[0] = reg;
-    memcpy(&b[1], buf, len);
-
-    msg.addr = client->addr;
-    msg.flags = 0;
-    msg.buf = b;
-    msg.len = len + 1;
-
-    return i2c_transfer(client->adapter, &msg, 1);
-}
-
-// Function to read a single register from the AP3216C device
-static unsigned char ap3216c_read_reg(struct ap3216c_dev *dev, u8 reg)
-{
-    u8 data = 0;
-
-    ap3216c_read_regs(dev, reg, &data, 1);
-    return data;
-}
-
-// Function to write a single register to the AP3216C device
-static void ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 data)
-{
-    u8 buf = data;
-    ap3216c_write_regs(dev, reg, &buf, 1);
-}
-
 // Function to read data from the AP3216C sensors
 void ap3216c_readdata(struct ap3216c_dev *dev)
 {
-    unsigned char i = 0;
     unsigned char buf[6];
+    struct regxfer_op ops[6];
+    int i;
 
-    // Read the data from the sensor registers
-    for (i = 0; i < 6; i++) {
-        buf[i] = ap3216c_read_reg(dev, AP3216C_IRDATALOW + i);
-    }
+    // Read the six data registers one by one, but in a single i2c_transfer
+    for (i = 0; i < 6; i++)
+        ops[i] = (struct regxfer_op)REGXFER_READ(AP3216C_IRDATALOW + i, &buf[i], 1);
+    if (regxfer_run(dev->rx, ops, 6))
+        memset(buf, 0, sizeof(buf));
 
     // Process the IR data
     if (buf[0] & 0X80)
@@ -128,9 +68,9 @@ static int ap3216c_open(struct inode *inode, struct file *filp)
     struct cdev *cdev = filp->f_path.dentry->d_inode->i_cdev;
     struct ap3216c_dev *ap3216cdev = container_of(cdev, struct ap3216c_dev, cdev);
 
-    ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0x04);
-    mdelay(50);
-    ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0X03);
+    regxfer_write_u8(ap3216cdev->rx, AP3216C_SYSTEMCONG, 0x04);
+    msleep(50);
+    regxfer_write_u8(ap3216cdev->rx, AP3216C_SYSTEMCONG, 0X03);
     return 0;
 }
 
@@ -166,6 +106,13 @@ static const struct file_operations ap3216c_ops = {
     .release = ap3216c_release,
 };
 
+// 8-bit register addresses; the largest transfer is the six data registers
+static const struct regxfer_config ap3216c_regxfer = {
+    .reg_bytes = 1,
+    .max_ops = 6,
+    .max_bytes = 6 * 2,
+};
+
 // Probe function for the AP3216C device
 static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
@@ -177,6 +124,10 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
     if (!ap3216cdev)
         return -ENOMEM;
 
+    ap3216cdev->rx = devm_regxfer_init_i2c(client, &ap3216c_regxfer);
+    if (IS_ERR(ap3216cdev->rx))
+        return PTR_ERR(ap3216cdev->rx);
+
     // Allocate a device number
     ret = alloc_chrdev_region(&ap3216cdev->devid, 0, AP3216C_CNT, AP3216C_NAME);
     if (ret < 0) {
@@ -253,6 +204,7 @@ static struct i2c_driver ap3216c_driver = {
         .owner = THIS_MODULE,
         .name = "ap3216c",
         .of_match_table = ap3216c_of_match,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
     .id_table = ap3216c_id,
 };
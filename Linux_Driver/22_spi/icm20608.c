@@ -11,12 +11,16 @@
 #include <linux/device.h>
 #include <asm/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include "regxfer.h"
 
 #define ICM20608_CNT    1
 #define ICM20608_NAME   "icm20608"
 
 struct icm20608_dev {
     struct spi_device *spi;
+    struct regxfer *rx;             /* Register access, see 40_regxfer */
     dev_t devid;
     struct cdev cdev;
     struct class *class;
@@ -29,127 +33,10 @@ struct icm20608_dev {
     signed int accel_y_adc;
     signed int accel_z_adc;
     signed int temp_adc;
+    struct work_struct init_work;   /* Deferred register init */
+    struct completion init_done;    /* Set once the chip is configured */
 };
 
-/**
- * icm20608_read_regs - Read multiple registers from the ICM20608
- * @dev: Pointer to the ICM20608 device structure
- * @reg: Register address to start reading from
- * @buf: Buffer to store the read data
- * @len: Number of bytes to read
- * 
- * Returns: 0 on success, negative error code on failure
- */
-static int icm20608_read_regs(struct icm20608_dev *dev, u8 reg, void *buf, int len)
-{
-    int ret = -1;
-    unsigned char txdata[1];
-    unsigned char *rxdata;
-    struct spi_message m;
-    struct spi_transfer *t;
-    struct spi_device *spi = (struct spi_device *)dev->spi;
-
-    t = kzalloc(sizeof(struct spi_transfer), GFP_KERNEL);
-    if (!t) {
-        return -ENOMEM;
-    }
-    rxdata = kzalloc(sizeof(char) * len, GFP_KERNEL);
-    if (!rxdata) {
-        goto out1;
-    }
-
-    txdata[0] = reg | 0x80;  // Set the highest bit for reading
-    t->tx_buf = txdata;
-    t->rx_buf = rxdata;
-    t->len = len + 1;
-    spi_message_init(&m);
-    spi_message_add_tail(t, &m);
-    ret = spi_sync(spi, &m);
-    if (ret) {
-        goto out2;
-    }
-
-    memcpy(buf, rxdata + 1, len);
-
-out2:
-    kfree(rxdata);
-out1:
-    kfree(t);
-
-    return ret;
-}
-
-/**
- * icm20608_write_regs - Write multiple registers to the ICM20608
- * @dev: Pointer to the ICM20608 device structure
- * @reg: Register address to start writing to
- * @buf: Buffer containing the data to write
- * @len: Number of bytes to write
- * 
- * Returns: 0 on success, negative error code on failure
- */
-static s32 icm20608_write_regs(struct icm20608_dev *dev, u8 reg, u8 *buf, u8 len)
-{
-    int ret = -1;
-    unsigned char *txdata;
-    struct spi_message m;
-    struct spi_transfer *t;
-    struct spi_device *spi = (struct spi_device *)dev->spi;
-
-    t = kzalloc(sizeof(struct spi_transfer), GFP_KERNEL);
-    if (!t) {
-        return -ENOMEM;
-    }
-
-    txdata = kzalloc(sizeof(char) + len, GFP_KERNEL);
-    if (!txdata) {
-        goto out1;
-    }
-
-    *txdata = reg & ~0x80;  // Clear the highest bit for writing
-    memcpy(txdata + 1, buf, len);
-    t->tx_buf = txdata;
-    t->len = len + 1;
-    spi_message_init(&m);
-    spi_message_add_tail(t, &m);
-    ret = spi_sync(spi, &m);
-    if (ret) {
-        goto out2;
-    }
-
-out2:
-    kfree(txdata);
-out1:
-    kfree(t);
-    return ret;
-}
-
-/**
- * icm20608_read_onereg - Read a single register from the ICM20608
- * @dev: Pointer to the ICM20608 device structure
- * @reg: Register address to read
- * 
- * Returns: The value read from the register
- */
-static unsigned char icm20608_read_onereg(struct icm20608_dev *dev, u8 reg)
-{
-    u8 data = 0;
-    icm20608_read_regs(dev, reg, &data, 1);
-    return data;
-}
-
-/**
- * icm20608_write_onereg - Write a single register to the ICM20608
- * @dev: Pointer to the ICM20608 device structure
- * @reg: Register address to write
- * @value: Value to write to the register
- */
-static void icm20608_write_onereg(struct icm20608_dev *dev, u8 reg, u8 value)
-{
-    u8 buf = value;
-    icm20608_write_regs(dev, reg, &buf, 1);
-}
-
 /**
  * icm20608_readdata - Read all sensor data from the ICM20608
  * @dev: Pointer to the ICM20608 device structure
@@ -157,7 +44,8 @@ static void icm20608_write_onereg(struct icm20608_dev *dev, u8 reg, u8 value)
 void icm20608_readdata(struct icm20608_dev *dev)
 {
     unsigned char data[14];
-    icm20608_read_regs(dev, ICM20_ACCEL_XOUT_H, data, 14);
+
+    regxfer_read(dev->rx, ICM20_ACCEL_XOUT_H, data, 14);
 
     dev->accel_x_adc = (signed short)((data[0] << 8) | data[1]);
     dev->accel_y_adc = (signed short)((data[2] << 8) | data[3]);
@@ -177,6 +65,11 @@ void icm20608_readdata(struct icm20608_dev *dev)
  */
 static int icm20608_open(struct inode *inode, struct file *filp)
 {
+    struct icm20608_dev *dev = container_of(inode->i_cdev, struct icm20608_dev, cdev);
+
+    /* The node exists before the chip is configured, wait for init_work */
+    if (wait_for_completion_interruptible(&dev->init_done))
+        return -ERESTARTSYS;
     return 0;
 }
 
@@ -234,35 +127,58 @@ static const struct file_operations icm20608_ops = {
 void icm20608_reginit(struct icm20608_dev *dev)
 {
     u8 value = 0;
+    static const u8 config[] = {
+        0x00,   // SMPLRT_DIV: output rate = internal sample rate
+        0x03,   // CONFIG: DLPF_CFG 3 (44Hz, 4.9ms delay)
+        0x18,   // GYRO_CONFIG: ±2000 degrees/sec
+        0x18,   // ACCEL_CONFIG: ±16g
+        0x03,   // ACCEL_CONFIG2: 44Hz bandwidth, 4.9ms delay
+    };
+    const struct regxfer_op init[] = {
+        REGXFER_WRITE(ICM20_SMPLRT_DIV, config, sizeof(config)),
+        REGXFER_WRITE(ICM20_FIFO_EN, "\x00", 1),     // Disable FIFO
+        REGXFER_WRITE(ICM20_USER_CTRL, "\x10", 1),   // Disable I2C interface
+        REGXFER_WRITE(ICM20_PWR_MGMT_2, "\x00", 1),  // Enable Sensor
+    };
 
     // Reset the device
-    icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x80);
-    mdelay(50);
-    icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x01);
-    mdelay(50);
+    regxfer_write_u8(dev->rx, ICM20_PWR_MGMT_1, 0x80);
+    msleep(50);
+    regxfer_write_u8(dev->rx, ICM20_PWR_MGMT_1, 0x01);
+    msleep(50);
 
     // Read the WHO_AM_I register
-    value = icm20608_read_onereg(dev, ICM20_WHO_AM_I);
+    regxfer_read(dev->rx, ICM20_WHO_AM_I, &value, 1);
     printk("ICM20608 ID = %#X\r\n", value);
 
-    // Set sample rate divider to 0 (output rate = internal sample rate)
-    icm20608_write_onereg(dev, ICM20_SMPLRT_DIV, 0x00);
-    // Set DLPF_CFG to 3 (44Hz, 4.9ms delay)
-    icm20608_write_onereg(dev, ICM20_CONFIG, 0x03);
-    // Set Gyroscope to ±2000 degrees/sec
-    icm20608_write_onereg(dev, ICM20_GYRO_CONFIG, 0x18);
-    // Set Accelerometer to ±16g
-    icm20608_write_onereg(dev, ICM20_ACCEL_CONFIG, 0x18);
-    // Set Accelerometer to 44Hz bandwidth, 4.9ms delay
-    icm20608_write_onereg(dev, ICM20_ACCEL_CONFIG2, 0x03);
-    // Disable FIFO
-    icm20608_write_onereg(dev, ICM20_FIFO_EN, 0x00);
-    // Disable I2C interface
-    icm20608_write_onereg(dev, ICM20_USER_CTRL, 0x10);
-    // Enable Sensor
-    icm20608_write_onereg(dev, ICM20_PWR_MGMT_2, 0x00);
+    // SMPLRT_DIV..ACCEL_CONFIG2 are consecutive, so the whole configuration
+    // is four register accesses in one spi_sync() instead of eight
+    regxfer_run(dev->rx, init, ARRAY_SIZE(init));
+}
+
+/**
+ * icm20608_init_work - Deferred chip bring-up
+ * @work: Pointer to the init_work member of the device structure
+ *
+ * The reset sequence sleeps for 100ms, so it runs here instead of in
+ * probe. Readers block in open() until it has finished.
+ */
+static void icm20608_init_work(struct work_struct *work)
+{
+    struct icm20608_dev *dev = container_of(work, struct icm20608_dev, init_work);
+
+    icm20608_reginit(dev);
+    complete_all(&dev->init_done);
 }
 
+/* Bit 7 of the address byte selects a read; the largest transfer is the 14-byte data read */
+static const struct regxfer_config icm20608_regxfer = {
+    .reg_bytes = 1,
+    .read_flag = 0x80,
+    .max_ops = 4,
+    .max_bytes = 1 + 14,
+};
+
 /**
  * icm20608_probe - Probe function for the SPI driver
  * @spi: Pointer to the SPI device structure
@@ -283,6 +199,12 @@ static int icm20608_probe(struct spi_device *spi)
     // Initialize the device structure
     icm20608dev->spi = spi;
     icm20608dev->nd = spi->dev.of_node;
+    INIT_WORK(&icm20608dev->init_work, icm20608_init_work);
+    init_completion(&icm20608dev->init_done);
+
+    icm20608dev->rx = devm_regxfer_init_spi(spi, &icm20608_regxfer);
+    if (IS_ERR(icm20608dev->rx))
+        return PTR_ERR(icm20608dev->rx);
 
     // Allocate a character device number
     alloc_chrdev_region(&icm20608dev->devid, 0, ICM20608_CNT, ICM20608_NAME);
@@ -306,12 +228,12 @@ static int icm20608_probe(struct spi_device *spi)
         goto destroy_device;
     }
 
-    // Initialize the ICM20608 registers
-    icm20608_reginit(icm20608dev);
-
     // Set the driver data
     spi_set_drvdata(spi, icm20608dev);
 
+    // Initialize the ICM20608 registers off the probe path
+    queue_work(system_long_wq, &icm20608dev->init_work);
+
     return 0;
 
 destroy_device:
@@ -334,6 +256,7 @@ static int icm20608_remove(struct spi_device *spi)
 {
     struct icm20608_dev *icm20608dev = spi_get_drvdata(spi);
 
+    flush_work(&icm20608dev->init_work);
     cdev_del(&icm20608dev->cdev);
     unregister_chrdev_region(icm20608dev->devid, ICM20608_CNT);
     device_destroy(icm20608dev->class, icm20608dev->devid);
@@ -359,6 +282,7 @@ static struct spi_driver icm20608_driver = {
         .owner = THIS_MODULE,
         .name = "icm20608",
         .of_match_table = icm20608_of_match,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
     .id_table = icm20608_id,
 };
@@ -39,6 +39,7 @@
 #include <linux/input/mt.h>
 #include <linux/input/touchscreen.h>
 #include <linux/input/edt-ft5x06.h>
+#include "touch_latency.h"
 
 #define MAX_SUPPORT_POINTS		5
 
@@ -112,6 +113,8 @@ struct edt_ft5x06_ts_data {
 
 	struct edt_reg_addr reg_addr;
 	enum edt_ver version;
+
+	struct touch_latency lat;
 };
 
 static int edt_ft5x06_ts_readwrite(struct i2c_client *client,
@@ -165,6 +168,14 @@ static bool edt_ft5x06_ts_check_crc(struct edt_ft5x06_ts_data *tsdata,
 	return true;
 }
 
+static irqreturn_t edt_ft5x06_ts_hardirq(int irq, void *dev_id)
+{
+	struct edt_ft5x06_ts_data *tsdata = dev_id;
+
+	touch_latency_irq(&tsdata->lat);
+	return IRQ_WAKE_THREAD;
+}
+
 static irqreturn_t edt_ft5x06_ts_isr(int irq, void *dev_id)
 {
 	struct edt_ft5x06_ts_data *tsdata = dev_id;
@@ -173,7 +184,7 @@ static irqreturn_t edt_ft5x06_ts_isr(int irq, void *dev_id)
 	u8 rdbuf[29];
 	int i, type, x, y, id;
 	int offset, tplen, datalen;
-	int error;
+	int error, contacts = 0;
 	bool down;
 
 	cmd = 0x02; 	/* 0X02是触摸状态寄存器 */
@@ -191,6 +202,7 @@ static irqreturn_t edt_ft5x06_ts_isr(int irq, void *dev_id)
 				    error);
 		goto out;
 	}
+	touch_latency_read(&tsdata->lat, sizeof(cmd) + datalen);
 
 	/* 上报每一个触摸点坐标 */
 	for (i = 0; i < MAX_SUPPORT_POINTS; i++) {
@@ -224,10 +236,12 @@ static irqreturn_t edt_ft5x06_ts_isr(int irq, void *dev_id)
 
 		input_report_abs(tsdata->input, ABS_MT_POSITION_X, x);
 		input_report_abs(tsdata->input, ABS_MT_POSITION_Y, y);
+		contacts++;
 	}
 
 	input_mt_report_pointer_emulation(tsdata->input, true);
 	input_sync(tsdata->input);
+	touch_latency_sync(&tsdata->lat, contacts);
 
 out:
 	return IRQ_HANDLED;
@@ -1050,18 +1064,19 @@ static int edt_ft5x06_ts_probe(struct i2c_client *client,
 	gpio_request(tsdata->irq_pin, "interrupt-gpios");
 	gpio_direction_input(tsdata->irq_pin);
 
-	error = devm_request_threaded_irq(&client->dev, client->irq, NULL,
-					edt_ft5x06_ts_isr,
+	touch_latency_register(&tsdata->lat, "edt_ft5x06");
+	error = devm_request_threaded_irq(&client->dev, client->irq,
+					edt_ft5x06_ts_hardirq, edt_ft5x06_ts_isr,
 					IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
 					client->name, tsdata);
 	if (error) {
 		dev_err(&client->dev, "Unable to request touchscreen IRQ.\n");
-		return error;
+		goto err_latency;
 	}
 
 	error = sysfs_create_group(&client->dev.kobj, &edt_ft5x06_attr_group);
 	if (error)
-		return error;
+		goto err_latency;
 
 	error = input_register_device(input);
 	if (error)
@@ -1078,6 +1093,8 @@ static int edt_ft5x06_ts_probe(struct i2c_client *client,
 
 err_remove_attrs:
 	sysfs_remove_group(&client->dev.kobj, &edt_ft5x06_attr_group);
+err_latency:
+	touch_latency_unregister(&tsdata->lat);
 	return error;
 }
 
@@ -1087,6 +1104,7 @@ static int edt_ft5x06_ts_remove(struct i2c_client *client)
 
 	edt_ft5x06_ts_teardown_debugfs(tsdata);
 	sysfs_remove_group(&client->dev.kobj, &edt_ft5x06_attr_group);
+	touch_latency_unregister(&tsdata->lat);
 
 	return 0;
 }
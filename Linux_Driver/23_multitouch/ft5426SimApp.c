@@ -0,0 +1,281 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <dirent.h>
+#include <math.h>
+#include <time.h>
+#include "touch_sim.h"
+
+/*
+ * Replays touch frames through touch_sim.ko (chip=ft5426) and measures what the
+ * ft5x06.ko IRQ path costs for it.
+ *
+ * Usage: ./ft5426SimApp [-r rec.txt] [-w rec.txt] [-s seconds] [-f hz] [-n fingers]
+ *                       [-m before|after|both]
+ *   -r : replay a recording, one frame per line: "<delay_us> <reg 0x00> <reg 0x01> ..."
+ *        in hex, '#' starts a comment. Without -r a synthetic gesture set is used:
+ *        1..n fingers moving for 1 s each, release, 0.5 s pause, repeated for -s s.
+ *   -w : save the frames that are going to be replayed
+ *   -m : before = ft5x06 legacy_read=1 (fixed 29 byte reads), after = count-sized
+ *        reads, both = run both and compare (default)
+ *
+ * Reported per run, normalised to one second of touch activity (time during
+ * which at least one finger is down): I2C transfers, bytes and modelled bus
+ * time (occupancy), and CPU time of the irq/..-edt_ft5426 thread from
+ * /proc/<pid>/schedstat.
+ */
+
+#define TD_STATUS			0x02
+#define TOUCH_DATA			0x03
+#define POINT_LEN			6
+#define EVENT_UP			0x01
+#define EVENT_ON			0x02
+#define LEGACY_PARAM		"/sys/module/ft5x06/parameters/legacy_read"
+
+static struct touch_sim_frame *frames;
+static int nframes, maxframes;
+
+static struct touch_sim_frame *new_frame(unsigned int delay_us)
+{
+	struct touch_sim_frame *f;
+
+	if (nframes == maxframes) {
+		maxframes = maxframes ? maxframes * 2 : 1024;
+		frames = realloc(frames, maxframes * sizeof(*frames));
+		if (frames == NULL) {
+			printf("Out of memory\r\n");
+			exit(-1);
+		}
+	}
+	f = &frames[nframes++];
+	memset(f, 0, sizeof(*f));
+	f->delay_us = delay_us;
+	return f;
+}
+
+/* The panel is mounted rotated: the driver reads X from YH/YL and Y from XH/XL */
+static void set_point(struct touch_sim_frame *f, int i, int event, int id, int x, int y)
+{
+	unsigned char *p = &f->regs[TOUCH_DATA + i * POINT_LEN];
+
+	p[0] = (event << 6) | ((y >> 8) & 0x0f);
+	p[1] = y & 0xff;
+	p[2] = (id << 4) | ((x >> 8) & 0x0f);
+	p[3] = x & 0xff;
+}
+
+static void synth(int seconds, int hz, int fingers)
+{
+	unsigned int period = 1000000 / hz, pause = 500000;
+	int t = 0, k = 1, step, i;
+	struct touch_sim_frame *f;
+
+	while (t < seconds * 1000000) {
+		/* k fingers circling for one second */
+		for (step = 0; step < hz; step++) {
+			f = new_frame(step == 0 ? pause : period);
+			f->regs[TD_STATUS] = k;
+			for (i = 0; i < k; i++) {
+				double a = 2 * M_PI * step / hz + i;
+
+				set_point(f, i, EVENT_ON, i, 512 + 200 * cos(a), 300 + 150 * sin(a));
+			}
+		}
+		/* Release: the controller reports UP events with TD_STATUS = 0 */
+		f = new_frame(period);
+		for (i = 0; i < k; i++)
+			set_point(f, i, EVENT_UP, i, 0, 0);
+		t += pause + (hz + 1) * period;
+		k = k % fingers + 1;
+	}
+}
+
+static int load(const char *path)
+{
+	char line[512], *p, *end;
+	struct touch_sim_frame *f;
+	int i;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		f = new_frame(strtoul(line, &p, 0));
+		for (i = 0; i < TOUCH_SIM_REGS; i++) {
+			unsigned long v = strtoul(p, &end, 16);
+
+			if (end == p)
+				break;
+			f->regs[i] = v;
+			p = end;
+		}
+	}
+	fclose(fp);
+	return nframes ? 0 : -1;
+}
+
+static int save(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	int i, j;
+
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+	fprintf(fp, "# delay_us regs[0x00..0x%02x]\n", TOUCH_SIM_REGS - 1);
+	for (i = 0; i < nframes; i++) {
+		fprintf(fp, "%u", frames[i].delay_us);
+		for (j = 0; j <= TOUCH_DATA + 5 * POINT_LEN; j++)
+			fprintf(fp, " %02x", frames[i].regs[j]);
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* CPU time of the edt_ft5426 IRQ thread, -1 if it is not found */
+static long long irq_thread_ns(void)
+{
+	char path[300], comm[32];
+	struct dirent *de;
+	long long ns = -1;
+	DIR *dir = opendir("/proc");
+	FILE *fp;
+
+	if (dir == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL && ns < 0) {
+		snprintf(path, sizeof(path), "/proc/%s/comm", de->d_name);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			continue;
+		/* "irq/<n>-edt_ft5426", truncated to 15 characters */
+		if (fgets(comm, sizeof(comm), fp) && !strncmp(comm, "irq/", 4) && strstr(comm, "-edt_ft5")) {
+			fclose(fp);
+			snprintf(path, sizeof(path), "/proc/%s/schedstat", de->d_name);
+			fp = fopen(path, "r");
+			if (fp == NULL)
+				continue;
+			if (fscanf(fp, "%lld", &ns) != 1)
+				ns = -1;
+		}
+		fclose(fp);
+	}
+	closedir(dir);
+	return ns;
+}
+
+static int set_legacy(int on)
+{
+	int fd = open(LEGACY_PARAM, O_WRONLY);
+
+	if (fd < 0) {
+		printf("Can't open file %s\r\n", LEGACY_PARAM);
+		return -1;
+	}
+	write(fd, on ? "1" : "0", 1);
+	close(fd);
+	return 0;
+}
+
+static int run(int fd, const char *name, double active_s)
+{
+	struct touch_sim_stats s0, s1;
+	long long cpu0, cpu1;
+	struct timespec ts = { 0, 100 * 1000 * 1000 };
+
+	if (read(fd, &s0, sizeof(s0)) != sizeof(s0))
+		return -1;
+	cpu0 = irq_thread_ns();
+
+	if (write(fd, frames, nframes * sizeof(*frames)) < 0) {
+		printf("write failed\r\n");
+		return -1;
+	}
+	do {
+		nanosleep(&ts, NULL);
+		if (read(fd, &s1, sizeof(s1)) != sizeof(s1))
+			return -1;
+	} while (s1.pending);
+	nanosleep(&ts, NULL);				/* Let the IRQ thread finish the last frame */
+	read(fd, &s1, sizeof(s1));
+	cpu1 = irq_thread_ns();
+
+	printf("%-6s frames=%llu xfers/s=%.1f bytes/s=%.1f bus=%.3f%% irq_cpu=%.3f ms/s rate_writes=%u\r\n",
+		   name, (unsigned long long)(s1.frames - s0.frames),
+		   (s1.xfers - s0.xfers) / active_s, (s1.bytes - s0.bytes) / active_s,
+		   (s1.bus_ns - s0.bus_ns) / (active_s * 1e7),
+		   (cpu0 < 0 || cpu1 < 0) ? -1.0 : (cpu1 - cpu0) / (active_s * 1e6),
+		   s1.rate_writes - s0.rate_writes);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *rec = NULL, *out = NULL, *mode = "both";
+	int seconds = 10, hz = 100, fingers = 5, opt, fd, i;
+	double active_s = 0;
+
+	while ((opt = getopt(argc, argv, "r:w:s:f:n:m:")) != -1) {
+		switch (opt) {
+		case 'r': rec = optarg; break;
+		case 'w': out = optarg; break;
+		case 's': seconds = atoi(optarg); break;
+		case 'f': hz = atoi(optarg); break;
+		case 'n': fingers = atoi(optarg); break;
+		case 'm': mode = optarg; break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (hz <= 0 || seconds <= 0 || fingers < 1 || fingers > 5) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	if (rec) {
+		if (load(rec) < 0)
+			return -1;
+	} else {
+		synth(seconds, hz, fingers);
+	}
+	if (out && save(out) < 0)
+		return -1;
+
+	/* Touch activity: time spent in frames that have at least one finger down */
+	for (i = 1; i < nframes; i++)
+		if (frames[i - 1].regs[TD_STATUS] & 0x0f)
+			active_s += frames[i].delay_us / 1e6;
+	if (active_s <= 0)
+		active_s = 1;
+	printf("%d frames, %.2f s of touch activity\r\n", nframes, active_s);
+
+	fd = open("/dev/touch_sim", O_RDWR);
+	if (fd < 0) {
+		printf("Can't open file /dev/touch_sim\r\n");
+		return -1;
+	}
+
+	if (strcmp(mode, "after")) {
+		if (set_legacy(1) == 0)
+			run(fd, "before", active_s);
+	}
+	if (strcmp(mode, "before")) {
+		if (set_legacy(0) == 0)
+			run(fd, "after", active_s);
+	}
+
+	close(fd);
+	free(frames);
+	return 0;
+}
@@ -4,91 +4,76 @@
 #include <linux/of_gpio.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include "touch_latency.h"
+#include "regxfer.h"
 
 /* FT5426 register definitions */
 #define FT5426_DEVIDE_MODE_REG   0x00    // Mode register
 #define FT5426_TD_STATUS_REG     0x02    // Status register
 #define FT5426_TOUCH_DATA_REG    0x03    // Starting register for touch data
+#define FT5426_PERIODACTIVE_REG  0x88    // Report rate in active mode, 3..14
 #define FT5426_ID_G_MODE_REG     0xA4    // Interrupt mode register
 
 #define MAX_SUPPORT_POINTS       5       // FT5426 supports a maximum of 5 touch points
+#define FT5426_POINT_LEN         6       // Bytes per touch point record
+#define FT5426_FRAME_LEN         (1 + MAX_SUPPORT_POINTS * FT5426_POINT_LEN)
 
 #define TOUCH_EVENT_DOWN         0x00    // Touch down
 #define TOUCH_EVENT_UP           0x01    // Touch up
 #define TOUCH_EVENT_ON           0x02    // Touch contact
 #define TOUCH_EVENT_RESERVED     0x03    // Reserved
 
+static unsigned int active_rate = 12;
+module_param(active_rate, uint, 0644);
+MODULE_PARM_DESC(active_rate, "Report rate while touched (FT5426_PERIODACTIVE_REG units, 3..14)");
+
+static unsigned int idle_rate = 3;
+module_param(idle_rate, uint, 0644);
+MODULE_PARM_DESC(idle_rate, "Report rate after idle_ms without touches");
+
+static unsigned int idle_ms = 2000;
+module_param(idle_ms, uint, 0644);
+MODULE_PARM_DESC(idle_ms, "Idle time before dropping to idle_rate, 0 = always active_rate");
+
+static bool legacy_read;
+module_param(legacy_read, bool, 0644);
+MODULE_PARM_DESC(legacy_read, "Always read all five point records, for before/after measurements");
 
 struct edt_ft5426_dev {
     struct i2c_client *client;
+    struct regxfer *rx;                 // Register access, see 40_regxfer
     struct input_dev *input;
     int reset_gpio;
     int irq_gpio;
-};
-
-static int edt_ft5426_ts_write(struct edt_ft5426_dev *ft5426,
-            u8 addr, u8 *buf, u16 len)
-{
-    struct i2c_client *client = ft5426->client;
-    struct i2c_msg msg;
-    u8 send_buf[6] = {0};
-    int ret;
+    int irq;
+    int last_num;                       // Touch points in the previous frame
+    u8 rdbuf[FT5426_FRAME_LEN];
 
-    send_buf[0] = addr;
-    memcpy(&send_buf[1], buf, len);
+    struct delayed_work idle_work;      // Drops the report rate when untouched
+    struct mutex rate_lock;
+    bool idle;
+    unsigned long last_touch;           // jiffies of the last frame with contacts
 
-    msg.flags = 0;                  // i2c write
-    msg.addr = client->addr;
-    msg.buf = send_buf;
-    msg.len = len + 1;
+    atomic64_t frames;                  // Frames handled by the IRQ thread
 
-    ret = i2c_transfer(client->adapter, &msg, 1);
-    if (1 == ret)
-        return 0;
-    else {
-        dev_err(&client->dev, "%s: write error, addr=0x%x len=%d.\n",
-                    __func__, addr, len);
-        return -1;
-    }
-}
-
-static int edt_ft5426_ts_read(struct edt_ft5426_dev *ft5426,
-            u8 addr, u8 *buf, u16 len)
-{
-    struct i2c_client *client = ft5426->client;
-    struct i2c_msg msg[2];
-    int ret;
-
-    msg[0].flags = 0;               // i2c write
-    msg[0].addr = client->addr;
-    msg[0].buf = &addr;
-    msg[0].len = 1;                 // 1 byte
-
-    msg[1].flags = I2C_M_RD;        // i2c read
-    msg[1].addr = client->addr;
-    msg[1].buf = buf;
-    msg[1].len = len;
-
-    ret = i2c_transfer(client->adapter, msg, 2);
-    if (2 == ret)
-        return 0;
-    else {
-        dev_err(&client->dev, "%s: read error, addr=0x%x len=%d.\n",
-                    __func__, addr, len);
-        return -1;
-    }
-}
+    struct touch_latency lat;           // IRQ edge to input_sync
+};
 
 static int edt_ft5426_ts_reset(struct edt_ft5426_dev *ft5426)
 {
     struct i2c_client *client = ft5426->client;
     int ret;
 
-    /* Get reset GPIO from device tree */
+    /* Get reset GPIO from device tree, optional (e.g. on the simulated controller) */
     ft5426->reset_gpio = of_get_named_gpio(client->dev.of_node, "reset-gpios", 0);
     if (!gpio_is_valid(ft5426->reset_gpio)) {
-        dev_err(&client->dev, "Failed to get ts reset gpio\n");
-        return ft5426->reset_gpio;
+        if (ft5426->reset_gpio == -EPROBE_DEFER)
+            return -EPROBE_DEFER;
+        dev_info(&client->dev, "No ts reset gpio, skipping reset\n");
+        return 0;
     }
 
     /* Request GPIO */
@@ -105,22 +90,92 @@ static int edt_ft5426_ts_reset(struct edt_ft5426_dev *ft5426)
     return 0;
 }
 
+/*
+ * Program the controller's report rate. Called with rate_lock held.
+ */
+static void edt_ft5426_ts_set_rate(struct edt_ft5426_dev *ft5426, unsigned int rate)
+{
+    regxfer_write_u8(ft5426->rx, FT5426_PERIODACTIVE_REG, clamp(rate, 3U, 14U));
+}
+
+/*
+ * A frame with contacts arrived: go back to active_rate if we were idle
+ * and push the idle deadline out by idle_ms.
+ */
+static void edt_ft5426_ts_touched(struct edt_ft5426_dev *ft5426)
+{
+    if (!idle_ms)
+        return;
+
+    mutex_lock(&ft5426->rate_lock);
+    ft5426->last_touch = jiffies;
+    if (ft5426->idle) {
+        edt_ft5426_ts_set_rate(ft5426, active_rate);
+        ft5426->idle = false;
+    }
+    mutex_unlock(&ft5426->rate_lock);
+
+    mod_delayed_work(system_wq, &ft5426->idle_work, msecs_to_jiffies(idle_ms));
+}
+
+static void edt_ft5426_ts_idle_work(struct work_struct *work)
+{
+    struct edt_ft5426_dev *ft5426 = container_of(to_delayed_work(work),
+                struct edt_ft5426_dev, idle_work);
+
+    mutex_lock(&ft5426->rate_lock);
+    /* A touch may have landed while we were waiting for the lock */
+    if (!ft5426->idle && idle_ms &&
+        time_after_eq(jiffies, ft5426->last_touch + msecs_to_jiffies(idle_ms))) {
+        edt_ft5426_ts_set_rate(ft5426, idle_rate);
+        ft5426->idle = true;
+    }
+    mutex_unlock(&ft5426->rate_lock);
+}
+
+/*
+ * Hard IRQ half: only timestamps the interrupt edge for the latency stats.
+ */
+static irqreturn_t edt_ft5426_ts_hardirq(int irq, void *dev_id)
+{
+    struct edt_ft5426_dev *ft5426 = dev_id;
+
+    touch_latency_irq(&ft5426->lat);
+    return IRQ_WAKE_THREAD;
+}
+
 static irqreturn_t edt_ft5426_ts_isr(int irq, void *dev_id)
 {
     struct edt_ft5426_dev *ft5426 = dev_id;
-    u8 rdbuf[30] = {0};
-    int i, type, x, y, id;
-    bool down;
+    u8 *rdbuf = ft5426->rdbuf;
+    int i, type, x, y, id, num, got, contacts = 0;
     int ret;
 
-    /* Read FT5426 touch coordinates starting from 0x02 register, read 29 registers continuously */
-    ret = edt_ft5426_ts_read(ft5426, FT5426_TD_STATUS_REG, rdbuf, 29);
+    /*
+     * Read TD_STATUS together with as many point records as the previous
+     * frame had (at least one). Most frames keep the same finger count,
+     * so this is a single transfer of 1 + n * 6 bytes instead of 29.
+     */
+    got = legacy_read ? MAX_SUPPORT_POINTS : max(ft5426->last_num, 1);
+    ret = regxfer_read(ft5426->rx, FT5426_TD_STATUS_REG, rdbuf,
+                1 + got * FT5426_POINT_LEN);
     if (ret)
         goto out;
 
-    for (i = 0; i < MAX_SUPPORT_POINTS; i++) {
+    num = min_t(int, rdbuf[0] & 0x0f, MAX_SUPPORT_POINTS);
+    if (num > got) {
+        /* More fingers than last time, fetch the missing records */
+        ret = regxfer_read(ft5426->rx, FT5426_TOUCH_DATA_REG + got * FT5426_POINT_LEN,
+                    &rdbuf[1 + got * FT5426_POINT_LEN],
+                    (num - got) * FT5426_POINT_LEN);
+        if (ret)
+            goto out;
+    }
+    touch_latency_read(&ft5426->lat, 1 + max(num, got) * FT5426_POINT_LEN);
 
-        u8 *buf = &rdbuf[i * 6 + 1];
+    for (i = 0; i < num; i++) {
+
+        u8 *buf = &rdbuf[i * FT5426_POINT_LEN + 1];
 
         /* For the first touch point, register TOUCH1_XH (address 0x03), bit description:
          * bit7:6  Event flag  0:press 1:release 2:contact 3:no event
@@ -128,8 +183,8 @@ static irqreturn_t edt_ft5426_ts_isr(int irq, void *dev_id)
          * bit3:0  X-axis touch point 11~8 bits
          */
         type = buf[0] >> 6;                     // Get touch point Event Flag
-        if (type == TOUCH_EVENT_RESERVED)
-            continue;
+        if (type == TOUCH_EVENT_RESERVED || type == TOUCH_EVENT_UP)
+            continue;                           // Released slots are dropped by input_mt_sync_frame
 
         /* The touchscreen we use is reversed with FT5426 */
         x = ((buf[2] << 8) | buf[3]) & 0x0fff;
@@ -140,46 +195,67 @@ static irqreturn_t edt_ft5426_ts_isr(int irq, void *dev_id)
          * bit3:0  Y-axis touch point 11~8 bits.
          */
         id = (buf[2] >> 4) & 0x0f;
-        down = type != TOUCH_EVENT_UP;
-
-        input_mt_slot(ft5426->input, id);
-        input_mt_report_slot_state(ft5426->input, MT_TOOL_FINGER, down);
-
-        if (!down)
+        if (id >= MAX_SUPPORT_POINTS)
             continue;
 
+        input_mt_slot(ft5426->input, id);
+        input_mt_report_slot_state(ft5426->input, MT_TOOL_FINGER, true);
         input_report_abs(ft5426->input, ABS_MT_POSITION_X, x);
         input_report_abs(ft5426->input, ABS_MT_POSITION_Y, y);
+        contacts++;
     }
 
-    input_mt_report_pointer_emulation(ft5426->input, true);
+    input_mt_sync_frame(ft5426->input);
     input_sync(ft5426->input);
+    touch_latency_sync(&ft5426->lat, contacts);
+
+    ft5426->last_num = num;
+    atomic64_inc(&ft5426->frames);
+    if (num)
+        edt_ft5426_ts_touched(ft5426);
 
 out:
     return IRQ_HANDLED;
 }
 
+/*
+ * Bus usage counters, for comparing read strategies and report rates.
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct edt_ft5426_dev *ft5426 = i2c_get_clientdata(to_i2c_client(dev));
+    struct regxfer_stats st;
+
+    regxfer_get_stats(ft5426->rx, &st);
+    return sprintf(buf, "frames %lld\nxfers %llu\nbytes %llu\nidle %d\n",
+                atomic64_read(&ft5426->frames), st.xfers, st.bytes, ft5426->idle);
+}
+static DEVICE_ATTR_RO(stats);
+
 static int edt_ft5426_ts_irq(struct edt_ft5426_dev *ft5426)
 {
     struct i2c_client *client = ft5426->client;
     int ret;
 
-    /* Get interrupt GPIO from device tree */
+    /* Get interrupt GPIO from device tree, fall back to client->irq */
     ft5426->irq_gpio = of_get_named_gpio(client->dev.of_node, "irq-gpios", 0);
-    if (!gpio_is_valid(ft5426->irq_gpio)) {
+    if (gpio_is_valid(ft5426->irq_gpio)) {
+        /* Request GPIO */
+        ret = devm_gpio_request_one(&client->dev, ft5426->irq_gpio,
+                    GPIOF_IN, "ft5426 interrupt");
+        if (ret < 0)
+            return ret;
+        ft5426->irq = gpio_to_irq(ft5426->irq_gpio);
+    } else if (client->irq > 0) {
+        ft5426->irq = client->irq;
+    } else {
         dev_err(&client->dev, "Failed to get ts interrupt gpio\n");
         return ft5426->irq_gpio;
     }
 
-    /* Request GPIO */
-    ret = devm_gpio_request_one(&client->dev, ft5426->irq_gpio,
-                GPIOF_IN, "ft5426 interrupt");
-    if (ret < 0)
-        return ret;
-
     /* Register interrupt service function */
-    ret = devm_request_threaded_irq(&client->dev, gpio_to_irq(ft5426->irq_gpio),
-                NULL, edt_ft5426_ts_isr, IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
+    ret = devm_request_threaded_irq(&client->dev, ft5426->irq,
+                edt_ft5426_ts_hardirq, edt_ft5426_ts_isr, IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
                 client->name, ft5426);
     if (ret) {
         dev_err(&client->dev, "Failed to request touchscreen IRQ.\n");
@@ -189,12 +265,24 @@ static int edt_ft5426_ts_irq(struct edt_ft5426_dev *ft5426)
     return 0;
 }
 
+/* 8-bit register addresses; the largest transfer is a full frame read */
+static const struct regxfer_config edt_ft5426_regxfer = {
+    .reg_bytes = 1,
+    .max_ops = 3,
+    .max_bytes = 1 + FT5426_FRAME_LEN,
+};
+
 static int edt_ft5426_ts_probe(struct i2c_client *client,
             const struct i2c_device_id *id)
 {
     struct edt_ft5426_dev *ft5426;
     struct input_dev *input;
-    u8 data;
+    u8 mode = 0, irq_mode = 1, rate = clamp(active_rate, 3U, 14U);
+    struct regxfer_op init[] = {
+        REGXFER_WRITE(FT5426_DEVIDE_MODE_REG, &mode, 1),    // Normal operating mode
+        REGXFER_WRITE(FT5426_ID_G_MODE_REG, &irq_mode, 1),  // Trigger mode interrupts
+        REGXFER_WRITE(FT5426_PERIODACTIVE_REG, &rate, 1),
+    };
     int ret;
 
     /* Instantiate a struct edt_ft5426_dev object */
@@ -205,6 +293,13 @@ static int edt_ft5426_ts_probe(struct i2c_client *client,
     }
 
     ft5426->client = client;
+    mutex_init(&ft5426->rate_lock);
+    INIT_DELAYED_WORK(&ft5426->idle_work, edt_ft5426_ts_idle_work);
+    i2c_set_clientdata(client, ft5426);
+
+    ft5426->rx = devm_regxfer_init_i2c(client, &edt_ft5426_regxfer);
+    if (IS_ERR(ft5426->rx))
+        return PTR_ERR(ft5426->rx);
 
     /* Reset FT5426 touch chip */
     ret = edt_ft5426_ts_reset(ft5426);
@@ -213,16 +308,8 @@ static int edt_ft5426_ts_probe(struct i2c_client *client,
 
     msleep(5);
 
-    /* Initialize FT5426 */
-    data = 0;
-    edt_ft5426_ts_write(ft5426, FT5426_DEVIDE_MODE_REG, &data, 1);
-    data = 1;
-    edt_ft5426_ts_write(ft5426, FT5426_ID_G_MODE_REG, &data, 1);
-
-    /* Request, register interrupt service function */
-    ret = edt_ft5426_ts_irq(ft5426);
-    if (ret)
-        return ret;
+    /* Initialize FT5426, all three registers in one i2c_transfer */
+    regxfer_run(ft5426->rx, init, ARRAY_SIZE(init));
 
     /* Register input device */
     input = devm_input_allocate_device(&client->dev);
@@ -240,7 +327,8 @@ static int edt_ft5426_ts_probe(struct i2c_client *client,
     input_set_abs_params(input, ABS_MT_POSITION_Y,
                 0, 600, 0, 0);
 
-    ret = input_mt_init_slots(input, MAX_SUPPORT_POINTS, INPUT_MT_DIRECT);
+    ret = input_mt_init_slots(input, MAX_SUPPORT_POINTS,
+                INPUT_MT_DIRECT | INPUT_MT_DROP_UNUSED);
     if (ret) {
         dev_err(&client->dev, "Failed to init MT slots.\n");
         return ret;
@@ -250,17 +338,47 @@ static int edt_ft5426_ts_probe(struct i2c_client *client,
     if (ret)
         return ret;
 
-    i2c_set_clientdata(client, ft5426);
+    touch_latency_register(&ft5426->lat, "ft5426");
+
+    /* Request, register interrupt service function, once input is ready */
+    ret = edt_ft5426_ts_irq(ft5426);
+    if (ret)
+        goto err_unregister;
+
+    ret = device_create_file(&client->dev, &dev_attr_stats);
+    if (ret)
+        goto err_unregister;
+
+    /* Start the idle countdown, the first touch restores active_rate */
+    ft5426->last_touch = jiffies;
+    if (idle_ms)
+        schedule_delayed_work(&ft5426->idle_work, msecs_to_jiffies(idle_ms));
     return 0;
+
+err_unregister:
+    touch_latency_unregister(&ft5426->lat);
+    input_unregister_device(input);
+    return ret;
 }
 
 static int edt_ft5426_ts_remove(struct i2c_client *client)
 {
     struct edt_ft5426_dev *ft5426 = i2c_get_clientdata(client);
+
+    disable_irq(ft5426->irq);           // The IRQ thread re-arms idle_work
+    cancel_delayed_work_sync(&ft5426->idle_work);
+    device_remove_file(&client->dev, &dev_attr_stats);
+    touch_latency_unregister(&ft5426->lat);
     input_unregister_device(ft5426->input);
     return 0;
 }
 
+static const struct i2c_device_id edt_ft5426_ts_id[] = {
+    { "edt_ft5426", 0 },                // Instantiated by touch_sim
+    { /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(i2c, edt_ft5426_ts_id);
+
 static const struct of_device_id edt_ft5426_of_match[] = {
     { .compatible = "edt,edt-ft5426", },
     { /* sentinel */ }
@@ -275,6 +393,7 @@ static struct i2c_driver edt_ft5426_ts_driver = {
     },
     .probe    = edt_ft5426_ts_probe,
     .remove   = edt_ft5426_ts_remove,
+    .id_table = edt_ft5426_ts_id,
 };
 
 module_i2c_driver(edt_ft5426_ts_driver);
@@ -14,6 +14,8 @@
 #include <linux/input/mt.h>
 #include <linux/input/touchscreen.h>
 #include <linux/i2c.h>
+#include "touch_latency.h"
+#include "regxfer.h"
 
 #define GT_CTRL_REG 	        0X8040  /* GT9147控制寄存器         */
 #define GT_MODSW_REG 	        0X804D  /* GT9147模式切换寄存器        */
@@ -28,6 +30,9 @@
 #define GT_TP4_REG 		        0X8167  /* 第四个触摸点数据地址  */
 #define GT_TP5_REG 		        0X816F	/* 第五个触摸点数据地址   */
 #define MAX_SUPPORT_POINTS      5       /* 最多5点电容触摸 */
+#define GT_POINT_LEN            8       /* 每个触摸点数据长度 */
+#define GT_BUFFER_READY         0x80    /* GT_GSTID_REG bit7，坐标数据已准备好 */
+#define GT_FRAME_LEN            (1 + MAX_SUPPORT_POINTS * GT_POINT_LEN) /* 状态+5个触摸点 */
 
 struct gt9147_dev {
 	int irq_pin,reset_pin;					/* 中断和复位IO		*/
@@ -35,7 +40,12 @@ struct gt9147_dev {
 	void *private_data;						/* 私有数据 		*/
 	struct input_dev *input;				/* input结构体 		*/
 	struct i2c_client *client;				/* I2C客户端 		*/
-
+	struct regxfer *rx;						/* 寄存器读写，见40_regxfer */
+	u8 rbuf[GT_FRAME_LEN];					/* 一帧触摸数据 */
+	int last_num;							/* 上一帧的触摸点数 	*/
+	int slots[MAX_SUPPORT_POINTS];			/* 每个触摸点分配到的slot */
+	struct input_mt_pos pos[MAX_SUPPORT_POINTS];
+	struct touch_latency lat;				/* 中断到input_sync的延迟统计 */
 };
 struct gt9147_dev gt9147;
 
@@ -62,6 +72,9 @@ const unsigned char GT9147_CT[]=
 	0xff,0xff,0xff,0xff,
 };
 
+/* 最长的一次传输是配置表+校验和，每段前面有2字节寄存器地址 */
+#define GT_XFER_BYTES           (2 + sizeof(GT9147_CT) + 2 + 2)
+
 /*
  * @description     : 复位GT9147
  * @param - client 	: 要操作的i2c
@@ -94,6 +107,10 @@ static int gt9147_ts_reset(struct i2c_client *client, struct gt9147_dev *dev)
 		}
 	}
 
+    /* 没有复位和中断IO(比如touch_sim模拟的设备)，跳过复位时序 */
+    if (!gpio_is_valid(dev->reset_pin) || !gpio_is_valid(dev->irq_pin))
+        return 0;
+
     /* 4、初始化GT9147，要严格按照GT9147时序要求 */
     gpio_set_value(dev->reset_pin, 0); /* 复位GT9147 */
     msleep(10);
@@ -107,115 +124,79 @@ static int gt9147_ts_reset(struct i2c_client *client, struct gt9147_dev *dev)
 }
 
 /*
- * @description	: 从GT9147读取多个寄存器数据
- * @param - dev:  GT9147设备
- * @param - reg:  要读取的寄存器首地址
- * @param - buf:  读取到的数据
- * @param - len:  要读取的数据长度
- * @return 		: 操作结果
+ * @description	: 触摸中断上半部，只记录中断时间，读数据在线程里面做
+ * @param - irq : 中断号
+ * @param - dev_id : GT9147设备
+ * @return 		: IRQ_WAKE_THREAD，唤醒中断线程
  */
-static int gt9147_read_regs(struct gt9147_dev *dev, u16 reg, u8 *buf, int len)
+static irqreturn_t gt9147_irq_hardirq(int irq, void *dev_id)
 {
-	int ret;
-    u8 regdata[2];
-	struct i2c_msg msg[2];
-	struct i2c_client *client = (struct i2c_client *)dev->client;
-    
-    /* GT9147寄存器长度为2个字节 */
-    regdata[0] = reg >> 8;
-    regdata[1] = reg & 0xFF;
-
-	/* msg[0]为发送要读取的首地址 */
-	msg[0].addr = client->addr;			/* ft5x06地址 */
-	msg[0].flags = !I2C_M_RD;			/* 标记为发送数据 */
-	msg[0].buf = &regdata[0];			/* 读取的首地址 */
-	msg[0].len = 2;						/* reg长度*/
-
-	/* msg[1]读取数据 */
-	msg[1].addr = client->addr;			/* ft5x06地址 */
-	msg[1].flags = I2C_M_RD;			/* 标记为读取数据*/
-	msg[1].buf = buf;					/* 读取数据缓冲区 */
-	msg[1].len = len;					/* 要读取的数据长度*/
-
-	ret = i2c_transfer(client->adapter, msg, 2);
-	if(ret == 2) {
-		ret = 0;
-	} else {
-		ret = -EREMOTEIO;
-	}
-	return ret;
+    struct gt9147_dev *dev = dev_id;
+
+    touch_latency_irq(&dev->lat);
+    return IRQ_WAKE_THREAD;
 }
 
 /*
- * @description	: 向GT9147多个寄存器写入数据
- * @param - dev:  GT9147设备
- * @param - reg:  要写入的寄存器首地址
- * @param - val:  要写入的数据缓冲区
- * @param - len:  要写入的数据长度
- * @return 	  :   操作结果
+ * @description	: 触摸中断处理函数。按上一帧的触摸点数推测本帧长度，
+ *				  一次I2C传输读出状态字节和所有触摸点。数据读到以后马上
+ *				  清除状态寄存器，触摸点数增加的时候补读剩下的触摸点，
+ *				  补读和清除合成一次I2C传输。每个触摸点由input_mt_assign_slots
+ *				  分配slot，没有上报的slot由input_mt_sync_frame释放。
+ * @param - irq : 中断号
+ * @param - dev_id : GT9147设备
+ * @return 		: 中断执行结果
  */
-static s32 gt9147_write_regs(struct gt9147_dev *dev, u16 reg, u8 *buf, u8 len)
-{
-	u8 b[256];
-	struct i2c_msg msg;
-	struct i2c_client *client = (struct i2c_client *)dev->client;
-	
-	b[0] = reg >> 8;			/* 寄存器首地址低8位 */
-    b[1] = reg & 0XFF;			/* 寄存器首地址高8位 */
-	memcpy(&b[2],buf,len);		/* 将要写入的数据拷贝到数组b里面 */
-
-	msg.addr = client->addr;	/* gt9147地址 */
-	msg.flags = 0;				/* 标记为写数据 */
-
-	msg.buf = b;				/* 要写入的数据缓冲区 */
-	msg.len = len + 2;			/* 要写入的数据长度 */
-
-	return i2c_transfer(client->adapter, &msg, 1);
-}
-
 static irqreturn_t gt9147_irq_handler(int irq, void *dev_id)
 {
-    int touch_num = 0;
-    int input_x, input_y;
-    int id = 0;
-    int ret = 0;
-    u8 data;
-    u8 touch_data[5];
     struct gt9147_dev *dev = dev_id;
-
-    ret = gt9147_read_regs(dev, GT_GSTID_REG, &data, 1);
-    if (data == 0x00)  {     /* 没有触摸数据，直接返回 */
+    u8 *buf = dev->rbuf;
+    u8 *point;
+    static const u8 data = 0x00;
+    struct regxfer_op ops[2];
+    int touch_num, got, i, n = 0, ret;
+
+    got = max(dev->last_num, 1);
+    ret = regxfer_read(dev->rx, GT_GSTID_REG, buf, 1 + got * GT_POINT_LEN);
+    if (ret || !(buf[0] & GT_BUFFER_READY))     /* 坐标数据还没准备好，直接返回 */
         goto fail;
-    } else {                 /* 统计触摸点数据 */
-        touch_num = data & 0x0f;
+
+    touch_num = min_t(int, buf[0] & 0x0f, MAX_SUPPORT_POINTS);
+    if (touch_num > got)    /* 触摸点增加了，补读剩下的触摸点 */
+        ops[n++] = (struct regxfer_op)REGXFER_READ(GT_TP1_REG + got * GT_POINT_LEN,
+                                                   buf + 1 + got * GT_POINT_LEN,
+                                                   (touch_num - got) * GT_POINT_LEN);
+    ops[n++] = (struct regxfer_op)REGXFER_WRITE(GT_GSTID_REG, &data, 1);   /* 向0X814E寄存器写0 */
+    ret = regxfer_run(dev->rx, ops, n);
+    if (ret)
+        goto clear;
+    touch_latency_read(&dev->lat, 1 + max(touch_num, got) * GT_POINT_LEN);
+
+    for (i = 0; i < touch_num; i++) {
+        point = buf + 1 + i * GT_POINT_LEN;     /* track id, x(2), y(2), size(2), 保留 */
+        dev->pos[i].x = point[1] | (point[2] << 8);
+        dev->pos[i].y = point[3] | (point[4] << 8);
     }
 
-    /* 由于GT9147没有硬件检测每个触摸点按下和抬起，因此每个触摸点的抬起和按
-     * 下不好处理，尝试过一些方法，但是效果都不好，因此这里暂时使用单点触摸 
-     */
-    if(touch_num) {         /* 单点触摸按下 */
-        gt9147_read_regs(dev, GT_TP1_REG, touch_data, 5);
-        id = touch_data[0] & 0x0F;
-        if(id == 0) {
-            input_x  = touch_data[1] | (touch_data[2] << 8);
-            input_y  = touch_data[3] | (touch_data[4] << 8);
-
-            input_mt_slot(dev->input, id);
-		    input_mt_report_slot_state(dev->input, MT_TOOL_FINGER, true);
-		    input_report_abs(dev->input, ABS_MT_POSITION_X, input_x);
-		    input_report_abs(dev->input, ABS_MT_POSITION_Y, input_y);
-        }
-    } else if(touch_num == 0){                /* 单点触摸释放 */
-        input_mt_slot(dev->input, id);
-        input_mt_report_slot_state(dev->input, MT_TOOL_FINGER, false);
+    ret = input_mt_assign_slots(dev->input, dev->slots, dev->pos, touch_num, 0);
+    if (ret)
+        goto fail;
+
+    for (i = 0; i < touch_num; i++) {
+        input_mt_slot(dev->input, dev->slots[i]);
+        input_mt_report_slot_state(dev->input, MT_TOOL_FINGER, true);
+        input_report_abs(dev->input, ABS_MT_POSITION_X, dev->pos[i].x);
+        input_report_abs(dev->input, ABS_MT_POSITION_Y, dev->pos[i].y);
     }
 
-	input_mt_report_pointer_emulation(dev->input, true);
+    input_mt_sync_frame(dev->input);    /* 释放本帧没有上报的slot，并模拟单点 */
     input_sync(dev->input);
+    touch_latency_sync(&dev->lat, touch_num);
+    dev->last_num = touch_num;
+	return IRQ_HANDLED;
 
-    data = 0x00;                /* 向0X814E寄存器写0 */
-    gt9147_write_regs(dev, GT_GSTID_REG, &data, 1);
-
+clear:
+    regxfer_write(dev->rx, GT_GSTID_REG, &data, 1); /* 补读失败了也要清除，否则不会再有中断 */
 fail:
 	return IRQ_HANDLED;
 }
@@ -232,7 +213,7 @@ static int gt9147_ts_irq(struct i2c_client *client, struct gt9147_dev *dev)
 	int ret = 0;
 
 	/* 2，申请中断,client->irq就是IO中断， */
-	ret = devm_request_threaded_irq(&client->dev, client->irq, NULL,
+	ret = devm_request_threaded_irq(&client->dev, client->irq, gt9147_irq_hardirq,
 					gt9147_irq_handler, IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
 					client->name, &gt9147);
 	if (ret) {
@@ -254,6 +235,10 @@ void gt9147_send_cfg(struct gt9147_dev *dev, unsigned char mode)
 {
 	unsigned char buf[2];
 	unsigned int i = 0;
+	struct regxfer_op ops[] = {
+		REGXFER_WRITE(GT_CFGS_REG, GT9147_CT, sizeof(GT9147_CT)),
+		REGXFER_WRITE(GT_CHECK_REG, buf, 2),	/* 校验和,配置更新标记 */
+	};
 
 	buf[0] = 0;
 	buf[1] = mode;	/* 是否写入到GT9147 FLASH?  即是否掉电保存 */
@@ -261,44 +246,38 @@ void gt9147_send_cfg(struct gt9147_dev *dev, unsigned char mode)
         buf[0] += GT9147_CT[i];            
     buf[0] = (~buf[0]) + 1;
 
-    /* 发送寄存器配置 */
-    gt9147_write_regs(dev, GT_CFGS_REG, (u8 *)GT9147_CT, sizeof(GT9147_CT));
-    gt9147_write_regs(dev, GT_CHECK_REG, buf, 2);/* 写入校验和,配置更新标记 */
+    /* 配置表和校验和在一次I2C传输里面发送 */
+    regxfer_run(dev->rx, ops, ARRAY_SIZE(ops));
 } 
 
-int gt9147_probe(struct i2c_client *client, const struct i2c_device_id *id)
+/*
+ * @description	: 复位、配置GT9147，注册input设备和中断。复位和软复位时序
+ *				  一共要睡眠300ms左右，驱动是异步probe，不拖慢启动；
+ *				  在probe里面同步执行，失败的话probe返回错误，设备不会
+ *				  绑定成一个没有input设备的空壳。
+ *				  input设备在GT9147配置完成以后才注册，中断最后申请。
+ * @param - client: i2c设备
+ * @return 		: 0，成功;其他负值,失败
+ */
+static int gt9147_hw_init(struct i2c_client *client)
 {
-    u8 data, ret;
-
-    gt9147.client = client;
-
- 	/* 1，获取设备树中的中断和复位引脚 */
-	gt9147.reset_pin = of_get_named_gpio(client->dev.of_node, "reset-gpios", 0);
-	gt9147.irq_pin = of_get_named_gpio(client->dev.of_node, "interrupt-gpios", 0);
-	if(!gpio_is_valid(gt9147.irq_pin)) {
-		return -1;
-	}
-
-	if(!gpio_is_valid(gt9147.reset_pin)) {
-		return -1;
-	}
+    u8 data;
+    int ret;
 
 	/* 2，复位GT9147 */
 	ret = gt9147_ts_reset(client, &gt9147);
-	if(ret < 0) {
-		goto fail;
-    }
+	if(ret < 0)
+		return ret;
 
     /* 3，初始化GT9147 */
-    data = 0x02;
-    gt9147_write_regs(&gt9147, GT_CTRL_REG, &data, 1); /* 软复位 */
-    mdelay(100);
-    data = 0x0;
-    gt9147_write_regs(&gt9147, GT_CTRL_REG, &data, 1); /* 停止软复位 */
-    mdelay(100);
+    regxfer_write_u8(gt9147.rx, GT_CTRL_REG, 0x02); /* 软复位 */
+    msleep(100);
+    regxfer_write_u8(gt9147.rx, GT_CTRL_REG, 0x00); /* 停止软复位 */
+    msleep(100);
 
     /* 4,初始化GT9147，烧写固件 */
-    gt9147_read_regs(&gt9147, GT_CFGS_REG, &data, 1);
+    data = 0;
+    regxfer_read(gt9147.rx, GT_CFGS_REG, &data, 1);
     printk("GT9147 ID =%#X\r\n", data);
     if(data <  GT9147_CT[0]) {
        gt9147_send_cfg(&gt9147, 0);
@@ -306,10 +285,8 @@ int gt9147_probe(struct i2c_client *client, const struct i2c_device_id *id)
 
     /* 5，input设备注册 */
 	gt9147.input = devm_input_allocate_device(&client->dev);
-	if (!gt9147.input) {
-		ret = -ENOMEM;
-		goto fail;
-	}
+	if (!gt9147.input)
+		return -ENOMEM;
 	gt9147.input->name = client->name;
 	gt9147.input->id.bustype = BUS_I2C;
 	gt9147.input->dev.parent = &client->dev;
@@ -322,25 +299,66 @@ int gt9147_probe(struct i2c_client *client, const struct i2c_device_id *id)
 	input_set_abs_params(gt9147.input, ABS_Y, 0, 272, 0, 0);
 	input_set_abs_params(gt9147.input, ABS_MT_POSITION_X,0, 480, 0, 0);
 	input_set_abs_params(gt9147.input, ABS_MT_POSITION_Y,0, 272, 0, 0);	     
-	ret = input_mt_init_slots(gt9147.input, MAX_SUPPORT_POINTS, 0);
-	if (ret) {
-		goto fail;
-	}
+	/* INPUT_MT_TRACK：input_mt_assign_slots要用的匹配矩阵，没有的话返回-ENXIO */
+	ret = input_mt_init_slots(gt9147.input, MAX_SUPPORT_POINTS,
+				  INPUT_MT_DIRECT | INPUT_MT_DROP_UNUSED | INPUT_MT_TRACK);
+	if (ret)
+		return ret;
 
+	/* devm分配的input设备，probe失败时自动注销 */
 	ret = input_register_device(gt9147.input);
 	if (ret)
-		goto fail;
+		return ret;
 
     /* 6，最后初始化中断 */
+	touch_latency_register(&gt9147.lat, "gt9147");
 	ret = gt9147_ts_irq(client, &gt9147);
 	if(ret < 0) {
-		goto fail;
+		touch_latency_unregister(&gt9147.lat);
+		return ret;
+	}
+
+    return 0;
+}
+
+static const struct regxfer_config gt9147_regxfer = {
+	.reg_bytes = 2,
+	.max_ops = 2,
+	.max_bytes = GT_XFER_BYTES,
+};
+
+int gt9147_probe(struct i2c_client *client, const struct i2c_device_id *id)
+{
+    int ret;
+
+    gt9147.client = client;
+    gt9147.last_num = 0;
+
+	/* 16位寄存器地址，一次传输最多两段：补读+清除状态，或者配置表+校验和 */
+	gt9147.rx = devm_regxfer_init_i2c(client, &gt9147_regxfer);
+	if (IS_ERR(gt9147.rx))
+		return PTR_ERR(gt9147.rx);
+
+ 	/* 1，获取设备树中的中断和复位引脚 */
+	gt9147.reset_pin = of_get_named_gpio(client->dev.of_node, "reset-gpios", 0);
+	gt9147.irq_pin = of_get_named_gpio(client->dev.of_node, "interrupt-gpios", 0);
+	if (gt9147.reset_pin == -EPROBE_DEFER || gt9147.irq_pin == -EPROBE_DEFER)
+		return -EPROBE_DEFER;
+
+	/* 两个引脚都是可选的，没有的话不做复位时序，中断用client->irq */
+	if (!client->irq) {
+		dev_err(&client->dev, "no irq\n");
+		return -EINVAL;
+	}
+
+	/* 2~6，复位、配置、注册input和中断 */
+	ret = gt9147_hw_init(client);
+	if (ret) {
+		dev_err(&client->dev, "GT9147 init failed, ret=%d\n", ret);
+		return ret;
 	}
 
     return 0;
-	
-fail:
-	return ret;
 }
 
 /*
@@ -350,6 +368,7 @@ fail:
  */
 int gt9147_remove(struct i2c_client *client)
 {
+    touch_latency_unregister(&gt9147.lat);
     input_unregister_device(gt9147.input);
     return 0;
 }
@@ -376,6 +395,7 @@ struct i2c_driver gt9147_i2c_driver = {
         .name  = "gt9147",
         .owner = THIS_MODULE,
         .of_match_table = gt9147_of_match_table,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
     .id_table = gt9147_id_table,
     .probe  = gt9147_probe,
@@ -0,0 +1,540 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/input.h>
+#include "touch_sim.h"
+
+/*
+ * Replay harness for the touch drivers: feeds register snapshots to
+ * ft5x06.ko or gt9147.ko through touch_sim.ko and checks the evdev stream
+ * they emit.
+ *
+ * Usage: ./touchReplayApp -c ft5426|gt9147 -t expected/ [-l]
+ *        ./touchReplayApp -c ft5426|gt9147 [-i /dev/input/eventX]
+ *                         [-s drag|pinch|lift | -r rec.txt]
+ *                         [-o golden.txt | -e golden.txt] [-l]
+ *   -c : chip touch_sim.ko was loaded with (chip=), default ft5426
+ *   -i : event device, default: the one whose name matches the chip
+ *   -t : replay every built-in scenario and compare it with
+ *        <dir>/<scenario>.txt, exit 1 on any mismatch
+ *   -s : one built-in scenario, default all of them one after the other
+ *   -r : recording, one frame per line: "<delay_us> <regs...>" in hex,
+ *        starting at the chip's snapshot base (see touch_sim.h), '#' starts
+ *        a comment
+ *   -o : save the captured event stream as a golden file
+ *   -e : compare the captured stream with a golden file, exit 1 on mismatch
+ *   -l : print the driver's latency histogram afterwards
+ *
+ * The stream is written as "type code value" lines, "---" for SYN_REPORT,
+ * without timestamps. Tracking IDs are renumbered from 0 in order of
+ * appearance. The input core drops values that did not change and only
+ * sends ABS_MT_SLOT when the slot differs from the last one sent, so every
+ * replay is preceded by a priming sequence, not captured, that leaves the
+ * same state behind whatever ran before: five fingers at (1, 1) in slots
+ * 0 to 4, then released.
+ *
+ * expected/ holds the streams of the built-in scenarios as worked out by
+ * hand from the gestures and the input core's rules, not recorded from a
+ * driver; both chips must produce them. Keep frames at least 10 ms apart:
+ * the controllers overwrite a snapshot the IRQ thread has not read yet, so
+ * faster replays are not repeatable.
+ */
+
+#define FT_TD_STATUS		0x02
+#define FT_TOUCH_DATA		0x03
+#define FT_POINT_LEN		6
+#define FT_EVENT_UP			0x01
+#define FT_EVENT_ON			0x02
+
+#define GT_BUFFER_READY		0x80
+#define GT_POINT_LEN		8
+
+#define FRAME_US			20000
+#define SETTLE_MS			200
+#define MAX_EVENTS			(1 << 20)
+#define LATENCY_DIR			"/sys/kernel/debug/touch_latency"
+
+struct chip {
+	const char *name;				/* -c and touch_latency name */
+	const char *input_name;			/* input_dev->name set by the driver */
+};
+
+static const struct chip chips[] = {
+	{ "ft5426", "FocalTech FT5426 TouchScreen" },
+	{ "gt9147", "atk-gt9147" },
+};
+
+static const struct chip *cur;
+static struct touch_sim_frame *frames;
+static int nframes, maxframes;
+static char **lines;
+static int nlines;
+static int next_id;
+
+static struct touch_sim_frame *new_frame(unsigned int delay_us)
+{
+	struct touch_sim_frame *f;
+
+	if (nframes == maxframes) {
+		maxframes = maxframes ? maxframes * 2 : 256;
+		frames = realloc(frames, maxframes * sizeof(*frames));
+		if (frames == NULL) {
+			printf("Out of memory\r\n");
+			exit(-1);
+		}
+	}
+	f = &frames[nframes++];
+	memset(f, 0, sizeof(*f));
+	f->delay_us = delay_us;
+	return f;
+}
+
+/*
+ * One frame with n fingers down at the given points, in the chip's
+ * register layout. n = 0 is a release frame.
+ */
+static void add_frame(int n, const int *ids, const int (*pt)[2])
+{
+	struct touch_sim_frame *f = new_frame(FRAME_US);
+	unsigned char *p;
+	int i;
+
+	if (!strcmp(cur->name, "ft5426")) {
+		f->regs[FT_TD_STATUS] = n;
+		for (i = 0; i < n; i++) {
+			/* The panel is mounted rotated: X lives in YH/YL, Y in XH/XL */
+			p = &f->regs[FT_TOUCH_DATA + i * FT_POINT_LEN];
+			p[0] = (FT_EVENT_ON << 6) | ((pt[i][1] >> 8) & 0x0f);
+			p[1] = pt[i][1] & 0xff;
+			p[2] = (ids[i] << 4) | ((pt[i][0] >> 8) & 0x0f);
+			p[3] = pt[i][0] & 0xff;
+		}
+	} else {
+		f->regs[0] = GT_BUFFER_READY | n;
+		for (i = 0; i < n; i++) {
+			p = &f->regs[1 + i * GT_POINT_LEN];
+			p[0] = ids[i];
+			p[1] = pt[i][0] & 0xff;
+			p[2] = pt[i][0] >> 8;
+			p[3] = pt[i][1] & 0xff;
+			p[4] = pt[i][1] >> 8;
+		}
+	}
+}
+
+static const int all_ids[5] = { 0, 1, 2, 3, 4 };
+
+/* Release, five fingers at (1, 1), release: see the comment on top */
+static void prime(void)
+{
+	int pt[5][2] = { { 1, 1 }, { 1, 1 }, { 1, 1 }, { 1, 1 }, { 1, 1 } };
+
+	add_frame(0, all_ids, pt);
+	add_frame(5, all_ids, pt);
+	add_frame(0, all_ids, pt);
+}
+
+/* One finger dragged diagonally, released */
+static void synth_drag(void)
+{
+	int pt[1][2];
+	int step;
+
+	for (step = 0; step < 8; step++) {
+		pt[0][0] = 40 + step * 40;
+		pt[0][1] = 100 + step * 10;
+		add_frame(1, all_ids, pt);
+	}
+	add_frame(0, all_ids, pt);
+}
+
+/* Two fingers on one line moving apart, released */
+static void synth_pinch(void)
+{
+	int pt[2][2];
+	int step;
+
+	for (step = 0; step < 8; step++) {
+		pt[0][0] = 200 - step * 15;
+		pt[0][1] = 136;
+		pt[1][0] = 280 + step * 15;
+		pt[1][1] = 136;
+		add_frame(2, all_ids, pt);
+	}
+	add_frame(0, all_ids, pt);
+}
+
+/*
+ * Five fingers, then the middle one lifts while the others keep moving
+ * and the controller packs them into four records, released
+ */
+static void synth_lift(void)
+{
+	int ids[5] = { 0, 1, 3, 4 };
+	int pt[5][2];
+	int step, i;
+
+	for (step = 0; step < 6; step++) {
+		for (i = 0; i < 5; i++) {
+			pt[i][0] = 40 + i * 90 + step * 4;
+			pt[i][1] = 60 + i * 30 + step * 8;
+		}
+		add_frame(5, all_ids, pt);
+	}
+	for (step = 0; step < 4; step++) {
+		pt[0][0] = 60 + step * 4;
+		pt[1][0] = 150 + step * 4;
+		pt[2][0] = 330 + step * 4;
+		pt[3][0] = 420 + step * 4;
+		for (i = 0; i < 4; i++)
+			pt[i][1] = 200 - step * 8;
+		add_frame(4, ids, pt);
+	}
+	add_frame(0, ids, pt);
+}
+
+struct scenario {
+	const char *name;
+	void (*build)(void);
+};
+
+static const struct scenario scenarios[] = {
+	{ "drag", synth_drag },
+	{ "pinch", synth_pinch },
+	{ "lift", synth_lift },
+};
+
+#define NSCENARIOS	((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+static int load(const char *path)
+{
+	char line[512], *p, *end;
+	struct touch_sim_frame *f;
+	int i;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		f = new_frame(strtoul(line, &p, 0));
+		for (i = 0; i < TOUCH_SIM_REGS; i++) {
+			unsigned long v = strtoul(p, &end, 16);
+
+			if (end == p)
+				break;
+			f->regs[i] = v;
+			p = end;
+		}
+	}
+	fclose(fp);
+	return nframes ? 0 : -1;
+}
+
+/* The event device whose name is the chip's input name */
+static int find_input(char *path, size_t len)
+{
+	char name[256], sys[64];
+	int i, fd;
+
+	for (i = 0; i < 32; i++) {
+		snprintf(sys, sizeof(sys), "/dev/input/event%d", i);
+		fd = open(sys, O_RDONLY);
+		if (fd < 0)
+			continue;
+		memset(name, 0, sizeof(name));
+		ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+		close(fd);
+		if (!strcmp(name, cur->input_name)) {
+			snprintf(path, len, "%s", sys);
+			return 0;
+		}
+	}
+	printf("No input device named \"%s\"\r\n", cur->input_name);
+	return -1;
+}
+
+static void add_line(const char *s)
+{
+	if (nlines == MAX_EVENTS)
+		return;
+	if (nlines % 1024 == 0) {
+		lines = realloc(lines, (nlines + 1024) * sizeof(*lines));
+		if (lines == NULL) {
+			printf("Out of memory\r\n");
+			exit(-1);
+		}
+	}
+	lines[nlines++] = strdup(s);
+}
+
+/*
+ * Format one event. Tracking IDs are renumbered so the stream does not
+ * depend on how many contacts the driver has seen before.
+ */
+static void record(const struct input_event *ev)
+{
+	char s[64];
+	int v = ev->value;
+
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		add_line("---");
+		return;
+	}
+	if (ev->type == EV_ABS && ev->code == ABS_MT_TRACKING_ID && v >= 0)
+		v = next_id++;
+	snprintf(s, sizeof(s), "%u %u %d", ev->type, ev->code, v);
+	add_line(s);
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Replay frames[], keep the events only if keep is set */
+static int replay(int simfd, int evfd, int keep)
+{
+	struct input_event ev[64];
+	struct touch_sim_stats st;
+	struct pollfd pfd = { .fd = evfd, .events = POLLIN };
+	long long quiet_since = -1;
+	int n, i;
+
+	/* Drop whatever the device queued before the replay */
+	while (read(evfd, ev, sizeof(ev)) > 0)
+		;
+
+	if (write(simfd, frames, nframes * sizeof(*frames)) < 0) {
+		printf("write failed\r\n");
+		return -1;
+	}
+
+	for (;;) {
+		if (poll(&pfd, 1, 20) > 0) {
+			n = read(evfd, ev, sizeof(ev));
+			for (i = 0; keep && i < n / (int)sizeof(ev[0]); i++)
+				record(&ev[i]);
+			quiet_since = -1;
+			continue;
+		}
+		if (read(simfd, &st, sizeof(st)) != sizeof(st))
+			return -1;
+		if (st.pending) {
+			quiet_since = -1;
+			continue;
+		}
+		/* Replay done, wait for the IRQ thread to report the last frame */
+		if (quiet_since < 0)
+			quiet_since = now_ms();
+		else if (now_ms() - quiet_since >= SETTLE_MS)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Prime, then replay a built-in scenario (sc) or the recording rec, and
+ * keep the events of the latter in lines[]
+ */
+static int capture(int simfd, int evfd, const struct scenario *sc, const char *rec)
+{
+	int i;
+
+	nframes = 0;
+	prime();
+	if (replay(simfd, evfd, 0) < 0)
+		return -1;
+
+	for (i = 0; i < nlines; i++)
+		free(lines[i]);
+	nlines = 0;
+	next_id = 0;
+	nframes = 0;
+	if (sc)
+		sc->build();
+	else if (load(rec) < 0)
+		return -1;
+	return replay(simfd, evfd, 1);
+}
+
+static int save(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	int i;
+
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+	fprintf(fp, "# %s, %d frames\n", cur->name, nframes);
+	for (i = 0; i < nlines; i++)
+		fprintf(fp, "%s\n", lines[i]);
+	fclose(fp);
+	return 0;
+}
+
+static int compare(const char *path, const char *what)
+{
+	char line[128];
+	int i = 0, ret = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (i >= nlines) {
+			printf("missing from line %d: expected \"%s\"\r\n", i + 1, line);
+			ret = 1;
+			break;
+		}
+		if (strcmp(line, lines[i])) {
+			printf("mismatch at event line %d: expected \"%s\", got \"%s\"\r\n",
+				   i + 1, line, lines[i]);
+			ret = 1;
+			break;
+		}
+		i++;
+	}
+	if (!ret && i < nlines) {
+		printf("extra events from line %d: \"%s\"\r\n", i + 1, lines[i]);
+		ret = 1;
+	}
+	fclose(fp);
+	printf("%s %s: %d event lines, %s\r\n", cur->name, what, nlines, ret ? "FAIL" : "PASS");
+	return ret;
+}
+
+static void show_latency(void)
+{
+	char path[128], buf[256];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s/histogram", LATENCY_DIR, cur->name);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return;
+	}
+	while (fgets(buf, sizeof(buf), fp))
+		fputs(buf, stdout);
+	fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *chipname = "ft5426", *input = NULL, *rec = NULL;
+	const char *out = NULL, *golden = NULL, *tdir = NULL, *scname = NULL;
+	const struct scenario *sc = NULL;
+	char evpath[64], path[256];
+	int latency = 0, opt, simfd, evfd, ret = 0, i, j, first = 0, last = NSCENARIOS;
+
+	while ((opt = getopt(argc, argv, "c:i:t:s:r:o:e:l")) != -1) {
+		switch (opt) {
+		case 'c': chipname = optarg; break;
+		case 'i': input = optarg; break;
+		case 't': tdir = optarg; break;
+		case 's': scname = optarg; break;
+		case 'r': rec = optarg; break;
+		case 'o': out = optarg; break;
+		case 'e': golden = optarg; break;
+		case 'l': latency = 1; break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < (int)(sizeof(chips) / sizeof(chips[0])); i++)
+		if (!strcmp(chipname, chips[i].name))
+			cur = &chips[i];
+	for (i = 0; scname && i < NSCENARIOS; i++) {
+		if (!strcmp(scname, scenarios[i].name)) {
+			first = i;
+			last = i + 1;
+		}
+	}
+	/* -o and -e take a single stream: one scenario or a recording */
+	if (cur == NULL || (out && golden) || (scname && first + 1 != last) ||
+		(scname && rec) || (tdir && (scname || rec || out || golden)) ||
+		((out || golden) && !scname && !rec)) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+	if (rec)
+		first = last = 0;
+
+	if (input == NULL) {
+		if (find_input(evpath, sizeof(evpath)) < 0)
+			return -1;
+		input = evpath;
+	}
+	evfd = open(input, O_RDONLY | O_NONBLOCK);
+	if (evfd < 0) {
+		printf("Can't open file %s\r\n", input);
+		return -1;
+	}
+	simfd = open("/dev/touch_sim", O_RDWR);
+	if (simfd < 0) {
+		printf("Can't open file /dev/touch_sim\r\n");
+		close(evfd);
+		return -1;
+	}
+
+	if (rec) {
+		if (capture(simfd, evfd, NULL, rec) < 0)
+			ret = -1;
+		else if (golden)
+			ret = compare(golden, rec);
+		else if (out)
+			ret = save(out);
+		else
+			for (i = 0; i < nlines; i++)
+				printf("%s\r\n", lines[i]);
+	}
+	for (i = first; ret >= 0 && i < last; i++) {
+		sc = &scenarios[i];
+		if (capture(simfd, evfd, sc, NULL) < 0) {
+			ret = -1;
+		} else if (tdir) {
+			snprintf(path, sizeof(path), "%s/%s.txt", tdir, sc->name);
+			if (compare(path, sc->name))
+				ret = 1;
+		} else if (golden) {
+			ret = compare(golden, sc->name);
+		} else if (out) {
+			ret = save(out);
+		} else {
+			printf("# %s\r\n", sc->name);
+			for (j = 0; j < nlines; j++)
+				printf("%s\r\n", lines[j]);
+		}
+	}
+	if (latency)
+		show_latency();
+
+	close(simfd);
+	close(evfd);
+	for (i = 0; i < nlines; i++)
+		free(lines[i]);
+	free(lines);
+	free(frames);
+	return ret;
+}
@@ -0,0 +1,152 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include "touch_latency.h"
+
+#define CREATE_TRACE_POINTS
+#include "touch_trace.h"
+
+/*
+ * Touch latency accounting: tracepoints plus a debugfs histogram per
+ * driver, see touch_latency.h.
+ */
+
+static struct dentry *touch_latency_root;
+
+static u64 touch_latency_since_irq(struct touch_latency *tl)
+{
+	return ktime_to_ns(ktime_sub(ktime_get(), READ_ONCE(tl->irq_ts)));
+}
+
+void touch_latency_irq(struct touch_latency *tl)
+{
+	WRITE_ONCE(tl->irq_ts, ktime_get());
+	trace_touch_irq(tl->name);
+}
+EXPORT_SYMBOL_GPL(touch_latency_irq);
+
+void touch_latency_read(struct touch_latency *tl, int bytes)
+{
+	trace_touch_read(tl->name, bytes, touch_latency_since_irq(tl));
+}
+EXPORT_SYMBOL_GPL(touch_latency_read);
+
+void touch_latency_sync(struct touch_latency *tl, int contacts)
+{
+	u64 ns = touch_latency_since_irq(tl);
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	unsigned long flags;
+	int b;
+
+	trace_touch_sync(tl->name, contacts, ns);
+
+	b = us ? min_t(int, ilog2(us) + 1, TOUCH_LAT_BUCKETS - 1) : 0;
+	spin_lock_irqsave(&tl->lock, flags);
+	tl->hist[b]++;
+	tl->count++;
+	tl->sum_ns += ns;
+	if (ns > tl->max_ns)
+		tl->max_ns = ns;
+	spin_unlock_irqrestore(&tl->lock, flags);
+}
+EXPORT_SYMBOL_GPL(touch_latency_sync);
+
+static int touch_latency_show(struct seq_file *m, void *v)
+{
+	struct touch_latency *tl = m->private;
+	u32 hist[TOUCH_LAT_BUCKETS];
+	u64 count, sum, max;
+	int i;
+
+	spin_lock_irq(&tl->lock);
+	memcpy(hist, tl->hist, sizeof(hist));
+	count = tl->count;
+	sum = tl->sum_ns;
+	max = tl->max_ns;
+	spin_unlock_irq(&tl->lock);
+
+	seq_printf(m, "frames %llu avg_us %llu max_us %llu\n", count,
+		   count ? div64_u64(sum, count * NSEC_PER_USEC) : 0,
+		   div_u64(max, NSEC_PER_USEC));
+	for (i = 0; i < TOUCH_LAT_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "%10u - %10u us: %u\n", 0, 1, hist[i]);
+		else if (i == TOUCH_LAT_BUCKETS - 1)
+			seq_printf(m, "%10u -            us: %u\n", 1U << (i - 1), hist[i]);
+		else
+			seq_printf(m, "%10u - %10u us: %u\n", 1U << (i - 1), 1U << i, hist[i]);
+	}
+	return 0;
+}
+
+static int touch_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, touch_latency_show, inode->i_private);
+}
+
+/* Any write resets the histogram */
+static ssize_t touch_latency_write(struct file *file, const char __user *buf,
+				   size_t cnt, loff_t *off)
+{
+	struct touch_latency *tl = ((struct seq_file *)file->private_data)->private;
+
+	spin_lock_irq(&tl->lock);
+	memset(tl->hist, 0, sizeof(tl->hist));
+	tl->count = 0;
+	tl->sum_ns = 0;
+	tl->max_ns = 0;
+	spin_unlock_irq(&tl->lock);
+	return cnt;
+}
+
+static const struct file_operations touch_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= touch_latency_open,
+	.read		= seq_read,
+	.write		= touch_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int touch_latency_register(struct touch_latency *tl, const char *name)
+{
+	memset(tl, 0, sizeof(*tl));
+	tl->name = name;
+	spin_lock_init(&tl->lock);
+	tl->irq_ts = ktime_get();
+
+	/* debugfs is optional, the tracepoints work without it */
+	tl->dir = debugfs_create_dir(name, touch_latency_root);
+	debugfs_create_file("histogram", 0600, tl->dir, tl, &touch_latency_fops);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(touch_latency_register);
+
+void touch_latency_unregister(struct touch_latency *tl)
+{
+	debugfs_remove_recursive(tl->dir);
+	tl->dir = NULL;
+}
+EXPORT_SYMBOL_GPL(touch_latency_unregister);
+
+static int __init touch_latency_init(void)
+{
+	touch_latency_root = debugfs_create_dir("touch_latency", NULL);
+	return 0;
+}
+
+static void __exit touch_latency_exit(void)
+{
+	debugfs_remove_recursive(touch_latency_root);
+}
+
+module_init(touch_latency_init);
+module_exit(touch_latency_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
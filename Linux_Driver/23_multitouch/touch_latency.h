@@ -0,0 +1,41 @@
+#ifndef TOUCH_LATENCY_H
+#define TOUCH_LATENCY_H
+
+/*
+ * Interrupt-to-input_sync latency accounting shared by the touch drivers,
+ * implemented in touch_latency.ko.
+ *
+ * The driver requests its IRQ with a primary handler that calls
+ * touch_latency_irq() and returns IRQ_WAKE_THREAD; the threaded handler
+ * calls touch_latency_read() after the I2C frame read and
+ * touch_latency_sync() after input_sync(). Every sync lands in a log2
+ * histogram in /sys/kernel/debug/touch_latency/<name>/histogram (write to
+ * the file to reset it) and the three steps are also tracepoints.
+ */
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+#define TOUCH_LAT_BUCKETS	24		/* <1us, 1-2us, 2-4us ... 4.2s and more */
+
+struct dentry;
+
+struct touch_latency {
+	const char *name;
+	ktime_t irq_ts;					/* Hard IRQ time of the frame in flight */
+	spinlock_t lock;				/* Histogram and counters */
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u32 hist[TOUCH_LAT_BUCKETS];
+	struct dentry *dir;
+};
+
+int touch_latency_register(struct touch_latency *tl, const char *name);
+void touch_latency_unregister(struct touch_latency *tl);
+void touch_latency_irq(struct touch_latency *tl);
+void touch_latency_read(struct touch_latency *tl, int bytes);
+void touch_latency_sync(struct touch_latency *tl, int contacts);
+
+#endif
@@ -0,0 +1,308 @@
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/irq_sim.h>
+#include <linux/hrtimer.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include "touch_sim.h"
+
+/*
+ * Simulated touch controller, FT5426 or GT9147 (chip=).
+ *
+ * Registers an I2C adapter with one edt_ft5426 or atk-gt9147 client on it,
+ * backed by a register file addressed with the chip's 8 or 16 bit register
+ * pointer, and an irq_sim interrupt as the client's IRQ, so ft5x06.ko or
+ * gt9147.ko binds to it exactly as to a real panel. Recorded frames
+ * written to /dev/touch_sim are replayed with an hrtimer: each frame is
+ * copied into the register file at the chip's snapshot base and the IRQ
+ * is fired. The adapter counts transfers and bytes and models the bus
+ * time at bus_khz.
+ *
+ * Needs CONFIG_IRQ_SIM. Like a real controller, frames that arrive while
+ * the IRQ thread is still busy (IRQ masked by IRQF_ONESHOT) are overwritten
+ * by the next snapshot instead of being queued.
+ */
+
+#define TOUCH_SIM_NAME      "touch_sim"
+#define TOUCH_SIM_MAX_FRAMES 65536
+#define TOUCH_SIM_REGFILE    0x10000    // Whole 16-bit register space
+
+struct touch_sim_chip {
+    const char *name;                   // chip= value
+    const char *client;                 // i2c_device_id of the driver
+    unsigned short addr;
+    int reg_bytes;                      // Register address width on the bus
+    u16 snap_base;                      // Where frames are copied to
+    int rate_reg;                       // Report rate register, -1 if none
+};
+
+static const struct touch_sim_chip touch_sim_chips[] = {
+    { "ft5426", "edt_ft5426", 0x38, 1, 0x00,   0x88 },
+    { "gt9147", "atk-gt9147", 0x14, 2, 0x814E, -1 },
+};
+
+static char *chip = "ft5426";
+module_param(chip, charp, 0444);
+MODULE_PARM_DESC(chip, "Simulated controller: ft5426 or gt9147");
+
+static unsigned short addr;
+module_param(addr, ushort, 0444);
+MODULE_PARM_DESC(addr, "I2C address of the simulated controller, 0 = chip default");
+
+static unsigned int bus_khz = 400;
+module_param(bus_khz, uint, 0444);
+MODULE_PARM_DESC(bus_khz, "Bus clock used to model bus occupancy");
+
+struct touch_sim_dev {
+    struct i2c_adapter adap;
+    struct i2c_client *client;
+    struct irq_sim irqsim;
+    struct miscdevice mdev;
+    struct hrtimer timer;               // Frame replay
+    struct mutex lock;                  // Serialises write() against write()
+    spinlock_t reg_lock;                // Register file, replay position, stats
+    const struct touch_sim_chip *chip;
+    u8 *regs;                           // TOUCH_SIM_REGFILE bytes
+    u16 ptr;                            // Register address pointer
+    struct touch_sim_frame *frames;
+    u32 nframes;
+    u32 pos;
+    struct touch_sim_stats st;
+};
+
+static struct touch_sim_dev touch_sim;
+
+static int touch_sim_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+    struct touch_sim_dev *sim = i2c_get_adapdata(adap);
+    unsigned long flags;
+    u64 bits = 1;                       // Final STOP
+    int i, j, ret = num;
+
+    spin_lock_irqsave(&sim->reg_lock, flags);
+    for (i = 0; i < num; i++) {
+        struct i2c_msg *m = &msgs[i];
+
+        if (m->addr != addr) {
+            ret = -ENXIO;
+            break;
+        }
+
+        /* (Repeated) START, address byte + ACK, data bytes + ACK */
+        bits += 1 + 9 + 9 * m->len;
+        sim->st.bytes += 1 + m->len;
+
+        if (m->flags & I2C_M_RD) {
+            for (j = 0; j < m->len; j++)
+                m->buf[j] = sim->regs[sim->ptr++];
+        } else if (m->len >= sim->chip->reg_bytes) {
+            /* Register address first, MSB first for 16-bit chips */
+            sim->ptr = m->buf[0];
+            if (sim->chip->reg_bytes == 2)
+                sim->ptr = (sim->ptr << 8) | m->buf[1];
+            for (j = sim->chip->reg_bytes; j < m->len; j++) {
+                if (sim->ptr == sim->chip->rate_reg) {
+                    sim->st.rate_writes++;
+                    sim->st.rate = m->buf[j];
+                }
+                sim->regs[sim->ptr++] = m->buf[j];
+            }
+        }
+    }
+    sim->st.xfers++;
+    sim->st.bus_ns += div_u64(bits * 1000000, bus_khz);
+    spin_unlock_irqrestore(&sim->reg_lock, flags);
+
+    return ret;
+}
+
+static u32 touch_sim_func(struct i2c_adapter *adap)
+{
+    return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm touch_sim_algo = {
+    .master_xfer   = touch_sim_xfer,
+    .functionality = touch_sim_func,
+};
+
+/*
+ * Publish the next frame and raise the touch IRQ.
+ */
+static enum hrtimer_restart touch_sim_timer(struct hrtimer *timer)
+{
+    struct touch_sim_dev *sim = container_of(timer, struct touch_sim_dev, timer);
+    bool more;
+
+    spin_lock(&sim->reg_lock);
+    if (sim->pos >= sim->nframes) {
+        spin_unlock(&sim->reg_lock);
+        return HRTIMER_NORESTART;
+    }
+    memcpy(sim->regs + sim->chip->snap_base, sim->frames[sim->pos].regs, TOUCH_SIM_REGS);
+    sim->pos++;
+    sim->st.frames++;
+    more = sim->pos < sim->nframes;
+    if (more)
+        hrtimer_forward_now(timer, us_to_ktime(sim->frames[sim->pos].delay_us));
+    spin_unlock(&sim->reg_lock);
+
+    irq_sim_fire(&sim->irqsim, 0);
+    return more ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+/*
+ * Replace the recording and start replaying it from the first frame.
+ */
+static ssize_t touch_sim_write(struct file *filp, const char __user *buf,
+            size_t cnt, loff_t *off)
+{
+    struct touch_sim_dev *sim = &touch_sim;
+    struct touch_sim_frame *frames, *old;
+    size_t n = cnt / sizeof(*frames);
+
+    if (n == 0 || n > TOUCH_SIM_MAX_FRAMES)
+        return -EINVAL;
+
+    frames = kvmalloc_array(n, sizeof(*frames), GFP_KERNEL);
+    if (!frames)
+        return -ENOMEM;
+    if (copy_from_user(frames, buf, n * sizeof(*frames))) {
+        kvfree(frames);
+        return -EFAULT;
+    }
+
+    mutex_lock(&sim->lock);
+    hrtimer_cancel(&sim->timer);
+    spin_lock_irq(&sim->reg_lock);
+    old = sim->frames;
+    sim->frames = frames;
+    sim->nframes = n;
+    sim->pos = 0;
+    spin_unlock_irq(&sim->reg_lock);
+    hrtimer_start(&sim->timer, us_to_ktime(frames[0].delay_us), HRTIMER_MODE_REL);
+    mutex_unlock(&sim->lock);
+
+    kvfree(old);
+    return n * sizeof(*frames);
+}
+
+static ssize_t touch_sim_read(struct file *filp, char __user *buf,
+            size_t cnt, loff_t *off)
+{
+    struct touch_sim_dev *sim = &touch_sim;
+    struct touch_sim_stats st;
+
+    if (cnt < sizeof(st))
+        return -EINVAL;
+
+    spin_lock_irq(&sim->reg_lock);
+    st = sim->st;
+    st.pending = sim->nframes - sim->pos;
+    st.bus_khz = bus_khz;
+    spin_unlock_irq(&sim->reg_lock);
+
+    if (copy_to_user(buf, &st, sizeof(st)))
+        return -EFAULT;
+    return sizeof(st);
+}
+
+static const struct file_operations touch_sim_fops = {
+    .owner = THIS_MODULE,
+    .read  = touch_sim_read,
+    .write = touch_sim_write,
+};
+
+static int __init touch_sim_init(void)
+{
+    struct touch_sim_dev *sim = &touch_sim;
+    struct i2c_board_info info = { };
+    int i, ret;
+
+    for (i = 0; i < ARRAY_SIZE(touch_sim_chips); i++)
+        if (!strcmp(chip, touch_sim_chips[i].name))
+            sim->chip = &touch_sim_chips[i];
+    if (!sim->chip || !bus_khz)
+        return -EINVAL;
+    if (!addr)
+        addr = sim->chip->addr;
+
+    sim->regs = vzalloc(TOUCH_SIM_REGFILE);
+    if (!sim->regs)
+        return -ENOMEM;
+
+    mutex_init(&sim->lock);
+    spin_lock_init(&sim->reg_lock);
+    hrtimer_init(&sim->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sim->timer.function = touch_sim_timer;
+
+    ret = irq_sim_init(&sim->irqsim, 1);
+    if (ret)
+        goto err_regs;
+
+    sim->adap.owner = THIS_MODULE;
+    sim->adap.algo = &touch_sim_algo;
+    strlcpy(sim->adap.name, TOUCH_SIM_NAME, sizeof(sim->adap.name));
+    i2c_set_adapdata(&sim->adap, sim);
+    ret = i2c_add_adapter(&sim->adap);
+    if (ret)
+        goto err_irq;
+
+    sim->mdev.minor = MISC_DYNAMIC_MINOR;
+    sim->mdev.name = TOUCH_SIM_NAME;
+    sim->mdev.fops = &touch_sim_fops;
+    ret = misc_register(&sim->mdev);
+    if (ret)
+        goto err_adap;
+
+    /* ft5x06.ko / gt9147.ko bind to this client through their i2c_device_id tables */
+    strlcpy(info.type, sim->chip->client, sizeof(info.type));
+    info.addr = addr;
+    info.irq = irq_sim_irqnum(&sim->irqsim, 0);
+    sim->client = i2c_new_device(&sim->adap, &info);
+    if (!sim->client) {
+        ret = -ENODEV;
+        goto err_misc;
+    }
+
+    pr_info("touch_sim: %s on i2c-%d addr 0x%02x irq %d\n", sim->chip->name,
+            sim->adap.nr, addr, info.irq);
+    return 0;
+
+err_misc:
+    misc_deregister(&sim->mdev);
+err_adap:
+    i2c_del_adapter(&sim->adap);
+err_irq:
+    irq_sim_fini(&sim->irqsim);
+err_regs:
+    vfree(sim->regs);
+    return ret;
+}
+
+static void __exit touch_sim_exit(void)
+{
+    struct touch_sim_dev *sim = &touch_sim;
+
+    i2c_unregister_device(sim->client);
+    misc_deregister(&sim->mdev);
+    hrtimer_cancel(&sim->timer);
+    i2c_del_adapter(&sim->adap);
+    irq_sim_fini(&sim->irqsim);
+    kvfree(sim->frames);
+    vfree(sim->regs);
+}
+
+module_init(touch_sim_init);
+module_exit(touch_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
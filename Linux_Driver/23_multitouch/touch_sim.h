@@ -0,0 +1,37 @@
+#ifndef TOUCH_SIM_H
+#define TOUCH_SIM_H
+
+/*
+ * Userspace ABI of the simulated touch controller (touch_sim.ko).
+ *
+ * write() to /dev/touch_sim takes an array of struct touch_sim_frame and
+ * starts replaying it: after delay_us the frame's register snapshot becomes
+ * visible on the simulated bus at the chip's snapshot base and the touch
+ * IRQ fires. read() returns struct touch_sim_stats.
+ *
+ * Snapshot base per chip (module parameter chip=):
+ *   ft5426 : 0x00,   registers 0x00..0x2F, TD_STATUS at regs[0x02]
+ *   gt9147 : 0x814E, status byte at regs[0], 5 points of 8 bytes after it
+ */
+
+#include <linux/types.h>
+
+#define TOUCH_SIM_REGS		0x30	/* Snapshot size, big enough for status + 5 points of either chip */
+
+struct touch_sim_frame {
+	__u32 delay_us;					/* Time since the previous frame */
+	__u8 regs[TOUCH_SIM_REGS];
+};
+
+struct touch_sim_stats {
+	__u64 frames;					/* Frames replayed */
+	__u64 xfers;					/* i2c_transfer() calls seen */
+	__u64 bytes;					/* Bytes on the bus, slave address bytes included */
+	__u64 bus_ns;					/* Bus time at bus_khz, START/STOP included */
+	__u32 rate_writes;				/* Writes to the report rate register (ft5426 0x88) */
+	__u32 rate;						/* Last report rate written */
+	__u32 pending;					/* Frames still to replay */
+	__u32 bus_khz;
+};
+
+#endif
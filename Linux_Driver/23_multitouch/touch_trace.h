@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM touch
+
+#if !defined(_TOUCH_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TOUCH_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Touch path events, all keyed by the driver's latency name:
+ *   touch_irq  : hard IRQ, i.e. the controller's interrupt edge
+ *   touch_read : frame read over I2C, latency since touch_irq
+ *   touch_sync : input_sync() done, latency since touch_irq
+ * Enable with: echo 1 > /sys/kernel/debug/tracing/events/touch/enable
+ */
+
+TRACE_EVENT(touch_irq,
+	TP_PROTO(const char *name),
+	TP_ARGS(name),
+	TP_STRUCT__entry(
+		__string(name, name)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+	),
+	TP_printk("%s", __get_str(name))
+);
+
+TRACE_EVENT(touch_read,
+	TP_PROTO(const char *name, int bytes, u64 latency_ns),
+	TP_ARGS(name, bytes, latency_ns),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(int, bytes)
+		__field(u64, latency_ns)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->bytes = bytes;
+		__entry->latency_ns = latency_ns;
+	),
+	TP_printk("%s bytes=%d latency_ns=%llu", __get_str(name),
+		  __entry->bytes, __entry->latency_ns)
+);
+
+TRACE_EVENT(touch_sync,
+	TP_PROTO(const char *name, int contacts, u64 latency_ns),
+	TP_ARGS(name, contacts, latency_ns),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(int, contacts)
+		__field(u64, latency_ns)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->contacts = contacts;
+		__entry->latency_ns = latency_ns;
+	),
+	TP_printk("%s contacts=%d latency_ns=%llu", __get_str(name),
+		  __entry->contacts, __entry->latency_ns)
+);
+
+#endif /* _TOUCH_TRACE_H */
+
+/* Out-of-tree: the trace header lives next to the sources */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE touch_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,594 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include "m_can_sim.h"
+
+/*
+ * Throughput and latency benchmark for the M_CAN driver.
+ *
+ * Usage: ./canBenchApp [-i can0] [-r rate] [-d s] [-n frames] [-L len]
+ *                      [-f fd%] [-I ids] [-j]
+ *        ./canBenchApp -S [-r rate] [-d s] [-f fd%] [-b bitrate]
+ *                      [-B data_bitrate] [-c ns] [-j]
+ *   -i : interface, vcan or the M_CAN in loopback mode, default can0
+ *   -r : frames per second, default 1000, 0 sends as fast as the queue
+ *        takes them
+ *   -d : how long to send, default 10 s
+ *   -n : stop after this many frames as well, default 1000000
+ *   -L : classic frame length, 4 to 8 bytes, default 8; the first four
+ *        carry a sequence number
+ *   -f : share of CAN FD frames (64 bytes, BRS) in percent, default 0
+ *   -I : ids, hex: "123" one id, "100-1ff" uniform over a range, "z100-17f"
+ *        Zipf over a range (the first id the busiest), ids above 7ff are
+ *        sent as extended ids; default 100-1ff
+ *   -S : run the message RAM model of m_can_sim.h instead of a device;
+ *        the rate and FD share give the bus load
+ *   -b : bit rate of the model, default 1000000
+ *   -B : data bit rate of the model, default 4 x the bit rate
+ *   -c : cost of a register or element access in the model, default 1000 ns
+ *   -j : print one JSON object instead of the report
+ *
+ * Latency is from the software TX timestamp the driver takes in
+ * m_can_start_xmit() (from write() when the device gives none) to the
+ * software RX timestamp of the frame that came back, the controller's RX
+ * copy in loopback mode, the echo on vcan. With hardware timestamps the
+ * time from start of frame to the RX software timestamp is reported too,
+ * i.e. the frame itself, the FIFO and the NAPI path. CPU is the whole
+ * system from /proc/stat, softirq separately, and this process.
+ *
+ * On the board:
+ *   ip link set can0 type can bitrate 1000000 loopback on
+ *   ip link set can0 up
+ *   echo 1 > /sys/kernel/debug/tracing/events/m_can/enable
+ *   ./canBenchApp -i can0 -r 5000 -j > before.json
+ * Without the device: ./canBenchApp -S -r 8000 -f 20
+ */
+
+struct bench {
+	int tx, rx;
+	u32 cap;
+	u32 sent;		/* written by the TX thread */
+	int tx_done;
+	long long drain_ns;
+
+	u64 *t_write, *t_txsw, *t_rx, *t_rxhw, *t_echo;
+	u32 unknown, dup, tx_busy;
+};
+
+struct cpu_sample {
+	unsigned long long busy, total, softirq;
+	struct rusage ru;
+};
+
+struct ids {
+	u32 first, n;
+	int zipf;
+	double *cdf;
+};
+
+static long long now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* parts per thousand, on a sorted array */
+static u64 pct(const u64 *v, u32 n, u32 ppt)
+{
+	return n ? v[(u64)(n - 1) * ppt / 1000] : 0;
+}
+
+static void cpu_sample(struct cpu_sample *c)
+{
+	unsigned long long v[10] = { 0 };
+	FILE *f = fopen("/proc/stat", "r");
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	if (f) {
+		if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6],
+			   &v[7]) == 8) {
+			for (i = 0; i < 8; i++)
+				c->total += v[i];
+			c->busy = c->total - v[3] - v[4];
+			c->softirq = v[6];
+		}
+		fclose(f);
+	}
+	getrusage(RUSAGE_SELF, &c->ru);
+}
+
+static unsigned long long if_stat(const char *ifname, const char *name)
+{
+	unsigned long long v = 0;
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s",
+		 ifname, name);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%llu", &v) != 1)
+			v = 0;
+		fclose(f);
+	}
+
+	return v;
+}
+
+static int parse_ids(const char *s, struct ids *ids)
+{
+	unsigned int a, b;
+	u32 i;
+	double sum = 0;
+
+	ids->zipf = *s == 'z';
+	if (ids->zipf)
+		s++;
+	if (sscanf(s, "%x-%x", &a, &b) == 2) {
+		if (b < a)
+			return -1;
+	} else if (sscanf(s, "%x", &a) == 1) {
+		b = a;
+	} else {
+		return -1;
+	}
+	if (b > CAN_EFF_MASK || (ids->zipf && b - a >= 4096))
+		return -1;
+	ids->first = a;
+	ids->n = b - a + 1;
+
+	if (!ids->zipf)
+		return 0;
+	ids->cdf = malloc(ids->n * sizeof(double));
+	if (!ids->cdf)
+		return -1;
+	for (i = 0; i < ids->n; i++) {
+		sum += 1.0 / (i + 1);
+		ids->cdf[i] = sum;
+	}
+	for (i = 0; i < ids->n; i++)
+		ids->cdf[i] /= sum;
+
+	return 0;
+}
+
+static canid_t pick_id(const struct ids *ids)
+{
+	double r;
+	u32 lo = 0, hi, id;
+
+	if (!ids->zipf) {
+		id = ids->first + (u32)rand() % ids->n;
+	} else {
+		r = (double)rand() / ((double)RAND_MAX + 1);
+		hi = ids->n - 1;
+		while (lo < hi) {
+			u32 mid = (lo + hi) / 2;
+
+			if (ids->cdf[mid] <= r)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		id = ids->first + lo;
+	}
+
+	return id > CAN_SFF_MASK ? id | CAN_EFF_FLAG : id;
+}
+
+static void take_ts(struct msghdr *msg, u64 *sw, u64 *hw)
+{
+	struct cmsghdr *cm;
+
+	*sw = *hw = 0;
+	for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+			struct timespec *ts = (struct timespec *)CMSG_DATA(cm);
+
+			*sw = ts[0].tv_sec * 1000000000ULL + ts[0].tv_nsec;
+			*hw = ts[2].tv_sec * 1000000000ULL + ts[2].tv_nsec;
+		}
+	}
+}
+
+static int recv_one(struct bench *b, int fd, int errq)
+{
+	char ctrl[CMSG_SPACE(3 * sizeof(struct timespec)) +
+		  CMSG_SPACE(sizeof(struct sock_extended_err) + 64)];
+	struct canfd_frame f;
+	struct iovec iov = { &f, sizeof(f) };
+	struct msghdr msg;
+	u64 sw, hw;
+	u32 seq;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	n = recvmsg(fd, &msg, MSG_DONTWAIT | (errq ? MSG_ERRQUEUE : 0));
+	if (n < (ssize_t)CAN_MTU)
+		return -1;
+
+	take_ts(&msg, &sw, &hw);
+	memcpy(&seq, f.data, sizeof(seq));
+	if (seq >= __atomic_load_n(&b->sent, __ATOMIC_ACQUIRE) || !sw) {
+		b->unknown++;
+		return 0;
+	}
+
+	if (errq) {
+		/* the TX timestamp the driver took when it queued the frame */
+		b->t_txsw[seq] = sw;
+	} else if (msg.msg_flags & MSG_DONTROUTE) {
+		if (!b->t_echo[seq])
+			b->t_echo[seq] = sw;
+	} else if (b->t_rx[seq]) {
+		b->dup++;
+	} else {
+		b->t_rx[seq] = sw;
+		b->t_rxhw[seq] = hw;
+	}
+
+	return 0;
+}
+
+static void *rx_thread(void *arg)
+{
+	struct bench *b = arg;
+	struct pollfd pfd[2] = { { b->rx, POLLIN, 0 }, { b->tx, 0, 0 } };
+	long long until = 0;
+
+	for (;;) {
+		if (__atomic_load_n(&b->tx_done, __ATOMIC_ACQUIRE)) {
+			if (!until)
+				until = now_ns(CLOCK_MONOTONIC) + b->drain_ns;
+			else if (now_ns(CLOCK_MONOTONIC) > until)
+				break;
+		}
+		if (poll(pfd, 2, 100) <= 0)
+			continue;
+		if (pfd[0].revents & POLLIN)
+			while (!recv_one(b, b->rx, 0))
+				;
+		if (pfd[1].revents & POLLERR)
+			while (!recv_one(b, b->tx, 1))
+				;
+	}
+
+	return NULL;
+}
+
+static int open_sock(const char *ifname, int fd_frames, int flags)
+{
+	struct hwtstamp_config cfg = { .tx_type = HWTSTAMP_TX_ON,
+				       .rx_filter = HWTSTAMP_FILTER_ALL };
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	int s, on = 1;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror(ifname);
+		close(s);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (fd_frames)
+		setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(s);
+		return -1;
+	}
+
+	/* vcan has no hardware timestamps, that is fine */
+	ifr.ifr_data = (void *)&cfg;
+	ioctl(s, SIOCSHWTSTAMP, &ifr);
+	setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+	return s;
+}
+
+static void report_lat(const char *name, u64 *v, u32 n, int json, int last)
+{
+	qsort(v, n, sizeof(v[0]), cmp_u64);
+	if (json)
+		printf("  \"%s\": {\"n\": %u, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}%s\n",
+		       name, n, pct(v, n, 500) / 1000.0, pct(v, n, 900) / 1000.0,
+		       pct(v, n, 990) / 1000.0, pct(v, n, 999) / 1000.0,
+		       n ? v[n - 1] / 1000.0 : 0.0, last ? "" : ",");
+	else
+		printf("%-9s %8u  p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f us\r\n",
+		       name, n, pct(v, n, 500) / 1000.0, pct(v, n, 900) / 1000.0,
+		       pct(v, n, 990) / 1000.0, pct(v, n, 999) / 1000.0,
+		       n ? v[n - 1] / 1000.0 : 0.0);
+}
+
+static int bench_dev(const char *ifname, u32 rate, u32 seconds, u32 max,
+		     u32 len, u32 fd_pct, const struct ids *ids, int json)
+{
+	int rxflags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		      SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	int txflags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	unsigned long long st0[3], st1[3];
+	struct bench b = { .cap = max, .drain_ns = 1000000000LL };
+	struct cpu_sample c0, c1;
+	struct canfd_frame f;
+	pthread_t thr;
+	long long start, end, next, period = rate ? 1000000000LL / rate : 0;
+	u64 *lat, *hwlat, tx;
+	u32 seq, i, nlat = 0, nhw = 0, got = 0, txsw = 0, nfd = 0;
+	double wall, cpu_busy, cpu_soft, self;
+
+	b.t_write = calloc(max, sizeof(u64));
+	b.t_txsw = calloc(max, sizeof(u64));
+	b.t_rx = calloc(max, sizeof(u64));
+	b.t_rxhw = calloc(max, sizeof(u64));
+	b.t_echo = calloc(max, sizeof(u64));
+	lat = calloc(max, sizeof(u64));
+	hwlat = calloc(max, sizeof(u64));
+	if (!b.t_write || !b.t_txsw || !b.t_rx || !b.t_rxhw || !b.t_echo ||
+	    !lat || !hwlat) {
+		printf("out of memory\r\n");
+		return 1;
+	}
+
+	b.tx = open_sock(ifname, fd_pct > 0, txflags);
+	b.rx = open_sock(ifname, fd_pct > 0, rxflags);
+	if (b.tx < 0 || b.rx < 0)
+		return 1;
+
+	st0[0] = if_stat(ifname, "rx_dropped");
+	st0[1] = if_stat(ifname, "rx_over_errors");
+	st0[2] = if_stat(ifname, "tx_dropped");
+	cpu_sample(&c0);
+	pthread_create(&thr, NULL, rx_thread, &b);
+
+	start = next = now_ns(CLOCK_MONOTONIC);
+	end = start + seconds * 1000000000LL;
+	memset(&f, 0x55, sizeof(f));
+	for (seq = 0; seq < max; seq++) {
+		if (rate) {
+			struct timespec ts = { next / 1000000000LL,
+					       next % 1000000000LL };
+
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			next += period;
+		}
+		if (now_ns(CLOCK_MONOTONIC) >= end)
+			break;
+
+		f.can_id = pick_id(ids);
+		if ((u32)rand() % 100 < fd_pct) {
+			f.len = 64;
+			f.flags = CANFD_BRS;
+			nfd++;
+		} else {
+			f.len = len;
+			f.flags = 0;
+		}
+		memcpy(f.data, &seq, sizeof(seq));
+
+		__atomic_store_n(&b.sent, seq + 1, __ATOMIC_RELEASE);
+		b.t_write[seq] = now_ns(CLOCK_REALTIME);
+		while (write(b.tx, &f, f.flags ? CANFD_MTU : CAN_MTU) < 0) {
+			if (errno != ENOBUFS) {
+				perror("write");
+				goto out;
+			}
+			/* queue full: the device is behind the rate */
+			b.tx_busy++;
+			usleep(100);
+			b.t_write[seq] = now_ns(CLOCK_REALTIME);
+		}
+	}
+out:
+	end = now_ns(CLOCK_MONOTONIC);
+	__atomic_store_n(&b.tx_done, 1, __ATOMIC_RELEASE);
+	pthread_join(thr, NULL);
+	cpu_sample(&c1);
+	st1[0] = if_stat(ifname, "rx_dropped");
+	st1[1] = if_stat(ifname, "rx_over_errors");
+	st1[2] = if_stat(ifname, "tx_dropped");
+
+	for (i = 0; i < b.sent; i++) {
+		tx = b.t_txsw[i] ? b.t_txsw[i] : b.t_write[i];
+		txsw += !!b.t_txsw[i];
+		if (b.t_rx[i] || b.t_echo[i]) {
+			got++;
+			lat[nlat++] = (b.t_rx[i] ? b.t_rx[i] : b.t_echo[i]) - tx;
+		}
+		if (b.t_rx[i] && b.t_rxhw[i] && b.t_rx[i] > b.t_rxhw[i])
+			hwlat[nhw++] = b.t_rx[i] - b.t_rxhw[i];
+	}
+
+	wall = (end - start) / 1e9;
+	cpu_busy = c1.total > c0.total ? 100.0 * (c1.busy - c0.busy) /
+					 (c1.total - c0.total) : 0;
+	cpu_soft = c1.total > c0.total ? 100.0 * (c1.softirq - c0.softirq) /
+					 (c1.total - c0.total) : 0;
+	self = (c1.ru.ru_utime.tv_sec - c0.ru.ru_utime.tv_sec +
+		c1.ru.ru_stime.tv_sec - c0.ru.ru_stime.tv_sec) +
+	       (c1.ru.ru_utime.tv_usec - c0.ru.ru_utime.tv_usec +
+		c1.ru.ru_stime.tv_usec - c0.ru.ru_stime.tv_usec) / 1e6;
+	self = wall > 0 ? 100.0 * self / wall : 0;
+
+	if (json) {
+		printf("{\n  \"target\": \"%s\", \"rate\": %u, \"seconds\": %.3f, \"fd_frames\": %u,\n",
+		       ifname, rate, wall, nfd);
+		printf("  \"sent\": %u, \"received\": %u, \"lost\": %u, \"tx_busy\": %u, \"unknown\": %u, \"duplicates\": %u,\n",
+		       b.sent, got, b.sent - got, b.tx_busy, b.unknown, b.dup);
+		printf("  \"tx_fps\": %.1f, \"rx_fps\": %.1f, \"tx_clock\": \"%s\",\n",
+		       b.sent / wall, got / wall, txsw ? "driver" : "write");
+		printf("  \"rx_dropped\": %llu, \"rx_over_errors\": %llu, \"tx_dropped\": %llu,\n",
+		       st1[0] - st0[0], st1[1] - st0[1], st1[2] - st0[2]);
+		printf("  \"cpu_pct\": %.1f, \"softirq_pct\": %.1f, \"self_pct\": %.1f,\n",
+		       cpu_busy, cpu_soft, self);
+		report_lat("latency", lat, nlat, 1, 0);
+		report_lat("sof_to_rx", hwlat, nhw, 1, 1);
+		printf("}\n");
+	} else {
+		printf("%s: %u sent in %.2f s (%.0f/s, %u FD), %u back (%.0f/s), %u lost, %u queue full\r\n",
+		       ifname, b.sent, wall, b.sent / wall, nfd, got, got / wall,
+		       b.sent - got, b.tx_busy);
+		printf("driver counters: rx_dropped %llu rx_over_errors %llu tx_dropped %llu\r\n",
+		       st1[0] - st0[0], st1[1] - st0[1], st1[2] - st0[2]);
+		printf("cpu %.1f%% softirq %.1f%% this process %.1f%%\r\n",
+		       cpu_busy, cpu_soft, self);
+		printf("latency from %s:\r\n", txsw ? "the driver's TX timestamp" : "write()");
+		report_lat("latency", lat, nlat, 0, 0);
+		report_lat("sof_to_rx", hwlat, nhw, 0, 1);
+	}
+
+	close(b.tx);
+	close(b.rx);
+	return 0;
+}
+
+/* the same numbers from the model: latency from end of frame to hand-off,
+ * CPU as the share of time spent polling
+ */
+static int bench_sim(u32 rate, u32 seconds, u32 fd_pct, u32 bitrate,
+		     u32 dbitrate, u64 cost_ns, int json)
+{
+	struct m_can_sim s = { .bitrate = bitrate, .cost_ns = cost_ns,
+			       .stall_pct = 5, .sorted = 1 };
+	struct m_can_sim_frame *f;
+	double bits, load;
+	u64 *lat;
+	u32 nf, i, n = 0;
+
+	/* mean frame length in bit times, with the intermission */
+	bits = (100 - fd_pct) / 100.0 * (47 + 44 + 3) +
+	       fd_pct / 100.0 * (30 + 552.0 * bitrate / dbitrate + 3);
+	load = rate ? 100.0 * rate * bits / bitrate : 99;
+	if (load > 99)
+		load = 99;
+	if (load < 1)
+		load = 1;
+
+	srand(1);
+	f = m_can_sim_gen(bitrate, dbitrate, fd_pct, (u32)load, seconds, &nf);
+	lat = f ? malloc((nf + 1) * sizeof(u64)) : NULL;
+	if (!lat) {
+		printf("out of memory\r\n");
+		return 1;
+	}
+	m_can_sim_run(&s, f, nf, 7);
+	for (i = 0; i < nf; i++)
+		if (f[i].done_ns)
+			lat[n++] = f[i].done_ns - f[i].eof_ns;
+
+	if (json) {
+		printf("{\n  \"target\": \"sim\", \"rate\": %u, \"seconds\": %u, \"bitrate\": %u, \"dbitrate\": %u, \"load_pct\": %.1f, \"access_ns\": %llu,\n",
+		       rate, seconds, bitrate, dbitrate, load,
+		       (unsigned long long)cost_ns);
+		printf("  \"sent\": %u, \"received\": %u, \"lost\": %u, \"rx_fps\": %.1f,\n",
+		       nf, s.delivered, s.lost, (double)s.delivered / seconds);
+		printf("  \"polls\": %u, \"max_batch\": %u, \"out_of_order\": %u, \"cpu_pct\": %.1f,\n",
+		       s.polls, s.max_batch, s.inversions,
+		       s.now ? 100.0 * s.busy_ns / s.now : 0);
+		report_lat("eof_to_stack", lat, n, 1, 1);
+		printf("}\n");
+	} else {
+		printf("model: %u bit/s, data %u bit/s, load %.1f%%, access %llu ns, %u s\r\n",
+		       bitrate, dbitrate, load, (unsigned long long)cost_ns,
+		       seconds);
+		printf("%u frames, %u handed off (%.0f/s), %u lost, %u polls, largest batch %u, %u out of order\r\n",
+		       nf, s.delivered, (double)s.delivered / seconds, s.lost,
+		       s.polls, s.max_batch, s.inversions);
+		printf("cpu %.1f%% (polling)\r\n",
+		       s.now ? 100.0 * s.busy_ns / s.now : 0);
+		report_lat("eof_to_stack", lat, n, 0, 1);
+	}
+
+	free(lat);
+	free(f);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "can0";
+	u32 rate = 1000, seconds = 10, max = 1000000, len = 8, fd_pct = 0;
+	u32 bitrate = 1000000, dbitrate = 0;
+	u64 cost_ns = 1000;
+	struct ids ids = { 0 };
+	int opt, sim = 0, json = 0;
+
+	if (parse_ids("100-1ff", &ids))
+		return -1;
+	while ((opt = getopt(argc, argv, "i:r:d:n:L:f:I:Sb:B:c:j")) != -1) {
+		switch (opt) {
+		case 'i': ifname = optarg; break;
+		case 'r': rate = (u32)atol(optarg); break;
+		case 'd': seconds = (u32)atol(optarg); break;
+		case 'n': max = (u32)atol(optarg); break;
+		case 'L': len = (u32)atol(optarg); break;
+		case 'f': fd_pct = (u32)atol(optarg); break;
+		case 'I':
+			if (parse_ids(optarg, &ids)) {
+				printf("Error Usage!\r\n");
+				return -1;
+			}
+			break;
+		case 'S': sim = 1; break;
+		case 'b': bitrate = (u32)atol(optarg); break;
+		case 'B': dbitrate = (u32)atol(optarg); break;
+		case 'c': cost_ns = (u64)atoll(optarg); break;
+		case 'j': json = 1; break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (!dbitrate)
+		dbitrate = 4 * bitrate;
+	if (len < 4 || len > 8 || fd_pct > 100 || !seconds || !max ||
+	    bitrate < 1000 || dbitrate < bitrate) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	srand(1);
+	if (sim)
+		return bench_sim(rate, seconds, fd_pct, bitrate, dbitrate,
+				 cost_ns, json);
+
+	return bench_dev(ifname, rate, seconds, max, len, fd_pct, &ids, json);
+}
@@ -0,0 +1,422 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include "m_can_filter.h"
+
+/*
+ * Offline checker for the M_CAN acceptance filter compiler.
+ *
+ * Usage: ./canFilterApp [-s n] [-x n] [-q id]... 'rules' | -
+ *        ./canFilterApp -t
+ *   -s/-x : standard/extended filter elements reserved in bosch,mram-cfg,
+ *           default 128/64
+ *   -q    : run a frame id through the simulated controller (8 hex digits
+ *           for an extended id, as in the rules)
+ *   -t    : self test, compiles fixed and random rule sets and checks every
+ *           standard id and a sample of extended ids against the rules
+ * Rules are read from the argument, or from stdin with "-". The compiled
+ * elements are printed as the driver lists them in
+ * /sys/kernel/debug/m_can/<device>/filters.
+ *
+ * The simulated controller walks the message RAM the way the M_CAN does:
+ * SIDFC/XIDFC give the list start and length, the first enabled element
+ * that matches decides, and GFC handles frames no element matches.
+ */
+
+#define SIM_MRAM_WORDS		(M_CAN_FILT_STD_MAX + 2 * M_CAN_FILT_EXT_MAX)
+
+struct sim {
+	unsigned int mram[SIM_MRAM_WORDS];
+	unsigned int sidfc, xidfc, xidam, gfc;
+};
+
+static struct m_can_filt_set fs;
+static struct sim sim;
+
+/* Element configuration back to the action the reference model uses */
+static int ec_action(unsigned int ec)
+{
+	switch (ec) {
+	case FILT_EC_FIFO0:
+		return M_CAN_FILT_FIFO0;
+	case FILT_EC_FIFO1:
+		return M_CAN_FILT_FIFO1;
+	case FILT_EC_REJECT:
+		return M_CAN_FILT_REJECT;
+	default:
+		return -1;
+	}
+}
+
+/* Same layout and register values as m_can_write_filters() */
+static void sim_load(struct sim *s, const struct m_can_filt_set *f)
+{
+	unsigned int xoff = M_CAN_FILT_STD_MAX * 4;
+	int i;
+
+	memset(s->mram, 0xa5, sizeof(s->mram));
+	for (i = 0; i < f->nsid; i++)
+		s->mram[i] = f->sid[i];
+	for (i = 0; i < f->nxid; i++) {
+		s->mram[xoff / 4 + 2 * i] = f->xid[i][0];
+		s->mram[xoff / 4 + 2 * i + 1] = f->xid[i][1];
+	}
+	s->sidfc = (f->nsid << 16) | 0;
+	s->xidfc = (f->nxid << 16) | xoff;
+	s->xidam = M_CAN_FILT_EFF_MASK;
+	s->gfc = f->gfc;
+}
+
+static int sim_nonmatch(const struct sim *s, int xtd)
+{
+	unsigned int anf = (s->gfc >> (xtd ? GFC_ANFE_SHIFT : GFC_ANFS_SHIFT)) & 3;
+
+	return anf == GFC_ANF_FIFO0 ? M_CAN_FILT_FIFO0 : M_CAN_FILT_REJECT;
+}
+
+/*
+ * @description	: run one frame through the simulated filter
+ * @param - fidx: matching element, -1 for a non-matching frame
+ * @return		: action the controller takes
+ */
+static int sim_rx(const struct sim *s, int xtd, unsigned int id, int *fidx)
+{
+	unsigned int i, n, base, e0, e1, t, ec, id1, id2, mid;
+	int hit;
+
+	*fidx = -1;
+	if (!xtd) {
+		n = (s->sidfc >> 16) & 0xff;
+		base = (s->sidfc & 0xfffc) / 4;
+		for (i = 0; i < n; i++) {
+			e0 = s->mram[base + i];
+			t = e0 >> SIDF_SFT_SHIFT;
+			ec = (e0 >> SIDF_SFEC_SHIFT) & 7;
+			id1 = (e0 >> SIDF_SFID1_SHIFT) & SIDF_SFID2_MASK;
+			id2 = e0 & SIDF_SFID2_MASK;
+			if (ec == FILT_EC_DISABLE)
+				continue;
+			switch (t) {
+			case FILT_TYPE_RANGE:
+				hit = id >= id1 && id <= id2;
+				break;
+			case FILT_TYPE_DUAL:
+				hit = id == id1 || id == id2;
+				break;
+			case FILT_TYPE_CLASSIC:
+				hit = (id & id2) == (id1 & id2);
+				break;
+			default:
+				hit = 0;
+				break;
+			}
+			if (hit) {
+				*fidx = i;
+				return ec_action(ec);
+			}
+		}
+	} else {
+		n = (s->xidfc >> 16) & 0x7f;
+		base = (s->xidfc & 0xfffc) / 4;
+		for (i = 0; i < n; i++) {
+			e0 = s->mram[base + 2 * i];
+			e1 = s->mram[base + 2 * i + 1];
+			ec = e0 >> XIDF_EFEC_SHIFT;
+			t = e1 >> XIDF_EFT_SHIFT;
+			id1 = e0 & XIDF_EFID_MASK;
+			id2 = e1 & XIDF_EFID_MASK;
+			if (ec == FILT_EC_DISABLE)
+				continue;
+			switch (t) {
+			case FILT_TYPE_RANGE:
+				mid = id & s->xidam;
+				hit = mid >= id1 && mid <= id2;
+				break;
+			case FILT_TYPE_DUAL:
+				hit = id == id1 || id == id2;
+				break;
+			case FILT_TYPE_CLASSIC:
+				hit = (id & id2) == (id1 & id2);
+				break;
+			default:
+				hit = id >= id1 && id <= id2;
+				break;
+			}
+			if (hit) {
+				*fidx = i;
+				return ec_action(ec);
+			}
+		}
+	}
+
+	return sim_nonmatch(s, xtd);
+}
+
+static void print_set(const struct m_can_filt_set *f)
+{
+	char buf[96];
+	int i;
+
+	for (i = 0; i < f->nrules; i++) {
+		m_can_filt_rule_str(&f->rule[i], buf, sizeof(buf));
+		printf("rule %3d: %s\r\n", i, buf);
+	}
+	printf("%d rules -> %d std, %d ext elements, gfc 0x%02x\r\n",
+	       f->nrules, f->nsid, f->nxid, f->gfc);
+	for (i = 0; i < f->nsid && i < M_CAN_FILT_STD_MAX; i++) {
+		m_can_filt_elem_str(f, 0, i, buf, sizeof(buf));
+		printf("%3d: %08x          %s\r\n", i, f->sid[i], buf);
+	}
+	for (i = 0; i < f->nxid && i < M_CAN_FILT_EXT_MAX; i++) {
+		m_can_filt_elem_str(f, 1, i, buf, sizeof(buf));
+		printf("%3d: %08x %08x %s\r\n", i, f->xid[i][0], f->xid[i][1], buf);
+	}
+}
+
+static int fails;
+
+static void check_id(const struct m_can_filt_set *f, int xtd, unsigned int id)
+{
+	int want, got, fidx;
+
+	id &= xtd ? M_CAN_FILT_EFF_MASK : M_CAN_FILT_SFF_MASK;
+	want = m_can_filt_match(f, xtd, id);
+	got = sim_rx(&sim, xtd, id, &fidx);
+	if (want != got) {
+		if (fails++ < 10)
+			printf("  %s id %x: rules say %s, message RAM says %s (element %d)\r\n",
+			       xtd ? "ext" : "std", id, m_can_filt_action_name[want],
+			       got < 0 ? "?" : m_can_filt_action_name[got], fidx);
+	}
+}
+
+/* Every standard id, rule boundaries and random extended ids */
+static void check_set(const struct m_can_filt_set *f)
+{
+	const struct m_can_filt_rule *r;
+	unsigned int id;
+	int i, b;
+
+	sim_load(&sim, f);
+	for (id = 0; id <= M_CAN_FILT_SFF_MASK; id++)
+		check_id(f, 0, id);
+
+	for (i = 0; i < f->nrules; i++) {
+		r = &f->rule[i];
+		if (!r->xtd)
+			continue;
+		if (r->type == M_CAN_FILT_RANGE) {
+			for (b = -1; b <= 1; b++) {
+				check_id(f, 1, r->id1 + b);
+				check_id(f, 1, r->id2 + b);
+			}
+			for (b = 0; b < 64; b++)
+				check_id(f, 1, r->id1 + rand() % (r->id2 - r->id1 + 1));
+		} else {
+			check_id(f, 1, r->id1);
+			for (b = 0; b < 29; b++)
+				check_id(f, 1, r->id1 ^ (1u << b));
+			for (b = 0; b < 64; b++)
+				check_id(f, 1, r->id1 | ((unsigned int)rand() & ~r->id2));
+		}
+	}
+	for (i = 0; i < 4096; i++)
+		check_id(f, 1, ((unsigned int)rand() << 16) ^ (unsigned int)rand());
+}
+
+static int test_rules(const char *rules, int expect_nsid, int expect_nxid)
+{
+	int before = fails, ret;
+
+	memset(&fs, 0, sizeof(fs));
+	ret = m_can_filt_parse(&fs, rules);
+	if (!ret)
+		ret = m_can_filt_compile(&fs, M_CAN_FILT_STD_MAX, M_CAN_FILT_EXT_MAX);
+	if (ret) {
+		printf("FAIL \"%s\": error %d\r\n", rules, ret);
+		return ++fails;
+	}
+	if ((expect_nsid >= 0 && fs.nsid != expect_nsid) ||
+	    (expect_nxid >= 0 && fs.nxid != expect_nxid)) {
+		printf("FAIL \"%s\": %d std %d ext elements, expected %d %d\r\n",
+		       rules, fs.nsid, fs.nxid, expect_nsid, expect_nxid);
+		fails++;
+	}
+	check_set(&fs);
+	if (fails != before)
+		printf("FAIL \"%s\"\r\n", rules);
+	return fails - before;
+}
+
+static void random_rules(char *buf, int len)
+{
+	int n = 1 + rand() % 40, i, xtd, w, pos = 0;
+	unsigned int lim, id, mask, hi;
+
+	for (i = 0; i < n && pos < len - 64; i++) {
+		xtd = rand() % 3 == 0;
+		lim = xtd ? M_CAN_FILT_EFF_MASK : M_CAN_FILT_SFF_MASK;
+		w = xtd ? 8 : 3;
+		id = (((unsigned int)rand() << 16) ^ rand()) & lim;
+		switch (rand() % 4) {
+		case 0:		/* exact id */
+			pos += snprintf(buf + pos, len - pos, "%0*x:%0*x", w, id, w, lim);
+			break;
+		case 1:		/* prefix mask */
+			mask = lim & ~((1u << (rand() % 8)) - 1);
+			pos += snprintf(buf + pos, len - pos, "%0*x:%0*x", w, id, w, mask);
+			break;
+		case 2:		/* arbitrary mask */
+			mask = (((unsigned int)rand() << 16) ^ rand()) & lim;
+			pos += snprintf(buf + pos, len - pos, "%0*x:%0*x", w, id, w, mask);
+			break;
+		default:	/* range */
+			hi = id + rand() % 64;
+			if (hi > lim)
+				hi = lim;
+			pos += snprintf(buf + pos, len - pos, "%0*x-%0*x", w, id, w, hi);
+			break;
+		}
+		if (rand() % 5 == 0)
+			pos += snprintf(buf + pos, len - pos, " reject");
+		else if (rand() % 4 == 0)
+			pos += snprintf(buf + pos, len - pos, " fifo1");
+		pos += snprintf(buf + pos, len - pos, i % 4 == 3 ? "\n" : ",");
+	}
+}
+
+static int self_test(void)
+{
+	static const char * const bad[] = {
+		"123~7ff", "xyz", "200-100", "reject", "123:", "800:7ff:1",
+		"123456789:1fffffff", "00000000-20000000",
+	};
+	static char buf[4096];
+	char rule[96];
+	int i, ret;
+
+	/* layout: single ids pair up, prefix masks become ranges and merge */
+	test_rules("", 0, 0);
+	test_rules("123:7ff,125:7ff,127:7ff", 2, 0);
+	test_rules("123:7ff,124:7ff,125:7ff", 1, 0);
+	test_rules("100:700", 1, 0);
+	test_rules("100:70f", 1, 0);
+	test_rules("100:70f 100:70f", 1, 0);
+	test_rules("100-1ff 180-2ff 300-30f 310:7f0", 1, 0);
+	test_rules("120:7f0 reject, 100:700", 2, 0);
+	test_rules("# j1939\n18fef100:1fffff00, 0cf00400:1fffffff\n"
+		   "00001000-00001fff, 123:7ff", 1, 3);
+	test_rules("00000000:00000000", 0, 1);
+	test_rules("0x7ff:0x7ff fifo0, 000-7ff reject", 2, 0);
+
+	/* priority lane: fifo1 elements sit between reject and fifo0 */
+	test_rules("000-0ff fifo1, 000-7ff, 080:7f0 reject", 3, 0);
+	test_rules("010:7ff fifo1, 020:7ff fifo1, 000:000, 00000010:1fffffff fifo1", 2, 1);
+
+	/* malformed rules are refused */
+	for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+		if (m_can_filt_parse(&fs, bad[i]) != -EINVAL) {
+			printf("FAIL \"%s\" accepted\r\n", bad[i]);
+			fails++;
+		}
+	}
+
+	/* element budget from bosch,mram-cfg */
+	m_can_filt_parse(&fs, "100-110 200-210 300-310");
+	if (m_can_filt_compile(&fs, 2, 0) != -ENOSPC || fs.nsid != 3) {
+		printf("FAIL element budget not enforced\r\n");
+		fails++;
+	}
+
+	/* printed rules parse back to the same rules */
+	m_can_filt_parse(&fs, "00000123-00000456 reject, 7f0:7f0, 1abcdef0:1ffffff0");
+	for (i = 0; i < fs.nrules; i++) {
+		struct m_can_filt_set *again = calloc(1, sizeof(*again));
+
+		m_can_filt_rule_str(&fs.rule[i], rule, sizeof(rule));
+		ret = m_can_filt_parse(again, rule);
+		if (ret || again->nrules != 1 ||
+		    memcmp(&again->rule[0], &fs.rule[i], sizeof(fs.rule[i]))) {
+			printf("FAIL \"%s\" does not round trip\r\n", rule);
+			fails++;
+		}
+		free(again);
+	}
+
+	srand(1);
+	for (i = 0; i < 500; i++) {
+		random_rules(buf, sizeof(buf));
+		if (test_rules(buf, -1, -1) && fails > 20)
+			break;
+	}
+
+	printf("%s: %d failures\r\n", fails ? "FAIL" : "PASS", fails);
+	return fails ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static char text[65536];
+	const char *query[16];
+	int std_max = M_CAN_FILT_STD_MAX, ext_max = M_CAN_FILT_EXT_MAX;
+	int nq = 0, opt, ret, i, d, fidx, xtd;
+	unsigned int id;
+	size_t len;
+
+	while ((opt = getopt(argc, argv, "s:x:q:t")) != -1) {
+		switch (opt) {
+		case 's': std_max = atoi(optarg); break;
+		case 'x': ext_max = atoi(optarg); break;
+		case 'q':
+			if (nq < 16)
+				query[nq++] = optarg;
+			break;
+		case 't': return self_test();
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	if (!strcmp(argv[optind], "-")) {
+		len = fread(text, 1, sizeof(text) - 1, stdin);
+		text[len] = '\0';
+	} else {
+		snprintf(text, sizeof(text), "%s", argv[optind]);
+	}
+
+	ret = m_can_filt_parse(&fs, text);
+	if (ret) {
+		printf("rule %d: %s\r\n", fs.nrules, ret == -E2BIG ? "too many rules" : "bad rule");
+		return 1;
+	}
+	ret = m_can_filt_compile(&fs, std_max, ext_max);
+	print_set(&fs);
+	if (ret) {
+		printf("needs %d/%d std/ext elements, %d/%d reserved\r\n",
+		       fs.nsid, fs.nxid, std_max, ext_max);
+		return 1;
+	}
+
+	sim_load(&sim, &fs);
+	for (i = 0; i < nq; i++) {
+		if (!m_can_filt_hex(query[i], &id, &d)) {
+			printf("bad id %s\r\n", query[i]);
+			continue;
+		}
+		xtd = d == 8 || id > M_CAN_FILT_SFF_MASK;
+		ret = sim_rx(&sim, xtd, id, &fidx);
+		printf("%s %x: %s", xtd ? "ext" : "std", id, m_can_filt_action_name[ret]);
+		if (fidx >= 0)
+			printf(", element %d, rule %d", fidx,
+			       xtd ? fs.xid_rule[fidx] : fs.sid_rule[fidx]);
+		printf("\r\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,320 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+/*
+ * Loopback load generator for the M_CAN RX priority lane: floods the bus
+ * with bulk frames while sending a priority id at a fixed period, and
+ * reports how long each class waited in the controller and the RX path.
+ *
+ * Usage: ./canPrioApp [-i can0] [-p id] [-b id] [-t ms] [-g us] [-d s]
+ *   -i : interface, default can0
+ *   -p : priority id, default 010
+ *   -b : bulk id, default 700
+ *   -t : priority frame period, default 10 ms
+ *   -g : gap between bulk frames, default 0 (as fast as the queue takes them)
+ *   -d : duration, default 10 s
+ *
+ * On the board, with the controller looping its own frames back:
+ *   ip link set can0 type can bitrate 1000000 loopback on
+ *   echo "010:7ff fifo1, 000:000" > /sys/kernel/debug/m_can/<dev>/filters
+ *   ip link set can0 up
+ *   ./canPrioApp
+ * and once more without the fifo1 rule to compare.
+ *
+ * The receiving socket sees every frame twice: the echo the driver sends
+ * up when the transmission completes (MSG_DONTROUTE) and the copy the
+ * controller received into its RX FIFO. "rx" is the time between the two
+ * kernel timestamps, i.e. FIFO residence plus NAPI, and does not depend on
+ * how long the frame queued for transmission. "e2e" runs from write() to
+ * the RX copy and includes TX queueing behind the bulk frames.
+ */
+
+#define RING		65536
+#define CLASSES		2
+
+enum { PRIO, BULK };
+
+struct lat {
+	uint64_t *v;
+	size_t n, cap;
+};
+
+struct class {
+	const char *name;
+	canid_t id;
+	uint32_t sent;
+	uint32_t busy;			/* writes refused with ENOBUFS */
+	uint32_t received;
+	uint64_t echo_ns[RING];		/* echo timestamp by sequence number */
+	uint64_t rx_ns[RING];
+	struct lat rx, e2e;
+};
+
+static struct class cls[CLASSES] = {
+	[PRIO] = { .name = "prio", .id = 0x010 },
+	[BULK] = { .name = "bulk", .id = 0x700 },
+};
+static const char *ifname = "can0";
+static int period_ms = 10, gap_us, duration = 10;
+static volatile int stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void lat_add(struct lat *l, uint64_t v)
+{
+	if (l->n == l->cap) {
+		l->cap = l->cap ? 2 * l->cap : 4096;
+		l->v = realloc(l->v, l->cap * sizeof(*l->v));
+		if (!l->v) {
+			printf("out of memory\r\n");
+			exit(1);
+		}
+	}
+	l->v[l->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void lat_print(const char *cname, const char *what, struct lat *l)
+{
+	if (!l->n) {
+		printf("%s %-3s: no samples\r\n", cname, what);
+		return;
+	}
+	qsort(l->v, l->n, sizeof(*l->v), cmp_u64);
+	printf("%s %-3s: n %zu  p50 %llu  p99 %llu  p99.9 %llu  max %llu us\r\n",
+	       cname, what, l->n,
+	       (unsigned long long)l->v[l->n / 2] / 1000,
+	       (unsigned long long)l->v[l->n * 99 / 100] / 1000,
+	       (unsigned long long)l->v[l->n * 999 / 1000] / 1000,
+	       (unsigned long long)l->v[l->n - 1] / 1000);
+}
+
+static int open_can(void)
+{
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	int s;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror(ifname);
+		exit(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	return s;
+}
+
+/* payload: sequence number, then the low 32 bits of the send time in us */
+static int send_one(int s, struct class *c)
+{
+	struct can_frame f;
+	uint32_t us = now_ns() / 1000;
+
+	memset(&f, 0, sizeof(f));
+	f.can_id = c->id;
+	f.can_dlc = 8;
+	memcpy(f.data, &c->sent, 4);
+	memcpy(f.data + 4, &us, 4);
+	if (write(s, &f, sizeof(f)) != sizeof(f)) {
+		if (errno == ENOBUFS || errno == EAGAIN) {
+			c->busy++;
+			return -1;
+		}
+		perror("write");
+		exit(1);
+	}
+	c->sent++;
+	return 0;
+}
+
+static void *bulk_thread(void *arg)
+{
+	int s = open_can();
+
+	(void)arg;
+	while (!stop) {
+		if (send_one(s, &cls[BULK]) < 0)
+			usleep(50);
+		else if (gap_us)
+			usleep(gap_us);
+	}
+	close(s);
+	return NULL;
+}
+
+static void *prio_thread(void *arg)
+{
+	struct timespec next;
+	int s = open_can();
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!stop) {
+		next.tv_nsec += period_ms * 1000000L;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		while (send_one(s, &cls[PRIO]) < 0 && !stop)
+			usleep(50);
+	}
+	close(s);
+	return NULL;
+}
+
+static void receive(int s, uint64_t until)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct timespec))];
+	struct can_frame f;
+	struct iovec iov = { &f, sizeof(f) };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct class *c;
+	uint64_t ts, t_rx;
+	uint32_t seq, us;
+	int i;
+
+	while (now_ns() < until) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if (recvmsg(s, &msg, 0) != sizeof(f))
+			continue;
+
+		ts = 0;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+			if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec *t = (struct timespec *)CMSG_DATA(cm);
+
+				ts = t->tv_sec * 1000000000ull + t->tv_nsec;
+			}
+		if (!ts)
+			ts = now_ns();
+
+		for (c = NULL, i = 0; i < CLASSES; i++)
+			if (f.can_id == cls[i].id)
+				c = &cls[i];
+		if (!c)
+			continue;
+		memcpy(&seq, f.data, 4);
+		memcpy(&us, f.data + 4, 4);
+
+		if (msg.msg_flags & MSG_DONTROUTE) {
+			c->echo_ns[seq % RING] = ts;
+		} else {
+			c->received++;
+			c->rx_ns[seq % RING] = ts;
+			t_rx = ts / 1000;
+			lat_add(&c->e2e, (uint64_t)(uint32_t)((uint32_t)t_rx - us) * 1000);
+		}
+
+		/* both copies seen, in either order */
+		if (c->echo_ns[seq % RING] && c->rx_ns[seq % RING]) {
+			if (c->rx_ns[seq % RING] >= c->echo_ns[seq % RING])
+				lat_add(&c->rx, c->rx_ns[seq % RING] - c->echo_ns[seq % RING]);
+			else
+				lat_add(&c->rx, 0);
+			c->echo_ns[seq % RING] = 0;
+			c->rx_ns[seq % RING] = 0;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct can_filter flt[CLASSES];
+	struct timeval tv = { 0, 100000 };
+	pthread_t bulk, prio;
+	int opt, s, on = 1, i;
+	uint64_t t0;
+
+	while ((opt = getopt(argc, argv, "i:p:b:t:g:d:")) != -1) {
+		switch (opt) {
+		case 'i': ifname = optarg; break;
+		case 'p': cls[PRIO].id = strtoul(optarg, NULL, 16) & CAN_SFF_MASK; break;
+		case 'b': cls[BULK].id = strtoul(optarg, NULL, 16) & CAN_SFF_MASK; break;
+		case 't': period_ms = atoi(optarg); break;
+		case 'g': gap_us = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (period_ms <= 0 || duration <= 0 || cls[PRIO].id == cls[BULK].id) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	s = open_can();
+	for (i = 0; i < CLASSES; i++) {
+		flt[i].can_id = cls[i].id;
+		flt[i].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	}
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, flt, sizeof(flt));
+	setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	i = 4 << 20;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i));
+
+	pthread_create(&bulk, NULL, bulk_thread, NULL);
+	pthread_create(&prio, NULL, prio_thread, NULL);
+
+	t0 = now_ns();
+	receive(s, t0 + duration * 1000000000ull);
+	stop = 1;
+	pthread_join(bulk, NULL);
+	pthread_join(prio, NULL);
+	/* let the last frames come back */
+	receive(s, now_ns() + 200000000ull);
+	close(s);
+
+	for (i = 0; i < CLASSES; i++) {
+		printf("%s id %03x: sent %u received %u missing %u busy %u, %.0f frames/s\r\n",
+		       cls[i].name, cls[i].id, cls[i].sent, cls[i].received,
+		       cls[i].sent - cls[i].received, cls[i].busy,
+		       cls[i].received / (double)duration);
+		lat_print(cls[i].name, "rx", &cls[i].rx);
+		lat_print(cls[i].name, "e2e", &cls[i].e2e);
+	}
+
+	return 0;
+}
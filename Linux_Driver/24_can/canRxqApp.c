@@ -0,0 +1,287 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include <stdint.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include "m_can_ts.h"
+#include "m_can_rxq.h"
+#include "m_can_sim.h"
+
+/*
+ * Order in which the M_CAN driver hands frames to the stack.
+ *
+ * Usage: ./canRxqApp -t [-b bitrate] [-l load] [-c ns] [-s seconds]
+ *        ./canRxqApp [-i can0] [-n frames]
+ *   -t : offline simulation of the message RAM and the NAPI poll: bus
+ *        traffic spread over the TX event FIFO, RX FIFO 1 and RX FIFO 0,
+ *        polls that read them the way m_can_poll() does while frames keep
+ *        coming in (m_can_sim.h), and the order the stack sees, once per
+ *        FIFO as read and once through the timestamp-ordered queue of
+ *        m_can_rxq.h
+ *   -b : bit rate, default 1000000
+ *   -l : bus load in percent, default 90
+ *   -c : cost of one register or element access, default 1000 ns
+ *   -s : simulated time, default 10 s
+ *        with none of -b -l -c -s, -t runs a fixed set of cases
+ *   -i : on the board: turn on hardware timestamps and count the frames,
+ *        echoes included, stamped earlier than the frame before them
+ *   -n : stop after this many frames, default runs until interrupted
+ *
+ * Live, with the controller looping its frames back and FIFO 1 in use:
+ *   ip link set can0 type can bitrate 1000000 loopback on
+ *   echo "010:7ff fifo1, 000:000" > /sys/kernel/debug/m_can/<dev>/filters
+ *   ip link set can0 up
+ *   ./canPrioApp -d 60 &
+ *   ./canRxqApp -i can0
+ *   cat /sys/kernel/debug/m_can/<dev>/rx_fifos
+ */
+
+static int fails;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		if (fails++ < 20) {					\
+			printf("  " __VA_ARGS__);			\
+			printf("\r\n");					\
+		}							\
+	}								\
+} while (0)
+
+/* expect: 0 report only, 1 at most a tenth of the per FIFO count, 2 none */
+static void sim_case(u32 bitrate, u32 load, u64 cost_ns, u32 seconds,
+		     int expect)
+{
+	struct m_can_sim s = { .bitrate = bitrate, .cost_ns = cost_ns,
+			       .stall_pct = 5 };
+	struct m_can_sim_frame *f;
+	u32 nf, inv[2], i;
+
+	srand(bitrate ^ load);
+	f = m_can_sim_gen(bitrate, bitrate, 0, load, seconds, &nf);
+	if (!f) {
+		fails++;
+		return;
+	}
+
+	printf("%7u bit/s load %2u%% access %4llu ns, %u s, %u frames:\r\n",
+	       bitrate, load, (unsigned long long)cost_ns, seconds, nf);
+	for (i = 0; i < 2; i++) {
+		s.sorted = i;
+		m_can_sim_run(&s, f, nf, 7);
+		inv[i] = s.inversions;
+		printf("  %-9s delivered %u lost %u polls %u largest batch %u, %u out of order, key error %lld ns\r\n",
+		       i ? "sorted" : "per fifo", s.delivered, s.lost, s.polls,
+		       s.max_batch, s.inversions, s.max_err);
+		CHECK(s.delivered + s.lost == nf, "%u frames went missing",
+		      nf - s.delivered - s.lost);
+		CHECK(!s.key_fails, "%u keys off by more than the rounding",
+		      s.key_fails);
+	}
+
+	if (expect == 2)
+		CHECK(!inv[1], "sorted queue delivered %u out of order", inv[1]);
+	if (expect == 1)
+		CHECK(inv[1] <= inv[0] / 10, "sorted %u vs per fifo %u out of order",
+		      inv[1], inv[0]);
+	free(f);
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+	const struct m_can_rxq_ent *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	/* items are insertion numbers: equal keys stay in order */
+	return (uintptr_t)x->item < (uintptr_t)y->item ? -1 : 1;
+}
+
+/* m_can_rxq_add() against a stable sort, runs of ascending keys as the
+ * poll produces them, and the full queue
+ */
+static void test_queue(void)
+{
+	static struct m_can_rxq q;
+	struct m_can_rxq_ent ref[M_CAN_RXQ_MAX];
+	u64 base[M_CAN_SIM_SRCS];
+	u32 round, n, i, src;
+	int moved;
+
+	for (round = 0; round < 20000; round++) {
+		q.n = 0;
+		n = 1 + (u32)rand() % M_CAN_RXQ_MAX;
+		for (src = 0; src < M_CAN_SIM_SRCS; src++)
+			base[src] = (u64)rand() % 50;
+		for (i = 0; i < n; i++) {
+			src = round & 1 ? (u32)rand() % M_CAN_SIM_SRCS :
+					  i * M_CAN_SIM_SRCS / n;
+			base[src] += (u64)rand() % 4;
+			ref[i].key = base[src];
+			ref[i].item = (void *)(uintptr_t)(i + 1);
+			moved = m_can_rxq_add(&q, ref[i].key, ref[i].item);
+			CHECK(moved >= 0 && (u32)moved <= i, "round %u: moved %d",
+			      round, moved);
+		}
+		qsort(ref, n, sizeof(ref[0]), cmp_key);
+		for (i = 0; i < n; i++)
+			CHECK(q.ent[i].key == ref[i].key &&
+			      q.ent[i].item == ref[i].item,
+			      "round %u entry %u differs", round, i);
+	}
+
+	q.n = M_CAN_RXQ_MAX;
+	CHECK(m_can_rxq_add(&q, 0, NULL) == -1, "full queue took an entry");
+	printf("queue: 20000 rounds\r\n");
+}
+
+static int self_test(u32 bitrate, u32 load, u64 cost_ns, u32 seconds,
+		     int custom)
+{
+	srand(1);
+	test_queue();
+
+	if (custom) {
+		sim_case(bitrate, load, cost_ns, seconds, 0);
+	} else {
+		/* reads take no time: nothing may come out of order */
+		sim_case(1000000, 90, 0, 10, 2);
+		sim_case(500000, 60, 0, 10, 2);
+		/* slow reads: frames finishing during a poll can still be
+		 * handed off a poll late, behind newer ones of another FIFO
+		 */
+		sim_case(1000000, 90, 1000, 10, 1);
+		sim_case(1000000, 99, 2000, 10, 1);
+		/* many counter wraps */
+		sim_case(125000, 50, 1000, 120, 1);
+	}
+
+	printf("%s: %d failures\r\n", fails ? "FAIL" : "PASS", fails);
+	return fails ? 1 : 0;
+}
+
+static int watch(const char *ifname, long count)
+{
+	struct hwtstamp_config cfg = { .tx_type = HWTSTAMP_TX_ON,
+				       .rx_filter = HWTSTAMP_FILTER_ALL };
+	int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	char ctrl[CMSG_SPACE(3 * sizeof(struct timespec))];
+	struct sockaddr_can addr;
+	struct canfd_frame f;
+	struct iovec iov = { &f, sizeof(f) };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct ifreq ifr;
+	long long hw, last = 0, worst = 0;
+	unsigned long frames = 0, nots = 0, inversions = 0;
+	int s, on = 1;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror(ifname);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on));
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	ifr.ifr_data = (void *)&cfg;
+	if (ioctl(s, SIOCSHWTSTAMP, &ifr) < 0)
+		perror("SIOCSHWTSTAMP");
+	setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+	while (count < 0 || count-- > 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if (recvmsg(s, &msg, 0) < 0) {
+			perror("recvmsg");
+			return 1;
+		}
+
+		hw = 0;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+				struct timespec *ts = (struct timespec *)CMSG_DATA(cm);
+
+				hw = ts[2].tv_sec * 1000000000LL + ts[2].tv_nsec;
+			}
+		}
+
+		frames++;
+		if (!hw) {
+			nots++;
+			continue;
+		}
+		if (last && hw < last) {
+			inversions++;
+			if (last - hw > worst)
+				worst = last - hw;
+		}
+		last = hw;
+
+		if (frames % 10000 == 0)
+			printf("%lu frames, %lu without timestamp, %lu out of order, worst %.1f us\r\n",
+			       frames, nots, inversions, worst / 1000.0);
+	}
+
+	printf("%lu frames, %lu without timestamp, %lu out of order, worst %.1f us\r\n",
+	       frames, nots, inversions, worst / 1000.0);
+	close(s);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "can0";
+	u32 bitrate = 1000000, load = 90, seconds = 10;
+	u64 cost_ns = 1000;
+	int opt, test = 0, custom = 0;
+	long count = -1;
+
+	while ((opt = getopt(argc, argv, "i:n:tb:l:c:s:")) != -1) {
+		switch (opt) {
+		case 'i': ifname = optarg; break;
+		case 'n': count = atol(optarg); break;
+		case 't': test = 1; break;
+		case 'b': bitrate = (u32)atol(optarg); custom = 1; break;
+		case 'l': load = (u32)atol(optarg); custom = 1; break;
+		case 'c': cost_ns = (u64)atoll(optarg); custom = 1; break;
+		case 's': seconds = (u32)atol(optarg); custom = 1; break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+
+	if (test) {
+		if (bitrate < 1000 || !load || load > 100 || !seconds) {
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+		return self_test(bitrate, load, cost_ns, seconds, custom);
+	}
+
+	return watch(ifname, count);
+}
@@ -0,0 +1,462 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/can/error.h>
+#include "m_can_stats.h"
+
+/*
+ * CAN bus load and top talkers, with the statistics engine the M_CAN
+ * driver runs in its NAPI poll (m_can_stats.h).
+ *
+ * Usage: ./canStatsApp -i can0 [-b bitrate] [-B data_bitrate] [-d s]
+ *        ./canStatsApp -t
+ *   -i : listen on an interface (vcan works too) and print the load, the
+ *        frame and bus error counts and the ten busiest ids every second
+ *   -b : nominal bit rate, default 500000
+ *   -B : CAN FD data bit rate, default the nominal one
+ *   -d : stop after this many seconds, default runs until interrupted
+ *   -t : offline test: frame lengths against a bit by bit reference,
+ *        worst case bounds, the id table against an exact count, and
+ *        the load of synthetic traffic
+ *
+ * On the board the driver keeps the same numbers for every frame it
+ * receives or sends:
+ *   cat /sys/kernel/debug/m_can/<dev>/bus_stats
+ */
+
+static int fails;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		if (fails++ < 20) {					\
+			printf("  " __VA_ARGS__);			\
+			printf("\r\n");					\
+		}							\
+	}								\
+} while (0)
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Reference frame length: the unstuffed bits in an array, CRC-15 over
+ * them, then stuffing by looking back at the last five bits sent.
+ */
+struct ref {
+	u8 bit[700];
+	u8 phase[700];
+	int n;
+};
+
+static void ref_put(struct ref *r, u32 val, int width, int phase)
+{
+	while (width--) {
+		r->bit[r->n] = (val >> width) & 1;
+		r->phase[r->n++] = phase;
+	}
+}
+
+static u32 ref_crc15(const struct ref *r)
+{
+	u32 crc = 0, i, nxt;
+
+	for (i = 0; i < (u32)r->n; i++) {
+		nxt = r->bit[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7fff;
+		if (nxt)
+			crc ^= 0x4599;
+	}
+	return crc;
+}
+
+static void ref_stuff(const struct ref *r, int tail_stuff, u32 *n)
+{
+	u8 out[1000];
+	int o = 0, i, k, same;
+
+	for (i = 0; i <= r->n; i++) {
+		same = o >= 5;
+		for (k = 1; same && k < 5; k++)
+			same = out[o - 1 - k] == out[o - 1];
+		if (same && (i < r->n || tail_stuff)) {
+			out[o] = !out[o - 1];
+			n[i < r->n ? r->phase[i] : r->phase[r->n - 1]]++;
+			o++;
+		}
+		if (i == r->n)
+			break;
+		out[o++] = r->bit[i];
+		n[r->phase[i]]++;
+	}
+}
+
+static void ref_bits(canid_t can_id, const u8 *data, u32 len, bool fd,
+		     u32 flags, u32 *nbits, u32 *dbits)
+{
+	static struct ref r;
+	int eff = !!(can_id & CAN_EFF_FLAG);
+	int rtr = !fd && (can_id & CAN_RTR_FLAG);
+	int dp = fd && (flags & CANFD_BRS) ? 1 : 0;
+	u32 id = can_id & (eff ? CAN_EFF_MASK : CAN_SFF_MASK);
+	u32 n[2] = { 0, 0 }, i, crc_len;
+
+	r.n = 0;
+	ref_put(&r, 0, 1, 0);
+	if (eff) {
+		ref_put(&r, id >> 18, 11, 0);
+		ref_put(&r, 1, 1, 0);		/* SRR */
+		ref_put(&r, 1, 1, 0);		/* IDE */
+		ref_put(&r, id & 0x3ffff, 18, 0);
+	} else {
+		ref_put(&r, id, 11, 0);
+	}
+
+	if (!fd) {
+		if (len > 8)
+			len = 8;
+		ref_put(&r, rtr, 1, 0);
+		ref_put(&r, 0, 2, 0);
+		ref_put(&r, len, 4, 0);
+		for (i = 0; !rtr && i < len; i++)
+			ref_put(&r, data[i], 8, 0);
+		ref_put(&r, ref_crc15(&r), 15, 0);
+		ref_stuff(&r, 1, n);
+		*nbits = n[0] + 10 + 3;
+		*dbits = 0;
+		return;
+	}
+
+	ref_put(&r, 0, 1, 0);			/* RRS */
+	if (!eff)
+		ref_put(&r, 0, 1, 0);		/* IDE */
+	ref_put(&r, 1, 1, 0);			/* FDF */
+	ref_put(&r, 0, 1, 0);			/* res */
+	ref_put(&r, !!(flags & CANFD_BRS), 1, 0);
+	ref_put(&r, !!(flags & CANFD_ESI), 1, dp);
+	ref_put(&r, m_can_len2dlc(len), 4, dp);
+	for (i = 0; i < len; i++)
+		ref_put(&r, data[i], 8, dp);
+	ref_stuff(&r, 0, n);
+
+	/* stuff count 4, CRC, one fixed stuff bit per 4 bits and in front */
+	crc_len = len > 16 ? 21 : 17;
+	n[dp] += 4 + crc_len + 1 + (4 + crc_len - 1) / 4;
+	n[dp] += 1;				/* CRC delimiter */
+	*nbits = n[0] + 2 + 7 + 3;
+	*dbits = n[1];
+}
+
+static const u8 fd_lens[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24,
+			      32, 48, 64 };
+
+static void random_frame(canid_t *id, u8 *data, u32 *len, bool *fd,
+			 u32 *flags)
+{
+	int i, pattern = rand() % 4;
+
+	*fd = rand() % 2;
+	*id = rand() % 2 ? ((u32)rand() & CAN_EFF_MASK) | CAN_EFF_FLAG :
+			   (u32)rand() & CAN_SFF_MASK;
+	if (!*fd && rand() % 8 == 0)
+		*id |= CAN_RTR_FLAG;
+	*flags = *fd ? rand() % 4 : 0;
+	*len = *fd ? fd_lens[rand() % sizeof(fd_lens)] : rand() % 9;
+	for (i = 0; i < 64; i++) {
+		/* long runs make the stuffing interesting */
+		if (pattern == 0)
+			data[i] = 0;
+		else if (pattern == 1)
+			data[i] = 0xff;
+		else if (pattern == 2)
+			data[i] = rand() % 2 ? 0x0f : 0xf0;
+		else
+			data[i] = rand();
+	}
+	if (rand() % 8 == 0)
+		*id = *id & CAN_EFF_FLAG ? CAN_EFF_FLAG : 0;
+}
+
+static void test_lengths(void)
+{
+	static const u8 zero[64];
+	u32 nb, db, rn, rd, i, min, max, len, flags, worst = 0;
+	u8 data[64];
+	canid_t id;
+	bool fd;
+
+	for (i = 0; i < 200000; i++) {
+		random_frame(&id, data, &len, &fd, &flags);
+		m_can_frame_bits(id, data, len, fd, flags, &nb, &db);
+		ref_bits(id, data, len, fd, flags, &rn, &rd);
+		CHECK(nb == rn && db == rd,
+		      "id %x len %u fd %d flags %u: %u+%u bits, want %u+%u",
+		      id, len, fd, flags, nb, db, rn, rd);
+
+		/* classic frames: unstuffed length up to the worst case */
+		if (!fd) {
+			if (id & CAN_RTR_FLAG)
+				len = 0;
+			min = (id & CAN_EFF_FLAG ? 67 : 47) + 8 * len;
+			max = min + (min - 13 - 1) / 4;
+			CHECK(nb >= min && nb <= max,
+			      "id %x len %u: %u bits outside %u..%u",
+			      id, len, nb, min, max);
+			if (len == 8 && !(id & CAN_EFF_FLAG) && nb > worst)
+				worst = nb;
+		}
+	}
+
+	/* known lengths: all-zero standard frames */
+	m_can_frame_bits(0, zero, 8, false, 0, &nb, &db);
+	ref_bits(0, zero, 8, false, 0, &rn, &rd);
+	CHECK(nb == rn, "id 0 len 8: %u bits, want %u", nb, rn);
+	m_can_frame_bits(0x7ff, zero, 0, false, 0, &nb, &db);
+	CHECK(nb >= 47 && nb <= 55, "id 7ff len 0: %u bits", nb);
+
+	/* FD without BRS stays in the nominal phase */
+	m_can_frame_bits(0x123, zero, 64, true, 0, &nb, &db);
+	CHECK(db == 0 && nb > 64 * 8, "FD no BRS: %u+%u bits", nb, db);
+	m_can_frame_bits(0x123, zero, 64, true, CANFD_BRS, &nb, &db);
+	CHECK(nb < 40 && db > 64 * 8, "FD BRS: %u+%u bits", nb, db);
+
+	printf("lengths: 200000 frames, longest 8 byte standard frame %u bits\r\n",
+	       worst);
+}
+
+static void test_table(int ids)
+{
+	static struct m_can_stats st;
+	static u32 want[4096];
+	static canid_t idv[4096];
+	u32 i, f, total = 0, in_table = 0, sum = 0, k;
+	struct m_can_stats_id *e;
+	u8 data[8] = { 0 };
+
+	m_can_stats_reset(&st, 0, 0);
+	m_can_stats_rates(&st, 500000, 0);
+	memset(want, 0, sizeof(want));
+	for (i = 0; i < (u32)ids; i++)
+		idv[i] = rand() % 2 ? ((u32)rand() & CAN_EFF_MASK) | CAN_EFF_FLAG :
+				      (u32)rand() & CAN_SFF_MASK;
+
+	/* skewed: a few ids carry most of the traffic */
+	for (f = 0; f < 100000; f++) {
+		k = rand() % 4 ? rand() % (ids < 8 ? ids : 8) : rand() % ids;
+		/* RTR frames count for their id */
+		m_can_stats_frame(&st, idv[k] | (f % 7 ? 0 : CAN_RTR_FLAG),
+				  data, 8, false, 0);
+		want[k]++;
+		total++;
+	}
+
+	CHECK(st.nids <= M_CAN_STATS_IDS_MAX, "%u ids in the table", st.nids);
+	for (i = 0; i < M_CAN_STATS_IDS; i++)
+		if (st.ids[i].key != M_CAN_STATS_EMPTY) {
+			in_table++;
+			sum += st.ids[i].frames;
+		}
+	CHECK(in_table == st.nids, "%u slots used, nids %u", in_table, st.nids);
+	CHECK(sum + st.other_frames == total, "%u + %u frames, want %u", sum,
+	      st.other_frames, total);
+	CHECK(st.frames == total, "total %llu, want %u",
+	      (unsigned long long)st.frames, total);
+
+	/* every id is either counted exactly in the table or not at all */
+	sum = 0;
+	for (k = 0; k < (u32)ids; k++) {
+		e = NULL;
+		for (i = 0; i < M_CAN_STATS_IDS; i++)
+			if (st.ids[i].key == idv[k])
+				e = &st.ids[i];
+		if (e) {
+			/* duplicate random ids share a slot */
+			for (f = 0, i = 0; i < (u32)ids; i++)
+				if (idv[i] == idv[k])
+					f += want[i];
+			CHECK(e->frames == f, "id %x: %u frames, want %u",
+			      idv[k], e->frames, f);
+		} else {
+			sum += want[k];
+		}
+	}
+	CHECK(sum == st.other_frames, "other %u frames, want %u",
+	      st.other_frames, sum);
+
+	printf("table: %4d ids, %3u tracked, %u of %u frames in other\r\n",
+	       ids, st.nids, st.other_frames, total);
+}
+
+static void test_load(u32 bitrate, u32 dbitrate, bool fd, u32 flags,
+		      u32 len, u32 gap_us)
+{
+	static struct m_can_stats st;
+	u8 data[64];
+	u32 nb, db, want, i;
+	u64 t = 0, ps;
+	const struct m_can_stats_win *w;
+
+	memset(data, 0x55, sizeof(data));
+	m_can_frame_bits(0x100, data, len, fd, flags, &nb, &db);
+	ps = (u64)nb * (1000000000000ULL / bitrate) +
+	     (u64)db * (1000000000000ULL / dbitrate);
+	want = ps / gap_us / 1000;
+
+	m_can_stats_reset(&st, 0, 0);
+	m_can_stats_rates(&st, bitrate, dbitrate);
+	for (t = 0; t < 10 * M_CAN_STATS_WINDOW_NS; t += gap_us * 1000ULL) {
+		if (m_can_stats_due(&st, t))
+			m_can_stats_close(&st, t, 0, 0, 0);
+		m_can_stats_frame(&st, 0x100, data, len, fd, flags);
+	}
+
+	CHECK(st.hist_count == 9, "%u windows", st.hist_count);
+	for (i = 0; i < st.hist_count; i++) {
+		w = m_can_stats_hist(&st, i);
+		CHECK(w->load_pm + 1 >= want && w->load_pm <= want + 1,
+		      "window %u: %u per mille, want %u", i, w->load_pm, want);
+	}
+	printf("load: %7u/%7u bit/s %2u bytes%s every %4u us: %u+%u bits, %u per mille\r\n",
+	       bitrate, dbitrate, len, fd ? (flags & CANFD_BRS ? " FD BRS" : " FD") : "",
+	       gap_us, nb, db, m_can_stats_hist(&st, 0)->load_pm);
+}
+
+static int self_test(void)
+{
+	srand(1);
+	m_can_stats_init_tabs();
+
+	test_lengths();
+	test_table(5);
+	test_table(150);
+	test_table(400);
+	test_table(4000);
+	test_load(500000, 500000, false, 0, 8, 300);
+	test_load(1000000, 1000000, false, 0, 8, 125);
+	test_load(500000, 2000000, true, CANFD_BRS, 64, 500);
+	test_load(500000, 2000000, true, 0, 64, 2000);
+
+	printf("%s: %d failures\r\n", fails ? "FAIL" : "PASS", fails);
+	return fails ? 1 : 0;
+}
+
+static void print_stats(struct m_can_stats *st)
+{
+	static struct m_can_stats_id top[M_CAN_STATS_IDS];
+	const struct m_can_stats_win *w = m_can_stats_hist(st, st->hist_count - 1);
+	int i;
+
+	printf("load %3u.%u%%  peak %3u.%u%%  frames %u  bus errors %u\r\n",
+	       w->load_pm / 10, w->load_pm % 10, st->peak_pm / 10,
+	       st->peak_pm % 10, w->frames, w->bus_errors);
+
+	memcpy(top, st->ids, sizeof(top));
+	qsort(top, M_CAN_STATS_IDS, sizeof(top[0]), m_can_stats_cmp);
+	for (i = 0; i < 10 && top[i].key != M_CAN_STATS_EMPTY; i++)
+		printf("  %*x  %8u frames  %5.1f%% of bus time\r\n",
+		       top[i].key & CAN_EFF_FLAG ? 8 : 3,
+		       top[i].key & CAN_EFF_MASK, top[i].frames,
+		       st->busy_ps ? 100.0 * top[i].busy_ps / st->busy_ps : 0.0);
+	if (st->other_frames)
+		printf("  other     %8u frames\r\n", st->other_frames);
+}
+
+static int listen_can(const char *ifname, u32 bitrate, u32 dbitrate,
+		      int duration)
+{
+	static struct m_can_stats st;
+	struct timeval tv = { 0, 100000 };
+	can_err_mask_t err_mask = CAN_ERR_PROT | CAN_ERR_BUSERROR;
+	struct sockaddr_can addr;
+	struct canfd_frame f;
+	struct ifreq ifr;
+	u32 bus_errors = 0;
+	u64 t0, t;
+	int s, on = 1;
+	ssize_t n;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror(ifname);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask));
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	m_can_stats_init_tabs();
+	t0 = now_ns();
+	m_can_stats_reset(&st, t0, 0);
+	m_can_stats_rates(&st, bitrate, dbitrate);
+
+	for (;;) {
+		n = read(s, &f, sizeof(f));
+		t = now_ns();
+		if (n == CAN_MTU || n == CANFD_MTU) {
+			if (f.can_id & CAN_ERR_FLAG)
+				bus_errors++;
+			else
+				m_can_stats_frame(&st, f.can_id, f.data, f.len,
+						  n == CANFD_MTU, f.flags);
+		}
+		if (m_can_stats_due(&st, t)) {
+			m_can_stats_close(&st, t, 0, 0, bus_errors);
+			print_stats(&st);
+		}
+		if (duration && t - t0 >= duration * 1000000000ull)
+			break;
+	}
+
+	close(s);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "can0";
+	u32 bitrate = 500000, dbitrate = 0;
+	int duration = 0, opt;
+
+	while ((opt = getopt(argc, argv, "i:b:B:d:t")) != -1) {
+		switch (opt) {
+		case 'i': ifname = optarg; break;
+		case 'b': bitrate = strtoul(optarg, NULL, 0); break;
+		case 'B': dbitrate = strtoul(optarg, NULL, 0); break;
+		case 'd': duration = atoi(optarg); break;
+		case 't': return self_test();
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (!bitrate) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	return listen_can(ifname, bitrate, dbitrate ? dbitrate : bitrate,
+			  duration);
+}
@@ -0,0 +1,181 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include "m_can_ts.h"
+
+/*
+ * M_CAN hardware timestamps.
+ *
+ * Usage: ./canTstampApp [-i can0] [-n frames]
+ *        ./canTstampApp -t
+ *   -i : turn on hardware timestamping (SIOCSHWTSTAMP) and print every
+ *        frame with its hardware and software receive time, the gap to
+ *        the previous frame on both clocks, and hardware minus software
+ *   -n : stop after this many frames, default runs until interrupted
+ *   -t : offline test of the 16-bit counter extension in m_can_ts.h:
+ *        an hour of simulated counter per frequency, reads at random
+ *        intervals up to 90% of a wrap, frame timestamps up to 45% of a
+ *        wrap before and after each read
+ */
+
+static int fails;
+
+static void test_freq(u32 freq, u64 seconds)
+{
+	const u32 mask = 0xffff;
+	const u64 start_ns = 1700000000ULL * 1000000000ULL;
+	u64 tick = 123456, end = seconds * freq, f, want, got;
+	struct m_can_tc tc;
+	long long err, max_err = 0, bound;
+	unsigned long reads = 0, frames = 0;
+	int i;
+
+	m_can_tc_init(&tc, mask, freq, (u32)tick, start_ns + tick * 1000000000ULL / freq);
+	while (tick < end) {
+		tick += 1 + (u64)rand() % (mask * 9 / 10);
+		m_can_tc_read(&tc, (u32)tick);
+		reads++;
+
+		for (i = 0; i < 4; i++) {
+			f = tick - mask * 45 / 100 + (u64)rand() % (mask * 90 / 100);
+			want = start_ns + (u64)((long double)f * 1e9L / freq);
+			got = m_can_tc_cyc2time(&tc, (u32)f);
+			err = (long long)(got - want);
+			if (err < 0)
+				err = -err;
+			if (err > max_err)
+				max_err = err;
+			/* truncation of mult: 2^-24 ns per count, plus rounding */
+			bound = 2 + (long long)(f >> M_CAN_TC_SHIFT);
+			if (err > bound && fails++ < 10)
+				printf("  %u Hz tick %llu: %llu ns, want %llu\r\n", freq,
+				       (unsigned long long)f, (unsigned long long)got,
+				       (unsigned long long)want);
+			frames++;
+		}
+	}
+	printf("%8u Hz: %lu reads %lu frames, wrap %llu us, max error %lld ns\r\n",
+	       freq, reads, frames, (unsigned long long)m_can_tc_wrap_ns(&tc) / 1000,
+	       max_err);
+}
+
+static int self_test(void)
+{
+	/* bit rates with TCP = 0 and 15, and an external 8 MHz counter */
+	static const u32 freq[] = { 1000, 10000, 62500, 125000, 250000, 333333,
+				    500000, 1000000, 2000000, 8000000 };
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < sizeof(freq) / sizeof(freq[0]); i++)
+		test_freq(freq[i], 3600);
+
+	printf("%s: %d failures\r\n", fails ? "FAIL" : "PASS", fails);
+	return fails ? 1 : 0;
+}
+
+static int dump(const char *ifname, long count)
+{
+	struct hwtstamp_config cfg = { .tx_type = HWTSTAMP_TX_ON,
+				       .rx_filter = HWTSTAMP_FILTER_ALL };
+	int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+		    SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	char ctrl[CMSG_SPACE(3 * sizeof(struct timespec))];
+	struct sockaddr_can addr;
+	struct canfd_frame f;
+	struct iovec iov = { &f, sizeof(f) };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct ifreq ifr;
+	long long hw, sw, last_hw = 0, last_sw = 0;
+	int s, on = 1;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror(ifname);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	ifr.ifr_data = (void *)&cfg;
+	if (ioctl(s, SIOCSHWTSTAMP, &ifr) < 0)
+		perror("SIOCSHWTSTAMP");
+	setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+	printf("id       len  hw_ns               sw_ns               hw_gap_us  sw_gap_us  hw-sw_us\r\n");
+	while (count < 0 || count-- > 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if (recvmsg(s, &msg, 0) < 0) {
+			perror("recvmsg");
+			return 1;
+		}
+
+		hw = sw = 0;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+				struct timespec *ts = (struct timespec *)CMSG_DATA(cm);
+
+				sw = ts[0].tv_sec * 1000000000LL + ts[0].tv_nsec;
+				hw = ts[2].tv_sec * 1000000000LL + ts[2].tv_nsec;
+			}
+		}
+
+		printf("%08x %2d  %-18lld  %-18lld  %9.1f  %9.1f  %8.1f\r\n",
+		       f.can_id, f.len, hw, sw,
+		       last_hw && hw ? (hw - last_hw) / 1000.0 : 0.0,
+		       last_sw ? (sw - last_sw) / 1000.0 : 0.0,
+		       hw ? (hw - sw) / 1000.0 : 0.0);
+		last_hw = hw;
+		last_sw = sw;
+	}
+
+	close(s);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "can0";
+	long count = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:n:t")) != -1) {
+		switch (opt) {
+		case 'i': ifname = optarg; break;
+		case 'n': count = atol(optarg); break;
+		case 't': return self_test();
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+
+	return dump(ifname, count);
+}
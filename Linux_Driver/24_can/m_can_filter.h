@@ -0,0 +1,452 @@
+#ifndef M_CAN_FILTER_H
+#define M_CAN_FILTER_H
+
+/*
+ * M_CAN acceptance filter compiler, shared by m_can_platform.ko and
+ * canFilterApp so a rule set can be checked against a simulated message
+ * RAM before it is loaded on the board.
+ *
+ * Rules use the candump / CAN_RAW_FILTER notation, separated by commas or
+ * whitespace, '#' starts a comment:
+ *	<id>:<mask>	classic id/mask filter
+ *	<id>-<id>	inclusive id range
+ * followed by an optional action keyword: "fifo0" (default), "fifo1" for
+ * the priority FIFO the driver drains first, or "reject".
+ * An id written with 8 hex digits, or above 0x7ff, is a 29-bit id, so
+ * "123:7ff" only matches standard frames and "00000123:1fffffff" only the
+ * extended one.
+ *
+ * The compiler turns prefix masks into ranges, merges overlapping and
+ * adjacent ranges, packs single ids two per dual-id element and orders the
+ * list reject rules first, then FIFO 1 rules, then FIFO 0 rules, since the
+ * controller stops at the first matching element. With at least one rule
+ * loaded, frames matching no element are rejected by the controller and
+ * never reach the CPU.
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#else
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#define M_CAN_FILT_STD_MAX	128	/* SIDFC.LSS limit */
+#define M_CAN_FILT_EXT_MAX	64	/* XIDFC.LSE limit */
+#define M_CAN_FILT_RULES_MAX	256
+
+#define M_CAN_FILT_SFF_MASK	0x7ff
+#define M_CAN_FILT_EFF_MASK	0x1fffffff
+
+/* Standard Message ID Filter Element */
+#define SIDF_SFT_SHIFT		30
+#define SIDF_SFEC_SHIFT		27
+#define SIDF_SFID1_SHIFT	16
+#define SIDF_SFID2_MASK		0x7ff
+
+/* Extended Message ID Filter Element, F0 and F1 */
+#define XIDF_EFEC_SHIFT		29
+#define XIDF_EFT_SHIFT		30
+#define XIDF_EFID_MASK		0x1fffffff
+
+/* Filter type, SFT/EFT (EFT range uses XIDAM, programmed to all ones) */
+#define FILT_TYPE_RANGE		0x0
+#define FILT_TYPE_DUAL		0x1
+#define FILT_TYPE_CLASSIC	0x2
+#define FILT_TYPE_DISABLED	0x3
+
+/* Filter element configuration, SFEC/EFEC */
+#define FILT_EC_DISABLE		0x0
+#define FILT_EC_FIFO0		0x1
+#define FILT_EC_FIFO1		0x2
+#define FILT_EC_REJECT		0x3
+
+/* Global Filter Configuration (GFC) */
+#define GFC_ANFS_SHIFT		4
+#define GFC_ANFE_SHIFT		2
+#define GFC_ANF_FIFO0		0x0
+#define GFC_ANF_FIFO1		0x1
+#define GFC_ANF_REJECT		0x2
+#define GFC_RRFS		0x2
+#define GFC_RRFE		0x1
+
+/* Actions, in the order their elements are placed in the list */
+enum m_can_filt_action {
+	M_CAN_FILT_REJECT = 0,
+	M_CAN_FILT_FIFO1,
+	M_CAN_FILT_FIFO0,
+	M_CAN_FILT_ACTIONS,
+};
+
+enum m_can_filt_type {
+	M_CAN_FILT_MASK = 0,
+	M_CAN_FILT_RANGE,
+};
+
+struct m_can_filt_rule {
+	unsigned int id1;		/* id, or first id of the range */
+	unsigned int id2;		/* mask, or last id of the range */
+	unsigned char type;
+	unsigned char xtd;
+	unsigned char action;
+};
+
+struct m_can_filt_span {
+	unsigned int lo;
+	unsigned int hi;
+	unsigned short rule;
+};
+
+struct m_can_filt_set {
+	struct m_can_filt_rule rule[M_CAN_FILT_RULES_MAX];
+	int nrules;
+
+	/* compiled image, as written to message RAM and GFC */
+	unsigned int sid[M_CAN_FILT_STD_MAX];
+	unsigned int xid[M_CAN_FILT_EXT_MAX][2];
+	unsigned short sid_rule[M_CAN_FILT_STD_MAX];	/* lowest source rule */
+	unsigned short xid_rule[M_CAN_FILT_EXT_MAX];
+	int nsid;
+	int nxid;
+	unsigned int gfc;
+
+	/* compiler scratch */
+	struct m_can_filt_span span[M_CAN_FILT_RULES_MAX];
+};
+
+static const unsigned char m_can_filt_ec[M_CAN_FILT_ACTIONS] = {
+	[M_CAN_FILT_REJECT] = FILT_EC_REJECT,
+	[M_CAN_FILT_FIFO1] = FILT_EC_FIFO1,
+	[M_CAN_FILT_FIFO0] = FILT_EC_FIFO0,
+};
+
+static const char * const m_can_filt_action_name[M_CAN_FILT_ACTIONS] = {
+	[M_CAN_FILT_REJECT] = "reject",
+	[M_CAN_FILT_FIFO1] = "fifo1",
+	[M_CAN_FILT_FIFO0] = "fifo0",
+};
+
+static inline const char *m_can_filt_hex(const char *s, unsigned int *val,
+					 int *digits)
+{
+	unsigned int v = 0;
+	int n = 0, d;
+
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+		s += 2;
+
+	for (;; s++) {
+		if (*s >= '0' && *s <= '9')
+			d = *s - '0';
+		else if ((*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+			d = (*s | 0x20) - 'a' + 10;
+		else
+			break;
+		if (++n > 8)
+			return NULL;
+		v = (v << 4) | d;
+	}
+	if (!n)
+		return NULL;
+
+	*val = v;
+	*digits = n;
+	return s;
+}
+
+static inline int m_can_filt_is_sep(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+}
+
+/*
+ * Parse a rule set. Returns 0, -EINVAL on a malformed rule (fs->nrules is
+ * then the index of the offending rule) or -E2BIG on too many rules.
+ */
+static inline int m_can_filt_parse(struct m_can_filt_set *fs, const char *s)
+{
+	struct m_can_filt_rule *r = NULL;
+	unsigned int id1, id2, lim;
+	const char *end, *p;
+	int d1, d2, a;
+	char op;
+
+	fs->nrules = 0;
+	for (;;) {
+		while (m_can_filt_is_sep(*s))
+			s++;
+		if (*s == '#') {
+			while (*s && *s != '\n')
+				s++;
+			continue;
+		}
+		if (!*s)
+			break;
+
+		for (end = s; *end && *end != '#' && !m_can_filt_is_sep(*end);)
+			end++;
+
+		/* action keyword for the preceding rule */
+		for (a = 0; a < M_CAN_FILT_ACTIONS; a++)
+			if (strlen(m_can_filt_action_name[a]) == (size_t)(end - s) &&
+			    !strncmp(s, m_can_filt_action_name[a], end - s))
+				break;
+		if (a < M_CAN_FILT_ACTIONS) {
+			if (!r)
+				return -EINVAL;
+			r->action = a;
+			s = end;
+			continue;
+		}
+
+		if (fs->nrules == M_CAN_FILT_RULES_MAX)
+			return -E2BIG;
+		r = &fs->rule[fs->nrules];
+
+		p = m_can_filt_hex(s, &id1, &d1);
+		if (!p || (*p != ':' && *p != '-'))
+			return -EINVAL;
+		op = *p;
+		p = m_can_filt_hex(p + 1, &id2, &d2);
+		if (!p || p != end)
+			return -EINVAL;
+
+		r->action = M_CAN_FILT_FIFO0;
+		if (op == ':') {
+			r->type = M_CAN_FILT_MASK;
+			r->xtd = d1 == 8 || id1 > M_CAN_FILT_SFF_MASK;
+			lim = r->xtd ? M_CAN_FILT_EFF_MASK : M_CAN_FILT_SFF_MASK;
+			if (id1 > lim)
+				return -EINVAL;
+			/* CAN_EFF_FLAG/CAN_RTR_FLAG in a socket mask are dropped */
+			r->id2 = id2 & lim;
+			r->id1 = id1 & r->id2;
+		} else {
+			r->type = M_CAN_FILT_RANGE;
+			r->xtd = d1 == 8 || d2 == 8 || id2 > M_CAN_FILT_SFF_MASK;
+			lim = r->xtd ? M_CAN_FILT_EFF_MASK : M_CAN_FILT_SFF_MASK;
+			if (id1 > id2 || id2 > lim)
+				return -EINVAL;
+			r->id1 = id1;
+			r->id2 = id2;
+		}
+		fs->nrules++;
+		s = end;
+	}
+
+	return 0;
+}
+
+static inline void m_can_filt_add(struct m_can_filt_set *fs, int xtd,
+				  unsigned int type, int action,
+				  unsigned int id1, unsigned int id2, int rule)
+{
+	unsigned int ec = m_can_filt_ec[action];
+	int i;
+
+	if (!xtd) {
+		i = fs->nsid++;
+		if (i >= M_CAN_FILT_STD_MAX)
+			return;
+		fs->sid[i] = (type << SIDF_SFT_SHIFT) | (ec << SIDF_SFEC_SHIFT) |
+			     (id1 << SIDF_SFID1_SHIFT) | id2;
+		fs->sid_rule[i] = rule;
+	} else {
+		i = fs->nxid++;
+		if (i >= M_CAN_FILT_EXT_MAX)
+			return;
+		fs->xid[i][0] = (ec << XIDF_EFEC_SHIFT) | id1;
+		fs->xid[i][1] = (type << XIDF_EFT_SHIFT) | id2;
+		fs->xid_rule[i] = rule;
+	}
+}
+
+/* Emit the elements of one frame format and action */
+static inline void m_can_filt_emit(struct m_can_filt_set *fs, int xtd,
+				   int action)
+{
+	unsigned int lim = xtd ? M_CAN_FILT_EFF_MASK : M_CAN_FILT_SFF_MASK;
+	struct m_can_filt_span *sp = fs->span, t;
+	const struct m_can_filt_rule *r;
+	int i, j, n = 0, single = -1;
+	unsigned int inv;
+
+	for (i = 0; i < fs->nrules; i++) {
+		r = &fs->rule[i];
+		if (r->xtd != xtd || r->action != action)
+			continue;
+
+		if (r->type == M_CAN_FILT_RANGE) {
+			sp[n].lo = r->id1;
+			sp[n].hi = r->id2;
+			sp[n++].rule = i;
+			continue;
+		}
+
+		/* mask with contiguous don't-care low bits is a range */
+		inv = ~r->id2 & lim;
+		if (!(inv & (inv + 1))) {
+			sp[n].lo = r->id1;
+			sp[n].hi = r->id1 | inv;
+			sp[n++].rule = i;
+			continue;
+		}
+
+		for (j = 0; j < i; j++)
+			if (fs->rule[j].type == r->type &&
+			    fs->rule[j].xtd == xtd &&
+			    fs->rule[j].action == action &&
+			    fs->rule[j].id1 == r->id1 &&
+			    fs->rule[j].id2 == r->id2)
+				break;
+		if (j == i)
+			m_can_filt_add(fs, xtd, FILT_TYPE_CLASSIC, action,
+				       r->id1, r->id2, i);
+	}
+
+	/* sort by first id, the lists are short */
+	for (i = 1; i < n; i++) {
+		t = sp[i];
+		for (j = i; j > 0 && sp[j - 1].lo > t.lo; j--)
+			sp[j] = sp[j - 1];
+		sp[j] = t;
+	}
+
+	/* merge overlapping and adjacent spans */
+	for (i = 0, j = 0; i < n; i++) {
+		if (j && sp[i].lo <= sp[j - 1].hi + 1) {
+			if (sp[i].hi > sp[j - 1].hi)
+				sp[j - 1].hi = sp[i].hi;
+			if (sp[i].rule < sp[j - 1].rule)
+				sp[j - 1].rule = sp[i].rule;
+		} else {
+			sp[j++] = sp[i];
+		}
+	}
+	n = j;
+
+	for (i = 0; i < n; i++) {
+		if (sp[i].lo != sp[i].hi) {
+			m_can_filt_add(fs, xtd, FILT_TYPE_RANGE, action,
+				       sp[i].lo, sp[i].hi, sp[i].rule);
+		} else if (single < 0) {
+			single = i;
+		} else {
+			m_can_filt_add(fs, xtd, FILT_TYPE_DUAL, action,
+				       sp[single].lo, sp[i].lo,
+				       sp[single].rule < sp[i].rule ?
+				       sp[single].rule : sp[i].rule);
+			single = -1;
+		}
+	}
+	if (single >= 0)
+		m_can_filt_add(fs, xtd, FILT_TYPE_DUAL, action,
+			       sp[single].lo, sp[single].lo, sp[single].rule);
+}
+
+/*
+ * Compile the parsed rules for a message RAM with std_max standard and
+ * ext_max extended filter elements. Returns 0 or -ENOSPC; fs->nsid and
+ * fs->nxid then hold the number of elements the rule set needs.
+ */
+static inline int m_can_filt_compile(struct m_can_filt_set *fs, int std_max,
+				     int ext_max)
+{
+	int xtd, a;
+
+	fs->nsid = 0;
+	fs->nxid = 0;
+	for (xtd = 0; xtd < 2; xtd++)
+		for (a = 0; a < M_CAN_FILT_ACTIONS; a++)
+			m_can_filt_emit(fs, xtd, a);
+
+	/* no rules: accept everything into FIFO 0, as without filtering */
+	fs->gfc = 0;
+	if (fs->nrules)
+		fs->gfc = (GFC_ANF_REJECT << GFC_ANFS_SHIFT) |
+			  (GFC_ANF_REJECT << GFC_ANFE_SHIFT);
+
+	if (std_max > M_CAN_FILT_STD_MAX)
+		std_max = M_CAN_FILT_STD_MAX;
+	if (ext_max > M_CAN_FILT_EXT_MAX)
+		ext_max = M_CAN_FILT_EXT_MAX;
+	if (fs->nsid > std_max || fs->nxid > ext_max)
+		return -ENOSPC;
+
+	return 0;
+}
+
+/* Whether any rule needs RX FIFO 1 */
+static inline int m_can_filt_uses_fifo1(const struct m_can_filt_set *fs)
+{
+	int i;
+
+	for (i = 0; i < fs->nrules; i++)
+		if (fs->rule[i].action == M_CAN_FILT_FIFO1)
+			return 1;
+	return 0;
+}
+
+/* Reference semantics of the rule set: the action a frame gets */
+static inline int m_can_filt_match(const struct m_can_filt_set *fs, int xtd,
+				   unsigned int id)
+{
+	const struct m_can_filt_rule *r;
+	int i, best = M_CAN_FILT_ACTIONS;
+
+	for (i = 0; i < fs->nrules; i++) {
+		r = &fs->rule[i];
+		if (r->xtd != xtd || r->action >= best)
+			continue;
+		if (r->type == M_CAN_FILT_MASK ? (id & r->id2) == r->id1 :
+		    id >= r->id1 && id <= r->id2)
+			best = r->action;
+	}
+
+	if (best == M_CAN_FILT_ACTIONS)
+		return fs->nrules ? M_CAN_FILT_REJECT : M_CAN_FILT_FIFO0;
+	return best;
+}
+
+static inline int m_can_filt_rule_str(const struct m_can_filt_rule *r,
+				      char *buf, int len)
+{
+	int w = r->xtd ? 8 : 3;
+
+	return snprintf(buf, len, "%0*x%c%0*x %s", w, r->id1,
+			r->type == M_CAN_FILT_MASK ? ':' : '-', w, r->id2,
+			m_can_filt_action_name[r->action]);
+}
+
+/* Describe filter element i, the way the controller will read it */
+static inline int m_can_filt_elem_str(const struct m_can_filt_set *fs,
+				      int xtd, int i, char *buf, int len)
+{
+	static const char * const type[] = { "range", "dual", "mask", "off" };
+	static const char * const ec[] = { "disabled", "fifo0", "fifo1",
+					   "reject", "prio", "prio-fifo0",
+					   "prio-fifo1", "rxbuf" };
+	unsigned int t, e, id1, id2;
+	int w = xtd ? 8 : 3;
+
+	if (!xtd) {
+		t = fs->sid[i] >> SIDF_SFT_SHIFT;
+		e = (fs->sid[i] >> SIDF_SFEC_SHIFT) & 0x7;
+		id1 = (fs->sid[i] >> SIDF_SFID1_SHIFT) & SIDF_SFID2_MASK;
+		id2 = fs->sid[i] & SIDF_SFID2_MASK;
+	} else {
+		t = fs->xid[i][1] >> XIDF_EFT_SHIFT;
+		e = fs->xid[i][0] >> XIDF_EFEC_SHIFT;
+		id1 = fs->xid[i][0] & XIDF_EFID_MASK;
+		id2 = fs->xid[i][1] & XIDF_EFID_MASK;
+	}
+
+	return snprintf(buf, len, "%s %-5s %0*x %0*x %-6s rule %d",
+			xtd ? "ext" : "std", type[t], w, id1, w, id2, ec[e],
+			xtd ? fs->xid_rule[i] : fs->sid_rule[i]);
+}
+
+#endif
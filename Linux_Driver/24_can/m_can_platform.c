@@ -27,6 +27,25 @@
 #include <linux/iopoll.h>
 #include <linux/can/dev.h>
 #include <linux/pinctrl/consumer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rtnetlink.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/sort.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+
+#include "m_can_filter.h"
+#include "m_can_ts.h"
+#include "m_can_stats.h"
+#include "m_can_rxq.h"
+
+#define CREATE_TRACE_POINTS
+#include "m_can_trace.h"
 
 /* napi related */
 #define M_CAN_NAPI_WEIGHT	64
@@ -175,6 +194,21 @@ enum m_can_mram_cfg {
 #define NBTP_NTSEG2_SHIFT	0
 #define NBTP_NTSEG2_MASK	(0x7f << NBTP_NTSEG2_SHIFT)
 
+/* Timestamp Counter Configuration (TSCC) */
+#define TSCC_TCP_SHIFT		16
+#define TSCC_TCP_MASK		(0xf << TSCC_TCP_SHIFT)
+#define TSCC_TSS_INTERNAL	0x1
+#define TSCC_TSS_EXTERNAL	0x2
+
+/* Timestamp Counter Value (TSCV) */
+#define TSCV_TSC_MASK		0xffff
+
+/* Timeout Counter Configuration (TOCC) */
+#define TOCC_TOP_SHIFT		16
+#define TOCC_TOP_MAX		0xffff
+#define TOCC_TOS_RXF0		(0x2 << 1)
+#define TOCC_ETOC		BIT(0)
+
 /* Error Counter Register(ECR) */
 #define ECR_RP			BIT(15)
 #define ECR_REC_SHIFT		8
@@ -252,6 +286,17 @@ enum m_can_mram_cfg {
 #define ILE_EINT1	BIT(1)
 #define ILE_EINT0	BIT(0)
 
+/* Standard ID Filter Configuration (SIDFC) */
+#define SIDFC_LSS_SHIFT		16
+#define SIDFC_LSS_MASK		(0xff << SIDFC_LSS_SHIFT)
+
+/* Extended ID Filter Configuration (XIDFC) */
+#define XIDFC_LSE_SHIFT		16
+#define XIDFC_LSE_MASK		(0x7f << XIDFC_LSE_SHIFT)
+
+/* Extended ID AND Mask (XIDAM) */
+#define XIDAM_MASK		0x1fffffff
+
 /* Rx FIFO 0/1 Configuration (RXF0C/RXF1C) */
 #define RXFC_FWM_SHIFT	24
 #define RXFC_FWM_MASK	(0x7f << RXFC_FWM_SHIFT)
@@ -327,8 +372,11 @@ enum m_can_mram_cfg {
 #define RX_BUF_RTR		BIT(29)
 /* R1 */
 #define RX_BUF_ANMF		BIT(31)
+#define RX_BUF_FIDX_SHIFT	24
+#define RX_BUF_FIDX_MASK	(0x7f << RX_BUF_FIDX_SHIFT)
 #define RX_BUF_FDF		BIT(21)
 #define RX_BUF_BRS		BIT(20)
+#define RX_BUF_RXTS_MASK	0xffff
 
 /* Tx Buffer Element */
 /* T0 */
@@ -346,6 +394,7 @@ enum m_can_mram_cfg {
 /* E1 */
 #define TX_EVENT_MM_SHIFT	TX_BUF_MM_SHIFT
 #define TX_EVENT_MM_MASK	(0xff << TX_EVENT_MM_SHIFT)
+#define TX_EVENT_TXTS_MASK	0xffff
 
 /* address offset and element number for each FIFO/Buffer in the Message RAM */
 struct mram_cfg {
@@ -353,6 +402,38 @@ struct mram_cfg {
 	u8  num;
 };
 
+/* RX FIFO 1 carries the ids the filters mark "fifo1" and is drained first */
+#define M_CAN_RX_FIFOS	2
+
+static const enum m_can_reg m_can_rxfs[M_CAN_RX_FIFOS] = {
+	M_CAN_RXF0S, M_CAN_RXF1S
+};
+static const enum m_can_reg m_can_rxfa[M_CAN_RX_FIFOS] = {
+	M_CAN_RXF0A, M_CAN_RXF1A
+};
+
+/* per RX FIFO statistics, updated from NAPI only */
+struct m_can_rxf_stats {
+	u32 frames;
+	u32 lost;		/* RFxL events */
+	u32 max_fill;		/* highest fill level a poll found */
+	u32 batches;		/* status read + acknowledge pairs */
+};
+
+/* LEC interrupts are counted in windows of this length */
+#define M_CAN_LEC_WINDOW_MS	100
+
+/* error storm and bus-off recovery counters, debugfs "errors" */
+struct m_can_err_stats {
+	u32 lec_irqs;		/* polls that found a LEC interrupt */
+	u32 lec_masked;		/* times the limiter masked them */
+	u32 lec_masked_ms;
+	u32 summaries;		/* bus error frames sent */
+	u32 coalesced;		/* errors held back for a later summary */
+	u32 busoff_restarts;
+	u32 injected;
+};
+
 /* m_can private data structure */
 struct m_can_priv {
 	struct can_priv can;	/* must be the first member */
@@ -368,6 +449,83 @@ struct m_can_priv {
 	/* message ram configuration */
 	void __iomem *mram_base;
 	struct mram_cfg mcfg[MRAM_CFG_NUM];
+
+	/* acceptance filters, loaded through debugfs under RTNL */
+	struct m_can_filt_set *filt;
+	u32 filt_hits_std[M_CAN_FILT_STD_MAX];
+	u32 filt_hits_ext[M_CAN_FILT_EXT_MAX];
+	u32 filt_nonmatch;
+	struct dentry *debugfs;
+
+	struct m_can_rxf_stats rxf_stats[M_CAN_RX_FIFOS];
+
+	/* FIFO 0 interrupt coalescing, set with ethtool -C while down */
+	u32 rx_coalesce_frames;
+	u32 rx_coalesce_usecs;
+
+	/* hardware timestamps: the 16-bit counter extended in m_can_ts.h,
+	 * kept current by tc_work and read from NAPI and the ISR
+	 */
+	spinlock_t tc_lock;
+	struct m_can_tc tc;
+	struct delayed_work tc_work;
+	unsigned long tc_period;	/* jiffies between counter reads */
+	u32 ts_ext_hz;			/* "bosch,ts-external-hz", 0: internal */
+	bool ts_valid;
+	struct hwtstamp_config hwts;
+	struct m_can_tc poll_tc;	/* copy of tc for the running poll */
+
+	/* frames of the running poll, in timestamp order */
+	struct m_can_rxq rxq;
+	u32 rxq_batches;
+	u32 rxq_max;
+	u32 rxq_reordered;	/* frames queued in front of others */
+
+	/* TX ring, see m_can_tx_ring_full() */
+	u32 tx_ring_size;
+	u32 tx_put;		/* next slot xmit fills */
+	u32 tx_bar;		/* TXBAR bits waiting for the doorbell */
+	u32 tx_rung;		/* 3.0.x: slots below this were requested */
+	u32 tx_tail;		/* 3.0.x: next slot NAPI completes */
+
+	/* bus load and per-id statistics, written from NAPI only */
+	struct m_can_stats bstats;
+	struct u64_stats_sync bstats_sync;
+	bool bstats_reset;	/* requested through debugfs */
+
+	/* error storm mitigation and bus-off recovery, tunables in debugfs */
+	spinlock_t err_lock;
+	u32 ie;			/* IE as written, LEC bits may be masked */
+	u32 lec_irq_limit;	/* per M_CAN_LEC_WINDOW_MS, 0: no limit */
+	u32 lec_backoff_ms;
+	u32 lec_backoff_max_ms;
+	u32 lec_backoff;	/* backoff of the last masking */
+	u32 lec_win_irqs;
+	unsigned long lec_win_end;
+	unsigned long lec_masked_at;
+	unsigned long lec_unmasked_at;
+	bool lec_masked;
+	struct delayed_work lec_work;
+	u32 err_summary_ms;	/* 0: one error frame per error */
+	u32 err_sum_count;	/* errors since the last summary */
+	u8 err_sum_prot;	/* CAN_ERR_PROT_* seen since then */
+	u8 err_sum_loc;
+	unsigned long err_sum_next;
+	struct delayed_work err_sum_work;
+	u32 busoff_restart_ms;	/* 0: leave it to restart-ms */
+	u32 busoff_restart_max_ms;
+	u32 busoff_shift;
+	u32 busoff_delay;	/* delay of the last restart */
+	unsigned long busoff_at;
+	struct delayed_work busoff_work;
+	struct m_can_err_stats err_stats;
+
+	/* fault injection, see m_can_inject_raise() */
+	struct hrtimer inject_timer;
+	ktime_t inject_period;
+	ktime_t inject_end;
+	u32 inject_ir;
+	atomic_t inject_latch;	/* IR bits the next poll finds set */
 };
 
 static inline u32 m_can_read(const struct m_can_priv *priv, enum m_can_reg reg)
@@ -381,11 +539,12 @@ static inline void m_can_write(const struct m_can_priv *priv,
 	writel(val, priv->base + reg);
 }
 
-static inline u32 m_can_fifo_read(const struct m_can_priv *priv,
-				  u32 fgi, unsigned int offset)
+/* RXF0 and RXF1 elements have the same size */
+static inline void __iomem *m_can_rx_elem(const struct m_can_priv *priv,
+					  int fifo, u32 fgi)
 {
-	return readl(priv->mram_base + priv->mcfg[MRAM_RXF0].off +
-		     fgi * RXF0_ELEMENT_SIZE + offset);
+	return priv->mram_base + priv->mcfg[MRAM_RXF0 + fifo].off +
+	       fgi * RXF0_ELEMENT_SIZE;
 }
 
 static inline void m_can_fifo_write(const struct m_can_priv *priv,
@@ -402,9 +561,31 @@ static inline u32 m_can_txe_fifo_read(const struct m_can_priv *priv,
 			fgi * TXE_ELEMENT_SIZE + offset);
 }
 
-static inline bool m_can_tx_fifo_full(const struct m_can_priv *priv)
+/* The TX ring is tracked in software: on >= 3.1.x the FIFO slot at the
+ * put index is busy until NAPI has taken its echo, on 3.0.x the dedicated
+ * buffers are used in order and refilled once all of them completed, so
+ * that frames with the same id cannot overtake each other.
+ */
+static inline bool m_can_tx_ring_full(const struct m_can_priv *priv)
 {
-		return !!(m_can_read(priv, M_CAN_TXFQS) & TXFQS_TFQF);
+	u32 putidx = READ_ONCE(priv->tx_put);
+
+	if (priv->version == 30)
+		return putidx >= priv->tx_ring_size;
+
+	return !!priv->can.echo_skb[putidx];
+}
+
+/* Hand the frames written since the last doorbell to the controller */
+static inline void m_can_tx_doorbell(struct m_can_priv *priv)
+{
+	if (!priv->tx_bar)
+		return;
+
+	m_can_write(priv, M_CAN_TXBAR, priv->tx_bar);
+	priv->tx_bar = 0;
+	/* 3.0.x: TXBTO of these buffers is clear from here on */
+	WRITE_ONCE(priv->tx_rung, priv->tx_put);
 }
 
 static inline void m_can_config_endisable(const struct m_can_priv *priv,
@@ -449,33 +630,213 @@ static inline void m_can_disable_all_interrupts(const struct m_can_priv *priv)
 	m_can_write(priv, M_CAN_ILE, 0x0);
 }
 
-static void m_can_read_fifo(struct net_device *dev, u32 rxfs)
+/* IR bits that come with a PSR.LEC protocol error */
+static inline u32 m_can_lec_irqs(const struct m_can_priv *priv)
+{
+	return priv->version == 30 ? IR_ERR_LEC_30X : IR_ERR_LEC_31X;
+}
+
+/* Time of a captured counter value, against the poll's copy of tc;
+ * 0 while the counter is not tracked
+ */
+static u64 m_can_poll_ns(const struct m_can_priv *priv, u32 ts)
+{
+	if (!priv->ts_valid)
+		return 0;
+
+	return m_can_tc_cyc2time(&priv->poll_tc, ts);
+}
+
+static void m_can_hwtstamp(struct sk_buff *skb, u64 ns)
+{
+	struct skb_shared_hwtstamps *hwts = skb_hwtstamps(skb);
+
+	memset(hwts, 0, sizeof(*hwts));
+	hwts->hwtstamp = ns_to_ktime(ns);
+}
+
+/* Queue a frame for the hand-off at the end of the poll */
+static void m_can_rxq_queue(struct m_can_priv *priv, struct sk_buff *skb,
+			    u64 ns)
+{
+	int moved = m_can_rxq_add(&priv->rxq, ns, skb);
+
+	if (unlikely(moved < 0))
+		netif_receive_skb(skb);	/* more than the poll's budgets */
+	else if (moved)
+		priv->rxq_reordered++;
+}
+
+/* Pass the poll's frames up in timestamp order, as one list */
+static void m_can_rxq_flush(struct m_can_priv *priv)
+{
+	struct list_head list;
+	struct sk_buff *skb;
+	u32 i;
+
+	if (!priv->rxq.n)
+		return;
+
+	INIT_LIST_HEAD(&list);
+	for (i = 0; i < priv->rxq.n; i++) {
+		skb = priv->rxq.ent[i].item;
+		list_add_tail(&skb->list, &list);
+	}
+
+	priv->rxq_batches++;
+	if (priv->rxq.n > priv->rxq_max)
+		priv->rxq_max = priv->rxq.n;
+	priv->rxq.n = 0;
+
+	netif_receive_skb_list(&list);
+}
+
+/* Keep the counter extension current, several reads per wrap */
+static void m_can_tc_work(struct work_struct *work)
+{
+	struct m_can_priv *priv = container_of(to_delayed_work(work),
+					       struct m_can_priv, tc_work);
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->tc_lock, flags);
+	m_can_tc_read(&priv->tc, m_can_read(priv, M_CAN_TSCV) & TSCV_TSC_MASK);
+	spin_unlock_irqrestore(&priv->tc_lock, flags);
+
+	schedule_delayed_work(&priv->tc_work, priv->tc_period);
+}
+
+/* Anchor the counter to the wall clock once the controller runs. The
+ * counter ticks once per nominal bit time (TSCC.TCP = 0) or with the
+ * external clock, so the hardware timestamps share the realtime clock's
+ * epoch but follow the CAN clock's rate from then on: they are meant for
+ * frame to frame times, not for comparing with other clocks over hours.
+ */
+static void m_can_ts_start(struct net_device *dev)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	u32 freq = priv->ts_ext_hz ? : priv->can.bittiming.bitrate;
+	unsigned long flags;
+	u64 wrap;
+
+	priv->ts_valid = false;
+	if (freq < 1000)
+		return;
+
+	spin_lock_irqsave(&priv->tc_lock, flags);
+	m_can_tc_init(&priv->tc, TSCV_TSC_MASK, freq,
+		      m_can_read(priv, M_CAN_TSCV), ktime_get_real_ns());
+	spin_unlock_irqrestore(&priv->tc_lock, flags);
+
+	wrap = m_can_tc_wrap_ns(&priv->tc);
+	priv->tc_period = max(nsecs_to_jiffies(wrap / 4), 1UL);
+	if (jiffies_to_nsecs(priv->tc_period) >= wrap / 2) {
+		netdev_warn(dev, "timestamp counter wraps every %llu us, too fast to track\n",
+			    div_u64(wrap, NSEC_PER_USEC));
+		return;
+	}
+
+	priv->ts_valid = true;
+	mod_delayed_work(system_wq, &priv->tc_work, priv->tc_period);
+}
+
+/* Charge a frame to the bus statistics. NAPI is the only writer, the
+ * sync only makes the 64-bit counters safe to copy on 32-bit CPUs.
+ */
+static void m_can_account(struct m_can_priv *priv,
+			  const struct canfd_frame *cf, bool fd)
+{
+	u64_stats_update_begin(&priv->bstats_sync);
+	m_can_stats_frame(&priv->bstats, cf->can_id, cf->data, cf->len, fd,
+			  cf->flags);
+	u64_stats_update_end(&priv->bstats_sync);
+}
+
+/* A frame we sent; in loopback mode it comes back through RX as well */
+static void m_can_account_echo(struct m_can_priv *priv, struct sk_buff *skb)
+{
+	if (priv->can.ctrlmode & CAN_CTRLMODE_LOOPBACK)
+		return;
+
+	m_can_account(priv, (struct canfd_frame *)skb->data,
+		      can_is_canfd_skb(skb));
+}
+
+/* Close the statistics window once a second while there is traffic, the
+ * error counters are sampled then. A reset asked for from debugfs is
+ * carried out here so that NAPI stays the only writer.
+ */
+static void m_can_stats_poll(struct m_can_priv *priv)
+{
+	u64 now = ktime_get_ns();
+	u32 ecr;
+
+	if (!READ_ONCE(priv->bstats_reset) &&
+	    !m_can_stats_due(&priv->bstats, now))
+		return;
+
+	u64_stats_update_begin(&priv->bstats_sync);
+	if (READ_ONCE(priv->bstats_reset)) {
+		m_can_stats_reset(&priv->bstats, now,
+				  priv->can.can_stats.bus_error);
+		WRITE_ONCE(priv->bstats_reset, false);
+	} else {
+		ecr = m_can_read(priv, M_CAN_ECR);
+		m_can_stats_close(&priv->bstats, now,
+				  (ecr & ECR_TEC_MASK) >> ECR_TEC_SHIFT,
+				  (ecr & ECR_REC_MASK) >> ECR_REC_SHIFT,
+				  priv->can.can_stats.bus_error);
+	}
+	u64_stats_update_end(&priv->bstats_sync);
+}
+
+/* Copy one RX FIFO element out of message RAM and pass it up. The header
+ * and the payload are each read with one memcpy_fromio(), which the ARM
+ * port turns into burst loads instead of a readl() per word.
+ */
+static void m_can_read_fifo(struct net_device *dev, int fifo, u32 fgi)
 {
 	struct net_device_stats *stats = &dev->stats;
 	struct m_can_priv *priv = netdev_priv(dev);
+	void __iomem *elem = m_can_rx_elem(priv, fifo, fgi);
 	struct canfd_frame *cf;
 	struct sk_buff *skb;
-	u32 id, fgi, dlc;
-	int i;
+	u32 hdr[2];
+	u32 id, dlc;
+	u64 ns;
+
+	memcpy_fromio(hdr, elem, sizeof(hdr));
+	id = hdr[M_CAN_FIFO_ID / 4];
+	dlc = hdr[M_CAN_FIFO_DLC / 4];
+
+	/* filter hit counters, the element index comes with the frame */
+	if (dlc & RX_BUF_ANMF)
+		priv->filt_nonmatch++;
+	else if (id & RX_BUF_XTD)
+		priv->filt_hits_ext[((dlc & RX_BUF_FIDX_MASK) >>
+				     RX_BUF_FIDX_SHIFT) % M_CAN_FILT_EXT_MAX]++;
+	else
+		priv->filt_hits_std[(dlc & RX_BUF_FIDX_MASK) >>
+				    RX_BUF_FIDX_SHIFT]++;
 
-	/* calculate the fifo get index for where to read data */
-	fgi = (rxfs & RXFS_FGI_MASK) >> RXFS_FGI_SHIFT;
-	dlc = m_can_fifo_read(priv, fgi, M_CAN_FIFO_DLC);
 	if (dlc & RX_BUF_FDF)
 		skb = alloc_canfd_skb(dev, &cf);
 	else
 		skb = alloc_can_skb(dev, (struct can_frame **)&cf);
 	if (!skb) {
+		/* the element is still released with the batch */
 		stats->rx_dropped++;
 		return;
 	}
 
+	ns = m_can_poll_ns(priv, dlc & RX_BUF_RXTS_MASK);
+	if (priv->hwts.rx_filter != HWTSTAMP_FILTER_NONE && priv->ts_valid)
+		m_can_hwtstamp(skb, ns);
+
 	if (dlc & RX_BUF_FDF)
 		cf->len = can_dlc2len((dlc >> 16) & 0x0F);
 	else
 		cf->len = get_can_dlc((dlc >> 16) & 0x0F);
 
-	id = m_can_fifo_read(priv, fgi, M_CAN_FIFO_ID);
 	if (id & RX_BUF_XTD)
 		cf->can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
 	else
@@ -492,57 +853,79 @@ static void m_can_read_fifo(struct net_device *dev, u32 rxfs)
 		if (dlc & RX_BUF_BRS)
 			cf->flags |= CANFD_BRS;
 
-		for (i = 0; i < cf->len; i += 4)
-			*(u32 *)(cf->data + i) =
-				m_can_fifo_read(priv, fgi,
-						M_CAN_FIFO_DATA(i / 4));
+		if (cf->len)
+			memcpy_fromio(cf->data, elem + M_CAN_FIFO_DATA(0),
+				      round_up(cf->len, 4));
 	}
 
-	/* acknowledge rx fifo 0 */
-	m_can_write(priv, M_CAN_RXF0A, fgi);
+	trace_m_can_rx(dev, fifo, cf, ns);
+	m_can_account(priv, cf, dlc & RX_BUF_FDF);
 
 	stats->rx_packets++;
 	stats->rx_bytes += cf->len;
 
-	netif_receive_skb(skb);
+	m_can_rxq_queue(priv, skb, ns);
 }
 
-static int m_can_do_rx_poll(struct net_device *dev, int quota)
+/* Drain an RX FIFO in batches: one status read gives the fill level and
+ * get index, the elements are copied in order, and one write to RXFnA with
+ * the last index releases the whole batch.
+ */
+static int m_can_do_rx_poll(struct net_device *dev, int fifo, int quota)
 {
 	struct m_can_priv *priv = netdev_priv(dev);
-	u32 pkts = 0;
-	u32 rxfs;
+	struct m_can_rxf_stats *st = &priv->rxf_stats[fifo];
+	u32 size = priv->mcfg[MRAM_RXF0 + fifo].num;
+	int pkts = 0;
+	u32 rxfs, fill, fgi, last, n;
 
-	rxfs = m_can_read(priv, M_CAN_RXF0S);
-	if (!(rxfs & RXFS_FFL_MASK)) {
-		netdev_dbg(dev, "no messages in fifo0\n");
-		return 0;
-	}
+	while (pkts < quota) {
+		rxfs = m_can_read(priv, m_can_rxfs[fifo]);
+		fill = rxfs & RXFS_FFL_MASK;
+		if (!fill)
+			break;
 
-	while ((rxfs & RXFS_FFL_MASK) && (quota > 0)) {
 		if (rxfs & RXFS_RFL)
-			netdev_warn(dev, "Rx FIFO 0 Message Lost\n");
-
-		m_can_read_fifo(dev, rxfs);
+			netdev_warn(dev, "Rx FIFO %d Message Lost\n", fifo);
+
+		st->batches++;
+		if (fill > st->max_fill)
+			st->max_fill = fill;
+
+		fgi = (rxfs & RXFS_FGI_MASK) >> RXFS_FGI_SHIFT;
+		n = min_t(u32, fill, quota - pkts);
+		last = fgi;
+		pkts += n;
+		while (n--) {
+			m_can_read_fifo(dev, fifo, fgi);
+			last = fgi;
+			if (++fgi >= size)
+				fgi = 0;
+		}
 
-		quota--;
-		pkts++;
-		rxfs = m_can_read(priv, M_CAN_RXF0S);
+		/* acknowledge everything up to and including last */
+		m_can_write(priv, m_can_rxfa[fifo], last);
 	}
+	st->frames += pkts;
 
-	if (pkts)
+	if (!pkts)
+		netdev_dbg(dev, "no messages in fifo%d\n", fifo);
+	else
 		can_led_event(dev, CAN_LED_EVENT_RX);
 
 	return pkts;
 }
 
-static int m_can_handle_lost_msg(struct net_device *dev)
+static int m_can_handle_lost_msg(struct net_device *dev, int fifo)
 {
+	struct m_can_priv *priv = netdev_priv(dev);
 	struct net_device_stats *stats = &dev->stats;
 	struct sk_buff *skb;
 	struct can_frame *frame;
 
-	netdev_err(dev, "msg lost in rxf0\n");
+	netdev_err(dev, "msg lost in rxf%d\n", fifo);
+
+	priv->rxf_stats[fifo].lost++;
 
 	stats->rx_errors++;
 	stats->rx_over_errors++;
@@ -559,61 +942,130 @@ static int m_can_handle_lost_msg(struct net_device *dev)
 	return 1;
 }
 
-static int m_can_handle_lec_err(struct net_device *dev,
-				enum m_can_lec_type lec_type)
+/* Send the bus errors collected since the last summary as one error
+ * frame: data[2] and data[3] hold every type and the last location seen,
+ * data[5] how many errors it stands for (saturated), data[6] and data[7]
+ * the error counters.
+ */
+static int m_can_err_sum_send(struct net_device *dev, bool napi)
 {
 	struct m_can_priv *priv = netdev_priv(dev);
 	struct net_device_stats *stats = &dev->stats;
 	struct can_frame *cf;
 	struct sk_buff *skb;
-
-	priv->can.can_stats.bus_error++;
-	stats->rx_errors++;
+	unsigned long flags;
+	u32 count, ecr;
+	u8 prot, loc;
+
+	spin_lock_irqsave(&priv->err_lock, flags);
+	count = priv->err_sum_count;
+	prot = priv->err_sum_prot;
+	loc = priv->err_sum_loc;
+	priv->err_sum_count = 0;
+	priv->err_sum_prot = 0;
+	priv->err_sum_loc = 0;
+	priv->err_sum_next = jiffies + msecs_to_jiffies(priv->err_summary_ms);
+	if (count)
+		priv->err_stats.summaries++;
+	spin_unlock_irqrestore(&priv->err_lock, flags);
+
+	if (!count)
+		return 0;
 
 	/* propagate the error condition to the CAN stack */
 	skb = alloc_can_err_skb(dev, &cf);
 	if (unlikely(!skb))
 		return 0;
 
+	ecr = m_can_read(priv, M_CAN_ECR);
+	cf->can_id |= CAN_ERR_PROT | CAN_ERR_BUSERROR;
+	cf->data[2] = prot;
+	cf->data[3] = loc;
+	cf->data[5] = min_t(u32, count, 0xff);
+	cf->data[6] = (ecr & ECR_TEC_MASK) >> ECR_TEC_SHIFT;
+	cf->data[7] = (ecr & ECR_REC_MASK) >> ECR_REC_SHIFT;
+
+	stats->rx_packets++;
+	stats->rx_bytes += cf->can_dlc;
+	if (napi)
+		netif_receive_skb(skb);
+	else
+		netif_rx_ni(skb);
+
+	return 1;
+}
+
+static void m_can_err_sum_work(struct work_struct *work)
+{
+	struct m_can_priv *priv = container_of(to_delayed_work(work),
+					       struct m_can_priv, err_sum_work);
+
+	m_can_err_sum_send(priv->dev, false);
+}
+
+static int m_can_handle_lec_err(struct net_device *dev,
+				enum m_can_lec_type lec_type)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	struct net_device_stats *stats = &dev->stats;
+	unsigned long flags, delay;
+	u8 prot = 0, loc = 0;
+
+	priv->can.can_stats.bus_error++;
+	stats->rx_errors++;
+
 	/* check for 'last error code' which tells us the
 	 * type of the last error to occur on the CAN bus
 	 */
-	cf->can_id |= CAN_ERR_PROT | CAN_ERR_BUSERROR;
-
 	switch (lec_type) {
 	case LEC_STUFF_ERROR:
 		netdev_dbg(dev, "stuff error\n");
-		cf->data[2] |= CAN_ERR_PROT_STUFF;
+		prot = CAN_ERR_PROT_STUFF;
 		break;
 	case LEC_FORM_ERROR:
 		netdev_dbg(dev, "form error\n");
-		cf->data[2] |= CAN_ERR_PROT_FORM;
+		prot = CAN_ERR_PROT_FORM;
 		break;
 	case LEC_ACK_ERROR:
 		netdev_dbg(dev, "ack error\n");
-		cf->data[3] = CAN_ERR_PROT_LOC_ACK;
+		loc = CAN_ERR_PROT_LOC_ACK;
 		break;
 	case LEC_BIT1_ERROR:
 		netdev_dbg(dev, "bit1 error\n");
-		cf->data[2] |= CAN_ERR_PROT_BIT1;
+		prot = CAN_ERR_PROT_BIT1;
 		break;
 	case LEC_BIT0_ERROR:
 		netdev_dbg(dev, "bit0 error\n");
-		cf->data[2] |= CAN_ERR_PROT_BIT0;
+		prot = CAN_ERR_PROT_BIT0;
 		break;
 	case LEC_CRC_ERROR:
 		netdev_dbg(dev, "CRC error\n");
-		cf->data[3] = CAN_ERR_PROT_LOC_CRC_SEQ;
+		loc = CAN_ERR_PROT_LOC_CRC_SEQ;
 		break;
 	default:
 		break;
 	}
 
-	stats->rx_packets++;
-	stats->rx_bytes += cf->can_dlc;
-	netif_receive_skb(skb);
+	/* the first error after a quiet period goes out at once, the ones
+	 * that follow are summed up and sent every err_summary_ms
+	 */
+	spin_lock_irqsave(&priv->err_lock, flags);
+	priv->err_sum_prot |= prot;
+	if (loc)
+		priv->err_sum_loc = loc;
+	priv->err_sum_count++;
+	delay = 0;
+	if (priv->err_summary_ms && time_before(jiffies, priv->err_sum_next))
+		delay = priv->err_sum_next - jiffies;
+	spin_unlock_irqrestore(&priv->err_lock, flags);
+
+	if (!delay)
+		return m_can_err_sum_send(dev, true);
+
+	priv->err_stats.coalesced++;
+	schedule_delayed_work(&priv->err_sum_work, delay);
 
-	return 1;
+	return 0;
 }
 
 static int __m_can_get_berr_counter(const struct net_device *dev,
@@ -664,6 +1116,30 @@ static int m_can_get_berr_counter(const struct net_device *dev,
 	return 0;
 }
 
+/* Bus-off recovery when restart-ms is 0: restart after busoff_restart_ms,
+ * doubling up to busoff_restart_max_ms while the bus keeps failing. A bus
+ * that stayed up for four times the maximum starts over at the minimum.
+ */
+static void m_can_busoff_schedule(struct m_can_priv *priv)
+{
+	u32 limit;
+
+	if (!priv->busoff_restart_ms || priv->can.restart_ms)
+		return;
+
+	limit = max(priv->busoff_restart_ms, priv->busoff_restart_max_ms);
+	if (time_after(jiffies, priv->busoff_at + msecs_to_jiffies(4 * limit)))
+		priv->busoff_shift = 0;
+	priv->busoff_delay = min_t(u64, (u64)priv->busoff_restart_ms <<
+				   priv->busoff_shift, limit);
+	if (priv->busoff_delay < limit)
+		priv->busoff_shift++;
+	priv->busoff_at = jiffies;
+
+	schedule_delayed_work(&priv->busoff_work,
+			      msecs_to_jiffies(priv->busoff_delay));
+}
+
 static int m_can_handle_state_change(struct net_device *dev,
 				     enum can_state new_state)
 {
@@ -691,6 +1167,7 @@ static int m_can_handle_state_change(struct net_device *dev,
 		m_can_disable_all_interrupts(priv);
 		priv->can.can_stats.bus_off++;
 		can_bus_off(dev);
+		m_can_busoff_schedule(priv);
 		break;
 	default:
 		break;
@@ -770,6 +1247,8 @@ static int m_can_handle_state_errors(struct net_device *dev, u32 psr)
 
 static void m_can_handle_other_err(struct net_device *dev, u32 irqstatus)
 {
+	struct m_can_priv *priv = netdev_priv(dev);
+
 	if (irqstatus & IR_WDI)
 		netdev_err(dev, "Message RAM Watchdog event due to missing READY\n");
 	if (irqstatus & IR_ELO)
@@ -778,7 +1257,8 @@ static void m_can_handle_other_err(struct net_device *dev, u32 irqstatus)
 		netdev_err(dev, "Bit Error Uncorrected\n");
 	if (irqstatus & IR_BEC)
 		netdev_err(dev, "Bit Error Corrected\n");
-	if (irqstatus & IR_TOO)
+	/* with RX coalescing the timeout counter runs off FIFO 0 */
+	if ((irqstatus & IR_TOO) && priv->rx_coalesce_frames <= 1)
 		netdev_err(dev, "Timeout reached\n");
 	if (irqstatus & IR_MRAF)
 		netdev_err(dev, "Message RAM access failure occurred\n");
@@ -797,8 +1277,11 @@ static int m_can_handle_bus_errors(struct net_device *dev, u32 irqstatus,
 	struct m_can_priv *priv = netdev_priv(dev);
 	int work_done = 0;
 
+	if (irqstatus & IR_RF1L)
+		work_done += m_can_handle_lost_msg(dev, 1);
+
 	if (irqstatus & IR_RF0L)
-		work_done += m_can_handle_lost_msg(dev);
+		work_done += m_can_handle_lost_msg(dev, 0);
 
 	/* handle lec errors on the bus */
 	if ((priv->can.ctrlmode & CAN_CTRLMODE_BERR_REPORTING) &&
@@ -811,17 +1294,278 @@ static int m_can_handle_bus_errors(struct net_device *dev, u32 irqstatus,
 	return work_done;
 }
 
+/* A flapping bus raises a LEC interrupt per frame and each one costs a
+ * NAPI round. Past lec_irq_limit of them in a window the LEC interrupts
+ * are masked for lec_backoff_ms, doubled up to lec_backoff_max_ms when
+ * the storm is back within a second of unmasking. RX, TX and state
+ * changes keep interrupting meanwhile.
+ */
+static void m_can_lec_throttle(struct net_device *dev)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	unsigned long flags;
+	u32 backoff;
+
+	priv->err_stats.lec_irqs++;
+	if (!priv->lec_irq_limit)
+		return;
+
+	spin_lock_irqsave(&priv->err_lock, flags);
+	if (time_after_eq(jiffies, priv->lec_win_end)) {
+		priv->lec_win_end = jiffies +
+				    msecs_to_jiffies(M_CAN_LEC_WINDOW_MS);
+		priv->lec_win_irqs = 0;
+	}
+	if (priv->lec_masked || ++priv->lec_win_irqs <= priv->lec_irq_limit) {
+		spin_unlock_irqrestore(&priv->err_lock, flags);
+		return;
+	}
+
+	if (priv->lec_backoff && time_before(jiffies,
+					     priv->lec_unmasked_at + HZ))
+		backoff = min(priv->lec_backoff * 2, priv->lec_backoff_max_ms);
+	else
+		backoff = priv->lec_backoff_ms;
+	backoff = max(backoff, 1U);
+	priv->lec_backoff = backoff;
+
+	priv->ie &= ~m_can_lec_irqs(priv);
+	m_can_write(priv, M_CAN_IE, priv->ie);
+	priv->lec_masked = true;
+	priv->lec_masked_at = jiffies;
+	priv->lec_win_irqs = 0;
+	priv->err_stats.lec_masked++;
+	spin_unlock_irqrestore(&priv->err_lock, flags);
+
+	if (net_ratelimit())
+		netdev_warn(dev, "bus error storm, error interrupts off for %u ms\n",
+			    backoff);
+	schedule_delayed_work(&priv->lec_work, msecs_to_jiffies(backoff));
+}
+
+static void m_can_lec_work(struct work_struct *work)
+{
+	struct m_can_priv *priv = container_of(to_delayed_work(work),
+					       struct m_can_priv, lec_work);
+	u32 lec = m_can_lec_irqs(priv);
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->err_lock, flags);
+	if (priv->lec_masked) {
+		/* errors latched while masked are old news */
+		m_can_write(priv, M_CAN_IR, lec);
+		priv->ie |= lec;
+		m_can_write(priv, M_CAN_IE, priv->ie);
+		priv->lec_masked = false;
+		priv->lec_unmasked_at = jiffies;
+		priv->err_stats.lec_masked_ms +=
+			jiffies_to_msecs(jiffies - priv->lec_masked_at);
+	}
+	spin_unlock_irqrestore(&priv->err_lock, flags);
+}
+
+/* Take an echo skb out of its slot, with the TX event timestamp attached:
+ * local listeners see it as the echo's hwtstamp, and the sending socket
+ * gets it on its error queue when it asked for SOF_TIMESTAMPING_TX_HARDWARE.
+ */
+static struct sk_buff *m_can_take_echo_skb(struct net_device *dev,
+					   unsigned int idx, u64 ns,
+					   u8 *len)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	struct sk_buff *skb;
+
+	skb = __can_get_echo_skb(dev, idx, len);
+	if (!skb)
+		return NULL;
+
+	if (priv->hwts.tx_type == HWTSTAMP_TX_ON && priv->ts_valid) {
+		m_can_hwtstamp(skb, ns);
+		if (skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP)
+			skb_tstamp_tx(skb, skb_hwtstamps(skb));
+	}
+
+	return skb;
+}
+
+/* Release completed transmissions from NAPI. One TXEFS read gives the
+ * number of events and the get index, the echo skbs join the poll's
+ * hand-off queue at their TX timestamp while walking the elements, one
+ * TXEFA write with the last index frees the whole batch, and then the
+ * queue is woken. Version 3.0.x has no event FIFO and completes its
+ * dedicated buffers in ring order instead, stamped with the time of the
+ * walk.
+ */
+static int m_can_echo_tx_event(struct net_device *dev, int quota)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	struct net_device_stats *stats = &dev->stats;
+	u32 size = priv->mcfg[MRAM_TXE].num;
+	struct sk_buff *skb;
+	u32 txefs, txbto, count, fgi, last, e1, i;
+	unsigned int msg_mark, bytes = 0;
+	u64 ns;
+	u8 len;
+
+	if (priv->version == 30) {
+		/* walk the requested buffers in order, TXBTO tells which
+		 * ones went out; the interrupt status alone may be stale
+		 */
+		last = READ_ONCE(priv->tx_rung);
+		smp_rmb();
+		txbto = m_can_read(priv, M_CAN_TXBTO);
+		ns = m_can_poll_ns(priv, m_can_read(priv, M_CAN_TSCV) &
+				       TSCV_TSC_MASK);
+		count = 0;
+		while (priv->tx_tail < last && count < quota &&
+		       (txbto & BIT(priv->tx_tail))) {
+			skb = __can_get_echo_skb(dev, priv->tx_tail, &len);
+			if (skb) {
+				trace_m_can_tx_done(dev, priv->tx_tail,
+						    (struct canfd_frame *)skb->data,
+						    ns);
+				m_can_account_echo(priv, skb);
+				bytes += len;
+				m_can_rxq_queue(priv, skb, ns);
+			}
+			priv->tx_tail++;
+			count++;
+		}
+		if (!count)
+			return 0;
+
+		/* all buffers done: start over at buffer 0 */
+		if (priv->tx_tail >= priv->tx_ring_size) {
+			priv->tx_tail = 0;
+			WRITE_ONCE(priv->tx_rung, 0);
+			smp_wmb();
+			WRITE_ONCE(priv->tx_put, 0);
+		}
+	} else {
+		txefs = m_can_read(priv, M_CAN_TXEFS);
+		count = min_t(u32, (txefs & TXEFS_EFFL_MASK) >>
+				   TXEFS_EFFL_SHIFT, quota);
+		if (!count)
+			return 0;
+
+		fgi = (txefs & TXEFS_EFGI_MASK) >> TXEFS_EFGI_SHIFT;
+		last = fgi;
+		for (i = 0; i < count; i++) {
+			/* get message marker and timestamp */
+			e1 = m_can_txe_fifo_read(priv, fgi, 4);
+			msg_mark = (e1 & TX_EVENT_MM_MASK) >> TX_EVENT_MM_SHIFT;
+
+			ns = m_can_poll_ns(priv, e1 & TX_EVENT_TXTS_MASK);
+			skb = m_can_take_echo_skb(dev, msg_mark, ns, &len);
+			if (skb) {
+				trace_m_can_tx_done(dev, msg_mark,
+						    (struct canfd_frame *)skb->data,
+						    ns);
+				m_can_account_echo(priv, skb);
+				bytes += len;
+				m_can_rxq_queue(priv, skb, ns);
+			}
+
+			last = fgi;
+			if (++fgi >= size)
+				fgi = 0;
+		}
+
+		/* ack all txe elements up to and including last */
+		m_can_write(priv, M_CAN_TXEFA, (TXEFA_EFAI_MASK &
+						(last << TXEFA_EFAI_SHIFT)));
+	}
+
+	/* update stats */
+	stats->tx_packets += count;
+	stats->tx_bytes += bytes;
+	can_led_event(dev, CAN_LED_EVENT_TX);
+
+	/* pairs with the barrier in m_can_start_xmit() */
+	smp_mb();
+	if (netif_queue_stopped(dev) && !m_can_tx_ring_full(priv))
+		netif_wake_queue(dev);
+
+	return count;
+}
+
+/* Fault injection: latch IR bits as if the controller had set them and
+ * interrupt like it would. The poll takes them together with IR, and for
+ * injected errors PSR reads as a stuff error or bus-off.
+ */
+static void m_can_inject_raise(struct m_can_priv *priv, u32 ir)
+{
+	atomic_or(ir, &priv->inject_latch);
+	priv->err_stats.injected++;
+
+	m_can_disable_all_interrupts(priv);
+	napi_schedule(&priv->napi);
+}
+
+static u32 m_can_inject_psr(const struct m_can_priv *priv, u32 psr, u32 inj)
+{
+	if (inj & m_can_lec_irqs(priv))
+		psr = (psr & ~LEC_UNUSED) | LEC_STUFF_ERROR;
+	if (inj & IR_BO)
+		psr |= PSR_BO;
+
+	return psr;
+}
+
+/* an error burst, one LEC interrupt per period while IE lets it through */
+static enum hrtimer_restart m_can_inject_timer(struct hrtimer *timer)
+{
+	struct m_can_priv *priv = container_of(timer, struct m_can_priv,
+					       inject_timer);
+
+	if (ktime_after(ktime_get(), priv->inject_end))
+		return HRTIMER_NORESTART;
+
+	if (READ_ONCE(priv->ie) & priv->inject_ir)
+		m_can_inject_raise(priv, priv->inject_ir);
+
+	hrtimer_forward_now(timer, priv->inject_period);
+
+	return HRTIMER_RESTART;
+}
+
 static int m_can_poll(struct napi_struct *napi, int quota)
 {
 	struct net_device *dev = napi->dev;
 	struct m_can_priv *priv = netdev_priv(dev);
-	int work_done = 0;
-	u32 irqstatus, psr;
+	int work_done = 0, tx_done = 0;
+	bool tx_pending = false;
+	unsigned long flags;
+	u32 irqstatus, psr, inj;
 
-	irqstatus = priv->irqstatus | m_can_read(priv, M_CAN_IR);
+	inj = atomic_xchg(&priv->inject_latch, 0);
+	irqstatus = priv->irqstatus | m_can_read(priv, M_CAN_IR) | inj;
 	if (!irqstatus)
 		goto end;
 
+	m_can_stats_poll(priv);
+
+	/* one counter extension for all the frames of this poll */
+	if (priv->ts_valid) {
+		spin_lock_irqsave(&priv->tc_lock, flags);
+		priv->poll_tc = priv->tc;
+		spin_unlock_irqrestore(&priv->tc_lock, flags);
+	}
+
+	/* TX completions have their own budget and do not count as RX work,
+	 * but a full batch may have left events behind
+	 */
+	if (irqstatus & (priv->version == 30 ? IR_TC : IR_TEFN)) {
+		tx_done = m_can_echo_tx_event(dev, quota);
+		tx_pending = tx_done == quota;
+	}
+
+	/* priority lane first: FIFO 1 only holds ids the filters put there,
+	 * it is drained first but handed off in bus order with the rest
+	 */
+	if (irqstatus & IR_RF1N)
+		work_done += m_can_do_rx_poll(dev, 1, quota);
+
 	/* Errata workaround for issue "Needless activation of MRAF irq"
 	 * During frame reception while the MCAN is in Error Passive state
 	 * and the Receive Error Counter has the value MCAN_ECR.REC = 127,
@@ -844,67 +1588,47 @@ static int m_can_poll(struct napi_struct *napi, int quota)
 	}
 
 	psr = m_can_read(priv, M_CAN_PSR);
+	if (unlikely(inj))
+		psr = m_can_inject_psr(priv, psr, inj);
 	if (irqstatus & IR_ERR_STATE)
 		work_done += m_can_handle_state_errors(dev, psr);
 
+	if (irqstatus & m_can_lec_irqs(priv))
+		m_can_lec_throttle(dev);
+
 	if (irqstatus & IR_ERR_BUS_30X)
 		work_done += m_can_handle_bus_errors(dev, irqstatus, psr);
 
-	if (irqstatus & IR_RF0N)
-		work_done += m_can_do_rx_poll(dev, (quota - work_done));
+	if (irqstatus & (IR_RF0N | IR_RF0W | IR_TOO)) {
+		work_done += m_can_do_rx_poll(dev, 0, (quota - work_done));
+
+		/* a FIFO 1 frame that came in meanwhile may be older than
+		 * the last FIFO 0 ones, it goes into this batch too
+		 */
+		if (priv->mcfg[MRAM_RXF1].num && work_done < quota &&
+		    (m_can_read(priv, M_CAN_RXF1S) & RXFS_FFL_MASK))
+			work_done += m_can_do_rx_poll(dev, 1,
+						      quota - work_done);
+	}
+
+	m_can_rxq_flush(priv);
+	trace_m_can_poll(dev, irqstatus, work_done, tx_done, quota);
 
-	if (work_done < quota) {
+	if (work_done < quota && !tx_pending) {
 		napi_complete_done(napi, work_done);
 		m_can_enable_all_interrupts(priv);
+	} else if (work_done < quota) {
+		work_done = quota;
 	}
 
 end:
 	return work_done;
 }
 
-static void m_can_echo_tx_event(struct net_device *dev)
-{
-	u32 txe_count = 0;
-	u32 m_can_txefs;
-	u32 fgi = 0;
-	int i = 0;
-	unsigned int msg_mark;
-
-	struct m_can_priv *priv = netdev_priv(dev);
-	struct net_device_stats *stats = &dev->stats;
-
-	/* read tx event fifo status */
-	m_can_txefs = m_can_read(priv, M_CAN_TXEFS);
-
-	/* Get Tx Event fifo element count */
-	txe_count = (m_can_txefs & TXEFS_EFFL_MASK)
-			>> TXEFS_EFFL_SHIFT;
-
-	/* Get and process all sent elements */
-	for (i = 0; i < txe_count; i++) {
-		/* retrieve get index */
-		fgi = (m_can_read(priv, M_CAN_TXEFS) & TXEFS_EFGI_MASK)
-			>> TXEFS_EFGI_SHIFT;
-
-		/* get message marker */
-		msg_mark = (m_can_txe_fifo_read(priv, fgi, 4) &
-			    TX_EVENT_MM_MASK) >> TX_EVENT_MM_SHIFT;
-
-		/* ack txe element */
-		m_can_write(priv, M_CAN_TXEFA, (TXEFA_EFAI_MASK &
-						(fgi << TXEFA_EFAI_SHIFT)));
-
-		/* update stats */
-		stats->tx_bytes += can_get_echo_skb(dev, msg_mark);
-		stats->tx_packets++;
-	}
-}
-
 static irqreturn_t m_can_isr(int irq, void *dev_id)
 {
 	struct net_device *dev = (struct net_device *)dev_id;
 	struct m_can_priv *priv = netdev_priv(dev);
-	struct net_device_stats *stats = &dev->stats;
 	u32 ir;
 
 	ir = m_can_read(priv, M_CAN_IR);
@@ -916,35 +1640,18 @@ static irqreturn_t m_can_isr(int irq, void *dev_id)
 		m_can_write(priv, M_CAN_IR, ir);
 
 	/* schedule NAPI in case of
-	 * - rx IRQ
+	 * - rx IRQ, FIFO 0 or FIFO 1
+	 * - tx complete (3.0.x) or new tx event (>= 3.1.x)
 	 * - state change IRQ
 	 * - bus error IRQ and bus error reporting
 	 */
-	if ((ir & IR_RF0N) || (ir & IR_ERR_ALL_30X)) {
+	if ((ir & (IR_RF0N | IR_RF0W | IR_RF1N | IR_TC | IR_TEFN)) ||
+	    (ir & IR_ERR_ALL_30X)) {
 		priv->irqstatus = ir;
 		m_can_disable_all_interrupts(priv);
 		napi_schedule(&priv->napi);
 	}
 
-	if (priv->version == 30) {
-		if (ir & IR_TC) {
-			/* Transmission Complete Interrupt*/
-			stats->tx_bytes += can_get_echo_skb(dev, 0);
-			stats->tx_packets++;
-			can_led_event(dev, CAN_LED_EVENT_TX);
-			netif_wake_queue(dev);
-		}
-	} else  {
-		if (ir & IR_TEFN) {
-			/* New TX FIFO Element arrived */
-			m_can_echo_tx_event(dev);
-			can_led_event(dev, CAN_LED_EVENT_TX);
-			if (netif_queue_stopped(dev) &&
-			    !m_can_tx_fifo_full(priv))
-				netif_wake_queue(dev);
-		}
-	}
-
 	return IRQ_HANDLED;
 }
 
@@ -1060,10 +1767,42 @@ static int m_can_set_bittiming(struct net_device *dev)
 	return 0;
 }
 
+/* Load the acceptance filter list into message RAM. Without rules no
+ * element is used and non-matching frames go to FIFO 0, i.e. everything
+ * is received.
+ */
+static void m_can_write_filters(const struct m_can_priv *priv)
+{
+	const struct m_can_filt_set *fs = priv->filt;
+	void __iomem *sidf = priv->mram_base + priv->mcfg[MRAM_SIDF].off;
+	void __iomem *xidf = priv->mram_base + priv->mcfg[MRAM_XIDF].off;
+	int i, nsid = 0, nxid = 0;
+
+	if (fs) {
+		nsid = fs->nsid;
+		nxid = fs->nxid;
+	}
+
+	for (i = 0; i < nsid; i++)
+		writel(fs->sid[i], sidf + i * SIDF_ELEMENT_SIZE);
+	for (i = 0; i < nxid; i++) {
+		writel(fs->xid[i][0], xidf + i * XIDF_ELEMENT_SIZE);
+		writel(fs->xid[i][1], xidf + i * XIDF_ELEMENT_SIZE + 4);
+	}
+
+	m_can_write(priv, M_CAN_SIDFC, (nsid << SIDFC_LSS_SHIFT) |
+		    priv->mcfg[MRAM_SIDF].off);
+	m_can_write(priv, M_CAN_XIDFC, (nxid << XIDFC_LSE_SHIFT) |
+		    priv->mcfg[MRAM_XIDF].off);
+	m_can_write(priv, M_CAN_XIDAM, XIDAM_MASK);
+	m_can_write(priv, M_CAN_GFC, fs ? fs->gfc : 0x0);
+}
+
 /* Configure M_CAN chip:
  * - set rx buffer/fifo element size
  * - configure rx fifo
- * - accept non-matching frame into fifo 0
+ * - load the acceptance filters, non-matching frames go to fifo 0
+ *   without rules and are rejected with rules
  * - configure tx buffer
  *		- >= v3.1.x: TX FIFO is used
  * - configure mode
@@ -1072,21 +1811,45 @@ static int m_can_set_bittiming(struct net_device *dev)
 static void m_can_chip_config(struct net_device *dev)
 {
 	struct m_can_priv *priv = netdev_priv(dev);
-	u32 cccr, test;
+	u32 cccr, test, ie, fwm = 0, tocc = 0;
+	unsigned long flags;
+	u64 top;
+
+	/* FIFO 0 coalescing: watermark in frames, timeout in bit times
+	 * (TSCC.TCP + 1 bit times per count, TCP is 0)
+	 */
+	if (priv->rx_coalesce_frames > 1) {
+		fwm = min_t(u32, priv->rx_coalesce_frames,
+			    priv->mcfg[MRAM_RXF0].num);
+		top = DIV_ROUND_UP_ULL((u64)priv->rx_coalesce_usecs *
+				       priv->can.bittiming.bitrate,
+				       USEC_PER_SEC);
+		top = clamp_t(u64, top, 1, TOCC_TOP_MAX);
+		tocc = ((u32)top << TOCC_TOP_SHIFT) | TOCC_TOS_RXF0 |
+		       TOCC_ETOC;
+	}
 
 	m_can_config_endisable(priv, true);
 
 	/* RX Buffer/FIFO Element Size 64 bytes data field */
 	m_can_write(priv, M_CAN_RXESC, M_CAN_RXESC_64BYTES);
 
-	/* Accept Non-matching Frames Into FIFO 0 */
-	m_can_write(priv, M_CAN_GFC, 0x0);
+	/* Standard/extended filter lists and global filter */
+	m_can_write_filters(priv);
 
 	if (priv->version == 30) {
-		/* only support one Tx Buffer currently */
-		m_can_write(priv, M_CAN_TXBC, (1 << TXBC_NDTB_SHIFT) |
-				priv->mcfg[MRAM_TXB].off);
+		/* dedicated Tx Buffers used as a ring, one deep in FD mode
+		 * because CCCR.CMR applies to every pending buffer
+		 */
+		priv->tx_ring_size = priv->can.ctrlmode & CAN_CTRLMODE_FD ?
+				     1 : priv->mcfg[MRAM_TXB].num;
+		m_can_write(priv, M_CAN_TXBC,
+			    (priv->tx_ring_size << TXBC_NDTB_SHIFT) |
+			    priv->mcfg[MRAM_TXB].off);
+		m_can_write(priv, M_CAN_TXBTIE,
+			    GENMASK(priv->tx_ring_size - 1, 0));
 	} else {
+		priv->tx_ring_size = priv->mcfg[MRAM_TXB].num;
 		/* TX FIFO is used for newer IP Core versions */
 		m_can_write(priv, M_CAN_TXBC,
 			    (priv->mcfg[MRAM_TXB].num << TXBC_TFQS_SHIFT) |
@@ -1108,11 +1871,22 @@ static void m_can_chip_config(struct net_device *dev)
 			    priv->mcfg[MRAM_TXE].off);
 	}
 
-	/* rx fifo configuration, blocking mode, fifo size 1 */
+	/* rx fifo configuration, blocking mode, watermark when coalescing */
 	m_can_write(priv, M_CAN_RXF0C,
+		    (fwm << RXFC_FWM_SHIFT) |
 		    (priv->mcfg[MRAM_RXF0].num << RXFC_FS_SHIFT) |
 		     priv->mcfg[MRAM_RXF0].off);
 
+	/* the timeout counter bounds how long frames below the watermark
+	 * wait: it runs in bit times while FIFO 0 is not empty and raises
+	 * IR_TOO when it expires
+	 */
+	m_can_write(priv, M_CAN_TOCC, tocc);
+
+	/* timestamp counter: one count per bit time, or the external clock */
+	m_can_write(priv, M_CAN_TSCC, priv->ts_ext_hz ? TSCC_TSS_EXTERNAL :
+							TSCC_TSS_INTERNAL);
+
 	m_can_write(priv, M_CAN_RXF1C,
 		    (priv->mcfg[MRAM_RXF1].num << RXFC_FS_SHIFT) |
 		     priv->mcfg[MRAM_RXF1].off);
@@ -1159,15 +1933,20 @@ static void m_can_chip_config(struct net_device *dev)
 
 	/* Enable interrupts */
 	m_can_write(priv, M_CAN_IR, IR_ALL_INT);
+	ie = IR_ALL_INT;
 	if (!(priv->can.ctrlmode & CAN_CTRLMODE_BERR_REPORTING))
-		if (priv->version == 30)
-			m_can_write(priv, M_CAN_IE, IR_ALL_INT &
-				    ~(IR_ERR_LEC_30X));
-		else
-			m_can_write(priv, M_CAN_IE, IR_ALL_INT &
-				    ~(IR_ERR_LEC_31X));
-	else
-		m_can_write(priv, M_CAN_IE, IR_ALL_INT);
+		ie &= ~m_can_lec_irqs(priv);
+	/* coalesced FIFO 0: interrupt on watermark or timeout only */
+	if (fwm)
+		ie &= ~IR_RF0N;
+	/* counter wraps are tracked by tc_work, not worth an interrupt */
+	ie &= ~IR_TSW;
+	/* a restart also ends a LEC backoff */
+	spin_lock_irqsave(&priv->err_lock, flags);
+	priv->ie = ie;
+	priv->lec_masked = false;
+	m_can_write(priv, M_CAN_IE, ie);
+	spin_unlock_irqrestore(&priv->err_lock, flags);
 
 	/* route all interrupts to INT0 */
 	m_can_write(priv, M_CAN_ILS, ILS_ALL_INT0);
@@ -1181,10 +1960,31 @@ static void m_can_chip_config(struct net_device *dev)
 static void m_can_start(struct net_device *dev)
 {
 	struct m_can_priv *priv = netdev_priv(dev);
+	unsigned int i;
 
 	/* basic m_can configuration */
 	m_can_chip_config(dev);
 
+	/* frames pending across a restart are gone, start the ring where
+	 * the FIFO is
+	 */
+	for (i = 0; i < priv->can.echo_skb_max; i++)
+		can_free_echo_skb(dev, i);
+	priv->tx_bar = 0;
+	priv->tx_tail = 0;
+	if (priv->version == 30)
+		priv->tx_put = 0;
+	else
+		priv->tx_put = (m_can_read(priv, M_CAN_TXFQS) &
+				TXFQS_TFQPI_MASK) >> TXFQS_TFQPI_SHIFT;
+	priv->tx_rung = priv->tx_put;
+
+	m_can_ts_start(dev);
+
+	m_can_stats_rates(&priv->bstats, priv->can.bittiming.bitrate,
+			  priv->can.ctrlmode & CAN_CTRLMODE_FD ?
+			  priv->can.data_bittiming.bitrate : 0);
+
 	priv->can.state = CAN_STATE_ERROR_ACTIVE;
 
 	m_can_enable_all_interrupts(priv);
@@ -1204,6 +2004,38 @@ static int m_can_set_mode(struct net_device *dev, enum can_mode mode)
 	return 0;
 }
 
+/* what can_restart() does for restart-ms, on our own schedule */
+static void m_can_busoff_work(struct work_struct *work)
+{
+	struct m_can_priv *priv = container_of(to_delayed_work(work),
+					       struct m_can_priv, busoff_work);
+	struct net_device *dev = priv->dev;
+	struct can_frame *cf;
+	struct sk_buff *skb;
+
+	if (!netif_running(dev) || priv->can.state != CAN_STATE_BUS_OFF)
+		return;
+
+	netdev_dbg(dev, "restarting after bus-off, %u ms\n",
+		   priv->busoff_delay);
+
+	/* leaving INIT starts the 128 x 11 recessive bits recovery */
+	m_can_start(dev);
+	priv->can.can_stats.restarts++;
+	priv->err_stats.busoff_restarts++;
+
+	skb = alloc_can_err_skb(dev, &cf);
+	if (skb) {
+		cf->can_id |= CAN_ERR_RESTARTED;
+		dev->stats.rx_packets++;
+		dev->stats.rx_bytes += cf->can_dlc;
+		netif_rx_ni(skb);
+	}
+
+	netif_carrier_on(dev);
+	netif_wake_queue(dev);
+}
+
 /* Checks core release number of M_CAN
  * returns 0 if an unsupported device is detected
  * else it returns the release and step coded as:
@@ -1280,6 +2112,26 @@ static int m_can_dev_setup(struct platform_device *pdev, struct net_device *dev,
 	priv = netdev_priv(dev);
 	netif_napi_add(dev, &priv->napi, m_can_poll, M_CAN_NAPI_WEIGHT);
 
+	u64_stats_init(&priv->bstats_sync);
+	spin_lock_init(&priv->tc_lock);
+	INIT_DELAYED_WORK(&priv->tc_work, m_can_tc_work);
+
+	spin_lock_init(&priv->err_lock);
+	INIT_DELAYED_WORK(&priv->lec_work, m_can_lec_work);
+	INIT_DELAYED_WORK(&priv->err_sum_work, m_can_err_sum_work);
+	INIT_DELAYED_WORK(&priv->busoff_work, m_can_busoff_work);
+	hrtimer_init(&priv->inject_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->inject_timer.function = m_can_inject_timer;
+	atomic_set(&priv->inject_latch, 0);
+	/* up to 200 LEC interrupts/s and 10 error frames/s, the automatic
+	 * bus-off restart is off until busoff_restart_ms is set
+	 */
+	priv->lec_irq_limit = 20;
+	priv->lec_backoff_ms = 10;
+	priv->lec_backoff_max_ms = 1000;
+	priv->err_summary_ms = 100;
+	priv->busoff_restart_max_ms = 5000;
+
 	/* Shared properties of all M_CAN versions */
 	priv->version = m_can_version;
 	priv->dev = dev;
@@ -1350,6 +2202,9 @@ static int m_can_open(struct net_device *dev)
 		goto exit_irq_fail;
 	}
 
+	m_can_stats_reset(&priv->bstats, ktime_get_ns(),
+			  priv->can.can_stats.bus_error);
+
 	/* start the m_can controller */
 	m_can_start(dev);
 
@@ -1371,8 +2226,16 @@ static void m_can_stop(struct net_device *dev)
 	struct m_can_priv *priv = netdev_priv(dev);
 
 	/* disable all interrupts */
+	hrtimer_cancel(&priv->inject_timer);
 	m_can_disable_all_interrupts(priv);
 
+	cancel_delayed_work_sync(&priv->tc_work);
+	cancel_delayed_work_sync(&priv->lec_work);
+	cancel_delayed_work_sync(&priv->err_sum_work);
+	cancel_delayed_work_sync(&priv->busoff_work);
+	atomic_set(&priv->inject_latch, 0);
+	priv->ts_valid = false;
+
 	/* set the state as STOPPED */
 	priv->can.state = CAN_STATE_STOPPED;
 }
@@ -1392,20 +2255,6 @@ static int m_can_close(struct net_device *dev)
 	return 0;
 }
 
-static int m_can_next_echo_skb_occupied(struct net_device *dev, int putidx)
-{
-	struct m_can_priv *priv = netdev_priv(dev);
-	/*get wrap around for loopback skb index */
-	unsigned int wrap = priv->can.echo_skb_max;
-	int next_idx;
-
-	/* calculate next index */
-	next_idx = (++putidx >= wrap ? 0 : putidx);
-
-	/* check if occupied */
-	return !!priv->can.echo_skb[next_idx];
-}
-
 static netdev_tx_t m_can_start_xmit(struct sk_buff *skb,
 				    struct net_device *dev)
 {
@@ -1413,11 +2262,24 @@ static netdev_tx_t m_can_start_xmit(struct sk_buff *skb,
 	struct canfd_frame *cf = (struct canfd_frame *)skb->data;
 	u32 id, cccr, fdflags;
 	int i;
-	int putidx;
+	u32 putidx;
 
 	if (can_dropped_invalid_skb(dev, skb))
 		return NETDEV_TX_OK;
 
+	/* Check if the ring is full */
+	if (m_can_tx_ring_full(priv)) {
+		/* This shouldn't happen */
+		netif_stop_queue(dev);
+		m_can_tx_doorbell(priv);
+		netdev_warn(dev,
+			    "TX queue active although FIFO is full.");
+		return NETDEV_TX_BUSY;
+	}
+
+	/* put index kept in software, no TXFQS read per frame */
+	putidx = priv->tx_put;
+
 	/* Generate ID field for TX buffer Element */
 	/* Common to all supported M_CAN versions */
 	if (cf->can_id & CAN_EFF_FLAG) {
@@ -1431,20 +2293,17 @@ static netdev_tx_t m_can_start_xmit(struct sk_buff *skb,
 		id |= TX_BUF_RTR;
 
 	if (priv->version == 30) {
-		netif_stop_queue(dev);
-
 		/* message ram configuration */
-		m_can_fifo_write(priv, 0, M_CAN_FIFO_ID, id);
-		m_can_fifo_write(priv, 0, M_CAN_FIFO_DLC,
+		m_can_fifo_write(priv, putidx, M_CAN_FIFO_ID, id);
+		m_can_fifo_write(priv, putidx, M_CAN_FIFO_DLC,
 				 can_len2dlc(cf->len) << 16);
 
 		for (i = 0; i < cf->len; i += 4)
-			m_can_fifo_write(priv, 0,
+			m_can_fifo_write(priv, putidx,
 					 M_CAN_FIFO_DATA(i / 4),
 					 *(u32 *)(cf->data + i));
 
-		can_put_echo_skb(skb, dev, 0);
-
+		/* the ring is one buffer deep in FD mode, see chip_config */
 		if (priv->can.ctrlmode & CAN_CTRLMODE_FD) {
 			cccr = m_can_read(priv, M_CAN_CCCR);
 			cccr &= ~(CCCR_CMR_MASK << CCCR_CMR_SHIFT);
@@ -1460,24 +2319,10 @@ static netdev_tx_t m_can_start_xmit(struct sk_buff *skb,
 			}
 			m_can_write(priv, M_CAN_CCCR, cccr);
 		}
-		m_can_write(priv, M_CAN_TXBTIE, 0x1);
-		m_can_write(priv, M_CAN_TXBAR, 0x1);
 		/* End of xmit function for version 3.0.x */
 	} else {
 		/* Transmit routine for version >= v3.1.x */
 
-		/* Check if FIFO full */
-		if (m_can_tx_fifo_full(priv)) {
-			/* This shouldn't happen */
-			netif_stop_queue(dev);
-			netdev_warn(dev,
-				    "TX queue active although FIFO is full.");
-			return NETDEV_TX_BUSY;
-		}
-
-		/* get put index for frame */
-		putidx = ((m_can_read(priv, M_CAN_TXFQS) & TXFQS_TFQPI_MASK)
-				  >> TXFQS_TFQPI_SHIFT);
 		/* Write ID Field to FIFO Element */
 		m_can_fifo_write(priv, putidx, M_CAN_FIFO_ID, id);
 
@@ -1503,39 +2348,560 @@ static netdev_tx_t m_can_start_xmit(struct sk_buff *skb,
 		for (i = 0; i < cf->len; i += 4)
 			m_can_fifo_write(priv, putidx, M_CAN_FIFO_DATA(i / 4),
 					 *(u32 *)(cf->data + i));
+	}
 
-		/* Push loopback echo.
-		 * Will be looped back on TX interrupt based on message marker
-		 */
-		can_put_echo_skb(skb, dev, putidx);
+	/* Push loopback echo.
+	 * Will be looped back on TX completion based on the buffer index
+	 */
+	trace_m_can_xmit(dev, putidx, cf, 0);
+	skb_tx_timestamp(skb);
+	can_put_echo_skb(skb, dev, putidx);
+
+	priv->tx_bar |= BIT(putidx);
+	putidx++;
+	/* the FIFO wraps, the 3.0.x buffer ring restarts once drained */
+	if (putidx >= priv->tx_ring_size && priv->version != 30)
+		putidx = 0;
+	WRITE_ONCE(priv->tx_put, putidx);
+
+	/* stop network queue if the ring is full */
+	if (m_can_tx_ring_full(priv)) {
+		netif_stop_queue(dev);
+		/* NAPI may have released the batch in between */
+		smp_mb();
+		if (!m_can_tx_ring_full(priv))
+			netif_start_queue(dev);
+	}
+
+	/* one TXBAR write per batch: the stack sets xmit_more while it has
+	 * further frames for us, and a stopped queue ends the batch
+	 */
+	if (!netdev_xmit_more() || netif_queue_stopped(dev))
+		m_can_tx_doorbell(priv);
 
-		/* Enable TX FIFO element to start transfer  */
-		m_can_write(priv, M_CAN_TXBAR, (1 << putidx));
+	return NETDEV_TX_OK;
+}
+
+/* SIOCSHWTSTAMP: RX timestamps are all or nothing, TX timestamps come
+ * from the TX event FIFO, which version 3.0.x does not use
+ */
+static int m_can_hwtstamp_set(struct net_device *dev, struct ifreq *ifr)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	struct hwtstamp_config cfg;
 
-		/* stop network queue if fifo full */
-			if (m_can_tx_fifo_full(priv) ||
-			    m_can_next_echo_skb_occupied(dev, putidx))
-				netif_stop_queue(dev);
+	if (copy_from_user(&cfg, ifr->ifr_data, sizeof(cfg)))
+		return -EFAULT;
+
+	if (cfg.flags)
+		return -EINVAL;
+
+	switch (cfg.tx_type) {
+	case HWTSTAMP_TX_OFF:
+		break;
+	case HWTSTAMP_TX_ON:
+		if (priv->version == 30)
+			return -ERANGE;
+		break;
+	default:
+		return -ERANGE;
 	}
 
-	return NETDEV_TX_OK;
+	if (cfg.rx_filter != HWTSTAMP_FILTER_NONE)
+		cfg.rx_filter = HWTSTAMP_FILTER_ALL;
+
+	priv->hwts = cfg;
+
+	return copy_to_user(ifr->ifr_data, &cfg, sizeof(cfg)) ? -EFAULT : 0;
+}
+
+static int m_can_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+
+	switch (cmd) {
+	case SIOCSHWTSTAMP:
+		return m_can_hwtstamp_set(dev, ifr);
+	case SIOCGHWTSTAMP:
+		return copy_to_user(ifr->ifr_data, &priv->hwts,
+				    sizeof(priv->hwts)) ? -EFAULT : 0;
+	default:
+		return -EOPNOTSUPP;
+	}
 }
 
 static const struct net_device_ops m_can_netdev_ops = {
 	.ndo_open = m_can_open,
 	.ndo_stop = m_can_close,
 	.ndo_start_xmit = m_can_start_xmit,
+	.ndo_do_ioctl = m_can_ioctl,
 	.ndo_change_mtu = can_change_mtu,
 };
 
+static int m_can_get_coalesce(struct net_device *dev,
+			      struct ethtool_coalesce *ec)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+
+	ec->rx_max_coalesced_frames_irq = priv->rx_coalesce_frames;
+	ec->rx_coalesce_usecs_irq = priv->rx_coalesce_usecs;
+
+	return 0;
+}
+
+/* ethtool -C canX rx-frames-irq <n> rx-usecs-irq <us>
+ * Raise the FIFO 0 interrupt once n frames are waiting, or us after the
+ * first one arrived. n <= 1 interrupts on every frame. FIFO 1 is never
+ * coalesced. Like the bit timing, this is set while the interface is down.
+ */
+static int m_can_set_coalesce(struct net_device *dev,
+			      struct ethtool_coalesce *ec)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+	u32 frames = ec->rx_max_coalesced_frames_irq;
+	u32 usecs = ec->rx_coalesce_usecs_irq;
+
+	if (netif_running(dev))
+		return -EBUSY;
+
+	if (frames > priv->mcfg[MRAM_RXF0].num ||
+	    (frames > 1 && !usecs) || (frames <= 1 && usecs))
+		return -EINVAL;
+
+	priv->rx_coalesce_frames = frames;
+	priv->rx_coalesce_usecs = usecs;
+
+	return 0;
+}
+
+static int m_can_get_ts_info(struct net_device *dev,
+			     struct ethtool_ts_info *info)
+{
+	struct m_can_priv *priv = netdev_priv(dev);
+
+	info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE |
+				SOF_TIMESTAMPING_RX_SOFTWARE |
+				SOF_TIMESTAMPING_SOFTWARE |
+				SOF_TIMESTAMPING_RX_HARDWARE |
+				SOF_TIMESTAMPING_RAW_HARDWARE;
+	info->tx_types = BIT(HWTSTAMP_TX_OFF);
+	if (priv->version != 30) {
+		info->so_timestamping |= SOF_TIMESTAMPING_TX_HARDWARE;
+		info->tx_types |= BIT(HWTSTAMP_TX_ON);
+	}
+	info->rx_filters = BIT(HWTSTAMP_FILTER_NONE) |
+			   BIT(HWTSTAMP_FILTER_ALL);
+	/* the counter is not exposed as a PTP clock */
+	info->phc_index = -1;
+
+	return 0;
+}
+
+static const struct ethtool_ops m_can_ethtool_ops = {
+	.get_coalesce = m_can_get_coalesce,
+	.set_coalesce = m_can_set_coalesce,
+	.get_ts_info = m_can_get_ts_info,
+};
+
 static int register_m_can_dev(struct net_device *dev)
 {
 	dev->flags |= IFF_ECHO;	/* we support local echo */
 	dev->netdev_ops = &m_can_netdev_ops;
+	dev->ethtool_ops = &m_can_ethtool_ops;
 
 	return register_candev(dev);
 }
 
+static struct dentry *m_can_debugfs_root;
+
+static int m_can_filters_show(struct seq_file *s, void *unused)
+{
+	struct net_device *dev = s->private;
+	struct m_can_priv *priv = netdev_priv(dev);
+	const struct m_can_filt_set *fs;
+	char buf[96];
+	int i;
+
+	rtnl_lock();
+	fs = priv->filt;
+	seq_printf(s, "elements: std %d/%d ext %d/%d\n",
+		   fs ? fs->nsid : 0, priv->mcfg[MRAM_SIDF].num,
+		   fs ? fs->nxid : 0, priv->mcfg[MRAM_XIDF].num);
+	seq_printf(s, "non-matching: %s, received %u\n",
+		   fs && fs->nrules ? "rejected" : "fifo0", priv->filt_nonmatch);
+
+	for (i = 0; fs && i < fs->nrules; i++) {
+		m_can_filt_rule_str(&fs->rule[i], buf, sizeof(buf));
+		seq_printf(s, "rule %3d: %s\n", i, buf);
+	}
+	for (i = 0; fs && i < fs->nsid; i++) {
+		m_can_filt_elem_str(fs, 0, i, buf, sizeof(buf));
+		seq_printf(s, "%3d: %s hits %u\n", i, buf,
+			   priv->filt_hits_std[i]);
+	}
+	for (i = 0; fs && i < fs->nxid; i++) {
+		m_can_filt_elem_str(fs, 1, i, buf, sizeof(buf));
+		seq_printf(s, "%3d: %s hits %u\n", i, buf,
+			   priv->filt_hits_ext[i]);
+	}
+	rtnl_unlock();
+
+	return 0;
+}
+
+static int m_can_filters_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, m_can_filters_show, inode->i_private);
+}
+
+/* Writing a rule set (see m_can_filter.h) replaces the loaded one, an
+ * empty write removes all filters. The filter configuration registers
+ * can only be written in INIT mode, which also resets the FIFOs, so the
+ * rules are taken while the interface is down and loaded on open.
+ */
+static ssize_t m_can_filters_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct net_device *dev = s->private;
+	struct m_can_priv *priv = netdev_priv(dev);
+	struct m_can_filt_set *fs, *old;
+	char *text;
+	int ret;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+
+	text = memdup_user_nul(ubuf, count);
+	if (IS_ERR(text))
+		return PTR_ERR(text);
+
+	fs = kzalloc(sizeof(*fs), GFP_KERNEL);
+	if (!fs) {
+		kfree(text);
+		return -ENOMEM;
+	}
+
+	ret = m_can_filt_parse(fs, text);
+	if (ret) {
+		netdev_err(dev, "filter rule %d: %s\n", fs->nrules,
+			   ret == -E2BIG ? "too many rules" : "parse error");
+		goto out;
+	}
+
+	if (m_can_filt_uses_fifo1(fs) && !priv->mcfg[MRAM_RXF1].num) {
+		netdev_err(dev, "fifo1 rules need RX FIFO 1 in bosch,mram-cfg\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = m_can_filt_compile(fs, priv->mcfg[MRAM_SIDF].num,
+				 priv->mcfg[MRAM_XIDF].num);
+	if (ret) {
+		netdev_err(dev, "filters need %d std and %d ext elements, message RAM has %d and %d\n",
+			   fs->nsid, fs->nxid, priv->mcfg[MRAM_SIDF].num,
+			   priv->mcfg[MRAM_XIDF].num);
+		goto out;
+	}
+
+	rtnl_lock();
+	if (netif_running(dev)) {
+		rtnl_unlock();
+		ret = -EBUSY;
+		goto out;
+	}
+	old = priv->filt;
+	priv->filt = NULL;
+	if (fs->nrules) {
+		priv->filt = fs;
+		fs = NULL;
+	}
+	memset(priv->filt_hits_std, 0, sizeof(priv->filt_hits_std));
+	memset(priv->filt_hits_ext, 0, sizeof(priv->filt_hits_ext));
+	priv->filt_nonmatch = 0;
+	rtnl_unlock();
+
+	kfree(old);
+	ret = count;
+out:
+	kfree(fs);
+	kfree(text);
+	return ret;
+}
+
+static const struct file_operations m_can_filters_fops = {
+	.owner = THIS_MODULE,
+	.open = m_can_filters_open,
+	.read = seq_read,
+	.write = m_can_filters_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int m_can_rx_fifos_show(struct seq_file *s, void *unused)
+{
+	struct m_can_priv *priv = s->private;
+	const struct m_can_rxf_stats *st;
+	int i;
+
+	for (i = 0; i < M_CAN_RX_FIFOS; i++) {
+		st = &priv->rxf_stats[i];
+		seq_printf(s, "fifo%d: size %d frames %u lost %u max_fill %u batches %u\n",
+			   i, priv->mcfg[MRAM_RXF0 + i].num, st->frames,
+			   st->lost, st->max_fill, st->batches);
+	}
+	seq_printf(s, "hand-off: batches %u max %u reordered %u\n",
+		   priv->rxq_batches, priv->rxq_max, priv->rxq_reordered);
+
+	return 0;
+}
+
+static int m_can_rx_fifos_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, m_can_rx_fifos_show, inode->i_private);
+}
+
+/* any write resets the counters */
+static ssize_t m_can_rx_fifos_write(struct file *file,
+				    const char __user *ubuf, size_t count,
+				    loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct m_can_priv *priv = s->private;
+
+	memset(priv->rxf_stats, 0, sizeof(priv->rxf_stats));
+	priv->rxq_batches = 0;
+	priv->rxq_max = 0;
+	priv->rxq_reordered = 0;
+
+	return count;
+}
+
+static const struct file_operations m_can_rx_fifos_fops = {
+	.owner = THIS_MODULE,
+	.open = m_can_rx_fifos_open,
+	.read = seq_read,
+	.write = m_can_rx_fifos_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int m_can_bus_stats_show(struct seq_file *s, void *unused)
+{
+	struct m_can_priv *priv = s->private;
+	const struct m_can_stats_win *w, *first, *last;
+	const struct m_can_stats_id *e;
+	struct m_can_stats *st;
+	unsigned int start;
+	u64 now, ns;
+	u32 i, pm;
+
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+
+	do {
+		start = u64_stats_fetch_begin_irq(&priv->bstats_sync);
+		memcpy(st, &priv->bstats, sizeof(*st));
+	} while (u64_stats_fetch_retry_irq(&priv->bstats_sync, start));
+	now = ktime_get_ns();
+
+	seq_printf(s, "bitrate %u dbitrate %u\n",
+		   priv->can.bittiming.bitrate,
+		   priv->can.ctrlmode & CAN_CTRLMODE_FD ?
+		   priv->can.data_bittiming.bitrate : 0);
+
+	ns = now - st->since_ns;
+	pm = m_can_stats_load_pm(st->busy_ps, ns);
+	seq_printf(s, "total: %llu s %llu frames load %u.%u%% peak %u.%u%%\n",
+		   div_u64(ns, NSEC_PER_SEC), st->frames, pm / 10, pm % 10,
+		   st->peak_pm / 10, st->peak_pm % 10);
+
+	/* windows only close while NAPI runs, an idle bus shows as such */
+	ns = now - st->win_start_ns;
+	pm = m_can_stats_load_pm(st->win_busy_ps, ns);
+	seq_printf(s, "current: %llu ms %u frames load %u.%u%%\n",
+		   div_u64(ns, NSEC_PER_MSEC), st->win_frames, pm / 10, pm % 10);
+
+	if (st->hist_count) {
+		seq_puts(s, "windows:     ms  load%  frames  bus_errors  tec  rec\n");
+		for (i = 0; i < st->hist_count; i++) {
+			w = m_can_stats_hist(st, i);
+			seq_printf(s, "%7d %6u %3u.%u %7u %11u %4u %4u\n",
+				   (int)i - (int)st->hist_count, w->ms,
+				   w->load_pm / 10, w->load_pm % 10, w->frames,
+				   w->bus_errors, w->tec, w->rec);
+		}
+		first = m_can_stats_hist(st, 0);
+		last = m_can_stats_hist(st, st->hist_count - 1);
+		seq_printf(s, "error counter trend: tec %+d rec %+d over %u windows\n",
+			   (int)last->tec - (int)first->tec,
+			   (int)last->rec - (int)first->rec, st->hist_count);
+	}
+
+	sort(st->ids, M_CAN_STATS_IDS, sizeof(st->ids[0]), m_can_stats_cmp,
+	     NULL);
+	seq_printf(s, "ids: %u tracked, other %u frames\n", st->nids,
+		   st->other_frames);
+	for (i = 0; i < M_CAN_STATS_IDS; i++) {
+		e = &st->ids[i];
+		if (e->key == M_CAN_STATS_EMPTY)
+			break;
+		seq_printf(s, "%*x %10u frames %3u.%u%% of bus time\n",
+			   e->key & CAN_EFF_FLAG ? 8 : 3,
+			   e->key & CAN_EFF_MASK, e->frames,
+			   st->busy_ps ? (u32)div64_u64(e->busy_ps * 1000,
+							st->busy_ps) / 10 : 0,
+			   st->busy_ps ? (u32)div64_u64(e->busy_ps * 1000,
+							st->busy_ps) % 10 : 0);
+	}
+
+	kfree(st);
+
+	return 0;
+}
+
+static int m_can_bus_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, m_can_bus_stats_show, inode->i_private);
+}
+
+/* any write resets the statistics, at the next poll while running */
+static ssize_t m_can_bus_stats_write(struct file *file,
+				     const char __user *ubuf, size_t count,
+				     loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct m_can_priv *priv = s->private;
+
+	rtnl_lock();
+	if (netif_running(priv->dev))
+		WRITE_ONCE(priv->bstats_reset, true);
+	else
+		m_can_stats_reset(&priv->bstats, ktime_get_ns(),
+				  priv->can.can_stats.bus_error);
+	rtnl_unlock();
+
+	return count;
+}
+
+static const struct file_operations m_can_bus_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = m_can_bus_stats_open,
+	.read = seq_read,
+	.write = m_can_bus_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int m_can_errors_show(struct seq_file *s, void *unused)
+{
+	struct m_can_priv *priv = s->private;
+	const struct m_can_err_stats *es = &priv->err_stats;
+
+	seq_printf(s, "lec interrupts %u, limit %u per %u ms\n",
+		   es->lec_irqs, priv->lec_irq_limit, M_CAN_LEC_WINDOW_MS);
+	seq_printf(s, "lec masked %u times, %u ms in all, last backoff %u ms%s\n",
+		   es->lec_masked, es->lec_masked_ms, priv->lec_backoff,
+		   READ_ONCE(priv->lec_masked) ? ", masked now" : "");
+	seq_printf(s, "bus error frames %u, errors held back %u, summary every %u ms\n",
+		   es->summaries, es->coalesced, priv->err_summary_ms);
+	seq_printf(s, "bus-off %u, automatic restarts %u, last delay %u ms\n",
+		   priv->can.can_stats.bus_off, es->busoff_restarts,
+		   priv->busoff_delay);
+	seq_printf(s, "injected %u%s\n", es->injected,
+		   hrtimer_active(&priv->inject_timer) ? ", burst running" : "");
+
+	return 0;
+}
+
+static int m_can_errors_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, m_can_errors_show, inode->i_private);
+}
+
+/* Fault injection while running, berr-reporting on:
+ *   lec <rate_hz> <ms>	LEC interrupts at that rate for that long
+ *   busoff		one bus-off
+ *   stop		end a burst
+ */
+static ssize_t m_can_errors_write(struct file *file, const char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct m_can_priv *priv = s->private;
+	u32 hz, ms;
+	char *text;
+	int ret = count;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+
+	text = memdup_user_nul(ubuf, count);
+	if (IS_ERR(text))
+		return PTR_ERR(text);
+
+	rtnl_lock();
+	if (!netif_running(priv->dev)) {
+		ret = -ENETDOWN;
+	} else if (sscanf(text, "lec %u %u", &hz, &ms) == 2 &&
+		   hz && hz <= 1000000) {
+		hrtimer_cancel(&priv->inject_timer);
+		priv->inject_ir = m_can_lec_irqs(priv);
+		priv->inject_period = ns_to_ktime(NSEC_PER_SEC / hz);
+		priv->inject_end = ktime_add_ms(ktime_get(), ms);
+		hrtimer_start(&priv->inject_timer, priv->inject_period,
+			      HRTIMER_MODE_REL);
+	} else if (sysfs_streq(text, "busoff")) {
+		local_bh_disable();
+		m_can_inject_raise(priv, IR_BO);
+		local_bh_enable();
+	} else if (sysfs_streq(text, "stop")) {
+		hrtimer_cancel(&priv->inject_timer);
+	} else {
+		ret = -EINVAL;
+	}
+	rtnl_unlock();
+
+	kfree(text);
+	return ret;
+}
+
+static const struct file_operations m_can_errors_fops = {
+	.owner = THIS_MODULE,
+	.open = m_can_errors_open,
+	.read = seq_read,
+	.write = m_can_errors_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void m_can_debugfs_init(struct m_can_priv *priv)
+{
+	priv->debugfs = debugfs_create_dir(dev_name(priv->device),
+					   m_can_debugfs_root);
+	debugfs_create_file("filters", 0600, priv->debugfs, priv->dev,
+			    &m_can_filters_fops);
+	debugfs_create_file("rx_fifos", 0600, priv->debugfs, priv,
+			    &m_can_rx_fifos_fops);
+	debugfs_create_file("bus_stats", 0600, priv->debugfs, priv,
+			    &m_can_bus_stats_fops);
+	debugfs_create_file("errors", 0600, priv->debugfs, priv,
+			    &m_can_errors_fops);
+	debugfs_create_u32("lec_irq_limit", 0600, priv->debugfs,
+			   &priv->lec_irq_limit);
+	debugfs_create_u32("lec_backoff_ms", 0600, priv->debugfs,
+			   &priv->lec_backoff_ms);
+	debugfs_create_u32("lec_backoff_max_ms", 0600, priv->debugfs,
+			   &priv->lec_backoff_max_ms);
+	debugfs_create_u32("err_summary_ms", 0600, priv->debugfs,
+			   &priv->err_summary_ms);
+	debugfs_create_u32("busoff_restart_ms", 0600, priv->debugfs,
+			   &priv->busoff_restart_ms);
+	debugfs_create_u32("busoff_restart_max_ms", 0600, priv->debugfs,
+			   &priv->busoff_restart_max_ms);
+}
+
 static void m_can_init_ram(struct m_can_priv *priv)
 {
 	int end, i, start;
@@ -1666,6 +3032,13 @@ static int m_can_plat_probe(struct platform_device *pdev)
 	priv->can.clock.freq = clk_get_rate(cclk);
 	priv->mram_base = mram_addr;
 
+	/* optional external timestamp clock, in Hz */
+	of_property_read_u32(np, "bosch,ts-external-hz", &priv->ts_ext_hz);
+	if (priv->ts_ext_hz && priv->ts_ext_hz < 1000) {
+		dev_warn(&pdev->dev, "bosch,ts-external-hz too low, using the internal counter\n");
+		priv->ts_ext_hz = 0;
+	}
+
 	platform_set_drvdata(pdev, dev);
 	SET_NETDEV_DEV(dev, &pdev->dev);
 
@@ -1690,6 +3063,8 @@ static int m_can_plat_probe(struct platform_device *pdev)
 
 	m_can_of_parse_mram(priv, mram_config_vals);
 
+	m_can_debugfs_init(priv);
+
 	devm_can_led_init(dev);
 
 	of_can_transceiver(dev);
@@ -1763,8 +3138,11 @@ static void unregister_m_can_dev(struct net_device *dev)
 static int m_can_plat_remove(struct platform_device *pdev)
 {
 	struct net_device *dev = platform_get_drvdata(pdev);
+	struct m_can_priv *priv = netdev_priv(dev);
 
+	debugfs_remove_recursive(priv->debugfs);
 	unregister_m_can_dev(dev);
+	kfree(priv->filt);
 
 	pm_runtime_disable(&pdev->dev);
 
@@ -1825,7 +3203,27 @@ static struct platform_driver m_can_plat_driver = {
 	.remove = m_can_plat_remove,
 };
 
-module_platform_driver(m_can_plat_driver);
+static int __init m_can_init(void)
+{
+	int ret;
+
+	m_can_stats_init_tabs();
+	m_can_debugfs_root = debugfs_create_dir("m_can", NULL);
+	ret = platform_driver_register(&m_can_plat_driver);
+	if (ret)
+		debugfs_remove_recursive(m_can_debugfs_root);
+
+	return ret;
+}
+
+static void __exit m_can_exit(void)
+{
+	platform_driver_unregister(&m_can_plat_driver);
+	debugfs_remove_recursive(m_can_debugfs_root);
+}
+
+module_init(m_can_init);
+module_exit(m_can_exit);
 
 MODULE_AUTHOR("Dong Aisheng <b29396@freescale.com>");
 MODULE_LICENSE("GPL v2");
@@ -0,0 +1,63 @@
+#ifndef M_CAN_RXQ_H
+#define M_CAN_RXQ_H
+
+/*
+ * Hand-off queue of the M_CAN NAPI poll, ordered by hardware timestamp,
+ * shared by m_can_platform.ko and canRxqApp so the ordering can be
+ * simulated offline.
+ *
+ * It plays the part of can_rx_offload's sorted queue: one poll reads the
+ * TX event FIFO, RX FIFO 1 and RX FIFO 0 in turn, each of them in bus
+ * order by itself, and the frames are merged here by the start of frame
+ * timestamp (m_can_ts.h) before the whole batch goes to the stack at
+ * once. Insertion walks back from the tail, where a frame of the source
+ * being read usually belongs, so merging k sources costs at most k - 1
+ * moves per frame. Equal keys keep insertion order; with timestamps off
+ * every key is 0 and the queue is a plain FIFO.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+typedef uint64_t u64;
+typedef uint32_t u32;
+#endif
+
+/* one poll: the RX quota plus the TX event quota */
+#define M_CAN_RXQ_MAX	128
+
+struct m_can_rxq_ent {
+	u64 key;		/* SOF time in ns */
+	void *item;
+};
+
+struct m_can_rxq {
+	u32 n;
+	struct m_can_rxq_ent ent[M_CAN_RXQ_MAX];
+};
+
+/*
+ * @description	: insert in key order, behind any equal keys
+ * @return	: how many queued entries the new one went in front of,
+ *		  0 if it was appended, -1 if the queue is full
+ */
+static inline int m_can_rxq_add(struct m_can_rxq *q, u64 key, void *item)
+{
+	u32 i = q->n;
+
+	if (q->n >= M_CAN_RXQ_MAX)
+		return -1;
+
+	while (i && q->ent[i - 1].key > key) {
+		q->ent[i] = q->ent[i - 1];
+		i--;
+	}
+	q->ent[i].key = key;
+	q->ent[i].item = item;
+	q->n++;
+
+	return (int)(q->n - 1 - i);
+}
+
+#endif
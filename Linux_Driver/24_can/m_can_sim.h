@@ -0,0 +1,293 @@
+#ifndef M_CAN_SIM_H
+#define M_CAN_SIM_H
+
+/*
+ * Model of the M_CAN message RAM and the driver's NAPI poll, for the
+ * offline modes of canRxqApp and canBenchApp (userspace only).
+ *
+ * Frames go on the bus one after the other and land in the TX event FIFO,
+ * RX FIFO 1 or RX FIFO 0 at their end of frame, or are lost when it is
+ * full. After an interrupt latency a poll runs the way m_can_poll() does:
+ * TX events, FIFO 1, FIFO 0, FIFO 1 once more, each status read, element
+ * and acknowledge costing cost_ns while the bus goes on, and the frames
+ * are handed off as read or through the sorted queue of m_can_rxq.h.
+ * The counter extension of m_can_ts.h is read four times per wrap like
+ * tc_work does, and every key is checked against the frame's true time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "m_can_ts.h"
+#include "m_can_rxq.h"
+
+#define M_CAN_SIM_TXE		0
+#define M_CAN_SIM_F1		1
+#define M_CAN_SIM_F0		2
+#define M_CAN_SIM_SRCS		3
+#define M_CAN_SIM_FIFO_MAX	64
+#define M_CAN_SIM_QUOTA		64	/* M_CAN_NAPI_WEIGHT */
+
+static const u32 m_can_sim_fifo_size[M_CAN_SIM_SRCS] = { 16, 16, 32 };
+
+struct m_can_sim_frame {
+	u64 tick;		/* SOF in counter ticks */
+	u64 sof_ns;
+	u64 eof_ns;		/* when it lands in its FIFO */
+	u64 done_ns;		/* when it was handed off, 0: lost */
+	int src;
+};
+
+struct m_can_sim {
+	/* set up by the caller */
+	u32 bitrate;
+	u64 cost_ns;		/* one register or element access */
+	u32 stall_pct;		/* polls held up by other softirq work */
+	int sorted;
+
+	struct m_can_sim_frame *f;
+	u32 nf, next;
+	u32 fifo[M_CAN_SIM_SRCS][M_CAN_SIM_FIFO_MAX];
+	u32 head[M_CAN_SIM_SRCS], fill[M_CAN_SIM_SRCS];
+
+	u64 now;
+	struct m_can_tc tc, poll_tc;
+	u64 tc_next, tc_period;
+	struct m_can_rxq q;
+	u32 batch;
+
+	/* results */
+	u32 lost, polls, delivered, inversions, max_batch;
+	u32 key_fails;
+	long long max_err;
+	u64 last_sof;
+	u64 busy_ns;		/* time spent polling */
+};
+
+static inline u32 m_can_sim_counter(const struct m_can_sim *s, u64 ns)
+{
+	return (u32)(ns * s->bitrate / 1000000000ULL) & 0xffff;
+}
+
+/* let time pass: counter reads by tc_work, frames landing in the FIFOs */
+static inline void m_can_sim_advance(struct m_can_sim *s, u64 dt)
+{
+	struct m_can_sim_frame *fr;
+	u32 src;
+
+	s->now += dt;
+	while (s->tc_next <= s->now) {
+		m_can_tc_read(&s->tc, m_can_sim_counter(s, s->tc_next));
+		s->tc_next += s->tc_period;
+	}
+	while (s->next < s->nf && s->f[s->next].eof_ns <= s->now) {
+		fr = &s->f[s->next];
+		src = fr->src;
+		if (s->fill[src] < m_can_sim_fifo_size[src]) {
+			s->fifo[src][(s->head[src] + s->fill[src]) %
+				     m_can_sim_fifo_size[src]] = s->next;
+			s->fill[src]++;
+		} else {
+			s->lost++;
+		}
+		s->next++;
+	}
+}
+
+static inline void m_can_sim_out(struct m_can_sim *s,
+				 struct m_can_sim_frame *fr)
+{
+	if (s->delivered && fr->sof_ns < s->last_sof)
+		s->inversions++;
+	s->last_sof = fr->sof_ns;
+	fr->done_ns = s->now;
+	s->delivered++;
+}
+
+static inline void m_can_sim_read_elem(struct m_can_sim *s, u32 src)
+{
+	struct m_can_sim_frame *fr = &s->f[s->fifo[src][s->head[src]]];
+	long long err;
+	u64 key;
+
+	s->head[src] = (s->head[src] + 1) % m_can_sim_fifo_size[src];
+	s->fill[src]--;
+	m_can_sim_advance(s, s->cost_ns);
+	s->batch++;
+
+	/* truncation of mult: 2^-24 ns per count, plus rounding */
+	key = m_can_tc_cyc2time(&s->poll_tc, (u32)fr->tick & 0xffff);
+	err = (long long)(key - fr->tick * 1000000000ULL / s->bitrate);
+	if (err < 0)
+		err = -err;
+	if (err > s->max_err)
+		s->max_err = err;
+	if (err > 2 + (long long)(fr->tick >> M_CAN_TC_SHIFT))
+		s->key_fails++;
+
+	if (!s->sorted || m_can_rxq_add(&s->q, key, fr) < 0)
+		m_can_sim_out(s, fr);
+}
+
+/* m_can_do_rx_poll(): status read, batch of elements, one acknowledge */
+static inline int m_can_sim_rx_poll(struct m_can_sim *s, u32 src, int quota)
+{
+	int pkts = 0, n;
+
+	while (pkts < quota) {
+		m_can_sim_advance(s, s->cost_ns);
+		if (!s->fill[src])
+			break;
+		n = s->fill[src] < (u32)(quota - pkts) ? (int)s->fill[src] :
+							  quota - pkts;
+		pkts += n;
+		while (n--)
+			m_can_sim_read_elem(s, src);
+		m_can_sim_advance(s, s->cost_ns);
+	}
+
+	return pkts;
+}
+
+/* m_can_poll(), returns whether NAPI polls again at once */
+static inline int m_can_sim_poll(struct m_can_sim *s)
+{
+	u64 start = s->now;
+	int work, tx, i;
+
+	s->polls++;
+	s->batch = 0;
+	m_can_sim_advance(s, s->cost_ns);
+	s->poll_tc = s->tc;
+
+	m_can_sim_advance(s, s->cost_ns);
+	tx = s->fill[M_CAN_SIM_TXE] < M_CAN_SIM_QUOTA ?
+	     (int)s->fill[M_CAN_SIM_TXE] : M_CAN_SIM_QUOTA;
+	for (i = 0; i < tx; i++)
+		m_can_sim_read_elem(s, M_CAN_SIM_TXE);
+	if (tx)
+		m_can_sim_advance(s, s->cost_ns);
+
+	work = m_can_sim_rx_poll(s, M_CAN_SIM_F1, M_CAN_SIM_QUOTA);
+	work += m_can_sim_rx_poll(s, M_CAN_SIM_F0, M_CAN_SIM_QUOTA - work);
+	if (work < M_CAN_SIM_QUOTA) {
+		m_can_sim_advance(s, s->cost_ns);
+		if (s->fill[M_CAN_SIM_F1])
+			work += m_can_sim_rx_poll(s, M_CAN_SIM_F1,
+						  M_CAN_SIM_QUOTA - work);
+	}
+
+	for (i = 0; i < (int)s->q.n; i++)
+		m_can_sim_out(s, s->q.ent[i].item);
+	s->q.n = 0;
+	if (s->batch > s->max_batch)
+		s->max_batch = s->batch;
+	s->busy_ns += s->now - start;
+
+	return work == M_CAN_SIM_QUOTA || tx == M_CAN_SIM_QUOTA;
+}
+
+static inline int m_can_sim_idle(const struct m_can_sim *s)
+{
+	return !s->fill[M_CAN_SIM_TXE] && !s->fill[M_CAN_SIM_F1] &&
+	       !s->fill[M_CAN_SIM_F0];
+}
+
+/*
+ * @description	: bus traffic, 20% our own frames and 20% for FIFO 1
+ * @param - dbitrate : data phase bit rate of the FD frames
+ * @param - fd_pct   : share of CAN FD frames with BRS and 64 bytes,
+ *		       the others are classic with 0 to 8 bytes
+ * @param - load     : bus load in percent, idle gaps are random
+ * @return	: the frames in bus order, NULL when out of memory
+ */
+static inline struct m_can_sim_frame *m_can_sim_gen(u32 bitrate, u32 dbitrate,
+						    u32 fd_pct, u32 load,
+						    u32 seconds, u32 *nf)
+{
+	u64 tick = 1000, end = (u64)seconds * bitrate;
+	u32 n = 0, cap = 1024, len, gap, r;
+	struct m_can_sim_frame *f = malloc(cap * sizeof(*f)), *nfr;
+
+	while (f && tick < end) {
+		if (n == cap) {
+			cap *= 2;
+			nfr = realloc(f, cap * sizeof(*f));
+			if (!nfr) {
+				free(f);
+				return NULL;
+			}
+			f = nfr;
+		}
+		if ((u32)rand() % 100 < fd_pct)
+			/* arbitration and end at the nominal rate, 64 bytes
+			 * and the CRC at the data rate, in nominal bit times
+			 */
+			len = 30 + (u32)((u64)(512 + 40) * bitrate / dbitrate);
+		else
+			len = 47 + (u32)rand() % 89;
+		r = (u32)rand() % 10;
+		f[n].src = r < 2 ? M_CAN_SIM_TXE : r < 4 ? M_CAN_SIM_F1 :
+		       M_CAN_SIM_F0;
+		f[n].tick = tick;
+		f[n].sof_ns = tick * 1000000000ULL / bitrate;
+		f[n].eof_ns = (tick + len) * 1000000000ULL / bitrate;
+		f[n].done_ns = 0;
+		n++;
+		gap = (len + 3) * (100 - load) / load;
+		gap = gap ? (u32)rand() % (2 * gap + 1) : 0;
+		tick += len + 3 + gap;
+	}
+	*nf = n;
+
+	return f;
+}
+
+/* feed the frames through interrupts and polls, seed fixes the latencies */
+static inline void m_can_sim_run(struct m_can_sim *s,
+				 struct m_can_sim_frame *f, u32 nf,
+				 unsigned int seed)
+{
+	u32 i;
+
+	memset(s->fifo, 0, sizeof(s->fifo));
+	memset(s->head, 0, sizeof(s->head));
+	memset(s->fill, 0, sizeof(s->fill));
+	s->f = f;
+	s->nf = nf;
+	s->next = 0;
+	s->now = 0;
+	s->q.n = 0;
+	s->lost = s->polls = s->delivered = s->inversions = s->max_batch = 0;
+	s->key_fails = 0;
+	s->max_err = 0;
+	s->last_sof = 0;
+	s->busy_ns = 0;
+	for (i = 0; i < nf; i++)
+		f[i].done_ns = 0;
+
+	/* as m_can_ts_start(): anchored at 0, read four times per wrap */
+	m_can_tc_init(&s->tc, 0xffff, s->bitrate, 0, 0);
+	s->tc_period = m_can_tc_wrap_ns(&s->tc) / 4;
+	s->tc_next = s->tc_period;
+
+	/* a few us to the poll, up to 2 ms when other softirq work is in
+	 * the way
+	 */
+	srand(seed);
+	for (;;) {
+		m_can_sim_advance(s, 0);
+		if (m_can_sim_idle(s)) {
+			if (s->next >= s->nf)
+				break;
+			m_can_sim_advance(s, s->f[s->next].eof_ns - s->now);
+		}
+		if ((u32)rand() % 100 >= s->stall_pct)
+			m_can_sim_advance(s, 2000 + (u64)rand() % 20000);
+		else
+			m_can_sim_advance(s, 200000 + (u64)rand() % 1800000);
+		while (m_can_sim_poll(s))
+			m_can_sim_advance(s, s->cost_ns);
+	}
+}
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef M_CAN_STATS_H
+#define M_CAN_STATS_H
+
+/*
+ * Bus load and per-id traffic statistics, shared by m_can_platform.ko and
+ * canStatsApp so the engine can be tested offline and run on any socket.
+ *
+ * Every frame is charged with the time it occupied the bus: its exact
+ * length including dynamic stuff bits (computed from the id and payload,
+ * with the CRC for classic frames), the fixed stuff bits of the CAN FD CRC
+ * field, and for FD frames with BRS the data phase at the data bit rate.
+ * Load is that time over wall time, per window and since the last reset.
+ *
+ * Per-id counters live in a fixed open-addressing table with linear
+ * probing. Once it is 3/4 full, or a probe sequence runs out, new ids are
+ * summed up in "other", so the table never grows and lookups stay short.
+ *
+ * There is a single writer (the driver's NAPI poll, or the App's receive
+ * loop) and no locking in here; the driver wraps updates in u64_stats_sync
+ * so readers can take a consistent copy.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/can.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#define m_can_stats_div(a, b)	div64_u64((a), (b))
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/can.h>
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+#define m_can_stats_div(a, b)	((a) / (b))
+#endif
+
+#define M_CAN_STATS_IDS_BITS	8
+#define M_CAN_STATS_IDS		(1 << M_CAN_STATS_IDS_BITS)	/* slots */
+#define M_CAN_STATS_IDS_MAX	192	/* ids tracked before "other" */
+#define M_CAN_STATS_PROBES	8
+#define M_CAN_STATS_HIST	16	/* closed windows kept */
+#define M_CAN_STATS_WINDOW_NS	1000000000ULL
+#define M_CAN_STATS_EMPTY	0xffffffff	/* not a valid key */
+
+/* bits after the CRC sequence: delimiter, ACK, ACK delimiter, EOF, IFS */
+#define M_CAN_BITS_TAIL		13
+
+struct m_can_stats_id {
+	u32 key;		/* can_id with CAN_EFF_FLAG, no RTR/ERR */
+	u32 frames;
+	u64 busy_ps;		/* bus time */
+};
+
+struct m_can_stats_win {
+	u32 ms;			/* window length */
+	u32 load_pm;		/* per mille */
+	u32 frames;
+	u32 bus_errors;
+	u16 tec;		/* error counters at the end of the window */
+	u16 rec;
+};
+
+struct m_can_stats {
+	u32 ps_nbit;		/* picoseconds per nominal bit */
+	u32 ps_dbit;		/* picoseconds per data phase bit */
+
+	/* since the last reset */
+	u64 since_ns;
+	u64 frames;
+	u64 busy_ps;
+	u32 peak_pm;
+
+	/* window in progress */
+	u64 win_start_ns;
+	u64 win_busy_ps;
+	u32 win_frames;
+	u32 win_bus_errors;	/* bus error count at the window start */
+
+	struct m_can_stats_win hist[M_CAN_STATS_HIST];
+	u32 hist_head;		/* next slot */
+	u32 hist_count;
+
+	u32 nids;
+	u32 other_frames;
+	u64 other_ps;
+	struct m_can_stats_id ids[M_CAN_STATS_IDS];
+};
+
+/*
+ * Frame length. Bit stream state: value and run length of the last bit
+ * for stuffing, the CRC-15 of classic frames, and a bit count per phase.
+ */
+struct m_can_bits {
+	u32 n[2];		/* nominal, data phase */
+	int phase;
+	u32 last;
+	u32 run;
+	u32 crc;
+	bool crc_on;
+};
+
+static u8 m_can_stuff_tab[12][256];	/* state in -> state out | stuff << 4 */
+static u16 m_can_crc15_tab[256];
+static bool m_can_tabs_ready;
+
+/* one bit, with a dynamic stuff bit in front after five equal ones */
+static inline void m_can_bit(struct m_can_bits *b, u32 bit)
+{
+	u32 nxt;
+
+	bit &= 1;
+	if (b->run == 5) {
+		b->n[b->phase]++;
+		b->last ^= 1;
+		b->run = 1;
+	}
+	if (b->crc_on) {
+		nxt = bit ^ ((b->crc >> 14) & 1);
+		b->crc = (b->crc << 1) & 0x7fff;
+		if (nxt)
+			b->crc ^= 0x4599;
+	}
+	if (bit == b->last) {
+		b->run++;
+	} else {
+		b->last = bit;
+		b->run = 1;
+	}
+	b->n[b->phase]++;
+}
+
+/* a field, most significant bit first */
+static inline void m_can_bits(struct m_can_bits *b, u32 val, int width)
+{
+	while (width--)
+		m_can_bit(b, val >> width);
+}
+
+/* Build the byte tables: stuffing state (last bit, run 0..5) after a byte
+ * and the stuff bits it needed, and CRC-15 per byte.
+ */
+static inline void m_can_stats_init_tabs(void)
+{
+	struct m_can_bits b;
+	u32 s, v, i, c;
+
+	if (m_can_tabs_ready)
+		return;
+
+	for (s = 0; s < 12; s++) {
+		for (v = 0; v < 256; v++) {
+			memset(&b, 0, sizeof(b));
+			b.last = s / 6;
+			b.run = s % 6;
+			m_can_bits(&b, v, 8);
+			m_can_stuff_tab[s][v] = (b.last * 6 + b.run) |
+						((b.n[0] - 8) << 4);
+		}
+	}
+
+	for (v = 0; v < 256; v++) {
+		c = v << 7;
+		for (i = 0; i < 8; i++)
+			c = c & 0x4000 ? (c << 1) ^ 0x4599 : c << 1;
+		m_can_crc15_tab[v] = c & 0x7fff;
+	}
+
+	m_can_tabs_ready = true;
+}
+
+/* payload, a byte at a time through the tables */
+static inline void m_can_bytes(struct m_can_bits *b, const u8 *data, u32 len)
+{
+	u32 s = b->last * 6 + b->run, t, i;
+
+	for (i = 0; i < len; i++) {
+		if (b->crc_on)
+			b->crc = ((b->crc << 8) ^
+				  m_can_crc15_tab[((b->crc >> 7) ^ data[i]) &
+						  0xff]) & 0x7fff;
+		t = m_can_stuff_tab[s][data[i]];
+		b->n[b->phase] += 8 + (t >> 4);
+		s = t & 0xf;
+	}
+	b->last = s / 6;
+	b->run = s % 6;
+}
+
+static inline u32 m_can_len2dlc(u32 len)
+{
+	static const u8 dlc[65] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8,			/* 0 - 8 */
+		9, 9, 9, 9,					/* 9 - 12 */
+		10, 10, 10, 10,					/* 13 - 16 */
+		11, 11, 11, 11,					/* 17 - 20 */
+		12, 12, 12, 12,					/* 21 - 24 */
+		13, 13, 13, 13, 13, 13, 13, 13,			/* 25 - 32 */
+		14, 14, 14, 14, 14, 14, 14, 14,			/* 33 - 40 */
+		14, 14, 14, 14, 14, 14, 14, 14,			/* 41 - 48 */
+		15, 15, 15, 15, 15, 15, 15, 15,			/* 49 - 56 */
+		15, 15, 15, 15, 15, 15, 15, 15,			/* 57 - 64 */
+	};
+
+	return dlc[len > 64 ? 64 : len];
+}
+
+/*
+ * @description	: exact length of a frame as sent on the bus, the byte
+ *		  tables must have been built with m_can_stats_init_tabs()
+ * @param - fd	: CAN FD frame, @flags its CANFD_BRS / CANFD_ESI
+ * @param - nbits, dbits : bits at the nominal and the data bit rate
+ */
+static inline void m_can_frame_bits(canid_t can_id, const u8 *data, u32 len,
+				    bool fd, u32 flags, u32 *nbits, u32 *dbits)
+{
+	bool eff = can_id & CAN_EFF_FLAG;
+	bool rtr = !fd && (can_id & CAN_RTR_FLAG);
+	struct m_can_bits b;
+	u32 id = can_id & (eff ? CAN_EFF_MASK : CAN_SFF_MASK);
+	u32 crc_len;
+
+	memset(&b, 0, sizeof(b));
+	b.crc_on = !fd;
+
+	m_can_bit(&b, 0);				/* SOF */
+	if (eff) {
+		m_can_bits(&b, id >> 18, 11);
+		m_can_bits(&b, 3, 2);			/* SRR, IDE */
+		m_can_bits(&b, id, 18);
+	} else {
+		m_can_bits(&b, id, 11);
+	}
+
+	if (!fd) {
+		m_can_bit(&b, rtr);			/* RTR */
+		m_can_bits(&b, 0, 2);			/* IDE or r1, r0 */
+		if (len > 8)
+			len = 8;
+		m_can_bits(&b, len, 4);			/* DLC */
+		if (!rtr)
+			m_can_bytes(&b, data, len);
+
+		b.crc_on = false;
+		m_can_bits(&b, b.crc, 15);
+		/* stuffing still applies after the last CRC bit */
+		if (b.run == 5)
+			b.n[0]++;
+
+		*nbits = b.n[0] + M_CAN_BITS_TAIL;
+		*dbits = 0;
+		return;
+	}
+
+	if (eff)
+		m_can_bits(&b, 0x2, 3);			/* RRS, FDF, res */
+	else
+		m_can_bits(&b, 0x2, 4);			/* RRS, IDE, FDF, res */
+	m_can_bit(&b, !!(flags & CANFD_BRS));
+	if (flags & CANFD_BRS)
+		b.phase = 1;
+
+	m_can_bit(&b, !!(flags & CANFD_ESI));
+	m_can_bits(&b, m_can_len2dlc(len), 4);
+	m_can_bytes(&b, data, len);
+
+	/* stuff count and CRC with their fixed stuff bits, CRC delimiter;
+	 * a dynamic stuff bit due here is replaced by the first fixed one
+	 */
+	crc_len = len > 16 ? 21 : 17;
+	b.n[b.phase] += 4 + crc_len + (crc_len == 21 ? 7 : 6) + 1;
+
+	*nbits = b.n[0] + M_CAN_BITS_TAIL - 1;
+	*dbits = b.n[1];
+}
+
+static inline u32 m_can_stats_hash(u32 key)
+{
+	/* Fibonacci hashing, top bits of the product */
+	return (key * 0x9e3779b1u) >> (32 - M_CAN_STATS_IDS_BITS);
+}
+
+static inline void m_can_stats_reset(struct m_can_stats *st, u64 now_ns,
+				     u32 bus_errors)
+{
+	u32 i;
+
+	st->since_ns = now_ns;
+	st->frames = 0;
+	st->busy_ps = 0;
+	st->peak_pm = 0;
+	st->win_start_ns = now_ns;
+	st->win_busy_ps = 0;
+	st->win_frames = 0;
+	st->win_bus_errors = bus_errors;
+	st->hist_head = 0;
+	st->hist_count = 0;
+	st->nids = 0;
+	st->other_frames = 0;
+	st->other_ps = 0;
+	for (i = 0; i < M_CAN_STATS_IDS; i++)
+		st->ids[i].key = M_CAN_STATS_EMPTY;
+}
+
+/* bit rates in bit/s; a zero data bit rate means no FD data phase */
+static inline void m_can_stats_rates(struct m_can_stats *st, u32 bitrate,
+				     u32 dbitrate)
+{
+	st->ps_nbit = bitrate ? (u32)m_can_stats_div(1000000000000ULL,
+						     bitrate) : 0;
+	st->ps_dbit = dbitrate ? (u32)m_can_stats_div(1000000000000ULL,
+						      dbitrate) : st->ps_nbit;
+}
+
+static inline struct m_can_stats_id *
+m_can_stats_slot(struct m_can_stats *st, u32 key)
+{
+	struct m_can_stats_id *e;
+	u32 h = m_can_stats_hash(key), i;
+
+	for (i = 0; i < M_CAN_STATS_PROBES; i++) {
+		e = &st->ids[(h + i) & (M_CAN_STATS_IDS - 1)];
+		if (e->key == key)
+			return e;
+		if (e->key == M_CAN_STATS_EMPTY) {
+			if (st->nids >= M_CAN_STATS_IDS_MAX)
+				return NULL;
+			e->frames = 0;
+			e->busy_ps = 0;
+			e->key = key;	/* last, readers skip empty slots */
+			st->nids++;
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+/* Account one frame seen on the bus, returns its bus time in ps */
+static inline u64 m_can_stats_frame(struct m_can_stats *st, canid_t can_id,
+				    const u8 *data, u32 len, bool fd,
+				    u32 flags)
+{
+	struct m_can_stats_id *e;
+	u32 nbits, dbits;
+	u64 ps;
+
+	m_can_frame_bits(can_id, data, len, fd, flags, &nbits, &dbits);
+	ps = (u64)nbits * st->ps_nbit + (u64)dbits * st->ps_dbit;
+
+	st->frames++;
+	st->busy_ps += ps;
+	st->win_frames++;
+	st->win_busy_ps += ps;
+
+	e = m_can_stats_slot(st, can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+	if (e) {
+		e->frames++;
+		e->busy_ps += ps;
+	} else {
+		st->other_frames++;
+		st->other_ps += ps;
+	}
+
+	return ps;
+}
+
+/* load in per mille of busy time over elapsed time */
+static inline u32 m_can_stats_load_pm(u64 busy_ps, u64 ns)
+{
+	if (!ns)
+		return 0;
+
+	return (u32)m_can_stats_div(busy_ps, ns);
+}
+
+/* True once the window in progress is due to be closed */
+static inline bool m_can_stats_due(const struct m_can_stats *st, u64 now_ns)
+{
+	return now_ns - st->win_start_ns >= M_CAN_STATS_WINDOW_NS;
+}
+
+/* Close the window in progress, with the error state at its end. An idle
+ * gap longer than a window ends up in one long window of low load.
+ */
+static inline void m_can_stats_close(struct m_can_stats *st, u64 now_ns,
+				     u32 tec, u32 rec, u32 bus_errors)
+{
+	struct m_can_stats_win *w = &st->hist[st->hist_head];
+	u64 ns = now_ns - st->win_start_ns;
+
+	w->ms = (u32)m_can_stats_div(ns, 1000000);
+	w->load_pm = m_can_stats_load_pm(st->win_busy_ps, ns);
+	w->frames = st->win_frames;
+	w->bus_errors = bus_errors - st->win_bus_errors;
+	w->tec = tec;
+	w->rec = rec;
+	if (w->load_pm > st->peak_pm)
+		st->peak_pm = w->load_pm;
+
+	st->hist_head = (st->hist_head + 1) % M_CAN_STATS_HIST;
+	if (st->hist_count < M_CAN_STATS_HIST)
+		st->hist_count++;
+
+	st->win_start_ns = now_ns;
+	st->win_busy_ps = 0;
+	st->win_frames = 0;
+	st->win_bus_errors = bus_errors;
+}
+
+/* i-th closed window, 0 is the oldest kept */
+static inline const struct m_can_stats_win *
+m_can_stats_hist(const struct m_can_stats *st, u32 i)
+{
+	return &st->hist[(st->hist_head + M_CAN_STATS_HIST - st->hist_count +
+			  i) % M_CAN_STATS_HIST];
+}
+
+/* for sorting a copy of ids[], busiest first, empty slots last */
+static inline int m_can_stats_cmp(const void *a, const void *b)
+{
+	const struct m_can_stats_id *x = a, *y = b;
+
+	if (x->key == M_CAN_STATS_EMPTY || y->key == M_CAN_STATS_EMPTY)
+		return (x->key == M_CAN_STATS_EMPTY) -
+		       (y->key == M_CAN_STATS_EMPTY);
+	if (x->busy_ps != y->busy_ps)
+		return x->busy_ps < y->busy_ps ? 1 : -1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+#endif
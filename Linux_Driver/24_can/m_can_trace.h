@@ -0,0 +1,110 @@
+/*
+ * Tracepoints of the M_CAN driver, under events/m_can/ in tracefs.
+ *
+ * m_can_xmit, m_can_tx_done and m_can_rx follow a frame from the TX
+ * buffer to its echo and from the RX FIFO to the stack: xmit has the
+ * buffer the frame went to, tx_done the same buffer and the frame's
+ * hardware timestamp, rx the FIFO and the hardware timestamp. A frame
+ * looped back by the controller shows up as tx_done and rx with the same
+ * timestamp. m_can_poll sums up every NAPI round.
+ *
+ *   echo 1 > /sys/kernel/debug/tracing/events/m_can/enable
+ *   cat /sys/kernel/debug/tracing/trace_pipe
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM m_can
+
+#if !defined(_M_CAN_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _M_CAN_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h>
+#include <linux/can.h>
+
+DECLARE_EVENT_CLASS(m_can_frame,
+
+	TP_PROTO(const struct net_device *dev, u32 idx,
+		 const struct canfd_frame *cf, u64 ts),
+
+	TP_ARGS(dev, idx, cf, ts),
+
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(u32, idx)
+		__field(u32, can_id)
+		__field(u8, len)
+		__field(u8, flags)
+		__field(u64, ts)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->idx = idx;
+		__entry->can_id = cf->can_id;
+		__entry->len = cf->len;
+		__entry->flags = cf->flags;
+		__entry->ts = ts;
+	),
+
+	TP_printk("%s idx=%u id=%08x len=%u flags=%x ts=%llu",
+		  __get_str(name), __entry->idx, __entry->can_id,
+		  __entry->len, __entry->flags, __entry->ts)
+);
+
+/* idx: TX buffer, ts: 0 */
+DEFINE_EVENT(m_can_frame, m_can_xmit,
+	TP_PROTO(const struct net_device *dev, u32 idx,
+		 const struct canfd_frame *cf, u64 ts),
+	TP_ARGS(dev, idx, cf, ts)
+);
+
+/* idx: TX buffer, ts: SOF in ns, 0 without timestamps */
+DEFINE_EVENT(m_can_frame, m_can_tx_done,
+	TP_PROTO(const struct net_device *dev, u32 idx,
+		 const struct canfd_frame *cf, u64 ts),
+	TP_ARGS(dev, idx, cf, ts)
+);
+
+/* idx: RX FIFO, ts: SOF in ns, 0 without timestamps */
+DEFINE_EVENT(m_can_frame, m_can_rx,
+	TP_PROTO(const struct net_device *dev, u32 idx,
+		 const struct canfd_frame *cf, u64 ts),
+	TP_ARGS(dev, idx, cf, ts)
+);
+
+TRACE_EVENT(m_can_poll,
+
+	TP_PROTO(const struct net_device *dev, u32 irqstatus, int rx, int tx,
+		 int quota),
+
+	TP_ARGS(dev, irqstatus, rx, tx, quota),
+
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(u32, irqstatus)
+		__field(int, rx)
+		__field(int, tx)
+		__field(int, quota)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->irqstatus = irqstatus;
+		__entry->rx = rx;
+		__entry->tx = tx;
+		__entry->quota = quota;
+	),
+
+	TP_printk("%s ir=%08x rx=%d tx=%d quota=%d", __get_str(name),
+		  __entry->irqstatus, __entry->rx, __entry->tx, __entry->quota)
+);
+
+#endif /* _M_CAN_TRACE_H */
+
+/* the header is not under include/trace/events, see the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE m_can_trace
+#include <trace/define_trace.h>
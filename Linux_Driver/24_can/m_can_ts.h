@@ -0,0 +1,88 @@
+#ifndef M_CAN_TS_H
+#define M_CAN_TS_H
+
+/*
+ * Extension of the 16-bit M_CAN timestamp counter to 64-bit nanoseconds,
+ * shared by m_can_platform.ko and canTstampApp so the wraparound handling
+ * can be tested offline.
+ *
+ * It follows the kernel's cyclecounter/timecounter: the time at the last
+ * counter read is kept in ns together with the sub-ns remainder, and a
+ * frame's counter value is converted relative to that read, forwards or
+ * backwards. The counter must be read (m_can_tc_read) more often than it
+ * wraps, and a frame can be converted as long as it was captured less than
+ * half a wrap before or after the last read. At 1 Mbit/s with TCP = 0 a wrap
+ * is 65.5 ms. With a 24 bit fraction the conversion is exact to 2^-24 ns
+ * per count for counters from 1 kHz up.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/math64.h>
+#define m_can_tc_div(a, b)	div_u64((a), (b))
+#else
+#include <stdint.h>
+typedef uint64_t u64;
+typedef uint32_t u32;
+#define m_can_tc_div(a, b)	((a) / (b))
+#endif
+
+#define M_CAN_TC_SHIFT	24
+
+struct m_can_tc {
+	u32 mask;		/* counter width, 0xffff */
+	u64 mult;		/* ns = cycles * mult >> M_CAN_TC_SHIFT */
+	u32 cycle_last;
+	u64 nsec;		/* time at cycle_last */
+	u64 frac;		/* remainder below 1 ns, << M_CAN_TC_SHIFT */
+};
+
+/*
+ * @description	: start the extension at a known time
+ * @param - freq: counter frequency in Hz
+ * @param - now	: counter value read just now
+ * @param - ns	: time that value stands for
+ */
+static inline void m_can_tc_init(struct m_can_tc *tc, u32 mask, u32 freq,
+				 u32 now, u64 ns)
+{
+	tc->mask = mask;
+	tc->mult = m_can_tc_div(1000000000ULL << M_CAN_TC_SHIFT, freq);
+	tc->cycle_last = now & mask;
+	tc->nsec = ns;
+	tc->frac = 0;
+}
+
+/* Account for a fresh counter read, returns the time it stands for */
+static inline u64 m_can_tc_read(struct m_can_tc *tc, u32 now)
+{
+	u32 delta = (now - tc->cycle_last) & tc->mask;
+	u64 ns = delta * tc->mult + tc->frac;
+
+	tc->cycle_last = now & tc->mask;
+	tc->nsec += ns >> M_CAN_TC_SHIFT;
+	tc->frac = ns & ((1ULL << M_CAN_TC_SHIFT) - 1);
+
+	return tc->nsec;
+}
+
+/* Time of a captured counter value, within half a wrap of the last read */
+static inline u64 m_can_tc_cyc2time(const struct m_can_tc *tc, u32 cyc)
+{
+	u32 delta = (cyc - tc->cycle_last) & tc->mask;
+
+	if (delta > tc->mask / 2) {
+		delta = (tc->cycle_last - cyc) & tc->mask;
+		return tc->nsec - ((delta * tc->mult - tc->frac) >> M_CAN_TC_SHIFT);
+	}
+
+	return tc->nsec + ((delta * tc->mult + tc->frac) >> M_CAN_TC_SHIFT);
+}
+
+/* Counter wrap period in ns, the driver reads the counter 4 times per wrap */
+static inline u64 m_can_tc_wrap_ns(const struct m_can_tc *tc)
+{
+	return ((u64)tc->mask + 1) * tc->mult >> M_CAN_TC_SHIFT;
+}
+
+#endif
@@ -17,9 +17,26 @@
 #include <asm/io.h>
 #include "ap3216creg.h"
 #include <linux/regmap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #define AP3216C_CNT    1
 #define AP3216C_NAME   "ap3216c"
+#define AP3216C_MAX_REG    AP3216C_PSTHRHIGHH
+
+/*
+ * Configuration registers are cached (RBTREE), the status and data
+ * registers are volatile. The six data bytes are read one register at a
+ * time: the datasheet does not say the address auto-increments, so no
+ * bulk read (21_iic/ap3216c makes the same assumption). Init
+ * is a register sequence written with regmap_multi_reg_write(), and
+ * suspend/resume power the chip down and replay the cache with
+ * regcache_sync().
+ *
+ * The regmap sits on a small I2C bus of its own that counts transfers per
+ * start register in /sys/kernel/debug/ap3216c/access; write to the file to
+ * clear the counters.
+ */
 
 /* ap3216c device structure */
 struct ap3216c_dev {
@@ -32,23 +49,145 @@ struct ap3216c_dev {
     unsigned short ir, als, ps;  /* Sensor data */
     struct regmap *regmap;
     struct regmap_config regmap_config;
+    u32 bus_reads[AP3216C_MAX_REG + 1];     /* I2C transfers per start register */
+    u32 bus_writes[AP3216C_MAX_REG + 1];
+    struct dentry *debugfs;
+};
+
+static const struct regmap_range ap3216c_rd_ranges[] = {
+    regmap_reg_range(AP3216C_SYSTEMCONG, AP3216C_INTCLEAR),
+    regmap_reg_range(AP3216C_IRDATALOW, AP3216C_ALSCONFIG),
+    regmap_reg_range(AP3216C_ALSCALIB, AP3216C_ALSTHRHIGHH),
+    regmap_reg_range(AP3216C_PSCONFIG, AP3216C_PSLEDWAIT),
+    regmap_reg_range(AP3216C_PSCALIBL, AP3216C_PSTHRHIGHH),
+};
+
+/* Read-only data registers */
+static const struct regmap_range ap3216c_wr_no_ranges[] = {
+    regmap_reg_range(AP3216C_IRDATALOW, AP3216C_PSDATAHIGH),
+};
+
+/* Interrupt status and sensor data */
+static const struct regmap_range ap3216c_volatile_ranges[] = {
+    regmap_reg_range(AP3216C_INTSTATUS, AP3216C_INTSTATUS),
+    regmap_reg_range(AP3216C_IRDATALOW, AP3216C_PSDATAHIGH),
+};
+
+static const struct regmap_access_table ap3216c_rd_table = {
+    .yes_ranges = ap3216c_rd_ranges,
+    .n_yes_ranges = ARRAY_SIZE(ap3216c_rd_ranges),
+};
+
+static const struct regmap_access_table ap3216c_wr_table = {
+    .yes_ranges = ap3216c_rd_ranges,
+    .n_yes_ranges = ARRAY_SIZE(ap3216c_rd_ranges),
+    .no_ranges = ap3216c_wr_no_ranges,
+    .n_no_ranges = ARRAY_SIZE(ap3216c_wr_no_ranges),
+};
+
+static const struct regmap_access_table ap3216c_volatile_table = {
+    .yes_ranges = ap3216c_volatile_ranges,
+    .n_yes_ranges = ARRAY_SIZE(ap3216c_volatile_ranges),
+};
+
+/* Power-on values; the other registers are read once on first use */
+static const struct reg_default ap3216c_reg_defaults[] = {
+    { AP3216C_SYSTEMCONG,   0x00 },     /* Power down */
+    { AP3216C_INTCLEAR,     0x00 },
 };
 
+/* Written by ap3216c_open() after the reset */
+static const struct reg_sequence ap3216c_init_seq[] = {
+    { AP3216C_SYSTEMCONG,   0X03 },     /* Enable ALS, PS, and IR */
+};
+
+static void ap3216c_count(u32 *counters, u8 reg)
+{
+    if (reg <= AP3216C_MAX_REG)
+        counters[reg]++;
+}
+
 /*
- * @description: Reads a specific register value from the ap3216c device
- * @param - dev:  ap3216c device
- * @param - reg:  Register to read
- * @return:       Value read from the register
+ * I2C transfers for the regmap, the same ones regmap_init_i2c() would do,
+ * counted per start register. regmap serialises calls, no locking needed.
  */
-static unsigned char ap3216c_read_reg(struct ap3216c_dev *dev, u8 reg)
+static int ap3216c_bus_write(void *context, const void *data, size_t count)
+{
+    struct ap3216c_dev *dev = context;
+    int ret;
+
+    ap3216c_count(dev->bus_writes, *(const u8 *)data);
+    ret = i2c_master_send(dev->client, data, count);
+    if (ret == count)
+        return 0;
+    return ret < 0 ? ret : -EIO;
+}
+
+static int ap3216c_bus_read(void *context, const void *reg, size_t reg_size,
+                            void *val, size_t val_size)
+{
+    struct ap3216c_dev *dev = context;
+    struct i2c_msg xfer[2] = {
+        { .addr = dev->client->addr, .flags = 0, .len = reg_size, .buf = (u8 *)reg, },
+        { .addr = dev->client->addr, .flags = I2C_M_RD, .len = val_size, .buf = val, },
+    };
+    int ret;
+
+    ap3216c_count(dev->bus_reads, *(const u8 *)reg);
+    ret = i2c_transfer(dev->client->adapter, xfer, 2);
+    if (ret == 2)
+        return 0;
+    return ret < 0 ? ret : -EIO;
+}
+
+static const struct regmap_bus ap3216c_regmap_bus = {
+    .write = ap3216c_bus_write,
+    .read = ap3216c_bus_read,
+};
+
+/* Transfers per start register, "reg reads writes" */
+static int ap3216c_access_show(struct seq_file *s, void *unused)
 {
-    u8 ret;
-    unsigned int data;
+    struct ap3216c_dev *dev = s->private;
+    u32 reads = 0, writes = 0;
+    int reg;
 
-    ret = regmap_read(dev->regmap, reg, &data);
-    return (u8)data;
+    seq_puts(s, "reg   reads  writes\n");
+    for (reg = 0; reg <= AP3216C_MAX_REG; reg++) {
+        if (!dev->bus_reads[reg] && !dev->bus_writes[reg])
+            continue;
+        seq_printf(s, "0x%02x %6u %7u\n", reg, dev->bus_reads[reg], dev->bus_writes[reg]);
+        reads += dev->bus_reads[reg];
+        writes += dev->bus_writes[reg];
+    }
+    seq_printf(s, "total %5u %7u\n", reads, writes);
+    return 0;
 }
 
+static int ap3216c_access_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ap3216c_access_show, inode->i_private);
+}
+
+static ssize_t ap3216c_access_write(struct file *file, const char __user *buf,
+                                    size_t count, loff_t *ppos)
+{
+    struct ap3216c_dev *dev = ((struct seq_file *)file->private_data)->private;
+
+    memset(dev->bus_reads, 0, sizeof(dev->bus_reads));
+    memset(dev->bus_writes, 0, sizeof(dev->bus_writes));
+    return count;
+}
+
+static const struct file_operations ap3216c_access_fops = {
+    .owner = THIS_MODULE,
+    .open = ap3216c_access_open,
+    .read = seq_read,
+    .write = ap3216c_access_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 /*
  * @description: Writes a specific value to a specific register of the ap3216c device
  * @param - dev:  ap3216c device
@@ -66,12 +205,15 @@ static void ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 data)
  */
 void ap3216c_readdata(struct ap3216c_dev *dev)
 {
-    unsigned char i = 0;
     unsigned char buf[6];
-    
-    /* Loop to read data from all sensors */
-    for(i = 0; i < 6; i++) {
-        buf[i] = ap3216c_read_reg(dev, AP3216C_IRDATALOW + i);    
+    unsigned int val;
+    int i;
+
+    /* Loop to read data from all sensors, one register per transfer */
+    for (i = 0; i < 6; i++) {
+        if (regmap_read(dev->regmap, AP3216C_IRDATALOW + i, &val))
+            return;
+        buf[i] = val;
     }
 
     /* Process IR data */
@@ -102,11 +244,16 @@ static int ap3216c_open(struct inode *inode, struct file *filp)
     struct cdev *cdev = filp->f_path.dentry->d_inode->i_cdev;
     struct ap3216c_dev *ap3216cdev = container_of(cdev, struct ap3216c_dev, cdev);
 
-    /* Initialize AP3216C */
+    /* Initialize AP3216C, the reset bit clears itself so it bypasses the cache */
+    regcache_cache_bypass(ap3216cdev->regmap, true);
     ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0x04);  /* Reset AP3216C */
-    mdelay(50);  /* AP3216C reset delay */
-    ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0X03);  /* Enable ALS, PS, and IR */
-    return 0;
+    regcache_cache_bypass(ap3216cdev->regmap, false);
+    msleep(50);  /* AP3216C reset delay, open() may sleep */
+
+    /* The reset put every configuration register back to its power-on value */
+    regcache_drop_region(ap3216cdev->regmap, AP3216C_ALSCONFIG, AP3216C_MAX_REG);
+    return regmap_multi_reg_write(ap3216cdev->regmap, ap3216c_init_seq,
+                                  ARRAY_SIZE(ap3216c_init_seq));
 }
 
 /*
@@ -167,11 +314,20 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
         return -ENOMEM;
 
     /* Initialize regmap configuration */
+    ap3216cdev->client = client;
     ap3216cdev->regmap_config.reg_bits = 8;  /* Register length: 8 bits */
     ap3216cdev->regmap_config.val_bits = 8;  /* Value length: 8 bits */
+    ap3216cdev->regmap_config.max_register = AP3216C_MAX_REG;
+    ap3216cdev->regmap_config.rd_table = &ap3216c_rd_table;
+    ap3216cdev->regmap_config.wr_table = &ap3216c_wr_table;
+    ap3216cdev->regmap_config.volatile_table = &ap3216c_volatile_table;
+    ap3216cdev->regmap_config.reg_defaults = ap3216c_reg_defaults;
+    ap3216cdev->regmap_config.num_reg_defaults = ARRAY_SIZE(ap3216c_reg_defaults);
+    ap3216cdev->regmap_config.cache_type = REGCACHE_RBTREE;
 
-    /* Initialize I2C regmap */
-    ap3216cdev->regmap = regmap_init_i2c(client, &ap3216cdev->regmap_config);
+    /* Initialize I2C regmap, through the counting bus */
+    ap3216cdev->regmap = regmap_init(&client->dev, &ap3216c_regmap_bus, ap3216cdev,
+                                     &ap3216cdev->regmap_config);
     if (IS_ERR(ap3216cdev->regmap)) {
         return PTR_ERR(ap3216cdev->regmap);
     }    
@@ -205,10 +361,13 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
     if (IS_ERR(ap3216cdev->device)) {
         goto destroy_class;
     }
-    ap3216cdev->client = client;
     /* Save ap3216cdev structure */
     i2c_set_clientdata(client, ap3216cdev);
 
+    ap3216cdev->debugfs = debugfs_create_dir(AP3216C_NAME, NULL);
+    debugfs_create_file("access", 0600, ap3216cdev->debugfs, ap3216cdev,
+                        &ap3216c_access_fops);
+
     return 0;
 destroy_class:
     device_destroy(ap3216cdev->class, ap3216cdev->devid);
@@ -229,6 +388,7 @@ del_regmap:
 static int ap3216c_remove(struct i2c_client *client)
 {
     struct ap3216c_dev *ap3216cdev = i2c_get_clientdata(client);
+    debugfs_remove_recursive(ap3216cdev->debugfs);
     cdev_del(&ap3216cdev->cdev); /* Delete cdev */
     unregister_chrdev_region(ap3216cdev->devid, AP3216C_CNT); /* Unregister device number */
     device_destroy(ap3216cdev->class, ap3216cdev->devid);
@@ -237,6 +397,38 @@ static int ap3216c_remove(struct i2c_client *client)
     return 0;
 }
 
+/*
+ * @description: Suspend, power the chip down and keep later writes in the cache
+ * @param - d:    device
+ * @return:       0 on success
+ */
+static int ap3216c_suspend(struct device *d)
+{
+    struct ap3216c_dev *dev = dev_get_drvdata(d);
+
+    regcache_cache_bypass(dev->regmap, true);
+    regmap_write(dev->regmap, AP3216C_SYSTEMCONG, 0x00);     /* Power down */
+    regcache_cache_bypass(dev->regmap, false);
+    regcache_cache_only(dev->regmap, true);
+    regcache_mark_dirty(dev->regmap);
+    return 0;
+}
+
+/*
+ * @description: Resume, replay the cached configuration
+ * @param - d:    device
+ * @return:       0 on success; negative values on failure
+ */
+static int ap3216c_resume(struct device *d)
+{
+    struct ap3216c_dev *dev = dev_get_drvdata(d);
+
+    regcache_cache_only(dev->regmap, false);
+    return regcache_sync(dev->regmap);
+}
+
+static SIMPLE_DEV_PM_OPS(ap3216c_pm_ops, ap3216c_suspend, ap3216c_resume);
+
 /* Match list for i2c device ID */
 static const struct i2c_device_id ap3216c_id[] = {
     {"alientek,ap3216c", 0},  
@@ -257,6 +449,8 @@ static struct i2c_driver ap3216c_driver = {
             .owner = THIS_MODULE,
             .name = "ap3216c",
             .of_match_table = ap3216c_of_match, 
+            .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+            .pm = &ap3216c_pm_ops,
            },
     .id_table = ap3216c_id,
 };
@@ -13,5 +13,18 @@
 #define AP3216C_ALSDATAHIGH 0X0D    /* ALS data high byte           */
 #define AP3216C_PSDATALOW   0X0E    /* PS data low byte             */
 #define AP3216C_PSDATAHIGH  0X0F    /* PS data high byte            */
+#define AP3216C_ALSCONFIG   0X10    /* ALS range and persist        */
+#define AP3216C_ALSCALIB    0X19    /* ALS calibration              */
+#define AP3216C_ALSTHRLOWL  0X1A    /* ALS thresholds, 0x1A..0x1D   */
+#define AP3216C_ALSTHRHIGHH 0X1D
+#define AP3216C_PSCONFIG    0X20    /* PS gain, persist, integration*/
+#define AP3216C_PSLEDCONFIG 0X21    /* LED pulse and driver ratio   */
+#define AP3216C_PSINTFORM   0X22    /* PS interrupt mode            */
+#define AP3216C_PSMEANTIME  0X23    /* PS mean time                 */
+#define AP3216C_PSLEDWAIT   0X24    /* LED waiting time             */
+#define AP3216C_PSCALIBL    0X28    /* PS calibration, 0x28..0x29   */
+#define AP3216C_PSCALIBH    0X29
+#define AP3216C_PSTHRLOWL   0X2A    /* PS thresholds, 0x2A..0x2D    */
+#define AP3216C_PSTHRHIGHH  0X2D
 
 #endif
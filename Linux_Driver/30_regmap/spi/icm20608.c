@@ -12,9 +12,28 @@
 #include <asm/uaccess.h>
 #include <linux/cdev.h>
 #include <linux/regmap.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #define ICM20608_CNT    1
 #define ICM20608_NAME   "icm20608"
+#define ICM20608_MAX_REG    ICM20_ZA_OFFSET_L
+
+/*
+ * Configuration registers are cached (RBTREE, seeded with the reset
+ * values), only the data, status and FIFO registers are volatile. Init
+ * resets the chip, marks the cache dirty, collects the configuration in
+ * the cache and writes it with one regcache_sync(), which then skips
+ * registers still at their reset value and merges neighbouring ones into
+ * a single burst: CONFIG..ACCEL_CONFIG2 and PWR_MGMT_1, two transfers.
+ * Resume replays the cache the same way.
+ *
+ * The regmap sits on a small SPI bus of its own that counts transfers per
+ * start register in /sys/kernel/debug/icm20608/access; write to the file
+ * to clear the counters.
+ */
 
 struct icm20608_dev {
     struct spi_device *spi;
@@ -32,6 +51,206 @@ struct icm20608_dev {
     signed int temp_adc;
     struct regmap *regmap;
     struct regmap_config regmap_config;    
+    struct work_struct init_work;   /* Deferred register init */
+    struct completion init_done;    /* Set once the chip is configured */
+    int init_err;                   /* Result of the register init */
+    u32 bus_reads[ICM20608_MAX_REG + 1];    /* SPI transfers per start register */
+    u32 bus_writes[ICM20608_MAX_REG + 1];
+    struct dentry *debugfs;
+};
+
+static const struct regmap_range icm20608_rd_ranges[] = {
+    regmap_reg_range(ICM20_SELF_TEST_X_GYRO, ICM20_SELF_TEST_Z_GYRO),
+    regmap_reg_range(ICM20_SELF_TEST_X_ACCEL, ICM20_SELF_TEST_Z_ACCEL),
+    regmap_reg_range(ICM20_XG_OFFS_USRH, ICM20_ACCEL_WOM_THR),
+    regmap_reg_range(ICM20_FIFO_EN, ICM20_FIFO_EN),
+    regmap_reg_range(ICM20_FSYNC_INT, ICM20_INT_ENABLE),
+    regmap_reg_range(ICM20_INT_STATUS, ICM20_GYRO_ZOUT_L),
+    regmap_reg_range(ICM20_SIGNAL_PATH_RESET, ICM20_PWR_MGMT_2),
+    regmap_reg_range(ICM20_FIFO_COUNTH, ICM20_WHO_AM_I),
+    regmap_reg_range(ICM20_XA_OFFSET_H, ICM20_XA_OFFSET_L),
+    regmap_reg_range(ICM20_YA_OFFSET_H, ICM20_YA_OFFSET_L),
+    regmap_reg_range(ICM20_ZA_OFFSET_H, ICM20_ZA_OFFSET_L),
+};
+
+/* Read-only registers */
+static const struct regmap_range icm20608_wr_no_ranges[] = {
+    regmap_reg_range(ICM20_FSYNC_INT, ICM20_FSYNC_INT),
+    regmap_reg_range(ICM20_INT_STATUS, ICM20_GYRO_ZOUT_L),
+    regmap_reg_range(ICM20_FIFO_COUNTH, ICM20_FIFO_COUNTL),
+    regmap_reg_range(ICM20_WHO_AM_I, ICM20_WHO_AM_I),
+};
+
+/* Status, sensor data, self-clearing resets and the FIFO */
+static const struct regmap_range icm20608_volatile_ranges[] = {
+    regmap_reg_range(ICM20_FSYNC_INT, ICM20_FSYNC_INT),
+    regmap_reg_range(ICM20_INT_STATUS, ICM20_GYRO_ZOUT_L),
+    regmap_reg_range(ICM20_SIGNAL_PATH_RESET, ICM20_SIGNAL_PATH_RESET),
+    regmap_reg_range(ICM20_FIFO_COUNTH, ICM20_FIFO_R_W),
+};
+
+/* Reading these has side effects, keep regmap's debugfs away from them */
+static const struct regmap_range icm20608_precious_ranges[] = {
+    regmap_reg_range(ICM20_FIFO_R_W, ICM20_FIFO_R_W),
+};
+
+static const struct regmap_access_table icm20608_rd_table = {
+    .yes_ranges = icm20608_rd_ranges,
+    .n_yes_ranges = ARRAY_SIZE(icm20608_rd_ranges),
+};
+
+static const struct regmap_access_table icm20608_wr_table = {
+    .yes_ranges = icm20608_rd_ranges,
+    .n_yes_ranges = ARRAY_SIZE(icm20608_rd_ranges),
+    .no_ranges = icm20608_wr_no_ranges,
+    .n_no_ranges = ARRAY_SIZE(icm20608_wr_no_ranges),
+};
+
+static const struct regmap_access_table icm20608_volatile_table = {
+    .yes_ranges = icm20608_volatile_ranges,
+    .n_yes_ranges = ARRAY_SIZE(icm20608_volatile_ranges),
+};
+
+static const struct regmap_access_table icm20608_precious_table = {
+    .yes_ranges = icm20608_precious_ranges,
+    .n_yes_ranges = ARRAY_SIZE(icm20608_precious_ranges),
+};
+
+/*
+ * Reset values of the configuration registers. The factory-trimmed
+ * accelerometer offsets and WHO_AM_I are left out and read on first use.
+ */
+static const struct reg_default icm20608_reg_defaults[] = {
+    { ICM20_XG_OFFS_USRH,       0x00 },
+    { ICM20_XG_OFFS_USRL,       0x00 },
+    { ICM20_YG_OFFS_USRH,       0x00 },
+    { ICM20_YG_OFFS_USRL,       0x00 },
+    { ICM20_ZG_OFFS_USRH,       0x00 },
+    { ICM20_ZG_OFFS_USRL,       0x00 },
+    { ICM20_SMPLRT_DIV,         0x00 },
+    { ICM20_CONFIG,             0x00 },
+    { ICM20_GYRO_CONFIG,        0x00 },
+    { ICM20_ACCEL_CONFIG,       0x00 },
+    { ICM20_ACCEL_CONFIG2,      0x00 },
+    { ICM20_LP_MODE_CFG,        0x00 },
+    { ICM20_ACCEL_WOM_THR,      0x00 },
+    { ICM20_FIFO_EN,            0x00 },
+    { ICM20_INT_PIN_CFG,        0x00 },
+    { ICM20_INT_ENABLE,         0x00 },
+    { ICM20_ACCEL_INTEL_CTRL,   0x00 },
+    { ICM20_USER_CTRL,          0x00 },
+    { ICM20_PWR_MGMT_1,         0x40 },
+    { ICM20_PWR_MGMT_2,         0x00 },
+};
+
+/* Configuration written by icm20608_reginit() */
+static const struct reg_sequence icm20608_init_seq[] = {
+    { ICM20_PWR_MGMT_1,     0x01 },     /* Wake up, best available clock */
+    { ICM20_SMPLRT_DIV,     0x00 },     /* Output rate = internal rate */
+    { ICM20_GYRO_CONFIG,    0x18 },     /* Gyroscope +-2000 dps */
+    { ICM20_ACCEL_CONFIG,   0x18 },     /* Accelerometer +-16 g */
+    { ICM20_CONFIG,         0x04 },     /* Gyroscope low-pass 20 Hz */
+    { ICM20_ACCEL_CONFIG2,  0x04 },     /* Accelerometer low-pass 21.2 Hz */
+    { ICM20_PWR_MGMT_2,     0x00 },     /* All axes on */
+    { ICM20_LP_MODE_CFG,    0x00 },     /* Low-power mode off */
+    { ICM20_FIFO_EN,        0x00 },     /* FIFO off */
+};
+
+static void icm20608_count(u32 *counters, u8 reg)
+{
+    reg &= 0x7F;                        /* Strip the read flag */
+    if (reg <= ICM20608_MAX_REG)
+        counters[reg]++;
+}
+
+/*
+ * SPI transfers for the regmap, the same ones regmap_init_spi() would do,
+ * counted per start register. regmap serialises calls, no locking needed.
+ */
+static int icm20608_bus_write(void *context, const void *data, size_t count)
+{
+    struct icm20608_dev *dev = context;
+
+    icm20608_count(dev->bus_writes, *(const u8 *)data);
+    return spi_write(dev->spi, data, count);
+}
+
+static int icm20608_bus_gather_write(void *context, const void *reg, size_t reg_len,
+                                     const void *val, size_t val_len)
+{
+    struct icm20608_dev *dev = context;
+    struct spi_transfer t[2] = {
+        { .tx_buf = reg, .len = reg_len, },
+        { .tx_buf = val, .len = val_len, },
+    };
+    struct spi_message m;
+
+    icm20608_count(dev->bus_writes, *(const u8 *)reg);
+    spi_message_init(&m);
+    spi_message_add_tail(&t[0], &m);
+    spi_message_add_tail(&t[1], &m);
+    return spi_sync(dev->spi, &m);
+}
+
+static int icm20608_bus_read(void *context, const void *reg, size_t reg_size,
+                             void *val, size_t val_size)
+{
+    struct icm20608_dev *dev = context;
+
+    icm20608_count(dev->bus_reads, *(const u8 *)reg);
+    return spi_write_then_read(dev->spi, reg, reg_size, val, val_size);
+}
+
+static const struct regmap_bus icm20608_regmap_bus = {
+    .write = icm20608_bus_write,
+    .gather_write = icm20608_bus_gather_write,
+    .read = icm20608_bus_read,
+    .read_flag_mask = 0x80,
+    .reg_format_endian_default = REGMAP_ENDIAN_BIG,
+    .val_format_endian_default = REGMAP_ENDIAN_BIG,
+};
+
+/* Transfers per start register, "reg reads writes" */
+static int icm20608_access_show(struct seq_file *s, void *unused)
+{
+    struct icm20608_dev *dev = s->private;
+    u32 reads = 0, writes = 0;
+    int reg;
+
+    seq_puts(s, "reg   reads  writes\n");
+    for (reg = 0; reg <= ICM20608_MAX_REG; reg++) {
+        if (!dev->bus_reads[reg] && !dev->bus_writes[reg])
+            continue;
+        seq_printf(s, "0x%02x %6u %7u\n", reg, dev->bus_reads[reg], dev->bus_writes[reg]);
+        reads += dev->bus_reads[reg];
+        writes += dev->bus_writes[reg];
+    }
+    seq_printf(s, "total %5u %7u\n", reads, writes);
+    return 0;
+}
+
+static int icm20608_access_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, icm20608_access_show, inode->i_private);
+}
+
+static ssize_t icm20608_access_write(struct file *file, const char __user *buf,
+                                     size_t count, loff_t *ppos)
+{
+    struct icm20608_dev *dev = ((struct seq_file *)file->private_data)->private;
+
+    memset(dev->bus_reads, 0, sizeof(dev->bus_reads));
+    memset(dev->bus_writes, 0, sizeof(dev->bus_writes));
+    return count;
+}
+
+static const struct file_operations icm20608_access_fops = {
+    .owner = THIS_MODULE,
+    .open = icm20608_access_open,
+    .read = seq_read,
+    .write = icm20608_access_write,
+    .llseek = seq_lseek,
+    .release = single_release,
 };
 
 /*
@@ -75,11 +294,15 @@ void icm20608_readdata(struct icm20608_dev *dev)
 }
 
 /*
- * Open device
+ * Open device, waits for the deferred register init to finish
  */
 static int icm20608_open(struct inode *inode, struct file *filp)
 {
-    return 0;
+    struct icm20608_dev *dev = container_of(inode->i_cdev, struct icm20608_dev, cdev);
+
+    if (wait_for_completion_interruptible(&dev->init_done))
+        return -ERESTARTSYS;
+    return dev->init_err;
 }
 
 /*
@@ -123,26 +346,44 @@ static const struct file_operations icm20608_ops = {
 /*
  * Initialize ICM20608 internal registers
  */
-void icm20608_reginit(struct icm20608_dev *dev)
+int icm20608_reginit(struct icm20608_dev *dev)
 {
     u8 value = 0;
-    
+    int ret;
+
+    /* The reset bit clears itself: write it past the cache, which already holds the reset values */
+    regcache_cache_bypass(dev->regmap, true);
     icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x80);
-    mdelay(50);
-    icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x01);
-    mdelay(50);
+    regcache_cache_bypass(dev->regmap, false);
+    /* The chip is at its defaults now, the sync below may skip them */
+    regcache_mark_dirty(dev->regmap);
+    msleep(50);
 
     value = icm20608_read_onereg(dev, ICM20_WHO_AM_I);
     printk("ICM20608 ID = %#X\r\n", value);    
 
-    icm20608_write_onereg(dev, ICM20_SMPLRT_DIV, 0x00);
-    icm20608_write_onereg(dev, ICM20_GYRO_CONFIG, 0x18);
-    icm20608_write_onereg(dev, ICM20_ACCEL_CONFIG, 0x18);
-    icm20608_write_onereg(dev, ICM20_CONFIG, 0x04);
-    icm20608_write_onereg(dev, ICM20_ACCEL_CONFIG2, 0x04);
-    icm20608_write_onereg(dev, ICM20_PWR_MGMT_2, 0x00);
-    icm20608_write_onereg(dev, ICM20_LP_MODE_CFG, 0x00);
-    icm20608_write_onereg(dev, ICM20_FIFO_EN, 0x00);
+    /* Build the configuration in the cache, then write only what differs from reset */
+    regcache_cache_only(dev->regmap, true);
+    regmap_multi_reg_write(dev->regmap, icm20608_init_seq, ARRAY_SIZE(icm20608_init_seq));
+    regcache_cache_only(dev->regmap, false);
+    ret = regcache_sync(dev->regmap);
+    if (ret)
+        return ret;
+    msleep(50);                         /* Clock and sensors settle after wake-up */
+    return 0;
+}
+
+/*
+ * Deferred init: the reset sequence sleeps, keep it off the probe path
+ */
+static void icm20608_init_work(struct work_struct *work)
+{
+    struct icm20608_dev *dev = container_of(work, struct icm20608_dev, init_work);
+
+    dev->init_err = icm20608_reginit(dev);
+    if (dev->init_err)
+        dev_err(&dev->spi->dev, "register init failed, %d\n", dev->init_err);
+    complete_all(&dev->init_done);
 }
 
 /*
@@ -157,11 +398,24 @@ static int icm20608_probe(struct spi_device *spi)
     if(!icm20608dev)
         return -ENOMEM;
 
+    INIT_WORK(&icm20608dev->init_work, icm20608_init_work);
+    init_completion(&icm20608dev->init_done);
+
+    icm20608dev->spi = spi;
     icm20608dev->regmap_config.reg_bits = 8;
     icm20608dev->regmap_config.val_bits = 8;
     icm20608dev->regmap_config.read_flag_mask = 0x80;
+    icm20608dev->regmap_config.max_register = ICM20608_MAX_REG;
+    icm20608dev->regmap_config.rd_table = &icm20608_rd_table;
+    icm20608dev->regmap_config.wr_table = &icm20608_wr_table;
+    icm20608dev->regmap_config.volatile_table = &icm20608_volatile_table;
+    icm20608dev->regmap_config.precious_table = &icm20608_precious_table;
+    icm20608dev->regmap_config.reg_defaults = icm20608_reg_defaults;
+    icm20608dev->regmap_config.num_reg_defaults = ARRAY_SIZE(icm20608_reg_defaults);
+    icm20608dev->regmap_config.cache_type = REGCACHE_RBTREE;
 
-    icm20608dev->regmap = regmap_init_spi(spi, &icm20608dev->regmap_config);
+    icm20608dev->regmap = regmap_init(&spi->dev, &icm20608_regmap_bus, icm20608dev,
+                                      &icm20608dev->regmap_config);
     if (IS_ERR(icm20608dev->regmap)) {
         return PTR_ERR(icm20608dev->regmap);
     }    
@@ -189,13 +443,15 @@ static int icm20608_probe(struct spi_device *spi)
     if (IS_ERR(icm20608dev->device)) {
         goto destroy_class;
     }
-    icm20608dev->spi = spi;
     
     spi->mode = SPI_MODE_0;
     spi_setup(spi);
     
-    icm20608_reginit(icm20608dev);
     spi_set_drvdata(spi, icm20608dev);
+    icm20608dev->debugfs = debugfs_create_dir(ICM20608_NAME, NULL);
+    debugfs_create_file("access", 0600, icm20608dev->debugfs, icm20608dev,
+                        &icm20608_access_fops);
+    queue_work(system_long_wq, &icm20608dev->init_work);
 
     return 0;
 
@@ -217,6 +473,8 @@ static int icm20608_remove(struct spi_device *spi)
 {
     struct icm20608_dev *icm20608dev = spi_get_drvdata(spi);
 
+    flush_work(&icm20608dev->init_work);
+    debugfs_remove_recursive(icm20608dev->debugfs);
     cdev_del(&icm20608dev->cdev);
     unregister_chrdev_region(icm20608dev->devid, ICM20608_CNT);
     device_destroy(icm20608dev->class, icm20608dev->devid);
@@ -226,6 +484,38 @@ static int icm20608_remove(struct spi_device *spi)
     return 0;
 }
 
+/*
+ * Suspend: put the chip to sleep and keep later writes in the cache
+ */
+static int icm20608_suspend(struct device *d)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(d);
+
+    flush_work(&dev->init_work);
+    regcache_cache_bypass(dev->regmap, true);
+    regmap_write(dev->regmap, ICM20_PWR_MGMT_1, 0x41);     /* Sleep */
+    regcache_cache_bypass(dev->regmap, false);
+    regcache_cache_only(dev->regmap, true);
+    regcache_mark_dirty(dev->regmap);
+    return 0;
+}
+
+/*
+ * Resume: replay the cached configuration, which also wakes the chip
+ */
+static int icm20608_resume(struct device *d)
+{
+    struct icm20608_dev *dev = dev_get_drvdata(d);
+    int ret;
+
+    regcache_cache_only(dev->regmap, false);
+    ret = regcache_sync(dev->regmap);
+    msleep(50);
+    return ret;
+}
+
+static SIMPLE_DEV_PM_OPS(icm20608_pm_ops, icm20608_suspend, icm20608_resume);
+
 /* Traditional matching ID list */
 static const struct spi_device_id icm20608_id[] = {
     {"alientek,icm20608", 0},
@@ -246,6 +536,8 @@ static struct spi_driver icm20608_driver = {
         .owner = THIS_MODULE,
         .name = "icm20608",
         .of_match_table = icm20608_of_match,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &icm20608_pm_ops,
     },
     .id_table = icm20608_id,
 };
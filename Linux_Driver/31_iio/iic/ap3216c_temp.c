@@ -23,6 +23,8 @@
 #include <linux/iio/triggered_buffer.h>
 #include <linux/unaligned/be_byteshift.h>
 #include <linux/iio/trigger.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 #include "ap3216creg.h"
 
 
@@ -51,6 +53,8 @@ struct ap3216c_dev {
 	struct regmap_config regmap_config;	
 	struct mutex lock;
 	struct iio_trigger  *trig;
+	struct work_struct init_work;		/* 延迟执行的寄存器初始化 */
+	struct completion init_done;		/* 寄存器初始化完成 */
 };
 
 /*
@@ -151,7 +155,7 @@ static int ap3216c_reginit(struct ap3216c_dev *dev)
 {
 	/* 初始化AP3216C */
 	ap3216c_write_reg(dev, AP3216C_SYSTEMCONG, 0x04);		/* 复位AP3216C 			*/
-	mdelay(50);												/* AP3216C复位最少10ms 	*/
+	msleep(50);												/* AP3216C复位最少10ms 	*/
 	ap3216c_write_reg(dev, AP3216C_SYSTEMCONG, 0X03);		/* 开启ALS、PS+IR 		*/
 	ap3216c_write_reg(dev, AP3216C_ALSCONFIG, 0X00);		/* ALS单次转换触发中断，量程为0～20661 lux */
 	ap3216c_write_reg(dev, AP3216C_PSLEDCONFIG, 0X13);		/* IR LED 1脉冲，驱动电流100%*/
@@ -171,6 +175,31 @@ static int ap3216c_reginit(struct ap3216c_dev *dev)
 	return 0;
 }
 
+/*
+ * @description	: 延迟初始化工作，AP3216C复位需要睡眠，不放在probe里面执行
+ * @param - work: init_work
+ * @return 	  :   无
+ */
+static void ap3216c_init_work(struct work_struct *work)
+{
+	struct ap3216c_dev *dev = container_of(work, struct ap3216c_dev, init_work);
+
+	ap3216c_reginit(dev);
+	complete_all(&dev->init_done);
+}
+
+/*
+ * @description	: 等待延迟初始化完成，之前不能访问传感器
+ * @param - dev:  ap3216c设备
+ * @return 	  :   0，成功；-ERESTARTSYS，被信号打断
+ */
+static int ap3216c_wait_ready(struct ap3216c_dev *dev)
+{
+	if (wait_for_completion_interruptible(&dev->init_done))
+		return -ERESTARTSYS;
+	return 0;
+}
+
 /*
   * @description  	: 读取AP3216C传感器数
   * @param - dev	: ap3216c设备 
@@ -252,6 +281,10 @@ static int ap3216c_read_raw(struct iio_dev *indio_dev,
 	unsigned char regdata = 0;
 	struct ap3216c_dev *dev = iio_priv(indio_dev);
 
+	ret = ap3216c_wait_ready(dev);
+	if (ret)
+		return ret;
+
 	switch (mask) {
 	case IIO_CHAN_INFO_RAW:								/* 读取ICM20608加速度计、陀螺仪、温度传感器原始值 */
 		mutex_lock(&dev->lock);								/* 上锁 			*/
@@ -305,6 +338,10 @@ static int ap3216c_write_raw(struct iio_dev *indio_dev,
 	int ret = 0;
 	struct ap3216c_dev *dev = iio_priv(indio_dev);
 
+	ret = ap3216c_wait_ready(dev);
+	if (ret)
+		return ret;
+
 	iio_device_claim_direct_mode(indio_dev);		/* 保持direct模式 	*/
 	switch (mask) {
 	case IIO_CHAN_INFO_SCALE:	/* 设置ALS量程 */
@@ -492,6 +529,8 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
 	}	
 
 	mutex_init(&dev->lock);	
+	INIT_WORK(&dev->init_work, ap3216c_init_work);
+	init_completion(&dev->init_done);
 
 	/* 4、iio_dev的其他成员变量 */
 	indio_dev->dev.parent = &client->dev;
@@ -543,7 +582,7 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
 		goto err_iio_register;
 	}
 
-	ap3216c_reginit(dev); /* 初始化ap3216c */
+	queue_work(system_long_wq, &dev->init_work); /* 异步初始化ap3216c */
 	return 0;
 
 err_irq_request:
@@ -565,6 +604,7 @@ static int ap3216c_remove(struct i2c_client *client)
 	struct ap3216c_dev *dev;
 	
 	dev = iio_priv(indio_dev);
+	flush_work(&dev->init_work);
 
 	/* 1、释放regmap */
 	regmap_exit(dev->regmap);
@@ -593,6 +633,7 @@ static struct i2c_driver ap3216c_driver = {
 			.owner = THIS_MODULE,
 		   	.name = "ap3216c",
 		   	.of_match_table = ap3216c_of_match, 
+		   	.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		   },
 	.id_table = ap3216c_id,
 };
@@ -0,0 +1,106 @@
+/***************************************************************
+文件名		: fusion_shm.h
+描述	   	: icm20608_fusiond发布姿态四元数用的共享内存环形缓冲区。
+			  每个槽位一个seqlock，写者只有fusiond一个，读者可以有
+			  任意多个，读写都不需要系统调用，也不会互相阻塞。
+其他	   	: 读者用法：
+			  fd = shm_open(FUSION_SHM_NAME, O_RDONLY, 0);
+			  shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+			  fusion_read_latest(shm, &s);	取最新样本
+			  fusion_read(shm, idx, &s);	按序号逐个取，不丢样本
+***************************************************************/
+#ifndef FUSION_SHM_H
+#define FUSION_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define FUSION_SHM_NAME		"/icm20608_fusion"
+#define FUSION_SHM_MAGIC	0X46555331		/* "FUS1" */
+#define FUSION_RING_SIZE	1024			/* 必须是2的幂 */
+
+/* 读者拿到的样本 */
+struct fusion_sample {
+	uint64_t index;			/* 样本序号，从0开始 */
+	uint64_t t_ns;			/* 发布时间，CLOCK_MONOTONIC */
+	float q[4];				/* 姿态四元数 w x y z */
+};
+
+struct fusion_slot {
+	_Atomic uint32_t seq;	/* 奇数表示正在写 */
+	uint32_t pad;
+	struct fusion_sample s;
+};
+
+struct fusion_shm {
+	uint32_t magic;
+	uint32_t ring_size;
+	_Atomic uint64_t head;	/* 已发布的样本数 */
+	struct fusion_slot ring[FUSION_RING_SIZE];
+};
+
+/*
+ * @description	: 发布一个样本，只能由一个写者调用
+ * @param - shm	: 共享内存
+ * @param - t_ns: 时间戳
+ * @param - q	: 四元数
+ */
+static inline void fusion_publish(struct fusion_shm *shm, uint64_t t_ns, const float q[4])
+{
+	uint64_t h = atomic_load_explicit(&shm->head, memory_order_relaxed);
+	struct fusion_slot *slot = &shm->ring[h & (FUSION_RING_SIZE - 1)];
+	uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->s.index = h;
+	slot->s.t_ns = t_ns;
+	memcpy(slot->s.q, q, sizeof(slot->s.q));
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	atomic_store_explicit(&shm->head, h + 1, memory_order_release);
+}
+
+/*
+ * @description	: 按序号读取一个样本
+ * @param - shm	: 共享内存
+ * @param - idx	: 样本序号
+ * @param - out	: 读到的样本
+ * @return		: 0 成功；-1 还没发布或者已经被覆盖
+ */
+static inline int fusion_read(const struct fusion_shm *shm, uint64_t idx, struct fusion_sample *out)
+{
+	const struct fusion_slot *slot = &shm->ring[idx & (FUSION_RING_SIZE - 1)];
+	uint32_t s1, s2;
+
+	do {
+		s1 = atomic_load_explicit((_Atomic uint32_t *)&slot->seq, memory_order_acquire);
+		if (s1 & 1)
+			continue;		/* 写者正在写这个槽位 */
+		*out = slot->s;
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit((_Atomic uint32_t *)&slot->seq, memory_order_relaxed);
+	} while ((s1 & 1) || s1 != s2);
+
+	return out->index == idx ? 0 : -1;
+}
+
+/*
+ * @description	: 读取最新样本
+ * @return		: 0 成功；-1 还没有样本
+ */
+static inline int fusion_read_latest(const struct fusion_shm *shm, struct fusion_sample *out)
+{
+	uint64_t h;
+
+	for (;;) {
+		h = atomic_load_explicit((_Atomic uint64_t *)&shm->head, memory_order_acquire);
+		if (h == 0)
+			return -1;
+		if (fusion_read(shm, h - 1, out) == 0)
+			return 0;
+		/* 读的过程中槽位被新样本覆盖了，重新取最新的 */
+	}
+}
+
+#endif
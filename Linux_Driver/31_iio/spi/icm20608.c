@@ -34,6 +34,8 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 #include <linux/iio/triggered_buffer.h>
 #include <linux/unaligned/be_byteshift.h>
 #include <linux/iio/trigger.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #define ICM20608_NAME	"icm20608"
 #define ICM20608_TEMP_OFFSET	     0
@@ -81,6 +83,8 @@ struct icm20608_dev {
 	struct regmap_config regmap_config;	
 	struct mutex lock;
 	struct iio_trigger  *trig;
+	struct work_struct init_work;		/* 延迟执行的寄存器初始化 */
+	struct completion init_done;		/* 寄存器初始化完成 */
 };
 
 /*
@@ -175,9 +179,9 @@ void icm20608_reginit(struct icm20608_dev *dev)
 	u8 value = 0;
 	
 	icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x80);
-	mdelay(50);
+	msleep(50);
 	icm20608_write_onereg(dev, ICM20_PWR_MGMT_1, 0x01);
-	mdelay(50);
+	msleep(50);
 
 	value = icm20608_read_onereg(dev, ICM20_WHO_AM_I);
 	printk("ICM20608 ID = %#X\r\n", value);	
@@ -192,6 +196,32 @@ void icm20608_reginit(struct icm20608_dev *dev)
 	icm20608_write_onereg(dev, ICM20_INT_ENABLE, 0x01);		/* 使能FIFO溢出以及数据就绪中断	*/
 }
 
+/*
+ * @description  	: 延迟初始化工作，复位过程需要睡眠100ms，
+ *					  不放在probe里面执行，避免拖慢启动
+ * @param - work 	: init_work
+ * @return 			: 无
+ */
+static void icm20608_init_work(struct work_struct *work)
+{
+	struct icm20608_dev *dev = container_of(work, struct icm20608_dev, init_work);
+
+	icm20608_reginit(dev);
+	complete_all(&dev->init_done);
+}
+
+/*
+ * @description  	: 等待延迟初始化完成，之前不能访问传感器
+ * @param - dev 	: icm20608设备
+ * @return 			: 0，成功；-ERESTARTSYS，被信号打断
+ */
+static int icm20608_wait_ready(struct icm20608_dev *dev)
+{
+	if (wait_for_completion_interruptible(&dev->init_done))
+		return -ERESTARTSYS;
+	return 0;
+}
+
 /*
   * @description  	: 设置ICM20608传感器，可以用于陀螺仪、加速度计设置
   * @param - dev	: icm20608设备 
@@ -332,6 +362,10 @@ static int icm20608_read_raw(struct iio_dev *indio_dev,
 	int ret = 0;
 	unsigned char regdata = 0;
 
+	ret = icm20608_wait_ready(dev);
+	if (ret)
+		return ret;
+
 	switch (mask) {
 	case IIO_CHAN_INFO_RAW:								/* 读取ICM20608加速度计、陀螺仪、温度传感器原始值 */
 		iio_device_claim_direct_mode(indio_dev);		/* 保持direct模式 	*/
@@ -410,6 +444,10 @@ static int icm20608_write_raw(struct iio_dev *indio_dev,
 	struct icm20608_dev *dev = iio_priv(indio_dev);
 	int ret = 0;
 
+	ret = icm20608_wait_ready(dev);
+	if (ret)
+		return ret;
+
 	iio_device_claim_direct_mode(indio_dev);		/* 保持direct模式 	*/
 	switch (mask) {
 	case IIO_CHAN_INFO_SCALE:	/* 设置陀螺仪和加速度计的分辨率 */
@@ -552,6 +590,10 @@ static int icm20608_trigger_set_state(struct iio_trigger *trig,
 	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
 	struct icm20608_dev *dev = iio_priv(indio_dev);
 
+	ret = icm20608_wait_ready(dev);
+	if (ret)
+		return ret;
+
 	mutex_lock(&dev->lock);
 	if (state) {
 		ret = regmap_write(dev->regmap, ICM20_INT_ENABLE, 0x01);/* 使能数据就绪中断	*/
@@ -604,6 +646,8 @@ static int icm20608_probe(struct spi_device *spi)
 	}	
 
 	mutex_init(&dev->lock);
+	INIT_WORK(&dev->init_work, icm20608_init_work);
+	init_completion(&dev->init_done);
 
 	/* 4、iio_dev的其他成员变量 */
 	indio_dev->dev.parent = &spi->dev;
@@ -656,8 +700,8 @@ static int icm20608_probe(struct spi_device *spi)
 	spi->mode = SPI_MODE_0;	/*MODE0，CPOL=0，CPHA=0*/
 	spi_setup(spi);
 	
-	/* 初始化ICM20608内部寄存器 */
-	icm20608_reginit(dev);	
+	/* 初始化ICM20608内部寄存器，放到工作队列里面异步执行 */
+	queue_work(system_long_wq, &dev->init_work);
 
 	return 0;
 
@@ -679,6 +723,7 @@ static int icm20608_remove(struct spi_device *spi)
 	struct icm20608_dev *dev;
 	
 	dev = iio_priv(indio_dev); ;
+	flush_work(&dev->init_work);
 
 	/* 1、删除regmap */ 
 	regmap_exit(dev->regmap);
@@ -707,6 +752,7 @@ static struct spi_driver icm20608_driver = {
 			.owner = THIS_MODULE,
 		   	.name = "icm20608",
 		   	.of_match_table = icm20608_of_match,
+		   	.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		   },
 	.id_table = icm20608_id,
 };
@@ -0,0 +1,740 @@
+/***************************************************************
+文件名		: icm20608_fusiond.c
+描述	   	: icm20608姿态融合服务。从IIO缓冲区成块读取原始数据，
+			  批量转换成浮点，用Madgwick滤波器(IMU版本，无磁力计)
+			  解算姿态，四元数通过共享内存seqlock环形缓冲区发布
+			  (fusion_shm.h)，并统计每一级的CPU开销。
+其他	   	: 和icm20608_triggerAPP比：
+			  1、scale文件只在启动时读一次；
+			  2、设置buffer/watermark，一次read()读-n个样本，
+			     每个样本只剩1/n次系统调用；
+			  3、大端int16转float是一个没有分支、逐元素的循环，
+			     -O3下gcc在x86上生成SSE/AVX，在ARM上生成NEON
+			     (ARMv7需要加 -mfpu=neon -funsafe-math-optimizations，
+			     NEON浮点不完全符合IEEE，gcc默认不向量化)；
+			  4、消费者读共享内存，不需要任何系统调用。
+编译	   	: x86:  gcc -O3 -o icm20608_fusiond icm20608_fusiond.c -lm -lpthread -lrt
+			  ARM:  arm-none-linux-gnueabihf-gcc -O3 -mfpu=neon -funsafe-math-optimizations \
+			        -o icm20608_fusiond icm20608_fusiond.c -lm -lpthread -lrt
+使用方法	 ：./icm20608_fusiond [-d iio设备目录] [-n 每块样本数] [-r 采样率Hz]
+			                     [-B beta] [-s 统计间隔秒]
+			  ./icm20608_fusiond -c		作为消费者打印最新姿态
+			  ./icm20608_fusiond -t		单元测试(合成数据，x86上也能跑)
+			  ./icm20608_fusiond -b		转换和滤波的基准测试
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fusion_shm.h"
+
+#define ICM20608_SCAN_CH	7		/* ax ay az temp gx gy gz，每个2字节大端 */
+#define ICM20608_SCAN_BYTES	(ICM20608_SCAN_CH * 2)
+#define FUSION_MAX_BLOCK	1024	/* 一次read()最多读的样本数 */
+#define DEG2RAD				0.017453292519943295f
+
+/* 处理的各个阶段 */
+enum {
+	STAGE_READ,
+	STAGE_CONVERT,
+	STAGE_FILTER,
+	STAGE_PUBLISH,
+	STAGE_NUM,
+};
+
+static const char *stage_name[STAGE_NUM] = { "read", "convert", "filter", "publish" };
+
+struct stage_stats {
+	uint64_t cpu_ns[STAGE_NUM];		/* 本线程CPU时间 */
+	uint64_t samples;
+	uint64_t reads;
+};
+
+struct madgwick {
+	float q[4];						/* w x y z */
+	float beta;						/* 加速度计修正增益 */
+	float dt;						/* 采样周期，秒 */
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * @description		: 大端int16原始数据批量转换成浮点。raw和out都是
+ *					  扁平数组，scale按同样的排列预先展开，所以循环体
+ *					  只有逐元素的运算，编译器可以直接向量化
+ * @param - raw		: IIO缓冲区里的原始数据
+ * @param - scale	: 每个元素的比例系数
+ * @param - out		: 转换结果
+ * @param - count	: 元素个数(样本数 * 7)
+ */
+void convert_block(const uint8_t *restrict raw, const float *restrict scale,
+				   float *restrict out, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		int16_t v = (int16_t)(((uint16_t)raw[2 * i] << 8) | raw[2 * i + 1]);
+		out[i] = (float)v * scale[i];
+	}
+}
+
+/*
+ * @description		: 按一个样本的7个比例系数展开成一整块的系数表
+ * @param - tab		: 系数表，FUSION_MAX_BLOCK * 7个元素
+ * @param - ch		: 每个通道的系数
+ */
+static void scale_table_init(float *tab, const float ch[ICM20608_SCAN_CH])
+{
+	int i;
+
+	for (i = 0; i < FUSION_MAX_BLOCK * ICM20608_SCAN_CH; i++)
+		tab[i] = ch[i % ICM20608_SCAN_CH];
+}
+
+static void madgwick_init(struct madgwick *f, float beta, float rate)
+{
+	f->q[0] = 1.0f;
+	f->q[1] = f->q[2] = f->q[3] = 0.0f;
+	f->beta = beta;
+	f->dt = 1.0f / rate;
+}
+
+/*
+ * @description		: Madgwick IMU更新，一个样本
+ * @param - f		: 滤波器
+ * @param - g		: 角速度 rad/s
+ * @param - a		: 加速度，任意单位(只用方向)
+ */
+void madgwick_update(struct madgwick *f, const float g[3], const float a[3])
+{
+	float q0 = f->q[0], q1 = f->q[1], q2 = f->q[2], q3 = f->q[3];
+	float gx = g[0], gy = g[1], gz = g[2];
+	float ax = a[0], ay = a[1], az = a[2];
+	float qd0, qd1, qd2, qd3, s0, s1, s2, s3, n;
+
+	/* 陀螺仪积分得到的四元数变化率 */
+	qd0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	qd1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	qd2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	qd3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+	/* 加速度计有效时，沿梯度下降方向修正 */
+	n = ax * ax + ay * ay + az * az;
+	if (n > 0.0f) {
+		n = 1.0f / sqrtf(n);
+		ax *= n;
+		ay *= n;
+		az *= n;
+
+		s0 = 4.0f * q0 * q2 * q2 + 2.0f * q2 * ax + 4.0f * q0 * q1 * q1 - 2.0f * q1 * ay;
+		s1 = 4.0f * q1 * q3 * q3 - 2.0f * q3 * ax + 4.0f * q0 * q0 * q1 - 2.0f * q0 * ay
+			 - 4.0f * q1 + 8.0f * q1 * q1 * q1 + 8.0f * q1 * q2 * q2 + 4.0f * q1 * az;
+		s2 = 4.0f * q0 * q0 * q2 + 2.0f * q0 * ax + 4.0f * q2 * q3 * q3 - 2.0f * q3 * ay
+			 - 4.0f * q2 + 8.0f * q2 * q1 * q1 + 8.0f * q2 * q2 * q2 + 4.0f * q2 * az;
+		s3 = 4.0f * q1 * q1 * q3 - 2.0f * q1 * ax + 4.0f * q2 * q2 * q3 - 2.0f * q2 * ay;
+
+		n = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+		if (n > 0.0f) {
+			n = 1.0f / sqrtf(n);
+			qd0 -= f->beta * s0 * n;
+			qd1 -= f->beta * s1 * n;
+			qd2 -= f->beta * s2 * n;
+			qd3 -= f->beta * s3 * n;
+		}
+	}
+
+	q0 += qd0 * f->dt;
+	q1 += qd1 * f->dt;
+	q2 += qd2 * f->dt;
+	q3 += qd3 * f->dt;
+
+	n = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	f->q[0] = q0 * n;
+	f->q[1] = q1 * n;
+	f->q[2] = q2 * n;
+	f->q[3] = q3 * n;
+}
+
+/*
+ * @description		: 对一块转换好的样本做滤波
+ * @param - f		: 滤波器
+ * @param - conv	: 转换结果，每个样本7个float
+ * @param - n		: 样本数
+ * @param - qout	: 每个样本之后的姿态，NULL表示不需要
+ */
+void madgwick_block(struct madgwick *f, const float *conv, int n, float (*qout)[4])
+{
+	int i;
+
+	for (i = 0; i < n; i++, conv += ICM20608_SCAN_CH) {
+		madgwick_update(f, conv + 4, conv);
+		if (qout)
+			memcpy(qout[i], f->q, sizeof(f->q));
+	}
+}
+
+/* 四元数转欧拉角，角度 */
+static void quat_to_euler(const float q[4], float *roll, float *pitch, float *yaw)
+{
+	*roll = atan2f(2.0f * (q[0] * q[1] + q[2] * q[3]),
+				   1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2])) / DEG2RAD;
+	*pitch = asinf(fmaxf(-1.0f, fminf(1.0f, 2.0f * (q[0] * q[2] - q[3] * q[1])))) / DEG2RAD;
+	*yaw = atan2f(2.0f * (q[0] * q[3] + q[1] * q[2]),
+				  1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3])) / DEG2RAD;
+}
+
+/*
+ * @description		: 写sysfs属性
+ * @param - dir		: iio设备目录
+ * @param - name	: 属性文件，相对dir
+ * @param - val		: 要写的值
+ * @return			: 0 成功；其他 失败
+ */
+static int sysfs_write(const char *dir, const char *name, const char *val)
+{
+	char path[256];
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	if (!fp) {
+		printf("can't open file %s\r\n", path);
+		return -1;
+	}
+	ret = fputs(val, fp) < 0 ? -1 : 0;
+	if (fclose(fp))
+		ret = -1;
+	return ret;
+}
+
+static int sysfs_read_float(const char *dir, const char *name, float *val)
+{
+	char path[256];
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "r");
+	if (!fp) {
+		printf("can't open file %s\r\n", path);
+		return -1;
+	}
+	ret = fscanf(fp, "%f", val) == 1 ? 0 : -1;
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * @description		: 打开扫描通道、选触发器、设置缓冲区长度和水位线并使能
+ * @param - dir		: iio设备目录
+ * @param - block	: 每次read()的样本数
+ * @return			: 0 成功；其他 失败
+ */
+static int iio_buffer_setup(const char *dir, int block)
+{
+	static const char *elements[] = {
+		"in_accel_x_en", "in_accel_y_en", "in_accel_z_en",
+		"in_anglvel_x_en", "in_anglvel_y_en", "in_anglvel_z_en", "in_temp_en",
+	};
+	char path[64], val[16];
+	unsigned int i;
+
+	sysfs_write(dir, "buffer/enable", "0");
+	for (i = 0; i < sizeof(elements) / sizeof(elements[0]); i++) {
+		snprintf(path, sizeof(path), "scan_elements/%s", elements[i]);
+		if (sysfs_write(dir, path, "1"))
+			return -1;
+	}
+	/* 时间戳会把每个样本补齐到24字节，ICM20608_SCAN_BYTES按14字节算，必须关掉 */
+	if (sysfs_write(dir, "scan_elements/in_timestamp_en", "0"))
+		return -1;
+	if (sysfs_write(dir, "trigger/current_trigger", "icm20608-dev0"))
+		return -1;
+
+	/* 缓冲区放4块，水位线1块：内核攒够一块才唤醒read() */
+	snprintf(val, sizeof(val), "%d", block * 4);
+	if (sysfs_write(dir, "buffer/length", val))
+		return -1;
+	snprintf(val, sizeof(val), "%d", block);
+	sysfs_write(dir, "buffer/watermark", val);	/* 老内核没有这个文件 */
+	return sysfs_write(dir, "buffer/enable", "1");
+}
+
+static struct fusion_shm *fusion_shm_create(void)
+{
+	struct fusion_shm *shm;
+	int fd;
+
+	fd = shm_open(FUSION_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*shm))) {
+		perror("shm_open");
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	memset(shm, 0, sizeof(*shm));
+	shm->ring_size = FUSION_RING_SIZE;
+	shm->magic = FUSION_SHM_MAGIC;
+	return shm;
+}
+
+static void stats_print(struct stage_stats *st, uint64_t wall_ns)
+{
+	int i;
+
+	if (!st->samples || !wall_ns)
+		return;
+	printf("%llu samples, %llu reads (%.1f samples/read)\r\n",
+		   (unsigned long long)st->samples, (unsigned long long)st->reads,
+		   (double)st->samples / (st->reads ? st->reads : 1));
+	for (i = 0; i < STAGE_NUM; i++)
+		printf("  %-8s %8.1f ns/sample  %6.3f%% CPU\r\n", stage_name[i],
+			   (double)st->cpu_ns[i] / st->samples, st->cpu_ns[i] * 100.0 / wall_ns);
+}
+
+/*
+ * @description		: 融合服务主循环
+ * @return			: 0 成功；其他 失败
+ */
+static int fusiond_run(const char *dir, int block, float rate, float beta, int interval)
+{
+	static uint8_t raw[FUSION_MAX_BLOCK * ICM20608_SCAN_BYTES];
+	static float conv[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	static float scale_tab[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	static float quat[FUSION_MAX_BLOCK][4];
+	float ch[ICM20608_SCAN_CH], accel_scale, gyro_scale;
+	struct stage_stats st;
+	struct madgwick f;
+	struct fusion_shm *shm;
+	struct pollfd pfd;
+	uint64_t t0, t1, wall0, t_pub, period_ns;
+	char devnode[64];
+	const char *name;
+	ssize_t ret;
+	int i, n;
+
+	/* scale只在启动时读一次 */
+	if (sysfs_read_float(dir, "in_accel_scale", &accel_scale) ||
+		sysfs_read_float(dir, "in_anglvel_scale", &gyro_scale))
+		return -1;
+	for (i = 0; i < 3; i++) {
+		ch[i] = accel_scale;					/* g */
+		ch[4 + i] = gyro_scale * DEG2RAD;		/* 驱动给的是度/秒，滤波器要rad/s */
+	}
+	ch[3] = 1.0f;								/* 温度不参与融合，保持原始值 */
+	scale_table_init(scale_tab, ch);
+
+	if (iio_buffer_setup(dir, block))
+		return -1;
+
+	name = strrchr(dir, '/');
+	snprintf(devnode, sizeof(devnode), "/dev/%s", name ? name + 1 : dir);
+	pfd.fd = open(devnode, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0) {
+		printf("ERROR: %s file open failed!\r\n", devnode);
+		return -1;
+	}
+	pfd.events = POLLIN;
+
+	shm = fusion_shm_create();
+	if (!shm)
+		return -1;
+
+	madgwick_init(&f, beta, rate);
+	period_ns = 1000000000.0f / rate;
+	memset(&st, 0, sizeof(st));
+	wall0 = now_ns(CLOCK_MONOTONIC);
+
+	while (running) {
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		t0 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		ret = read(pfd.fd, raw, block * ICM20608_SCAN_BYTES);
+		t1 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		st.cpu_ns[STAGE_READ] += t1 - t0;
+		if (ret <= 0) {
+			if (ret < 0 && errno != EAGAIN)
+				perror("read");
+			continue;
+		}
+		n = ret / ICM20608_SCAN_BYTES;
+		st.reads++;
+		st.samples += n;
+
+		t0 = t1;
+		convert_block(raw, scale_tab, conv, n * ICM20608_SCAN_CH);
+		t1 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		st.cpu_ns[STAGE_CONVERT] += t1 - t0;
+
+		t0 = t1;
+		madgwick_block(&f, conv, n, quat);
+		t1 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		st.cpu_ns[STAGE_FILTER] += t1 - t0;
+
+		t0 = t1;
+		/* 每个样本都发布，时间戳按采样周期从块尾往前推 */
+		t_pub = now_ns(CLOCK_MONOTONIC);
+		for (i = 0; i < n; i++)
+			fusion_publish(shm, t_pub - (uint64_t)(n - 1 - i) * period_ns, quat[i]);
+		st.cpu_ns[STAGE_PUBLISH] += now_ns(CLOCK_THREAD_CPUTIME_ID) - t0;
+
+		if (interval && t_pub - wall0 >= (uint64_t)interval * 1000000000ULL) {
+			stats_print(&st, t_pub - wall0);
+			memset(&st, 0, sizeof(st));
+			wall0 = t_pub;
+		}
+	}
+
+	stats_print(&st, now_ns(CLOCK_MONOTONIC) - wall0);
+	sysfs_write(dir, "buffer/enable", "0");
+	close(pfd.fd);
+	munmap(shm, sizeof(*shm));
+	shm_unlink(FUSION_SHM_NAME);
+	return 0;
+}
+
+/*
+ * @description		: 消费者示例，每100ms打印一次最新姿态
+ * @return			: 0 成功；其他 失败
+ */
+static int consumer_run(void)
+{
+	struct fusion_shm *shm;
+	struct fusion_sample s;
+	float roll, pitch, yaw;
+	int fd;
+
+	fd = shm_open(FUSION_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0) {
+		perror("shm_open, is icm20608_fusiond running?");
+		return -1;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED || shm->magic != FUSION_SHM_MAGIC) {
+		printf("bad shared memory\r\n");
+		return -1;
+	}
+
+	while (running) {
+		if (fusion_read_latest(shm, &s) == 0) {
+			quat_to_euler(s.q, &roll, &pitch, &yaw);
+			printf("#%llu q = %.4f %.4f %.4f %.4f  roll %.1f pitch %.1f yaw %.1f\r\n",
+				   (unsigned long long)s.index, s.q[0], s.q[1], s.q[2], s.q[3],
+				   roll, pitch, yaw);
+		}
+		usleep(100000);
+	}
+	munmap(shm, sizeof(*shm));
+	return 0;
+}
+
+/******************** 单元测试和基准测试，合成数据 ********************/
+
+static int test_failed;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {									\
+		printf("FAIL %s:%d: ", __func__, __LINE__);	\
+		printf(__VA_ARGS__);						\
+		printf("\r\n");								\
+		test_failed++;								\
+	}												\
+} while (0)
+
+/* 合成一个大端样本 */
+static void synth_sample(uint8_t *p, const int16_t v[ICM20608_SCAN_CH])
+{
+	int i;
+
+	for (i = 0; i < ICM20608_SCAN_CH; i++) {
+		p[2 * i] = (uint16_t)v[i] >> 8;
+		p[2 * i + 1] = (uint16_t)v[i] & 0xFF;
+	}
+}
+
+/* 转换：边界值和随机值，和逐个标量计算的结果比较 */
+static void test_convert(void)
+{
+	static uint8_t raw[FUSION_MAX_BLOCK * ICM20608_SCAN_BYTES];
+	static float conv[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	static float tab[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	const float ch[ICM20608_SCAN_CH] = { 0.000488281f, 0.000488281f, 0.000488281f, 1.0f,
+										 0.061035f * DEG2RAD, 0.061035f * DEG2RAD, 0.061035f * DEG2RAD };
+	const int16_t edge[ICM20608_SCAN_CH] = { 32767, -32768, 1, -1, 0, 256, -256 };
+	int16_t v[ICM20608_SCAN_CH];
+	int i, k, n = FUSION_MAX_BLOCK;
+	float want;
+
+	scale_table_init(tab, ch);
+	srand(1);
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < ICM20608_SCAN_CH; k++)
+			v[k] = i == 0 ? edge[k] : (int16_t)(rand() & 0xFFFF);
+		synth_sample(raw + i * ICM20608_SCAN_BYTES, v);
+	}
+	convert_block(raw, tab, conv, n * ICM20608_SCAN_CH);
+
+	for (i = 0; i < n; i++)
+		for (k = 0; k < ICM20608_SCAN_CH; k++) {
+			const uint8_t *p = raw + i * ICM20608_SCAN_BYTES + 2 * k;
+			want = (float)(int16_t)((p[0] << 8) | p[1]) * ch[k];
+			CHECK(conv[i * ICM20608_SCAN_CH + k] == want, "sample %d ch %d: %g != %g",
+				  i, k, conv[i * ICM20608_SCAN_CH + k], want);
+		}
+	CHECK(conv[0] == 32767 * ch[0] && conv[1] == -32768 * ch[1], "edge values");
+}
+
+/* 静止、倾斜30度：滤波器应该收敛到对应的横滚角 */
+static void test_filter_tilt(void)
+{
+	const float g[3] = { 0, 0, 0 };
+	float a[3], roll, pitch, yaw;
+	struct madgwick f;
+	int i;
+
+	madgwick_init(&f, 0.1f, 1000.0f);
+	a[0] = 0;
+	a[1] = sinf(30 * DEG2RAD);
+	a[2] = cosf(30 * DEG2RAD);
+	for (i = 0; i < 20000; i++)
+		madgwick_update(&f, g, a);
+	quat_to_euler(f.q, &roll, &pitch, &yaw);
+	CHECK(fabsf(roll - 30) < 0.5f && fabsf(pitch) < 0.5f, "roll %.2f pitch %.2f", roll, pitch);
+
+	/* 平放静止：保持单位四元数 */
+	madgwick_init(&f, 0.1f, 1000.0f);
+	a[1] = 0;
+	a[2] = 1;
+	for (i = 0; i < 1000; i++)
+		madgwick_update(&f, g, a);
+	CHECK(fabsf(f.q[0] - 1) < 1e-5f, "level q0 %f", f.q[0]);
+}
+
+/* 绕Z轴90度/秒转1秒，航向应该是90度(beta为0只积分陀螺仪) */
+static void test_filter_yaw(void)
+{
+	const float g[3] = { 0, 0, 90 * DEG2RAD };
+	const float a[3] = { 0, 0, 1 };
+	float roll, pitch, yaw;
+	struct madgwick f;
+	int i;
+
+	madgwick_init(&f, 0.0f, 1000.0f);
+	for (i = 0; i < 1000; i++)
+		madgwick_update(&f, g, a);
+	quat_to_euler(f.q, &roll, &pitch, &yaw);
+	CHECK(fabsf(yaw - 90) < 0.1f && fabsf(roll) < 0.1f, "yaw %.3f roll %.3f", yaw, roll);
+
+	/* 带加速度修正时，水平面内的旋转不受影响 */
+	madgwick_init(&f, 0.1f, 1000.0f);
+	for (i = 0; i < 1000; i++)
+		madgwick_update(&f, g, a);
+	quat_to_euler(f.q, &roll, &pitch, &yaw);
+	CHECK(fabsf(yaw - 90) < 0.1f, "yaw with beta %.3f", yaw);
+}
+
+/* 一个写者高速发布，读者检查读到的样本没有被撕裂，序号不后退 */
+struct ring_test {
+	struct fusion_shm *shm;
+	uint64_t count;
+	_Atomic int started;
+	_Atomic int done;
+};
+
+static void *ring_writer(void *arg)
+{
+	struct ring_test *rt = arg;
+	uint64_t i;
+	float q[4];
+
+	while (!atomic_load(&rt->started))
+		;
+	for (i = 0; i < rt->count; i++) {
+		q[0] = q[1] = q[2] = q[3] = (float)i;
+		fusion_publish(rt->shm, i, q);
+	}
+	atomic_store(&rt->done, 1);
+	return NULL;
+}
+
+static void test_ring(void)
+{
+	static struct fusion_shm shm;
+	struct ring_test rt = { &shm, 20000000, 0, 0 };
+	struct fusion_sample s;
+	uint64_t last = 0, reads = 0, torn = 0, back = 0, lost = 0, next = 0;
+	pthread_t th;
+
+	memset(&shm, 0, sizeof(shm));
+	memset(&s, 0, sizeof(s));
+	pthread_create(&th, NULL, ring_writer, &rt);
+	atomic_store(&rt.started, 1);
+	while (!atomic_load(&rt.done)) {
+		if (fusion_read_latest(&shm, &s))
+			continue;
+		reads++;
+		if (s.q[0] != s.q[1] || s.q[0] != s.q[3] || s.t_ns != s.index ||
+			(float)s.index != s.q[0])
+			torn++;
+		if (s.index < last)
+			back++;
+		last = s.index;
+
+		/* 按序号追读：要么读到正确的样本，要么报告已被覆盖 */
+		if (fusion_read(&shm, next, &s) == 0) {
+			if (s.index != next || (float)s.index != s.q[2])
+				torn++;
+			next++;
+		} else if (next < last) {
+			lost++;
+			next = last;
+		}
+	}
+	pthread_join(th, NULL);
+
+	CHECK(torn == 0 && back == 0, "%llu reads, %llu torn, %llu went back",
+		  (unsigned long long)reads, (unsigned long long)torn, (unsigned long long)back);
+	CHECK(fusion_read_latest(&shm, &s) == 0 && s.index == rt.count - 1, "last index %llu",
+		  (unsigned long long)s.index);
+	printf("  ring: %llu concurrent reads, %llu overruns detected\r\n",
+		   (unsigned long long)reads, (unsigned long long)lost);
+}
+
+static int self_test(void)
+{
+	test_convert();
+	test_filter_tilt();
+	test_filter_yaw();
+	test_ring();
+	printf("%s\r\n", test_failed ? "FAILED" : "all tests passed");
+	return test_failed ? 1 : 0;
+}
+
+/* 转换和滤波的耗时，每样本纳秒 */
+static int benchmark(void)
+{
+	static uint8_t raw[FUSION_MAX_BLOCK * ICM20608_SCAN_BYTES];
+	static float conv[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	static float tab[FUSION_MAX_BLOCK * ICM20608_SCAN_CH];
+	const float ch[ICM20608_SCAN_CH] = { 0.000488281f, 0.000488281f, 0.000488281f, 1.0f,
+										 0.001f, 0.001f, 0.001f };
+	const int rounds = 2000;
+	int16_t v[ICM20608_SCAN_CH];
+	struct madgwick f;
+	uint64_t t0, t_conv, t_filt;
+	int i, k;
+
+	scale_table_init(tab, ch);
+	srand(2);
+	for (i = 0; i < FUSION_MAX_BLOCK; i++) {
+		for (k = 0; k < ICM20608_SCAN_CH; k++)
+			v[k] = (int16_t)(rand() & 0x3FF) - 512;
+		v[2] += 2048;							/* 大致朝上的重力 */
+		synth_sample(raw + i * ICM20608_SCAN_BYTES, v);
+	}
+
+	t0 = now_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < rounds; i++) {
+		convert_block(raw, tab, conv, FUSION_MAX_BLOCK * ICM20608_SCAN_CH);
+		__asm__ volatile("" : : "r"(conv) : "memory");	/* 不让编译器把循环优化掉 */
+	}
+	t_conv = now_ns(CLOCK_MONOTONIC) - t0;
+
+	madgwick_init(&f, 0.1f, 1000.0f);
+	t0 = now_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < rounds; i++)
+		madgwick_block(&f, conv, FUSION_MAX_BLOCK, NULL);
+	t_filt = now_ns(CLOCK_MONOTONIC) - t0;
+
+	printf("%d samples x %d rounds\r\n", FUSION_MAX_BLOCK, rounds);
+	printf("  convert %8.2f ns/sample\r\n", (double)t_conv / rounds / FUSION_MAX_BLOCK);
+	printf("  filter  %8.2f ns/sample  (q = %.3f %.3f %.3f %.3f)\r\n",
+		   (double)t_filt / rounds / FUSION_MAX_BLOCK, f.q[0], f.q[1], f.q[2], f.q[3]);
+	return 0;
+}
+
+/*
+ * @description		: main主程序
+ * @param - argc 	: argv数组元素个数
+ * @param - argv 	: 具体参数
+ * @return 			: 0 成功;其他 失败
+ */
+int main(int argc, char *argv[])
+{
+	const char *dir = "/sys/bus/iio/devices/iio:device0";
+	int opt, block = 64, interval = 5;
+	float rate = 1000.0f, beta = 0.1f;
+
+	while ((opt = getopt(argc, argv, "d:n:r:B:s:ctb")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'n':
+			block = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'B':
+			beta = atof(optarg);
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 't':
+			return self_test();
+		case 'b':
+			return benchmark();
+		case 'c':
+			signal(SIGINT, on_signal);
+			return consumer_run() ? 1 : 0;
+		default:
+			printf("Usage:\n"
+				   "\t./icm20608_fusiond [-d /sys/bus/iio/devices/iio:device0] [-n block]\n"
+				   "\t                   [-r rate] [-B beta] [-s interval]\n"
+				   "\t./icm20608_fusiond -c | -t | -b\n");
+			return -1;
+		}
+	}
+
+	if (block < 1 || block > FUSION_MAX_BLOCK || rate <= 0) {
+		printf("block must be 1..%d, rate > 0\r\n", FUSION_MAX_BLOCK);
+		return -1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	return fusiond_run(dir, block, rate, beta, interval) ? 1 : 0;
+}
@@ -7,13 +7,81 @@
 #include <linux/device.h>
 #include <linux/of_gpio.h>
 #include <linux/errno.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include "w1_engine.h"
+
+/*
+ * The bus is driven by w1_engine.ko: every 1-Wire time slot is scheduled
+ * from an hrtimer and the 750 ms conversion is a sleeping wait, so the CPU
+ * only works (and only has interrupts off) around the bus edges.
+ * bitbang=1 switches back to the old udelay() bit-banging for comparison.
+ * Both paths account CPU time and the longest interrupts-off stretch in the
+ * stats attribute; write anything to it to restart the measurement.
+ *
+ * All probes on the bus are enumerated with Search ROM at probe time. Each
+ * cycle starts one broadcast Convert T, so every probe converts at once,
+ * and then reads each scratchpad with Match ROM and checks its CRC. Every
+ * probe is an IIO temperature channel named after its ROM code:
+ * in_temp<n>_<rom>_input in milli-degrees C, or _raw with _scale 62.5 for
+ * buffer consumers. /dev/ds18b20 still returns the raw temperature of the
+ * first probe.
+ *
+ * The bus is idle while nobody is reading. A sysfs or /dev/ds18b20 read
+ * runs a cycle unless the last one is younger than the sampling period;
+ * an enabled buffer runs one cycle per period (in_sampling_frequency, 1 Hz
+ * at most) and the device's own trigger, ds18b20-dev<n>, fires after each
+ * cycle, which is pushed with the time of its Convert T.
+ */
+
+#define DS18B20_PERIOD_MS   1000        /* Default sampling period */
+#define DS18B20_MIN_PERIOD_MS 1000      /* Conversion plus the reads */
+#define DS18B20_CONV_MS     750         /* 12-bit conversion time */
+#define DS18B20_MAX_PROBES  32
+#define DS18B20_FAMILY      0X28
+#define DS18B20_SCRATCH_LEN 9
+#define DS18B20_READ_TRIES  2           /* Re-read a scratchpad once on a CRC error */
+
+static bool bitbang;
+module_param(bitbang, bool, 0644);
+MODULE_PARM_DESC(bitbang, "Use the udelay() bit-banging path (Skip ROM, first probe only) instead of the hrtimer engine");
+
+struct ds18b20_probe {
+    u8 rom[8];                      /* Family code, serial number, CRC */
+    u8 raw[2];                      /* Last good temperature, LSB first */
+    bool valid;
+    unsigned int crc_errors;
+};
+
+struct ds18b20_scan {
+    s16 temp[DS18B20_MAX_PROBES];   /* Enabled probes, packed */
+    s64 ts __aligned(8);
+};
 
 struct ds18b20_dev {
     struct miscdevice mdev;         /* MISC device */
-    int gpio;                       /* GPIO number */
-    unsigned char data[2];          /* Data buffer */
-    struct timer_list timer;        /* Timer */
-    struct work_struct work;        /* Work queue */
+    int gpio;                       /* GPIO number, unused with platform_data */
+    spinlock_t lock;                /* probes[].raw/valid, counters, timestamps */
+    struct mutex cycle_lock;        /* One sampling cycle at a time */
+    struct delayed_work work;       /* Buffered sampling cycle */
+    struct w1_engine w1;            /* 1-Wire master */
+    struct ds18b20_probe probes[DS18B20_MAX_PROBES];
+    int nprobes;
+    unsigned int conversions;
+    unsigned int errors;
+    u32 cycle_ms;                   /* Duration of the last cycle */
+    u32 period_ms;                  /* Sampling period */
+    s64 timestamp;                  /* IIO timestamp of the last cycle's Convert T */
+    ktime_t last_cycle;             /* When it ended */
+    bool sampled;                   /* At least one cycle ran */
+    ktime_t stats_since;
+    struct iio_dev *indio_dev;
+    struct iio_trigger *trig;       /* Fired after each cycle */
 };
 
 #define HIGH    1
@@ -21,31 +89,75 @@ struct ds18b20_dev {
 
 struct ds18b20_dev ds18b20_device;
 
+/* GPIO bus: open drain, the external pull-up takes the line high */
+static void ds18b20_gpio_low(void *priv)
+{
+    gpio_direction_output(ds18b20_device.gpio, 0);
+}
+
+static void ds18b20_gpio_release(void *priv)
+{
+    gpio_direction_input(ds18b20_device.gpio);
+}
+
+static int ds18b20_gpio_sample(void *priv)
+{
+    return gpio_get_value(ds18b20_device.gpio);
+}
+
+static const struct w1_bus_ops ds18b20_gpio_ops = {
+    .drive_low  = ds18b20_gpio_low,
+    .release    = ds18b20_gpio_release,
+    .sample     = ds18b20_gpio_sample,
+};
+
 /* Set GPIO output value */
 static void ds18b20_set_output(int value)
 {
+    struct w1_engine *w1 = &ds18b20_device.w1;
+
     if (value)
-        gpio_direction_output(ds18b20_device.gpio, 1);
+        w1->ops->release(w1->priv);
     else
-        gpio_direction_output(ds18b20_device.gpio, 0);
+        w1->ops->drive_low(w1->priv);
 }
 
 /* Set GPIO to input mode */
 static void ds18b20_set_input(void)
 {
-    gpio_direction_input(ds18b20_device.gpio);
+    struct w1_engine *w1 = &ds18b20_device.w1;
+
+    w1->ops->release(w1->priv);
 }
 
 /* Get GPIO value */
 static int ds18b20_get_io(void)
 {
-    return gpio_get_value(ds18b20_device.gpio); 
+    struct w1_engine *w1 = &ds18b20_device.w1;
+
+    return w1->ops->sample(w1->priv);
+}
+
+/* Disable interrupts for one bit, timed for the stats */
+static ktime_t ds18b20_irq_off(void)
+{
+    local_irq_disable();
+    return ktime_get();
+}
+
+static void ds18b20_irq_on(ktime_t t0)
+{
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    local_irq_enable();
+    w1_engine_account(&ds18b20_device.w1, 0, ns);
 }
 
 /* Write a bit to DS18B20 */
 static void ds18b20_write_bit(int bit)
 {
-    local_irq_disable();
+    ktime_t t0 = ds18b20_irq_off();
+
     if (bit) {
         ds18b20_set_output(LOW);
         udelay(2);
@@ -57,26 +169,27 @@ static void ds18b20_write_bit(int bit)
         ds18b20_set_output(HIGH);
         udelay(2);
     }
-    local_irq_enable();
+    ds18b20_irq_on(t0);
 }
 
 /* Read a bit from DS18B20 */
 static int ds18b20_read_bit(void)
 {
     u8 bit = 0;
-    local_irq_disable();
+    ktime_t t0 = ds18b20_irq_off();
+
     ds18b20_set_output(LOW);
     udelay(1);
 
     ds18b20_set_output(HIGH);
     udelay(1);
-    
+
     ds18b20_set_input();
 
     if (ds18b20_get_io())
         bit = 1;
     udelay(50);
-    local_irq_enable();
+    ds18b20_irq_on(t0);
     return bit;
 }
 
@@ -120,9 +233,150 @@ static int ds18b20_init(void)
     ds18b20_set_input();
     ret = ds18b20_get_io();
     udelay(240);
-    return ret;      
+    return ret;
+}
+
+/*
+ * Old bit-banged cycle: starts a conversion and reads back the previous
+ * one right away, relying on the 1 s period for the conversion time.
+ */
+static int ds18b20_convert_bitbang(u8 *data)
+{
+    if (ds18b20_init() != 0)
+        return -ENODEV;
+    ds18b20_write_byte(0XCC);
+    ds18b20_write_byte(0X44);
+
+    if (ds18b20_init() != 0)
+        return -ENODEV;
+    ds18b20_write_byte(0XCC);
+    ds18b20_write_byte(0XBE);
+
+    data[0] = ds18b20_read_byte();
+    data[1] = ds18b20_read_byte();
+    return 0;
+}
+
+/*
+ * @description : Read one probe's scratchpad with Match ROM and check it
+ * @param - p   : probe
+ * @param - scratch : 9 scratchpad bytes
+ * @return      : 0, -ENODEV without presence pulse, -EIO on a bad CRC
+ */
+static int ds18b20_read_probe(struct ds18b20_probe *p, u8 *scratch)
+{
+    struct w1_engine *w1 = &ds18b20_device.w1;
+    u8 cmd[10];
+    int ret;
+
+    cmd[0] = 0X55;                  /* Match ROM */
+    memcpy(&cmd[1], p->rom, 8);
+    cmd[9] = 0XBE;                  /* Read Scratchpad */
+
+    ret = w1_engine_reset(w1);
+    if (ret)
+        return ret;
+    w1_engine_write(w1, cmd, sizeof(cmd) * 8);
+    w1_engine_read(w1, scratch, DS18B20_SCRATCH_LEN * 8);
+
+    /* All zeros passes the CRC: the configuration byte has bits 0-4 set */
+    if (w1_crc8(scratch, DS18B20_SCRATCH_LEN) || (scratch[4] & 0x1F) != 0x1F)
+        return -EIO;
+    return 0;
+}
+
+/*
+ * One broadcast Convert T for every probe, sleep through the conversion,
+ * then read each probe back. Returns the number of probes that failed.
+ */
+static int ds18b20_convert(void)
+{
+    static const u8 convert[] = { 0XCC, 0X44 };     /* Skip ROM, Convert T */
+    struct w1_engine *w1 = &ds18b20_device.w1;
+    struct ds18b20_probe *p;
+    u8 scratch[DS18B20_SCRATCH_LEN];
+    int i, try, ret, failed = 0;
+
+    ret = w1_engine_reset(w1);
+    if (ret)
+        return ds18b20_device.nprobes;
+    w1_engine_write(w1, convert, 16);
+
+    msleep(DS18B20_CONV_MS);
+
+    for (i = 0; i < ds18b20_device.nprobes; i++) {
+        p = &ds18b20_device.probes[i];
+        for (try = 0; try < DS18B20_READ_TRIES; try++) {
+            ret = ds18b20_read_probe(p, scratch);
+            if (ret != -EIO)
+                break;
+            spin_lock_irq(&ds18b20_device.lock);
+            p->crc_errors++;
+            spin_unlock_irq(&ds18b20_device.lock);
+        }
+
+        spin_lock_irq(&ds18b20_device.lock);
+        if (ret == 0) {
+            memcpy(p->raw, scratch, sizeof(p->raw));
+            p->valid = true;
+        } else {
+            failed++;
+        }
+        spin_unlock_irq(&ds18b20_device.lock);
+    }
+    return failed;
 }
- 
+
+/* One sampling cycle, cycle_lock held */
+static void ds18b20_cycle(void)
+{
+    unsigned char data[2];
+    ktime_t t0 = ktime_get();
+    s64 ts = iio_get_time_ns(ds18b20_device.indio_dev);
+    int ret;
+
+    if (bitbang) {
+        ret = ds18b20_convert_bitbang(data);
+        w1_engine_account(&ds18b20_device.w1, ktime_to_ns(ktime_sub(ktime_get(), t0)), 0);
+        spin_lock_irq(&ds18b20_device.lock);
+        if (ret == 0) {
+            memcpy(ds18b20_device.probes[0].raw, data, sizeof(data));
+            ds18b20_device.probes[0].valid = true;
+        }
+        spin_unlock_irq(&ds18b20_device.lock);
+        ret = ret ? 1 : 0;
+    } else {
+        ret = ds18b20_convert();
+    }
+
+    spin_lock_irq(&ds18b20_device.lock);
+    ds18b20_device.conversions++;
+    ds18b20_device.errors += ret;
+    ds18b20_device.cycle_ms = ktime_ms_delta(ktime_get(), t0);
+    ds18b20_device.timestamp = ts;
+    ds18b20_device.last_cycle = ktime_get();
+    ds18b20_device.sampled = true;
+    spin_unlock_irq(&ds18b20_device.lock);
+
+    /* Buffer consumers pick the cycle up from the trigger handler */
+    iio_trigger_poll_chained(ds18b20_device.trig);
+}
+
+/* Run a cycle unless the last one is younger than the sampling period */
+static void ds18b20_refresh(void)
+{
+    bool fresh;
+
+    mutex_lock(&ds18b20_device.cycle_lock);
+    spin_lock_irq(&ds18b20_device.lock);
+    fresh = ds18b20_device.sampled &&
+            ktime_ms_delta(ktime_get(), ds18b20_device.last_cycle) < ds18b20_device.period_ms;
+    spin_unlock_irq(&ds18b20_device.lock);
+    if (!fresh)
+        ds18b20_cycle();
+    mutex_unlock(&ds18b20_device.cycle_lock);
+}
+
 /* Open function for DS18B20 device */
 static int ds18b20_open(struct inode *inode, struct file *filp)
 {
@@ -130,10 +384,18 @@ static int ds18b20_open(struct inode *inode, struct file *filp)
 }
 
 /* Read function for DS18B20 device */
-static ssize_t ds18b20_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt) 
+static ssize_t ds18b20_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
 {
+    unsigned char data[2];
     int ret;
-    ret = copy_to_user(buf, &ds18b20_device.data[0], 2);
+
+    ds18b20_refresh();
+
+    spin_lock_irq(&ds18b20_device.lock);
+    memcpy(data, ds18b20_device.probes[0].raw, sizeof(data));
+    spin_unlock_irq(&ds18b20_device.lock);
+
+    ret = copy_to_user(buf, data, 2);
     if (ret)
         return -ENOMEM;
     return ret;
@@ -145,35 +407,282 @@ static struct file_operations ds18b20_fops = {
     .read   = ds18b20_read,
 };
 
-/* Work queue callback function for DS18B20 */
+/* Work queue callback function for DS18B20, one cycle per period while the buffer is enabled */
 static void ds18b20_work_callback(struct work_struct *work)
 {
-    int ret = -1;
-    ret = ds18b20_init();
-    if (ret != 0)
-        goto out1;
-    
-    ds18b20_write_byte(0XCC);
-    ds18b20_write_byte(0X44);
-    
-    ret = ds18b20_init();
-    if (ret != 0)
-        goto out1;
-    
-    ds18b20_write_byte(0XCC);
-    ds18b20_write_byte(0XBE);
-    
-    ds18b20_device.data[0] = ds18b20_read_byte();
-    ds18b20_device.data[1] = ds18b20_read_byte();
-out1:
-    return;
+    unsigned long start = jiffies, period;
+
+    mutex_lock(&ds18b20_device.cycle_lock);
+    ds18b20_cycle();
+    mutex_unlock(&ds18b20_device.cycle_lock);
+
+    /* Next cycle one period after this one started */
+    period = msecs_to_jiffies(READ_ONCE(ds18b20_device.period_ms));
+    queue_delayed_work(system_long_wq, &ds18b20_device.work,
+                       time_before(jiffies, start + period) ? start + period - jiffies : 0);
+}
+
+/* Bus statistics since probe or the last write */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct w1_stats st;
+    unsigned int crc_errors = 0;
+    u64 elapsed;
+    u32 cpu;
+    int i;
+
+    w1_engine_get_stats(&ds18b20_device.w1, &st);
+    elapsed = ktime_to_ns(ktime_sub(ktime_get(), ds18b20_device.stats_since));
+    cpu = elapsed ? div64_u64(st.cpu_ns * 100000, elapsed) : 0;       /* 0.001 % */
+    for (i = 0; i < ds18b20_device.nprobes; i++)
+        crc_errors += ds18b20_device.probes[i].crc_errors;
+
+    return sprintf(buf, "mode %s\nprobes %d\ncycles %u\nerrors %u\ncrc_errors %u\n"
+                   "period_ms %u\ncycle_ms %u\nslots %llu\nresets %llu\n"
+                   "cpu_ns %llu\ncpu %u.%03u%%\nirqoff_max_ns %llu\n",
+                   bitbang ? "bitbang" : "engine", ds18b20_device.nprobes,
+                   ds18b20_device.conversions, ds18b20_device.errors, crc_errors,
+                   ds18b20_device.period_ms, ds18b20_device.cycle_ms, st.slots, st.resets, st.cpu_ns,
+                   cpu / 1000, cpu % 1000, st.irqoff_max_ns);
+}
+
+static ssize_t stats_store(struct device *dev, struct device_attribute *attr,
+                           const char *buf, size_t count)
+{
+    int i;
+
+    w1_engine_clear_stats(&ds18b20_device.w1);
+    spin_lock_irq(&ds18b20_device.lock);
+    ds18b20_device.conversions = 0;
+    ds18b20_device.errors = 0;
+    for (i = 0; i < ds18b20_device.nprobes; i++)
+        ds18b20_device.probes[i].crc_errors = 0;
+    ds18b20_device.stats_since = ktime_get();
+    spin_unlock_irq(&ds18b20_device.lock);
+    return count;
+}
+static DEVICE_ATTR_RW(stats);
+
+/* Push every probe's last temperature with the cycle's timestamp */
+static irqreturn_t ds18b20_trigger_handler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct ds18b20_scan scan;
+    s64 ts;
+    int i;
+
+    memset(&scan, 0, sizeof(scan));
+    spin_lock_irq(&ds18b20_device.lock);
+    for (i = 0; i < ds18b20_device.nprobes; i++)
+        scan.temp[i] = (s16)((ds18b20_device.probes[i].raw[1] << 8) |
+                             ds18b20_device.probes[i].raw[0]);
+    ts = ds18b20_device.timestamp;
+    spin_unlock_irq(&ds18b20_device.lock);
+
+    iio_push_to_buffers_with_timestamp(indio_dev, &scan, ts);
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
+}
+
+/* The bus only runs cycles while the buffer is enabled */
+static int ds18b20_buffer_postenable(struct iio_dev *indio_dev)
+{
+    int ret;
+
+    ret = iio_triggered_buffer_postenable(indio_dev);
+    if (ret)
+        return ret;
+    queue_delayed_work(system_long_wq, &ds18b20_device.work, 0);
+    return 0;
 }
 
-/* Timer callback function for DS18B20 */
-static void ds18b20_timer_callback(struct timer_list *arg)
+static int ds18b20_buffer_predisable(struct iio_dev *indio_dev)
 {
-    schedule_work(&ds18b20_device.work);
-    mod_timer(&ds18b20_device.timer, jiffies + (1000 * HZ / 1000));
+    cancel_delayed_work_sync(&ds18b20_device.work);
+    return iio_triggered_buffer_predisable(indio_dev);
+}
+
+static const struct iio_buffer_setup_ops ds18b20_buffer_ops = {
+    .postenable = ds18b20_buffer_postenable,
+    .predisable = ds18b20_buffer_predisable,
+};
+
+/* Temperature of one probe from the last cycle */
+static int ds18b20_read_raw(struct iio_dev *indio_dev,
+                            struct iio_chan_spec const *chan,
+                            int *val, int *val2, long mask)
+{
+    struct ds18b20_probe *p = &ds18b20_device.probes[chan->channel];
+    bool valid;
+    s16 raw;
+    u32 uhz;
+    int ret;
+
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+    case IIO_CHAN_INFO_PROCESSED:
+        /* With the buffer enabled the work is sampling already */
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret == 0) {
+            ds18b20_refresh();
+            iio_device_release_direct_mode(indio_dev);
+        }
+
+        spin_lock_irq(&ds18b20_device.lock);
+        raw = (s16)((p->raw[1] << 8) | p->raw[0]);
+        valid = p->valid;
+        spin_unlock_irq(&ds18b20_device.lock);
+
+        if (!valid)                 /* Not read successfully yet */
+            return -EAGAIN;
+        if (mask == IIO_CHAN_INFO_RAW)
+            *val = raw;
+        else
+            *val = raw * 1000 / 16; /* 0.0625 C per LSB */
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SCALE:
+        *val = 62;                  /* 62.5 milli-degrees C per LSB */
+        *val2 = 500000;
+        return IIO_VAL_INT_PLUS_MICRO;
+    case IIO_CHAN_INFO_OFFSET:
+        *val = 0;                   /* Two's complement, no offset */
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SAMP_FREQ:
+        uhz = 1000000000U / READ_ONCE(ds18b20_device.period_ms);
+        *val = uhz / 1000000;
+        *val2 = uhz % 1000000;
+        return IIO_VAL_INT_PLUS_MICRO;
+    default:
+        return -EINVAL;
+    }
+}
+
+static int ds18b20_write_raw(struct iio_dev *indio_dev,
+                             struct iio_chan_spec const *chan,
+                             int val, int val2, long mask)
+{
+    u64 uhz;
+    u32 period;
+
+    if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+        return -EINVAL;
+
+    if (val < 0 || val2 < 0 || (val == 0 && val2 == 0))
+        return -EINVAL;
+    uhz = (u64)val * 1000000 + val2;
+    period = div64_u64(1000000000ULL, uhz);
+    if (period < DS18B20_MIN_PERIOD_MS)
+        return -EINVAL;
+
+    /* Takes effect from the next cycle */
+    WRITE_ONCE(ds18b20_device.period_ms, period);
+    return 0;
+}
+
+static const struct iio_info ds18b20_iio_info = {
+    .read_raw = ds18b20_read_raw,
+    .write_raw = ds18b20_write_raw,
+};
+
+static const struct iio_trigger_ops ds18b20_trigger_ops = {
+    .validate_device = iio_trigger_validate_own_device,
+};
+
+/*
+ * @description : Enumerate the DS18B20 probes on the bus
+ * @param - dev : device
+ * @return      : number of probes, negative on error
+ */
+static int ds18b20_scan(struct device *dev)
+{
+    u8 roms[DS18B20_MAX_PROBES][8];
+    int i, n;
+
+    n = w1_engine_search(&ds18b20_device.w1, roms, DS18B20_MAX_PROBES);
+    if (n < 0)
+        return n;
+
+    ds18b20_device.nprobes = 0;
+    for (i = 0; i < n; i++) {
+        if (roms[i][0] != DS18B20_FAMILY)   /* Other 1-Wire devices on the bus */
+            continue;
+        memset(&ds18b20_device.probes[ds18b20_device.nprobes], 0, sizeof(struct ds18b20_probe));
+        memcpy(ds18b20_device.probes[ds18b20_device.nprobes].rom, roms[i], 8);
+        dev_info(dev, "probe %d: %8phN\n", ds18b20_device.nprobes, roms[i]);
+        ds18b20_device.nprobes++;
+    }
+    return ds18b20_device.nprobes;
+}
+
+/*
+ * One IIO temperature channel per probe, named after its ROM code, plus
+ * the timestamp. Every cycle carries all probes, the core picks out what
+ * is enabled.
+ */
+static int ds18b20_register_iio(struct platform_device *pdev)
+{
+    int n = ds18b20_device.nprobes;
+    struct iio_dev *indio_dev;
+    struct iio_chan_spec *chans;
+    unsigned long *masks;
+    int i, ret;
+
+    indio_dev = devm_iio_device_alloc(&pdev->dev, 0);
+    chans = devm_kcalloc(&pdev->dev, n + 1, sizeof(*chans), GFP_KERNEL);
+    masks = devm_kcalloc(&pdev->dev, 2, sizeof(*masks), GFP_KERNEL);
+    if (!indio_dev || !chans || !masks)
+        return -ENOMEM;
+
+    for (i = 0; i < n; i++) {
+        chans[i].type = IIO_TEMP;
+        chans[i].indexed = 1;
+        chans[i].channel = i;
+        chans[i].info_mask_separate = BIT(IIO_CHAN_INFO_PROCESSED) | BIT(IIO_CHAN_INFO_RAW);
+        chans[i].info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE) |
+                                            BIT(IIO_CHAN_INFO_OFFSET);
+        chans[i].info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ);
+        chans[i].scan_index = i;
+        chans[i].scan_type.sign = 's';
+        chans[i].scan_type.realbits = 16;
+        chans[i].scan_type.storagebits = 16;
+        chans[i].scan_type.endianness = IIO_CPU;
+        chans[i].extend_name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%8phN",
+                                              ds18b20_device.probes[i].rom);
+        if (!chans[i].extend_name)
+            return -ENOMEM;
+    }
+    chans[n] = (struct iio_chan_spec)IIO_CHAN_SOFT_TIMESTAMP(n);
+    masks[0] = GENMASK(n - 1, 0);
+
+    indio_dev->dev.parent = &pdev->dev;
+    indio_dev->info = &ds18b20_iio_info;
+    indio_dev->name = "ds18b20";
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    indio_dev->channels = chans;
+    indio_dev->num_channels = n + 1;
+    indio_dev->available_scan_masks = masks;
+    ds18b20_device.indio_dev = indio_dev;
+
+    ret = devm_iio_triggered_buffer_setup(&pdev->dev, indio_dev, NULL,
+                                          ds18b20_trigger_handler, &ds18b20_buffer_ops);
+    if (ret)
+        return ret;
+
+    /* Data-ready trigger, fired at the end of every cycle */
+    ds18b20_device.trig = devm_iio_trigger_alloc(&pdev->dev, "%s-dev%d",
+                                                 indio_dev->name, indio_dev->id);
+    if (!ds18b20_device.trig)
+        return -ENOMEM;
+    ds18b20_device.trig->dev.parent = &pdev->dev;
+    ds18b20_device.trig->ops = &ds18b20_trigger_ops;
+    iio_trigger_set_drvdata(ds18b20_device.trig, indio_dev);
+    ret = devm_iio_trigger_register(&pdev->dev, ds18b20_device.trig);
+    if (ret)
+        return ret;
+    indio_dev->trig = iio_trigger_get(ds18b20_device.trig);
+
+    return devm_iio_device_register(&pdev->dev, indio_dev);
 }
 
 /* Request GPIO for DS18B20 */
@@ -181,7 +690,7 @@ static int ds18b20_request_gpio(struct platform_device *pdev)
 {
     struct device *dev = &pdev->dev;
     int ret;
-    
+
     ds18b20_device.gpio = of_get_named_gpio(dev->of_node, "ds18b20-gpio", 0);
     if (!gpio_is_valid(ds18b20_device.gpio)) {
         dev_err(dev, "Failed to get gpio");
@@ -197,15 +706,50 @@ static int ds18b20_request_gpio(struct platform_device *pdev)
     return 0;
 }
 
+/* devm action: the engine's timer outlives everything that can start a transfer */
+static void ds18b20_w1_cleanup(void *data)
+{
+    w1_engine_cleanup(data);
+}
+
 /* Probe function for DS18B20 driver */
 static int ds18b20_probe(struct platform_device *pdev)
 {
+    struct w1_bus_pdata *pdata = dev_get_platdata(&pdev->dev);
     struct miscdevice *mdev;
     int ret;
 
     dev_info(&pdev->dev, "ds18b20 device and driver matched successfully!\n");
-    
-    ret = ds18b20_request_gpio(pdev);
+
+    /* A simulated bus (w1_sim.ko) comes with its own bus operations */
+    if (pdata) {
+        w1_engine_init(&ds18b20_device.w1, pdata->ops, pdata->priv);
+    } else {
+        ret = ds18b20_request_gpio(pdev);
+        if (ret)
+            return ret;
+        w1_engine_init(&ds18b20_device.w1, &ds18b20_gpio_ops, NULL);
+    }
+    /* Registered before the IIO device, so devm cleans it up after unregistering that */
+    ret = devm_add_action_or_reset(&pdev->dev, ds18b20_w1_cleanup, &ds18b20_device.w1);
+    if (ret)
+        return ret;
+    spin_lock_init(&ds18b20_device.lock);
+    mutex_init(&ds18b20_device.cycle_lock);
+    INIT_DELAYED_WORK(&ds18b20_device.work, ds18b20_work_callback);
+    ds18b20_device.period_ms = DS18B20_PERIOD_MS;
+    ds18b20_device.sampled = false;
+    ds18b20_device.conversions = 0;
+    ds18b20_device.errors = 0;
+    ds18b20_device.stats_since = ktime_get();
+
+    ret = ds18b20_scan(&pdev->dev);
+    if (ret <= 0) {
+        dev_err(&pdev->dev, "No DS18B20 on the bus\n");
+        return ret ? ret : -ENODEV;
+    }
+
+    ret = ds18b20_register_iio(pdev);
     if (ret)
         return ret;
 
@@ -214,13 +758,14 @@ static int ds18b20_probe(struct platform_device *pdev)
     mdev->minor = MISC_DYNAMIC_MINOR;
     mdev->fops = &ds18b20_fops;
 
-    timer_setup(&ds18b20_device.timer, ds18b20_timer_callback, 0);
-    ds18b20_device.timer.expires = jiffies + msecs_to_jiffies(1000);
-    add_timer(&ds18b20_device.timer);
-
-    INIT_WORK(&ds18b20_device.work, ds18b20_work_callback);
+    ret = device_create_file(&pdev->dev, &dev_attr_stats);
+    if (ret)
+        return ret;
 
-    return misc_register(mdev);
+    ret = misc_register(mdev);
+    if (ret)
+        device_remove_file(&pdev->dev, &dev_attr_stats);
+    return ret;
 }
 
 /* Remove function for DS18B20 driver */
@@ -229,8 +774,8 @@ static int ds18b20_remove(struct platform_device *pdev)
     dev_info(&pdev->dev, "DS18B20 driver has been removed!\n");
 
     misc_deregister(&ds18b20_device.mdev);
-    del_timer(&ds18b20_device.timer);
-    cancel_work_sync(&ds18b20_device.work);
+    cancel_delayed_work_sync(&ds18b20_device.work);
+    device_remove_file(&pdev->dev, &dev_attr_stats);
     return 0;
 }
 
@@ -245,6 +790,7 @@ static struct platform_driver ds18b20_driver = {
     .driver = {
         .name           = "ds18b20",
         .of_match_table = ds18b20_of_match,
+        .probe_type     = PROBE_PREFER_ASYNCHRONOUS,
     },
     .probe      = ds18b20_probe,
     .remove     = ds18b20_remove,
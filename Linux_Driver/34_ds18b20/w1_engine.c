@@ -0,0 +1,404 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include "w1_engine.h"
+
+/*
+ * 1-Wire master engine, see w1_engine.h.
+ *
+ * A transfer is started from process context and then runs entirely in the
+ * hrtimer callback, one step per expiry; the caller sleeps on a completion.
+ * Timings in us, standard speed, each one counted from the edge the step
+ * before actually drove (or the presence sample it took), not from that
+ * step's expiry: a late timer then only makes a low time or a wait longer,
+ * never shorter. Recovery between slots has no upper bound on 1-Wire, so
+ * that only stretches the transfer. A write-0 pulse stretched past 120 us
+ * is still read as 0 (slaves sample 15..60 us after the falling edge) as
+ * long as it stays far below the 480 us reset pulse.
+ */
+
+#define W1_T_RSTL       480             /* Reset pulse */
+#define W1_T_MSP        65              /* Release to presence sample */
+#define W1_T_RSTH       415             /* Rest of the presence window */
+#define W1_T_SLOT       60              /* Write-0 low time, minimum slot */
+#define W1_T_PULSE      2               /* Write-1 and read slot pull-down */
+#define W1_T_RDV        8               /* Release to read sample, < 15 us after the falling edge */
+#define W1_T_REC        5               /* Recovery between slots */
+#define W1_T_SLOT_REC   (W1_T_SLOT + W1_T_REC)  /* Falling edge to the next slot */
+#define W1_RESET_TRIES  3               /* Presence can be missed if the timer runs late */
+
+enum {
+    W1_IDLE,
+    W1_RST_RELEASE,                     /* End of the reset pulse */
+    W1_RST_SAMPLE,                      /* Presence sample */
+    W1_RST_DONE,                        /* End of the presence window */
+    W1_SLOT,                            /* Start of the next slot */
+    W1_SLOT_RELEASE,                    /* End of a write-0 pulse */
+};
+
+/* Tell a checking bus model which bit the slot about to start carries */
+static void w1_engine_intent(struct w1_engine *e, int bit)
+{
+    if (e->ops->slot)
+        e->ops->slot(e->priv, bit);
+}
+
+/* Read slot: short pull-down, sample before 15 us */
+static u64 w1_engine_read_slot(struct w1_engine *e, u8 *buf, int i)
+{
+    w1_engine_intent(e, 1);
+    e->ops->drive_low(e->priv);
+    udelay(W1_T_PULSE);
+    e->ops->release(e->priv);
+    udelay(W1_T_RDV);
+    if (e->ops->sample(e->priv))
+        buf[i / 8] |= BIT(i % 8);
+    else
+        buf[i / 8] &= ~BIT(i % 8);
+    return W1_T_SLOT_REC * NSEC_PER_USEC;
+}
+
+static u64 w1_engine_write_slot(struct w1_engine *e, int bit)
+{
+    w1_engine_intent(e, bit);
+    e->ops->drive_low(e->priv);
+    if (bit) {
+        udelay(W1_T_PULSE);
+        e->ops->release(e->priv);
+        return W1_T_SLOT_REC * NSEC_PER_USEC;
+    }
+
+    /* Write 0: hold the bus low for the whole slot, release from the timer */
+    e->state = W1_SLOT_RELEASE;
+    return W1_T_SLOT * NSEC_PER_USEC;
+}
+
+/*
+ * Search triplet, third slot: follow the slaves' bit when they agree,
+ * e->dir on a discrepancy (both read 0) or when nobody answered.
+ */
+static int w1_engine_triplet_dir(struct w1_engine *e)
+{
+    int id = e->tbits & 1, comp = (e->tbits >> 1) & 1;
+    int dir = (id != comp) ? id : e->dir;
+
+    if (dir)
+        e->tbits |= BIT(2);
+    return dir;
+}
+
+/*
+ * Start one slot. Returns the time from its falling edge to the next timer
+ * step.
+ */
+static u64 w1_engine_slot(struct w1_engine *e)
+{
+    int i = e->bit++;
+
+    e->st.slots++;
+    if (e->triplet) {
+        if (i < 2)
+            return w1_engine_read_slot(e, &e->tbits, i);
+        return w1_engine_write_slot(e, w1_engine_triplet_dir(e));
+    }
+    if (e->rbuf)
+        return w1_engine_read_slot(e, e->rbuf, i);
+    return w1_engine_write_slot(e, e->wbuf[i / 8] & BIT(i % 8));
+}
+
+static enum hrtimer_restart w1_engine_timer(struct hrtimer *timer)
+{
+    struct w1_engine *e = container_of(timer, struct w1_engine, timer);
+    ktime_t t0 = ktime_get(), edge;
+    u64 next = 0, dt;
+
+    spin_lock(&e->st_lock);
+    /* Every step starts with the edge or sample the next one is timed from */
+    edge = ktime_get();
+    switch (e->state) {
+    case W1_RST_RELEASE:
+        e->ops->release(e->priv);
+        e->state = W1_RST_SAMPLE;
+        next = W1_T_MSP * NSEC_PER_USEC;
+        break;
+    case W1_RST_SAMPLE:
+        e->presence = !e->ops->sample(e->priv);
+        e->state = W1_RST_DONE;
+        next = W1_T_RSTH * NSEC_PER_USEC;
+        break;
+    case W1_SLOT_RELEASE:
+        e->ops->release(e->priv);
+        e->state = W1_SLOT;
+        next = W1_T_REC * NSEC_PER_USEC;
+        break;
+    case W1_SLOT:
+        if (e->bit < e->nbits) {
+            next = w1_engine_slot(e);
+            break;
+        }
+        /* fall through */
+    default:
+        e->state = W1_IDLE;
+        break;
+    }
+
+    dt = ktime_to_ns(ktime_sub(ktime_get(), t0));
+    e->st.cpu_ns += dt;
+    if (dt > e->st.irqoff_max_ns)
+        e->st.irqoff_max_ns = dt;
+    spin_unlock(&e->st_lock);
+
+    if (!next) {
+        complete(&e->done);
+        return HRTIMER_NORESTART;
+    }
+    /*
+     * From the edge, not hrtimer_forward_now(): that counts from this
+     * expiry, so a step that ran late would shorten the next low time
+     * or wait by the same amount.
+     */
+    hrtimer_set_expires(timer, ktime_add_ns(edge, next));
+    return HRTIMER_RESTART;
+}
+
+/*
+ * Run the steps queued in e->state from the timer and sleep until done.
+ */
+static void w1_engine_run(struct w1_engine *e, u64 first_ns)
+{
+    reinit_completion(&e->done);
+    hrtimer_start(&e->timer, ns_to_ktime(first_ns), HRTIMER_MODE_REL);
+    wait_for_completion(&e->done);
+}
+
+/*
+ * @description : Reset pulse and presence detect
+ * @param - e   : engine
+ * @return      : 0 if a slave answered, -ENODEV otherwise
+ */
+int w1_engine_reset(struct w1_engine *e)
+{
+    int tries;
+
+    mutex_lock(&e->lock);
+    for (tries = 0; tries < W1_RESET_TRIES; tries++) {
+        spin_lock_irq(&e->st_lock);
+        e->st.resets++;
+        e->presence = 0;
+        e->state = W1_RST_RELEASE;
+        e->ops->drive_low(e->priv);
+        spin_unlock_irq(&e->st_lock);
+
+        w1_engine_run(e, W1_T_RSTL * NSEC_PER_USEC);
+        if (e->presence)
+            break;
+    }
+    mutex_unlock(&e->lock);
+
+    return e->presence ? 0 : -ENODEV;
+}
+EXPORT_SYMBOL_GPL(w1_engine_reset);
+
+static int w1_engine_xfer(struct w1_engine *e, const u8 *wbuf, u8 *rbuf, int nbits)
+{
+    if (nbits <= 0)
+        return 0;
+
+    mutex_lock(&e->lock);
+    e->wbuf = wbuf;
+    e->rbuf = rbuf;
+    e->nbits = nbits;
+    e->bit = 0;
+    e->state = W1_SLOT;
+    w1_engine_run(e, 0);
+    e->wbuf = NULL;
+    e->rbuf = NULL;
+    mutex_unlock(&e->lock);
+
+    return 0;
+}
+
+/*
+ * @description : Write bits, LSB of buf[0] first
+ * @param - e   : engine
+ * @param - buf : data
+ * @param - nbits : number of bits
+ * @return      : 0
+ */
+int w1_engine_write(struct w1_engine *e, const u8 *buf, int nbits)
+{
+    return w1_engine_xfer(e, buf, NULL, nbits);
+}
+EXPORT_SYMBOL_GPL(w1_engine_write);
+
+/*
+ * @description : Read bits into buf, LSB of buf[0] first
+ * @param - e   : engine
+ * @param - buf : data
+ * @param - nbits : number of bits
+ * @return      : 0
+ */
+int w1_engine_read(struct w1_engine *e, u8 *buf, int nbits)
+{
+    return w1_engine_xfer(e, NULL, buf, nbits);
+}
+EXPORT_SYMBOL_GPL(w1_engine_read);
+
+/*
+ * @description : Search ROM triplet: read a ROM bit and its complement from
+ *                all slaves, then write the direction to follow, in one go
+ * @param - e   : engine
+ * @param - dir : direction to take if the slaves disagree
+ * @return      : bit 0 id bit, bit 1 complement, bit 2 direction taken
+ */
+int w1_engine_triplet(struct w1_engine *e, int dir)
+{
+    int ret;
+
+    mutex_lock(&e->lock);
+    e->triplet = true;
+    e->tbits = 0;
+    e->dir = dir;
+    e->nbits = 3;
+    e->bit = 0;
+    e->state = W1_SLOT;
+    w1_engine_run(e, 0);
+    e->triplet = false;
+    ret = e->tbits;
+    mutex_unlock(&e->lock);
+
+    return ret;
+}
+EXPORT_SYMBOL_GPL(w1_engine_triplet);
+
+/*
+ * @description : Enumerate the slaves on the bus with Search ROM (0xF0),
+ *                one pass of 64 triplets per device, ROMs with a bad CRC
+ *                are dropped
+ * @param - e   : engine
+ * @param - roms : ROM codes found, family code first
+ * @param - max : size of roms
+ * @return      : number of ROM codes found, negative on error
+ */
+int w1_engine_search(struct w1_engine *e, u8 (*roms)[8], int max)
+{
+    static const u8 search = 0xF0;
+    u8 rom[8] = { 0 };
+    int desc = 64, last_zero, i, n = 0, tries = 0;
+    int ret;
+
+    while (n < max) {
+        ret = w1_engine_reset(e);
+        if (ret)
+            return n ? n : ret;
+        w1_engine_write(e, &search, 8);
+
+        last_zero = -1;
+        for (i = 0; i < 64; i++) {
+            int dir, t;
+
+            if (i == desc)
+                dir = 1;                /* Take the 1 branch at the last discrepancy */
+            else if (i > desc)
+                dir = 0;
+            else
+                dir = (rom[i / 8] >> (i % 8)) & 1;
+
+            t = w1_engine_triplet(e, dir);
+            if ((t & 3) == 3)           /* Nobody answered */
+                return n;
+            if ((t & 3) == 0 && !(t & 4))
+                last_zero = i;
+            if (t & 4)
+                rom[i / 8] |= BIT(i % 8);
+            else
+                rom[i / 8] &= ~BIT(i % 8);
+        }
+
+        if (w1_crc8(rom, 8) == 0) {
+            memcpy(roms[n++], rom, 8);
+        } else if (++tries < W1_RESET_TRIES) {
+            continue;                   /* Noise on the bus, redo the same branch */
+        }
+        tries = 0;
+
+        desc = last_zero;
+        if (desc < 0)
+            break;                      /* No discrepancy left, that was the last one */
+    }
+    return n;
+}
+EXPORT_SYMBOL_GPL(w1_engine_search);
+
+/* Account bus time spent outside the engine, e.g. by a bit-banging fallback */
+void w1_engine_account(struct w1_engine *e, u64 cpu_ns, u64 irqoff_ns)
+{
+    spin_lock_irq(&e->st_lock);
+    e->st.cpu_ns += cpu_ns;
+    if (irqoff_ns > e->st.irqoff_max_ns)
+        e->st.irqoff_max_ns = irqoff_ns;
+    spin_unlock_irq(&e->st_lock);
+}
+EXPORT_SYMBOL_GPL(w1_engine_account);
+
+void w1_engine_get_stats(struct w1_engine *e, struct w1_stats *st)
+{
+    spin_lock_irq(&e->st_lock);
+    *st = e->st;
+    spin_unlock_irq(&e->st_lock);
+}
+EXPORT_SYMBOL_GPL(w1_engine_get_stats);
+
+void w1_engine_clear_stats(struct w1_engine *e)
+{
+    spin_lock_irq(&e->st_lock);
+    memset(&e->st, 0, sizeof(e->st));
+    spin_unlock_irq(&e->st_lock);
+}
+EXPORT_SYMBOL_GPL(w1_engine_clear_stats);
+
+/*
+ * @description : Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1), as used by the ROM
+ *                code and the scratchpad; over data + its CRC byte it is 0
+ * @param - data : data
+ * @param - len : length
+ * @return      : CRC
+ */
+u8 w1_crc8(const u8 *data, int len)
+{
+    u8 crc = 0;
+    int i, j;
+
+    for (i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+}
+EXPORT_SYMBOL_GPL(w1_crc8);
+
+void w1_engine_init(struct w1_engine *e, const struct w1_bus_ops *ops, void *priv)
+{
+    memset(e, 0, sizeof(*e));
+    e->ops = ops;
+    e->priv = priv;
+    mutex_init(&e->lock);
+    spin_lock_init(&e->st_lock);
+    init_completion(&e->done);
+    hrtimer_init(&e->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    e->timer.function = w1_engine_timer;
+    e->ops->release(e->priv);
+}
+EXPORT_SYMBOL_GPL(w1_engine_init);
+
+void w1_engine_cleanup(struct w1_engine *e)
+{
+    hrtimer_cancel(&e->timer);
+}
+EXPORT_SYMBOL_GPL(w1_engine_cleanup);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
@@ -0,0 +1,74 @@
+#ifndef W1_ENGINE_H
+#define W1_ENGINE_H
+
+#include <linux/types.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+
+/*
+ * Interrupt-driven 1-Wire master, implemented in w1_engine.ko.
+ *
+ * Every time slot is scheduled from an hrtimer, so the CPU only touches the
+ * bus (in the timer callback, interrupts off) around the edges themselves.
+ * The only busy-waits left are the windows the protocol itself keeps below
+ * 15 us: the write-1 pulse and the read slot's pull-down + sample. Between
+ * slots the CPU is free.
+ *
+ * The bus goes through struct w1_bus_ops, so the same engine drives a GPIO
+ * or the simulated slave in w1_sim.ko.
+ */
+
+struct w1_bus_ops {
+    void (*drive_low)(void *priv);      /* Pull the bus low */
+    void (*release)(void *priv);        /* Let the pull-up take the bus high */
+    int (*sample)(void *priv);          /* Bus level, 0 or 1 */
+    void (*slot)(void *priv, int bit);  /* Optional: the bit the next slot carries, 1 for reads */
+};
+
+/* platform_data of a "ds18b20" device that has no GPIO, e.g. from w1_sim.ko */
+struct w1_bus_pdata {
+    const struct w1_bus_ops *ops;
+    void *priv;
+};
+
+struct w1_stats {
+    u64 slots;                          /* Read and write time slots */
+    u64 resets;                         /* Reset/presence sequences */
+    u64 cpu_ns;                         /* CPU time spent driving the bus */
+    u64 irqoff_max_ns;                  /* Longest stretch with interrupts off */
+};
+
+struct w1_engine {
+    const struct w1_bus_ops *ops;
+    void *priv;
+    struct hrtimer timer;
+    struct completion done;
+    struct mutex lock;                  /* One transfer at a time */
+    int state;
+    const u8 *wbuf;                     /* Transfer in flight: write, read or triplet */
+    u8 *rbuf;
+    bool triplet;
+    u8 tbits;                           /* Triplet: id bit, complement, direction taken */
+    int dir;                            /* Triplet: direction on a discrepancy */
+    int nbits;
+    int bit;
+    int presence;
+    spinlock_t st_lock;                 /* Stats, updated from the timer */
+    struct w1_stats st;
+};
+
+void w1_engine_init(struct w1_engine *e, const struct w1_bus_ops *ops, void *priv);
+void w1_engine_cleanup(struct w1_engine *e);
+int w1_engine_reset(struct w1_engine *e);
+int w1_engine_write(struct w1_engine *e, const u8 *buf, int nbits);
+int w1_engine_read(struct w1_engine *e, u8 *buf, int nbits);
+int w1_engine_triplet(struct w1_engine *e, int dir);
+int w1_engine_search(struct w1_engine *e, u8 (*roms)[8], int max);
+void w1_engine_account(struct w1_engine *e, u64 cpu_ns, u64 irqoff_ns);
+void w1_engine_get_stats(struct w1_engine *e, struct w1_stats *st);
+void w1_engine_clear_stats(struct w1_engine *e);
+u8 w1_crc8(const u8 *data, int len);
+
+#endif
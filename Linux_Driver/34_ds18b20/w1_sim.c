@@ -0,0 +1,416 @@
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include "w1_engine.h"
+
+/*
+ * Simulated DS18B20 probes on a simulated 1-Wire bus.
+ *
+ * Registers a "ds18b20" platform device whose platform_data carries bus
+ * operations instead of a GPIO, so ds18b20.ko drives this model with the
+ * same engine (or bit-banging code) it uses on the real pin. Every slave
+ * decodes the master's pulses from their timestamps the way the chip does;
+ * the bus reads as the wired-AND of all slaves. Pulses or samples outside
+ * the datasheet windows are counted in /sys/kernel/debug/w1_sim/violations:
+ *   reset       : low >= 480 us, presence pulse 20..140 us after release
+ *   write 1 / 0 : low < 15 us / 60..120 us (longer lows up to the reset
+ *                 threshold are still read as 0). The engine also says
+ *                 which bit it meant, so a write 0 released early enough
+ *                 to decode as a 1 still counts
+ *   read        : pull-down < 15 us, master samples within 15 us of the
+ *                 falling edge; a 0 is held for 30 us
+ * Supported commands: Search ROM, Read ROM, Match ROM, Skip ROM, Convert T,
+ * Read Scratchpad.
+ *
+ * Probe i reports temp_mc + i * 250 m°C; corrupt_every=N flips a bit in
+ * every Nth scratchpad read to exercise the driver's CRC check.
+ */
+
+#define W1_SIM_MAX          32
+#define W1_SIM_RSTL         480
+#define W1_SIM_PDH          20          /* Release to presence pulse */
+#define W1_SIM_PDL          120         /* Presence pulse length */
+#define W1_SIM_T1_MAX       15
+#define W1_SIM_T0_MIN       60
+#define W1_SIM_T0_MAX       120
+#define W1_SIM_RD_HOLD      30          /* How long a slave holds a 0 */
+
+static unsigned int count = 1;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Number of probes on the bus, 1..32");
+
+static int temp_mc = 25000;
+module_param(temp_mc, int, 0644);
+MODULE_PARM_DESC(temp_mc, "Temperature of probe 0 at the next conversion, milli-degrees C");
+
+static unsigned int conv_ms = 750;
+module_param(conv_ms, uint, 0644);
+MODULE_PARM_DESC(conv_ms, "Conversion time");
+
+static unsigned int corrupt_every;
+module_param(corrupt_every, uint, 0644);
+MODULE_PARM_DESC(corrupt_every, "Corrupt every Nth scratchpad read, 0 = never");
+
+enum {
+    W1_SIM_IDLE,                        /* Deselected, waiting for a reset */
+    W1_SIM_ROM,                         /* Receiving a ROM command */
+    W1_SIM_MATCH,                       /* Receiving a ROM code after Match ROM */
+    W1_SIM_SEARCH,                      /* Search ROM in progress */
+    W1_SIM_FUNC,                        /* Receiving a function command */
+    W1_SIM_TX,                          /* Sending tx[] */
+    W1_SIM_CONV,                        /* Converting, read slots poll the busy bit */
+};
+
+struct w1_sim_slave {
+    int index;
+    int mode;
+    u8 rx[8];                           /* Command byte or ROM code being received */
+    int rx_bits;
+    u8 tx[9];
+    int tx_len;                         /* Bits */
+    int tx_bit;
+    int search_bit;                     /* ROM bit under search */
+    int search_phase;                   /* 0 send bit, 1 send complement, 2 receive direction */
+    int slot_bit;                       /* What the slave drives in this read slot */
+    ktime_t conv_done;
+    u8 rom[8];
+    u8 scratch[9];
+};
+
+struct w1_sim_dev {
+    struct platform_device *pdev;
+    struct dentry *dir;
+    spinlock_t lock;
+    bool low;                           /* Master holds the bus low */
+    ktime_t t_fall;                     /* Last falling edge */
+    ktime_t t_reset;                    /* End of the last reset pulse */
+    bool in_reset;                      /* Presence window of t_reset still open */
+    int intent;                         /* Bit the master meant for this slot, -1 if not told */
+    struct w1_sim_slave slaves[W1_SIM_MAX];
+    u32 violations;
+    u32 reads;                          /* Scratchpad reads */
+};
+
+static struct w1_sim_dev w1_sim;
+
+static s64 w1_sim_us(ktime_t since)
+{
+    return ktime_us_delta(ktime_get(), since);
+}
+
+static int w1_sim_rom_bit(struct w1_sim_slave *s, int i)
+{
+    return (s->rom[i / 8] >> (i % 8)) & 1;
+}
+
+static void w1_sim_send(struct w1_sim_slave *s, const u8 *buf, int len)
+{
+    memcpy(s->tx, buf, len);
+    s->tx_len = len * 8;
+    s->tx_bit = 0;
+    s->mode = W1_SIM_TX;
+}
+
+static void w1_sim_receive(struct w1_sim_slave *s, int mode)
+{
+    memset(s->rx, 0, sizeof(s->rx));
+    s->rx_bits = 0;
+    s->mode = mode;
+}
+
+/* Latch the probe's temperature into the scratchpad, 12-bit resolution */
+static void w1_sim_convert(struct w1_sim_slave *s)
+{
+    s16 raw = (temp_mc + s->index * 250) * 16 / 1000;
+
+    s->scratch[0] = raw & 0xff;
+    s->scratch[1] = (raw >> 8) & 0xff;
+    s->scratch[8] = w1_crc8(s->scratch, 8);
+    s->conv_done = ktime_add_ms(ktime_get(), conv_ms);
+    s->mode = W1_SIM_CONV;
+}
+
+static void w1_sim_read_scratch(struct w1_sim_dev *sim, struct w1_sim_slave *s)
+{
+    w1_sim_send(s, s->scratch, sizeof(s->scratch));
+    if (corrupt_every && ++sim->reads % corrupt_every == 0)
+        s->tx[1] ^= 0x04;
+}
+
+/* A complete command byte (rx_bits == 8) or ROM code (64) was received */
+static void w1_sim_command(struct w1_sim_dev *sim, struct w1_sim_slave *s)
+{
+    u8 cmd = s->rx[0];
+
+    if (s->mode == W1_SIM_MATCH) {
+        if (memcmp(s->rx, s->rom, sizeof(s->rom)))
+            s->mode = W1_SIM_IDLE;
+        else
+            w1_sim_receive(s, W1_SIM_FUNC);
+        return;
+    }
+
+    if (s->mode == W1_SIM_ROM) {
+        switch (cmd) {
+        case 0xCC:                      /* Skip ROM */
+            w1_sim_receive(s, W1_SIM_FUNC);
+            break;
+        case 0x55:                      /* Match ROM */
+            w1_sim_receive(s, W1_SIM_MATCH);
+            break;
+        case 0x33:                      /* Read ROM */
+            w1_sim_send(s, s->rom, sizeof(s->rom));
+            break;
+        case 0xF0:                      /* Search ROM */
+            s->mode = W1_SIM_SEARCH;
+            s->search_bit = 0;
+            s->search_phase = 0;
+            break;
+        default:
+            s->mode = W1_SIM_IDLE;
+            break;
+        }
+        return;
+    }
+
+    switch (cmd) {
+    case 0x44:                          /* Convert T */
+        w1_sim_convert(s);
+        break;
+    case 0xBE:                          /* Read Scratchpad */
+        w1_sim_read_scratch(sim, s);
+        break;
+    default:
+        s->mode = W1_SIM_IDLE;
+        break;
+    }
+}
+
+/* A falling edge starts a slot; a sending slave decides its bit now */
+static void w1_sim_slot_start(struct w1_sim_slave *s)
+{
+    s->slot_bit = 1;
+    switch (s->mode) {
+    case W1_SIM_TX:
+        if (s->tx_bit < s->tx_len) {
+            s->slot_bit = (s->tx[s->tx_bit / 8] >> (s->tx_bit % 8)) & 1;
+            s->tx_bit++;
+        }
+        break;
+    case W1_SIM_CONV:
+        s->slot_bit = ktime_after(ktime_get(), s->conv_done);
+        break;
+    case W1_SIM_SEARCH:
+        if (s->search_phase == 0)
+            s->slot_bit = w1_sim_rom_bit(s, s->search_bit);
+        else if (s->search_phase == 1)
+            s->slot_bit = !w1_sim_rom_bit(s, s->search_bit);
+        break;
+    default:
+        break;
+    }
+}
+
+/* End of a slot that the master wrote bit into */
+static void w1_sim_slot_end(struct w1_sim_dev *sim, struct w1_sim_slave *s, int bit)
+{
+    switch (s->mode) {
+    case W1_SIM_ROM:
+    case W1_SIM_FUNC:
+    case W1_SIM_MATCH:
+        s->rx[s->rx_bits / 8] |= bit << (s->rx_bits % 8);
+        s->rx_bits++;
+        if (s->rx_bits == (s->mode == W1_SIM_MATCH ? 64 : 8))
+            w1_sim_command(sim, s);
+        break;
+    case W1_SIM_SEARCH:
+        if (s->search_phase < 2) {
+            s->search_phase++;
+            break;
+        }
+        /* Slaves whose bit is not the direction taken drop out */
+        if (bit != w1_sim_rom_bit(s, s->search_bit))
+            s->mode = W1_SIM_IDLE;
+        else if (++s->search_bit == 64)
+            s->mode = W1_SIM_FUNC;
+        s->search_phase = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static void w1_sim_low(void *priv)
+{
+    struct w1_sim_dev *sim = priv;
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    if (!sim->low) {
+        sim->low = true;
+        sim->t_fall = ktime_get();
+        sim->in_reset = false;
+        for (i = 0; i < count; i++)
+            w1_sim_slot_start(&sim->slaves[i]);
+    }
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static void w1_sim_release(void *priv)
+{
+    struct w1_sim_dev *sim = priv;
+    unsigned long flags;
+    s64 us;
+    int i;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    if (!sim->low)
+        goto out;
+    sim->low = false;
+    us = w1_sim_us(sim->t_fall);
+
+    if (us >= W1_SIM_RSTL) {
+        if (sim->intent >= 0)           /* A slot held low into a reset */
+            sim->violations++;
+        sim->intent = -1;
+        sim->t_reset = ktime_get();
+        sim->in_reset = true;
+        for (i = 0; i < count; i++)
+            w1_sim_receive(&sim->slaves[i], W1_SIM_ROM);
+        goto out;
+    }
+
+    /* Short: write 1 or read slot. Long: write 0. Anything else is out of spec */
+    if (us >= W1_SIM_T1_MAX && (us < W1_SIM_T0_MIN || us > W1_SIM_T0_MAX))
+        sim->violations++;
+    else if (sim->intent == 0 && us < W1_SIM_T0_MIN)
+        sim->violations++;              /* Write 0 too short, read as 1 */
+    else if (sim->intent == 1 && us >= W1_SIM_T1_MAX)
+        sim->violations++;              /* Write 1 or read slot too long, read as 0 */
+    sim->intent = -1;
+    for (i = 0; i < count; i++)
+        w1_sim_slot_end(sim, &sim->slaves[i], us < W1_SIM_T1_MAX);
+out:
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static int w1_sim_sample(void *priv)
+{
+    struct w1_sim_dev *sim = priv;
+    unsigned long flags;
+    int level = 1, i;
+    bool driven = false;
+    s64 us;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    if (sim->low) {
+        level = 0;
+    } else if (sim->in_reset) {
+        us = w1_sim_us(sim->t_reset);
+        if (us >= W1_SIM_PDH && us < W1_SIM_PDH + W1_SIM_PDL)
+            level = 0;
+        else if (us < W1_SIM_RSTL)      /* Master sampled outside the presence pulse */
+            sim->violations++;
+    } else {
+        for (i = 0; i < count; i++)
+            if (sim->slaves[i].slot_bit == 0)
+                driven = true;
+        if (driven) {
+            us = w1_sim_us(sim->t_fall);
+            if (us > W1_SIM_T1_MAX)
+                sim->violations++;
+            if (us < W1_SIM_RD_HOLD)
+                level = 0;
+        }
+    }
+    spin_unlock_irqrestore(&sim->lock, flags);
+    return level;
+}
+
+static void w1_sim_slot(void *priv, int bit)
+{
+    struct w1_sim_dev *sim = priv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    sim->intent = bit;
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static const struct w1_bus_ops w1_sim_ops = {
+    .drive_low  = w1_sim_low,
+    .release    = w1_sim_release,
+    .sample     = w1_sim_sample,
+    .slot       = w1_sim_slot,
+};
+
+static void w1_sim_slave_init(struct w1_sim_slave *s, int index)
+{
+    /* Serial numbers that share prefixes, so the search has to branch */
+    static const u8 serial[6] = { 0x53, 0x49, 0x4d, 0x00, 0x00, 0x00 };
+
+    s->index = index;
+    s->mode = W1_SIM_IDLE;
+    s->slot_bit = 1;
+    s->rom[0] = 0x28;                   /* DS18B20 family code */
+    memcpy(&s->rom[1], serial, sizeof(serial));
+    s->rom[6] = index * 37;
+    s->rom[7] = w1_crc8(s->rom, 7);
+    /* Power-on scratchpad: 85 C, TH/TL, 12-bit configuration */
+    s->scratch[0] = 0x50;
+    s->scratch[1] = 0x05;
+    s->scratch[2] = 0x4B;
+    s->scratch[3] = 0x46;
+    s->scratch[4] = 0x7F;
+    s->scratch[5] = 0xFF;
+    s->scratch[6] = 0x0C;
+    s->scratch[7] = 0x10;
+    s->scratch[8] = w1_crc8(s->scratch, 8);
+}
+
+static int __init w1_sim_init(void)
+{
+    struct w1_sim_dev *sim = &w1_sim;
+    struct w1_bus_pdata pdata = {
+        .ops  = &w1_sim_ops,
+        .priv = sim,
+    };
+    int i;
+
+    if (count < 1 || count > W1_SIM_MAX)
+        return -EINVAL;
+
+    spin_lock_init(&sim->lock);
+    sim->intent = -1;
+    for (i = 0; i < count; i++)
+        w1_sim_slave_init(&sim->slaves[i], i);
+
+    sim->dir = debugfs_create_dir("w1_sim", NULL);
+    debugfs_create_u32("violations", 0644, sim->dir, &sim->violations);
+    debugfs_create_u32("reads", 0444, sim->dir, &sim->reads);
+
+    /* ds18b20.ko binds by name and takes the bus operations from platform_data */
+    sim->pdev = platform_device_register_data(NULL, "ds18b20", PLATFORM_DEVID_NONE,
+                                              &pdata, sizeof(pdata));
+    if (IS_ERR(sim->pdev)) {
+        debugfs_remove_recursive(sim->dir);
+        return PTR_ERR(sim->pdev);
+    }
+    return 0;
+}
+
+static void __exit w1_sim_exit(void)
+{
+    platform_device_unregister(w1_sim.pdev);
+    debugfs_remove_recursive(w1_sim.dir);
+}
+
+module_init(w1_sim_init);
+module_exit(w1_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
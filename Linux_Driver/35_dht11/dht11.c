@@ -6,90 +6,283 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/of_gpio.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include "dht11_decode.h"
+#include "dht11.h"
+
+/*
+ * The frame is captured with a GPIO interrupt on both edges instead of
+ * polling the line with interrupts off: the handler only timestamps the
+ * edge and samples the level, and the pulse widths are decoded once the
+ * frame is complete (dht11_decode.h). The only interrupts-off time left is
+ * the handler itself, reported as irqoff_max_ns in the stats attribute.
+ * The line goes through struct dht11_line_ops, so dht11_sim.ko can stand
+ * in for the sensor.
+ *
+ * Capture starts before the release and treats anything timestamped before
+ * it as stale: disable_irq() is lazy unless IRQ_DISABLE_UNLAZY is set, and
+ * an edge latched while the interrupt was off (the start pulse) would
+ * otherwise be replayed by enable_irq() as if it were part of the frame.
+ * The frame is complete on the falling edge that ends the 40th data bit
+ * (dht11_frame_edge()), so a missed or extra edge before the data does not
+ * shift the count.
+ *
+ * A frame that is incomplete, has a glitch or a bad checksum is retried
+ * after DHT11_RETRY_MS, at most DHT11_RETRIES times. Results go to IIO:
+ * in_temp_raw and in_humidityrelative_raw in 0.1 units (scale 100 gives
+ * milli-degrees C / milli-percent).
+ *
+ * Nothing is sampled while nobody is reading. A sysfs or /dev/dht11 read
+ * starts a frame unless the last one is younger than the sampling period;
+ * an enabled buffer samples every period (in_sampling_frequency, 1 Hz at
+ * most) and the device's own trigger, dht11-dev<n>, fires after each good
+ * frame, which is pushed with the timestamp of the end of its start pulse.
+ *
+ * /sys/kernel/debug/dht11/trace holds the edges of the last capture, stale
+ * ones included; write a recorded trace to it to run that trace through the
+ * same decode path. dht11TraceApp decodes traces offline, traces/ holds
+ * recordings with their expected results.
+ */
+
+#define DHT11_PERIOD_MS     1500        /* Default sampling period */
+#define DHT11_MIN_PERIOD_MS 1000        /* The sensor needs ~1 s between frames */
+#define DHT11_RETRY_MS      1000
+#define DHT11_RETRIES       2
+#define DHT11_START_US      20000       /* Start pulse, >= 18 ms */
+#define DHT11_FRAME_MS      20          /* A frame takes ~5 ms */
+#define DHT11_TRACE_MAX     4096        /* Bytes accepted by a trace write */
+
+struct dht11_scan {
+    s16 temp;                   /* 0.1 C */
+    u16 humidity;               /* 0.1 % */
+    s64 ts __aligned(8);
+};
 
 struct dht11_dev {
     struct miscdevice mdev;     /* MISC device */
-    int gpio;                   /* GPIO number */
-    struct timer_list timer;    /* Timer */
-    struct work_struct work;    /* Work queue */
-    u8 data[5];                 /* Data buffer */
+    const struct dht11_line_ops *ops;
+    void *priv;
+    int gpio;                   /* GPIO number, unused with platform_data */
+    int irq;                    /* Edge interrupt of the GPIO */
+    struct delayed_work work;   /* Buffered sampling cycle */
+    struct completion done;     /* Frame captured */
+    struct mutex read_lock;     /* One frame (captured or injected) at a time */
+    u32 period_ms;              /* Sampling period */
+    struct dht11_edge frame[DHT11_EDGES_MAX];   /* Frame being decoded, read_lock */
+    spinlock_t lock;            /* Everything below */
+    struct dht11_edge edges[DHT11_EDGES_MAX];   /* Filled by the edge interrupt */
+    int nedges;
+    struct dht11_frame fs;      /* Capture state of the frame */
+    struct dht11_edge trace[DHT11_EDGES_MAX];   /* Last capture, for debugfs */
+    int ntrace;
+    u8 data[5];                 /* Last good frame */
+    bool valid;
+    s64 timestamp;              /* IIO timestamp of the last good frame */
+    ktime_t last_frame;         /* When it was read */
+    unsigned int frames;
+    unsigned int retries;
+    unsigned int timeouts;      /* Fewer than 40 bits */
+    unsigned int glitches;      /* High pulse too long for a bit */
+    unsigned int checksum_errors;
+    unsigned int failures;      /* Reads that ran out of retries */
+    u64 irqoff_max_ns;
+    struct iio_dev *indio_dev;
+    struct iio_trigger *trig;   /* Fired after each good frame */
+    struct dentry *dir;
 };
 
-#define HIGH    1
-#define LOW     0
-
 struct dht11_dev dht11_device;
 
-/* Set GPIO output value */
-static void dht11_set_output(int val)
+/* An edge during capture: timestamp and level only, decoding happens later */
+static void dht11_edge(void *ctx, int level)
 {
-    if (val)
-        gpio_direction_output(dht11_device.gpio, 1);
-    else
-        gpio_direction_output(dht11_device.gpio, 0);
+    struct dht11_dev *dev = ctx;
+    u64 t0 = ktime_get_ns();
+    int n, r;
+
+    spin_lock(&dev->lock);
+    n = dev->nedges;
+    if (n < DHT11_EDGES_MAX) {
+        /* Stale edges are kept for the trace, nothing after the frame */
+        r = dht11_frame_edge(&dev->fs, t0, level);
+        if (r != DHT11_EDGE_AFTER) {
+            dev->edges[n].ts = t0;
+            dev->edges[n].level = level;
+            dev->nedges = n + 1;
+        }
+        if (r == DHT11_EDGE_LAST)
+            complete(&dev->done);
+    }
+    dev->irqoff_max_ns = max(dev->irqoff_max_ns, ktime_get_ns() - t0);
+    spin_unlock(&dev->lock);
+}
+
+/* Edge interrupt of the GPIO, only enabled while a frame is captured */
+static irqreturn_t dht11_edge_irq(int irq, void *data)
+{
+    dht11_edge(data, gpio_get_value(dht11_device.gpio));
+    return IRQ_HANDLED;
 }
 
-/* Set GPIO to input mode */
-static void dht11_set_input(void)
+/* GPIO line: open drain, the external pull-up takes it high */
+static void dht11_gpio_low(void *priv)
+{
+    gpio_direction_output(dht11_device.gpio, 0);
+}
+
+static void dht11_gpio_release(void *priv)
 {
     gpio_direction_input(dht11_device.gpio);
 }
 
-/* Get GPIO value */
-static unsigned char dht11_get_io(void)
+static void dht11_gpio_capture(void *priv, void (*edge)(void *ctx, int level), void *ctx)
 {
-    return gpio_get_value(dht11_device.gpio);
+    if (edge)
+        enable_irq(dht11_device.irq);
+    else
+        disable_irq(dht11_device.irq);
 }
 
-/* Read a byte of data from DHT11 */
-static unsigned char dht11_read_byte(void)
+static const struct dht11_line_ops dht11_gpio_ops = {
+    .drive_low  = dht11_gpio_low,
+    .release    = dht11_gpio_release,
+    .capture    = dht11_gpio_capture,
+};
+
+/*
+ * @description     : Decode a capture, update the stats and publish the result
+ * @param - e       : edges
+ * @param - n       : number of edges
+ * @param - t_release : when the line was released, same clock as e
+ * @param - ts      : IIO timestamp of the frame
+ * @return          : 0 or the dht11_decode_capture() error
+ */
+static int dht11_process(const struct dht11_edge *e, int n, s64 t_release, s64 ts)
 {
-    unsigned char i, time = 0, data = 0;
-    local_irq_disable();
+    u8 buf[5];
+    int i, ret;
 
-    for (i = 0; i < 8; i++) {
-        time = 0;
-        while (dht11_get_io() == 0) {
-            udelay(1);
-            time++;
-            if (time > 100)
-                return -EINVAL;
-        }
-        udelay(45);     /* Delay for 45us */
-        if (dht11_get_io() == 1) {  /* If high level is detected, the data is 1, otherwise it's 0 */
-            data |= 1 << (7 - i);
-            time = 0;
-            while (dht11_get_io() == 1) {
-                udelay(1);
-                time++;
-                if (time > 100)
-                    return -EINVAL;
-            }
-        }
+    ret = dht11_decode_capture(e, n, t_release, buf);
+
+    spin_lock_irq(&dht11_device.lock);
+    for (i = 0; i < n; i++) {
+        dht11_device.trace[i].ts = e[i].ts - t_release;
+        dht11_device.trace[i].level = e[i].level;
+    }
+    dht11_device.ntrace = n;
+
+    switch (ret) {
+    case 0:
+        memcpy(dht11_device.data, buf, sizeof(buf));
+        dht11_device.valid = true;
+        dht11_device.timestamp = ts;
+        dht11_device.last_frame = ktime_get();
+        dht11_device.frames++;
+        break;
+    case -EAGAIN:
+        dht11_device.timeouts++;
+        break;
+    case -ERANGE:
+        dht11_device.glitches++;
+        break;
+    default:
+        dht11_device.checksum_errors++;
+        break;
     }
-    local_irq_enable();
-    return data;
+    spin_unlock_irq(&dht11_device.lock);
+
+    /* Buffer consumers pick the frame up from the trigger handler */
+    if (ret == 0)
+        iio_trigger_poll_chained(dht11_device.trig);
+    return ret;
 }
 
-/* Initialize DHT11 sensor */
-static int dht11_init(void)
+/* Send the start pulse and capture the sensor's answer, read_lock held */
+static int dht11_read_frame(void)
 {
-    dht11_set_output(HIGH); /* Pull up */
-    udelay(30);             /* Pull up for 30us */
+    struct dht11_edge *edges = dht11_device.frame;
+    s64 ts, t_release;
+    int n;
+
+    dht11_device.ops->drive_low(dht11_device.priv);    /* Start pulse, sleeping through it */
+    usleep_range(DHT11_START_US, DHT11_START_US + 2000);
+
+    spin_lock_irq(&dht11_device.lock);
+    dht11_device.nedges = 0;
+    dht11_frame_start(&dht11_device.fs, S64_MAX);
+    spin_unlock_irq(&dht11_device.lock);
+    reinit_completion(&dht11_device.done);
+
+    /* Capture first, so the release edge is seen and a replayed one dropped */
+    dht11_device.ops->capture(dht11_device.priv, dht11_edge, &dht11_device);
+    t_release = ktime_get_ns();
+    spin_lock_irq(&dht11_device.lock);
+    dht11_device.fs.t_release = t_release;
+    spin_unlock_irq(&dht11_device.lock);
+    ts = iio_get_time_ns(dht11_device.indio_dev);
+
+    /* Release, the pull-up and then the sensor take over */
+    dht11_device.ops->release(dht11_device.priv);
+    wait_for_completion_timeout(&dht11_device.done, msecs_to_jiffies(DHT11_FRAME_MS));
+    dht11_device.ops->capture(dht11_device.priv, NULL, NULL);
+
+    spin_lock_irq(&dht11_device.lock);
+    n = dht11_device.nedges;
+    memcpy(edges, dht11_device.edges, n * sizeof(edges[0]));
+    spin_unlock_irq(&dht11_device.lock);
+
+    return dht11_process(edges, n, t_release, ts);
+}
 
-    dht11_set_output(LOW);  /* Pull down */
-    mdelay(20);             /* Pull down for 20ms */
+/* Read a frame, retrying a failed one, read_lock held */
+static int dht11_sample(void)
+{
+    int try, ret;
+
+    for (try = 0; ; try++) {
+        ret = dht11_read_frame();
+        if (ret == 0 || try == DHT11_RETRIES)
+            break;
+        spin_lock_irq(&dht11_device.lock);
+        dht11_device.retries++;
+        spin_unlock_irq(&dht11_device.lock);
+        msleep(DHT11_RETRY_MS);
+    }
 
-    dht11_set_output(HIGH); /* Pull up */
-    udelay(30);             /* Pull up for 30us */
+    if (ret) {
+        spin_lock_irq(&dht11_device.lock);
+        dht11_device.failures++;
+        spin_unlock_irq(&dht11_device.lock);
+    }
+    return ret;
+}
 
-    dht11_set_input();      /* Set pin to input mode */
-    udelay(200);            /* Delay for 200us */
+/* Read a frame unless the last good one is younger than the sampling period */
+static int dht11_refresh(void)
+{
+    bool fresh;
+    int ret = 0;
 
-    if (!dht11_get_io()) {  /* If not high, DHT11 doesn't respond */
-        return -ENODEV;
-    }
-    return 0;
+    mutex_lock(&dht11_device.read_lock);
+    spin_lock_irq(&dht11_device.lock);
+    fresh = dht11_device.valid &&
+            ktime_ms_delta(ktime_get(), dht11_device.last_frame) < dht11_device.period_ms;
+    spin_unlock_irq(&dht11_device.lock);
+    if (!fresh)
+        ret = dht11_sample();
+    mutex_unlock(&dht11_device.read_lock);
+    return ret;
 }
 
 /* Open device */
@@ -101,8 +294,17 @@ static int dht11_open(struct inode *inode, struct file *filp)
 /* Read data from device */
 static ssize_t dht11_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
 {
+    u8 data[5];
     int ret = 0;
-    ret = copy_to_user(buf, &dht11_device.data[0], 5);
+
+    /* On failure the last good frame is returned, as before */
+    dht11_refresh();
+
+    spin_lock_irq(&dht11_device.lock);
+    memcpy(data, dht11_device.data, sizeof(data));
+    spin_unlock_irq(&dht11_device.lock);
+
+    ret = copy_to_user(buf, data, 5);
     return ret;
 }
 
@@ -112,31 +314,315 @@ static struct file_operations dht11_fops = {
     .read   = dht11_read,
 };
 
-/* Callback function for work queue to fetch raw temperature data */
+/* Work queue callback, one buffered sample per period while the buffer is enabled */
 static void dht11_work_callback(struct work_struct *work)
 {
-    int i = 0;
-    unsigned char buff[5];
+    unsigned long start = jiffies, period;
+
+    mutex_lock(&dht11_device.read_lock);
+    dht11_sample();
+    mutex_unlock(&dht11_device.read_lock);
+
+    /* Next cycle one period after this one started */
+    period = msecs_to_jiffies(READ_ONCE(dht11_device.period_ms));
+    queue_delayed_work(system_long_wq, &dht11_device.work,
+                       time_before(jiffies, start + period) ? start + period - jiffies : 0);
+}
+
+/* Frame statistics since probe or the last write */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t len;
+
+    spin_lock_irq(&dht11_device.lock);
+    len = sprintf(buf, "period_ms %u\nframes %u\nretries %u\ntimeouts %u\nglitches %u\n"
+                  "checksum_errors %u\nfailures %u\nlast_edges %d\nirqoff_max_ns %llu\n",
+                  dht11_device.period_ms, dht11_device.frames, dht11_device.retries,
+                  dht11_device.timeouts, dht11_device.glitches, dht11_device.checksum_errors,
+                  dht11_device.failures, dht11_device.ntrace, dht11_device.irqoff_max_ns);
+    spin_unlock_irq(&dht11_device.lock);
+    return len;
+}
+
+static ssize_t stats_store(struct device *dev, struct device_attribute *attr,
+                           const char *buf, size_t count)
+{
+    spin_lock_irq(&dht11_device.lock);
+    dht11_device.frames = 0;
+    dht11_device.retries = 0;
+    dht11_device.timeouts = 0;
+    dht11_device.glitches = 0;
+    dht11_device.checksum_errors = 0;
+    dht11_device.failures = 0;
+    dht11_device.irqoff_max_ns = 0;
+    spin_unlock_irq(&dht11_device.lock);
+    return count;
+}
+static DEVICE_ATTR_RW(stats);
+
+/* Last capture's edges, "<ns> <level>" per line, time from the release */
+static int dht11_trace_show(struct seq_file *s, void *unused)
+{
+    int i;
+
+    spin_lock_irq(&dht11_device.lock);
+    for (i = 0; i < dht11_device.ntrace; i++)
+        seq_printf(s, "%lld %d\n", dht11_device.trace[i].ts, dht11_device.trace[i].level);
+    spin_unlock_irq(&dht11_device.lock);
+    return 0;
+}
+
+static int dht11_trace_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, dht11_trace_show, NULL);
+}
+
+/* Decode a recorded trace as if it had just been captured */
+static ssize_t dht11_trace_write(struct file *file, const char __user *ubuf,
+                                 size_t count, loff_t *ppos)
+{
+    struct dht11_edge *edges;
+    char *text, *line, *p;
+    long long ts;
+    int level, n = 0, ret;
+
+    if (count > DHT11_TRACE_MAX)
+        return -EFBIG;
+    text = memdup_user_nul(ubuf, count);
+    if (IS_ERR(text))
+        return PTR_ERR(text);
+    edges = kcalloc(DHT11_EDGES_MAX, sizeof(*edges), GFP_KERNEL);
+    if (!edges) {
+        kfree(text);
+        return -ENOMEM;
+    }
 
-    if (!dht11_init()) {
-        for (i = 0; i < 5; i++) {
-            buff[i] = dht11_read_byte();    /* Read data */
+    p = text;
+    while ((line = strsep(&p, "\n")) != NULL) {
+        if (sscanf(line, "%lld %d", &ts, &level) != 2)
+            continue;
+        if (n == DHT11_EDGES_MAX) {
+            ret = -E2BIG;
+            goto out;
         }
-        /* Verify data */
-        if ((buff[0] + buff[1] + buff[2] + buff[3]) == buff[4]) {
-            memcpy(&dht11_device.data[0], &buff[0], 5);
+        edges[n].ts = ts;
+        edges[n].level = !!level;
+        n++;
+    }
+
+    mutex_lock(&dht11_device.read_lock);
+    ret = dht11_process(edges, n, 0, iio_get_time_ns(dht11_device.indio_dev));
+    mutex_unlock(&dht11_device.read_lock);
+out:
+    kfree(edges);
+    kfree(text);
+    return ret ? ret : count;
+}
+
+static const struct file_operations dht11_trace_fops = {
+    .owner      = THIS_MODULE,
+    .open       = dht11_trace_open,
+    .read       = seq_read,
+    .write      = dht11_trace_write,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* Push the last good frame with its own timestamp */
+static irqreturn_t dht11_trigger_handler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct dht11_scan scan;
+    s64 ts;
+
+    memset(&scan, 0, sizeof(scan));
+    spin_lock_irq(&dht11_device.lock);
+    scan.temp = dht11_temp_dc(dht11_device.data);
+    scan.humidity = dht11_humidity_dpc(dht11_device.data);
+    ts = dht11_device.timestamp;
+    spin_unlock_irq(&dht11_device.lock);
+
+    iio_push_to_buffers_with_timestamp(indio_dev, &scan, ts);
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
+}
+
+/* Sample only while the buffer is enabled */
+static int dht11_buffer_postenable(struct iio_dev *indio_dev)
+{
+    int ret;
+
+    ret = iio_triggered_buffer_postenable(indio_dev);
+    if (ret)
+        return ret;
+    queue_delayed_work(system_long_wq, &dht11_device.work, 0);
+    return 0;
+}
+
+static int dht11_buffer_predisable(struct iio_dev *indio_dev)
+{
+    cancel_delayed_work_sync(&dht11_device.work);
+    return iio_triggered_buffer_predisable(indio_dev);
+}
+
+static const struct iio_buffer_setup_ops dht11_buffer_ops = {
+    .postenable = dht11_buffer_postenable,
+    .predisable = dht11_buffer_predisable,
+};
+
+/* Last good frame, 0.1 C / 0.1 % */
+static int dht11_read_raw(struct iio_dev *indio_dev,
+                          struct iio_chan_spec const *chan,
+                          int *val, int *val2, long mask)
+{
+    u8 data[5];
+    bool valid;
+    u32 uhz;
+    int ret;
+
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+        /* With the buffer enabled the work is sampling already */
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret == 0) {
+            ret = dht11_refresh();
+            iio_device_release_direct_mode(indio_dev);
+            if (ret)
+                return ret;
         }
+
+        spin_lock_irq(&dht11_device.lock);
+        memcpy(data, dht11_device.data, sizeof(data));
+        valid = dht11_device.valid;
+        spin_unlock_irq(&dht11_device.lock);
+
+        if (!valid)             /* No good frame yet */
+            return -EAGAIN;
+        if (chan->type == IIO_TEMP)
+            *val = dht11_temp_dc(data);
+        else
+            *val = dht11_humidity_dpc(data);
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SCALE:
+        *val = 100;             /* milli-units per 0.1 */
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_OFFSET:
+        *val = 0;               /* The sign is in the raw value */
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SAMP_FREQ:
+        uhz = 1000000000U / READ_ONCE(dht11_device.period_ms);
+        *val = uhz / 1000000;
+        *val2 = uhz % 1000000;
+        return IIO_VAL_INT_PLUS_MICRO;
+    default:
+        return -EINVAL;
     }
 }
 
-/* Timer callback function, fetch data every 1s */
-static void dht11_timer_callback(struct timer_list *arg)
+static int dht11_write_raw(struct iio_dev *indio_dev,
+                           struct iio_chan_spec const *chan,
+                           int val, int val2, long mask)
+{
+    u64 uhz;
+    u32 period;
+
+    if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+        return -EINVAL;
+
+    if (val < 0 || val2 < 0 || (val == 0 && val2 == 0))
+        return -EINVAL;
+    uhz = (u64)val * 1000000 + val2;
+    period = div64_u64(1000000000ULL, uhz);
+    if (period < DHT11_MIN_PERIOD_MS)
+        return -EINVAL;
+
+    /* Takes effect from the next cycle */
+    WRITE_ONCE(dht11_device.period_ms, period);
+    return 0;
+}
+
+static const struct iio_info dht11_iio_info = {
+    .read_raw = dht11_read_raw,
+    .write_raw = dht11_write_raw,
+};
+
+static const struct iio_trigger_ops dht11_trigger_ops = {
+    .validate_device = iio_trigger_validate_own_device,
+};
+
+static const struct iio_chan_spec dht11_channels[] = {
+    {
+        .type = IIO_TEMP,
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE) |
+                              BIT(IIO_CHAN_INFO_OFFSET),
+        .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),
+        .scan_index = 0,
+        .scan_type = {
+            .sign = 's',
+            .realbits = 16,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
+    },
+    {
+        .type = IIO_HUMIDITYRELATIVE,
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE),
+        .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),
+        .scan_index = 1,
+        .scan_type = {
+            .sign = 'u',
+            .realbits = 16,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
+    },
+    IIO_CHAN_SOFT_TIMESTAMP(2),
+};
+
+/* Every frame carries both channels, the core picks out what is enabled */
+static const unsigned long dht11_scan_masks[] = { 0x3, 0 };
+
+static int dht11_register_iio(struct platform_device *pdev)
 {
-    schedule_work(&dht11_device.work);
-    mod_timer(&dht11_device.timer, jiffies + (1500 * HZ / 1000));
+    struct iio_dev *indio_dev;
+    int ret;
+
+    indio_dev = devm_iio_device_alloc(&pdev->dev, 0);
+    if (!indio_dev)
+        return -ENOMEM;
+
+    indio_dev->dev.parent = &pdev->dev;
+    indio_dev->info = &dht11_iio_info;
+    indio_dev->name = "dht11";
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    indio_dev->channels = dht11_channels;
+    indio_dev->num_channels = ARRAY_SIZE(dht11_channels);
+    indio_dev->available_scan_masks = dht11_scan_masks;
+    dht11_device.indio_dev = indio_dev;
+
+    ret = devm_iio_triggered_buffer_setup(&pdev->dev, indio_dev, NULL,
+                                          dht11_trigger_handler, &dht11_buffer_ops);
+    if (ret)
+        return ret;
+
+    /* Data-ready trigger, fired from the sampling path after each good frame */
+    dht11_device.trig = devm_iio_trigger_alloc(&pdev->dev, "%s-dev%d",
+                                               indio_dev->name, indio_dev->id);
+    if (!dht11_device.trig)
+        return -ENOMEM;
+    dht11_device.trig->dev.parent = &pdev->dev;
+    dht11_device.trig->ops = &dht11_trigger_ops;
+    iio_trigger_set_drvdata(dht11_device.trig, indio_dev);
+    ret = devm_iio_trigger_register(&pdev->dev, dht11_device.trig);
+    if (ret)
+        return ret;
+    indio_dev->trig = iio_trigger_get(dht11_device.trig);
+
+    return devm_iio_device_register(&pdev->dev, indio_dev);
 }
 
-/* Initialize GPIO */
+/* Initialize GPIO and its edge interrupt */
 static int dht11_request_gpio(struct platform_device *pdev)
 {
     struct device *dev = &pdev->dev;
@@ -154,52 +640,86 @@ static int dht11_request_gpio(struct platform_device *pdev)
         return ret;
     }
 
+    dht11_device.irq = gpio_to_irq(dht11_device.gpio);
+    if (dht11_device.irq < 0) {
+        dev_err(dev, "Gpio has no interrupt");
+        return dht11_device.irq;
+    }
+
+    /* Only enabled while a frame is being captured, masked as soon as it is not */
+    irq_set_status_flags(dht11_device.irq, IRQ_NOAUTOEN | IRQ_DISABLE_UNLAZY);
+    ret = devm_request_irq(dev, dht11_device.irq, dht11_edge_irq,
+                           IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                           "dht11", &dht11_device);
+    if (ret) {
+        dev_err(dev, "Failed to request irq %d", dht11_device.irq);
+        return ret;
+    }
+
     return 0;
 }
 
 /* Probe function for the driver */
 static int dht11_probe(struct platform_device *pdev)
 {
+    struct dht11_line_pdata *pdata = dev_get_platdata(&pdev->dev);
     struct miscdevice *mdev;
     int ret;
 
     dev_info(&pdev->dev, "dht11 device and driver matched successfully!\n");
 
-    ret = dht11_request_gpio(pdev);
+    spin_lock_init(&dht11_device.lock);
+    mutex_init(&dht11_device.read_lock);
+    init_completion(&dht11_device.done);
+    INIT_DELAYED_WORK(&dht11_device.work, dht11_work_callback);
+    dht11_device.period_ms = DHT11_PERIOD_MS;
+
+    /* A simulated sensor (dht11_sim.ko) comes with its own line operations */
+    if (pdata) {
+        dht11_device.ops = pdata->ops;
+        dht11_device.priv = pdata->priv;
+    } else {
+        ret = dht11_request_gpio(pdev);
+        if (ret)
+            return ret;
+        dht11_device.ops = &dht11_gpio_ops;
+        dht11_device.priv = NULL;
+    }
+
+    ret = dht11_register_iio(pdev);
+    if (ret)
+        return ret;
+
+    ret = device_create_file(&pdev->dev, &dev_attr_stats);
     if (ret)
         return ret;
 
+    dht11_device.dir = debugfs_create_dir("dht11", NULL);
+    debugfs_create_file("trace", 0600, dht11_device.dir, NULL, &dht11_trace_fops);
+
     /* Initialize MISC device */
     mdev = &dht11_device.mdev;
     mdev->name  = "dht11";
     mdev->minor = MISC_DYNAMIC_MINOR;
     mdev->fops  = &dht11_fops;
 
-    /* Initialize timer */
-    timer_setup(&dht11_device.timer, dht11_timer_callback, 0);
-    dht11_device.timer.expires = jiffies + msecs_to_jiffies(1500);
-    add_timer(&dht11_device.timer);
-
-    /* Initialize work queue */
-    INIT_WORK(&dht11_device.work, dht11_work_callback);
-
     /* Register MISC device */
-    return misc_register(mdev);
+    ret = misc_register(mdev);
+    if (ret) {
+        debugfs_remove_recursive(dht11_device.dir);
+        device_remove_file(&pdev->dev, &dev_attr_stats);
+    }
+    return ret;
 }
 
 /* Remove function for the driver */
 static int dht11_remove(struct platform_device *pdev)
 {
-    gpio_set_value(dht11_device.gpio, 0);
-
     /* Unregister MISC device */
     misc_deregister(&dht11_device.mdev);
 
-    /* Remove timer */
-    del_timer(&dht11_device.timer);
-
-    /* Cancel work queue */
-    cancel_work_sync(&dht11_device.work);
+    debugfs_remove_recursive(dht11_device.dir);
+    device_remove_file(&pdev->dev, &dev_attr_stats);
 
     dev_info(&pdev->dev, "DHT11 driver has been removed!\n");
     return 0;
@@ -217,6 +737,7 @@ static struct platform_driver dht11_driver = {
         .owner          = THIS_MODULE,
         .name           = "dht11",
         .of_match_table = dht11_of_match,
+        .probe_type     = PROBE_PREFER_ASYNCHRONOUS,
     },
     .probe      = dht11_probe,
     .remove     = dht11_remove,
@@ -0,0 +1,23 @@
+#ifndef DHT11_H
+#define DHT11_H
+
+#include <linux/types.h>
+
+/*
+ * Data line of a DHT11: the GPIO and its edge interrupt in dht11.ko, or the
+ * timing model in dht11_sim.ko.
+ */
+struct dht11_line_ops {
+    void (*drive_low)(void *priv);      /* Start pulse */
+    void (*release)(void *priv);        /* Let the pull-up and the sensor drive the line */
+    /* Report every edge through edge(ctx, level) from now on; edge == NULL stops */
+    void (*capture)(void *priv, void (*edge)(void *ctx, int level), void *ctx);
+};
+
+/* platform_data of a "dht11" device that has no GPIO, e.g. from dht11_sim.ko */
+struct dht11_line_pdata {
+    const struct dht11_line_ops *ops;
+    void *priv;
+};
+
+#endif
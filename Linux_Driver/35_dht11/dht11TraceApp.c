@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dht11_decode.h"
+
+/*
+ * Decode recorded DHT11 edge traces offline with the driver's decoder.
+ * Record a trace on the board with
+ *     cat /sys/kernel/debug/dht11/trace > frame.txt
+ * and decode it with
+ *     ./dht11TraceApp frame.txt [more.txt ...]
+ * Writing the file back to the debugfs trace runs it through the driver.
+ *
+ *     ./dht11TraceApp -t traces/
+ * decodes every trace listed in traces/expected.txt and compares the
+ * result with the line recorded there, exit 1 on any mismatch.
+ */
+
+#define RESULT_LEN  160
+
+/*
+ * @description     : Decode one trace file
+ * @param - path    : trace, "-" for stdin
+ * @param - name    : label the result starts with
+ * @param - res     : result line, "<name>: <n> edges, <what was decoded>"
+ * @return          : 0 on a good frame, -1 otherwise
+ */
+static int decode_file(const char *path, const char *name, char *res)
+{
+    struct dht11_edge edges[DHT11_EDGES_MAX];
+    unsigned char data[5];
+    char line[128];
+    long long ts;
+    int level, n = 0, ret, t, len;
+    FILE *fp;
+
+    fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!fp) {
+        perror(path);
+        snprintf(res, RESULT_LEN, "%s: cannot open", name);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%lld %d", &ts, &level) != 2)
+            continue;
+        if (n == DHT11_EDGES_MAX) {
+            fprintf(stderr, "%s: more than %d edges\n", path, DHT11_EDGES_MAX);
+            break;
+        }
+        edges[n].ts = ts;
+        edges[n].level = !!level;
+        n++;
+    }
+    if (fp != stdin)
+        fclose(fp);
+
+    /* Times are relative to the release, as the driver records them */
+    ret = dht11_decode_capture(edges, n, 0, data);
+    len = snprintf(res, RESULT_LEN, "%s: %d edges, ", name, n);
+    switch (ret) {
+    case 0:
+        t = dht11_temp_dc(data);
+        snprintf(res + len, RESULT_LEN - len,
+                 "Temperature: %s%d.%d°C, Humidity: %d.%d%%", t < 0 ? "-" : "",
+                 abs(t) / 10, abs(t) % 10,
+                 dht11_humidity_dpc(data) / 10, dht11_humidity_dpc(data) % 10);
+        return 0;
+    case -EAGAIN:
+        snprintf(res + len, RESULT_LEN - len, "incomplete frame");
+        break;
+    case -ERANGE:
+        snprintf(res + len, RESULT_LEN - len, "glitch, high pulse too long for a bit");
+        break;
+    default:
+        snprintf(res + len, RESULT_LEN - len, "checksum error %02x %02x %02x %02x %02x",
+                 data[0], data[1], data[2], data[3], data[4]);
+        break;
+    }
+    return -1;
+}
+
+/*
+ * @description     : Decode the traces listed in <dir>/expected.txt and
+ *                    compare each result with its line there
+ * @param - dir     : directory with the traces and expected.txt
+ * @return          : number of mismatches, -1 if expected.txt is missing
+ */
+static int check_dir(const char *dir)
+{
+    char path[256], line[RESULT_LEN], res[RESULT_LEN], *colon;
+    int checked = 0, failed = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/expected.txt", dir);
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        colon = strchr(line, ':');
+        if (line[0] == '#' || !colon)
+            continue;
+
+        *colon = '\0';
+        snprintf(path, sizeof(path), "%s/%s", dir, line);
+        decode_file(path, line, res);
+        *colon = ':';
+
+        checked++;
+        if (strcmp(res, line)) {
+            failed++;
+            printf("expected \"%s\"\n     got \"%s\"\n", line, res);
+        }
+    }
+    fclose(fp);
+
+    printf("%d traces, %s\n", checked, failed ? "FAIL" : "PASS");
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    char res[RESULT_LEN];
+    int i, failed = 0;
+
+    if (argc == 3 && !strcmp(argv[1], "-t"))
+        return check_dir(argv[2]) ? 1 : 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace|-> [trace ...]\n"
+                        "       %s -t <dir>\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (decode_file(argv[i], argv[i], res))
+            failed++;
+        printf("%s\n", res);
+    }
+
+    return failed ? 1 : 0;
+}
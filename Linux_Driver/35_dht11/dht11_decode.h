@@ -0,0 +1,171 @@
+#ifndef DHT11_DECODE_H
+#define DHT11_DECODE_H
+
+/*
+ * DHT11 frame decoder, shared by dht11.ko and dht11TraceApp so a recorded
+ * edge trace decodes the same way offline as it did in the driver.
+ *
+ * After the host releases the line the sensor answers with 80 us low and
+ * 80 us high, then sends 40 bits MSB first. Every bit is 50 us low followed
+ * by a high pulse of 26-28 us for a 0 or 70 us for a 1, and the frame ends
+ * with 50 us low before the pull-up takes the line back. Only the high
+ * pulse widths carry data, so the decoder looks for the last 40 complete
+ * high pulses in the trace and ignores whatever preceded them (the host's
+ * release, the response pulse, a missed first edge).
+ *
+ * Which edges belong to the frame is decided while capturing, edge by
+ * edge (dht11_frame_edge()), so the driver can stop at the falling edge
+ * that ends data bit 40: edges from before the host released the line
+ * (e.g. one latched while the interrupt was off and replayed) are stale,
+ * and a high pulse after a low longer than a bit's is the response, which
+ * restarts the bit count. dht11_decode_capture() applies the same rules to
+ * a whole capture.
+ *
+ * Trace format (debugfs trace file and recordings): one edge per line,
+ * "<ns> <level>", with the time relative to the host's release and the
+ * level the line was sampled at right after the edge. Stale edges have
+ * negative times. Recordings relative to the first edge decode the same.
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#else
+#include <errno.h>
+#endif
+
+#define DHT11_BITS          40
+#define DHT11_EDGES_MAX     96          /* 84 per frame, room for glitches */
+#define DHT11_BIT1_NS       48000       /* High pulse longer than this is a 1 */
+#define DHT11_BIT_LOW_MAX_NS 65000      /* Longer low is the 80 us response, not a bit */
+#define DHT11_HIGH_MAX_NS   120000      /* Longer is not a data bit */
+
+struct dht11_edge {
+    long long ts;                       /* ns */
+    int level;                          /* Line level after the edge */
+};
+
+/* Capture state of one frame */
+struct dht11_frame {
+    long long t_release;                /* Edges before it are stale */
+    long long t_fall;                   /* Last falling edge */
+    int last;                           /* Level after the last frame edge, -1 before the first */
+    int bits;                           /* Data bits ended so far, -1 before the response */
+};
+
+/* What dht11_frame_edge() made of an edge */
+#define DHT11_EDGE_STALE    0           /* Before the release */
+#define DHT11_EDGE_FRAME    1
+#define DHT11_EDGE_LAST     2           /* Falling edge that ends bit 40 */
+#define DHT11_EDGE_AFTER    3           /* The frame was complete already */
+
+static inline void dht11_frame_start(struct dht11_frame *f, long long t_release)
+{
+    f->t_release = t_release;
+    f->t_fall = 0;
+    f->last = -1;
+    f->bits = -1;
+}
+
+static inline int dht11_frame_edge(struct dht11_frame *f, long long ts, int level)
+{
+    if (f->bits >= DHT11_BITS)
+        return DHT11_EDGE_AFTER;
+    if (ts < f->t_release)
+        return DHT11_EDGE_STALE;
+
+    if (level) {
+        /* After the response low (or none seen) the next high is not a bit */
+        if (f->last < 0 || ts - f->t_fall > DHT11_BIT_LOW_MAX_NS)
+            f->bits = -1;
+    } else {
+        f->t_fall = ts;
+        if (f->last == 1 && ++f->bits == DHT11_BITS) {
+            f->last = level;
+            return DHT11_EDGE_LAST;
+        }
+    }
+    f->last = level;
+    return DHT11_EDGE_FRAME;
+}
+
+/*
+ * @description : Decode one frame from its edges
+ * @param - e   : edges in time order
+ * @param - n   : number of edges
+ * @param - out : 5 bytes: humidity, humidity tenths, temperature, tenths, checksum
+ * @return      : 0, -EAGAIN when the trace holds fewer than 40 bits,
+ *                -ERANGE on a high pulse too long for a bit, -EIO on a bad checksum
+ */
+static inline int dht11_decode(const struct dht11_edge *e, int n, unsigned char *out)
+{
+    long long width;
+    int i, bit = DHT11_BITS;
+
+    for (i = 0; i < 5; i++)
+        out[i] = 0;
+
+    /* Walk back from the end so the 40 bits are the last 40 high pulses */
+    for (i = n - 2; i >= 0 && bit > 0; i--) {
+        if (e[i].level != 1 || e[i + 1].level != 0)
+            continue;
+        width = e[i + 1].ts - e[i].ts;
+        if (width > DHT11_HIGH_MAX_NS)
+            return -ERANGE;
+        bit--;
+        if (width > DHT11_BIT1_NS)
+            out[bit / 8] |= 0x80 >> (bit % 8);
+    }
+    if (bit > 0)
+        return -EAGAIN;
+
+    if (((out[0] + out[1] + out[2] + out[3]) & 0xFF) != out[4])
+        return -EIO;
+    return 0;
+}
+
+/*
+ * @description     : Decode a capture: drop stale edges, stop after the
+ *                    falling edge that ends bit 40, decode what is left
+ * @param - e       : edges in time order
+ * @param - n       : number of edges
+ * @param - t_release : when the host released the line, same clock as e
+ * @param - out     : as for dht11_decode()
+ * @return          : as for dht11_decode(); -EAGAIN also when bit 40 never ended
+ */
+static inline int dht11_decode_capture(const struct dht11_edge *e, int n,
+                                       long long t_release, unsigned char *out)
+{
+    struct dht11_frame f;
+    int i, first = -1, r;
+
+    dht11_frame_start(&f, t_release);
+    for (i = 0; i < n; i++) {
+        r = dht11_frame_edge(&f, e[i].ts, e[i].level);
+        if (r == DHT11_EDGE_STALE)
+            continue;
+        if (first < 0)
+            first = i;
+        if (r == DHT11_EDGE_LAST)
+            return dht11_decode(e + first, i + 1 - first, out);
+    }
+
+    for (i = 0; i < 5; i++)
+        out[i] = 0;
+    return -EAGAIN;
+}
+
+/* Temperature in 0.1 C; bit 7 of the tenths byte is the sign on newer parts */
+static inline int dht11_temp_dc(const unsigned char *d)
+{
+    int t = d[2] * 10 + (d[3] & 0x7F);
+
+    return (d[3] & 0x80) ? -t : t;
+}
+
+/* Relative humidity in 0.1 % */
+static inline int dht11_humidity_dpc(const unsigned char *d)
+{
+    return d[0] * 10 + d[1];
+}
+
+#endif
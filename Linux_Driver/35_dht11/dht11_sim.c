@@ -0,0 +1,203 @@
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include "dht11.h"
+
+/*
+ * Simulated DHT11 on a simulated data line.
+ *
+ * Registers a "dht11" platform device whose platform_data carries line
+ * operations instead of a GPIO, so dht11.ko runs its normal capture and
+ * decode path against this model. After a start pulse of at least 18 ms the
+ * model answers 30 us after the release and walks the frame from an
+ * hrtimer, reporting every edge through the driver's capture callback in
+ * interrupt context, like the GPIO edge interrupt does; the host's own
+ * edges (start pulse and release) are reported too while capture is on.
+ * Shorter start pulses get no answer and are counted in
+ * /sys/kernel/debug/dht11_sim/violations.
+ *
+ * corrupt_every=N breaks the checksum of every Nth frame and drop_every=N
+ * stops every Nth frame half-way, to exercise the driver's retries.
+ */
+
+#define DHT11_SIM_START_US  18000       /* Shortest start pulse the sensor answers */
+#define DHT11_SIM_ANSWER_NS 30000       /* Release to the response pulse */
+#define DHT11_SIM_EDGES     84
+
+static int temp_dc = 234;
+module_param(temp_dc, int, 0644);
+MODULE_PARM_DESC(temp_dc, "Temperature in the next frame, 0.1 C");
+
+static unsigned int humidity = 550;
+module_param(humidity, uint, 0644);
+MODULE_PARM_DESC(humidity, "Relative humidity in the next frame, 0.1 %");
+
+static unsigned int corrupt_every;
+module_param(corrupt_every, uint, 0644);
+MODULE_PARM_DESC(corrupt_every, "Corrupt the checksum of every Nth frame, 0 = never");
+
+static unsigned int drop_every;
+module_param(drop_every, uint, 0644);
+MODULE_PARM_DESC(drop_every, "Stop every Nth frame after 20 bits, 0 = never");
+
+struct dht11_sim_dev {
+    struct platform_device *pdev;
+    struct dentry *dir;
+    struct hrtimer timer;
+    spinlock_t lock;
+    void (*edge)(void *ctx, int level); /* Driver's capture callback */
+    void *ctx;
+    bool low;                           /* Host holds the line low */
+    ktime_t t_low;                      /* Start of the start pulse */
+    u32 width_ns[DHT11_SIM_EDGES];      /* How long the line stays after edge i */
+    int nedges;
+    int next;                           /* Next edge; even edges fall, odd edges rise */
+    u32 frames;
+    u32 violations;
+};
+
+static struct dht11_sim_dev dht11_sim;
+
+/* Lay out the pulses of one frame */
+static void dht11_sim_build(struct dht11_sim_dev *sim)
+{
+    u8 d[5];
+    int i, n = 0, t = abs(temp_dc);
+
+    d[0] = humidity / 10;
+    d[1] = humidity % 10;
+    d[2] = t / 10;
+    d[3] = (t % 10) | (temp_dc < 0 ? 0x80 : 0);
+    d[4] = d[0] + d[1] + d[2] + d[3];
+
+    sim->frames++;
+    if (corrupt_every && sim->frames % corrupt_every == 0)
+        d[4] ^= 0x01;
+
+    sim->width_ns[n++] = 80000;         /* Response low */
+    sim->width_ns[n++] = 80000;         /* Response high */
+    for (i = 0; i < 40; i++) {
+        sim->width_ns[n++] = 50000;
+        sim->width_ns[n++] = (d[i / 8] & (0x80 >> (i % 8))) ? 70000 : 27000;
+    }
+    sim->width_ns[n++] = 50000;         /* End of frame, then released */
+    sim->width_ns[n++] = 0;
+    sim->nedges = n;
+
+    if (drop_every && sim->frames % drop_every == 0)
+        sim->nedges = 2 + 40;
+    sim->next = 0;
+}
+
+static enum hrtimer_restart dht11_sim_timer(struct hrtimer *timer)
+{
+    struct dht11_sim_dev *sim = container_of(timer, struct dht11_sim_dev, timer);
+    enum hrtimer_restart restart = HRTIMER_NORESTART;
+    int i;
+
+    spin_lock(&sim->lock);
+    i = sim->next++;
+    if (sim->edge)
+        sim->edge(sim->ctx, i & 1);
+    if (sim->next < sim->nedges) {
+        /* The sensor keeps its own time, callback latency does not add up */
+        hrtimer_set_expires(timer, ktime_add_ns(hrtimer_get_expires(timer), sim->width_ns[i]));
+        restart = HRTIMER_RESTART;
+    }
+    spin_unlock(&sim->lock);
+    return restart;
+}
+
+static void dht11_sim_low(void *priv)
+{
+    struct dht11_sim_dev *sim = priv;
+    unsigned long flags;
+
+    hrtimer_cancel(&sim->timer);        /* A new start pulse aborts a frame */
+    spin_lock_irqsave(&sim->lock, flags);
+    if (!sim->low && sim->edge)
+        sim->edge(sim->ctx, 0);
+    sim->low = true;
+    sim->t_low = ktime_get();
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static void dht11_sim_release(void *priv)
+{
+    struct dht11_sim_dev *sim = priv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    if (sim->low) {
+        sim->low = false;
+        if (sim->edge)                  /* The pull-up takes the line high */
+            sim->edge(sim->ctx, 1);
+        if (ktime_us_delta(ktime_get(), sim->t_low) < DHT11_SIM_START_US) {
+            sim->violations++;
+        } else {
+            dht11_sim_build(sim);
+            hrtimer_start(&sim->timer, ns_to_ktime(DHT11_SIM_ANSWER_NS), HRTIMER_MODE_REL);
+        }
+    }
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static void dht11_sim_capture(void *priv, void (*edge)(void *ctx, int level), void *ctx)
+{
+    struct dht11_sim_dev *sim = priv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&sim->lock, flags);
+    sim->edge = edge;
+    sim->ctx = ctx;
+    spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static const struct dht11_line_ops dht11_sim_ops = {
+    .drive_low  = dht11_sim_low,
+    .release    = dht11_sim_release,
+    .capture    = dht11_sim_capture,
+};
+
+static int __init dht11_sim_init(void)
+{
+    struct dht11_sim_dev *sim = &dht11_sim;
+    struct dht11_line_pdata pdata = {
+        .ops  = &dht11_sim_ops,
+        .priv = sim,
+    };
+
+    spin_lock_init(&sim->lock);
+    hrtimer_init(&sim->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sim->timer.function = dht11_sim_timer;
+
+    sim->dir = debugfs_create_dir("dht11_sim", NULL);
+    debugfs_create_u32("violations", 0644, sim->dir, &sim->violations);
+    debugfs_create_u32("frames", 0444, sim->dir, &sim->frames);
+
+    /* dht11.ko binds by name and takes the line operations from platform_data */
+    sim->pdev = platform_device_register_data(NULL, "dht11", PLATFORM_DEVID_NONE,
+                                              &pdata, sizeof(pdata));
+    if (IS_ERR(sim->pdev)) {
+        debugfs_remove_recursive(sim->dir);
+        return PTR_ERR(sim->pdev);
+    }
+    return 0;
+}
+
+static void __exit dht11_sim_exit(void)
+{
+    platform_device_unregister(dht11_sim.pdev);
+    hrtimer_cancel(&dht11_sim.timer);
+    debugfs_remove_recursive(dht11_sim.dir);
+}
+
+module_init(dht11_sim_init);
+module_exit(dht11_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
@@ -0,0 +1,462 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/ide.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <asm/mach/map.h>
+#include <asm/uaccess.h>
+#include <asm/io.h>
+#include "gpiobank.h"
+
+#define GPIOBANK_CNT		1
+#define GPIOBANK_NAME		"gpiobank"
+#define GPIOBANK_CHUNK		64		/* Updates copied from userspace per pass */
+
+#define PERIPH_BASE     		     (0x40000000)
+#define MPU_AHB4_PERIPH_BASE		 (PERIPH_BASE + 0x10000000)
+#define RCC_BASE        		     (MPU_AHB4_PERIPH_BASE + 0x0000)
+#define RCC_MP_AHB4ENSETR			 (RCC_BASE + 0XA28)
+#define GPIOI_BASE					 (MPU_AHB4_PERIPH_BASE + 0xA000)
+#define GPIO_BANK_SIZE				 0x400
+
+/* Register offsets inside one GPIO bank */
+#define GPIO_MODER		0x00
+#define GPIO_OTYPER		0x04
+#define GPIO_OSPEEDR	0x08
+#define GPIO_PUPDR		0x0C
+#define GPIO_IDR		0x10
+#define GPIO_ODR		0x14
+#define GPIO_BSRR		0x18
+
+static unsigned long bank_base = GPIOI_BASE;
+module_param(bank_base, ulong, 0444);
+MODULE_PARM_DESC(bank_base, "Physical base address of the GPIO bank (default GPIOI)");
+
+static unsigned int bank_clk = 8;
+module_param(bank_clk, uint, 0444);
+MODULE_PARM_DESC(bank_clk, "RCC_MP_AHB4ENSETR bit of the bank clock (GPIOI = 8)");
+
+static bool fake_mmio;
+module_param(fake_mmio, bool, 0444);
+MODULE_PARM_DESC(fake_mmio, "Back the bank with a kmalloc block and a BSRR model instead of hardware");
+
+/* gpiobank device structure */
+struct gpiobank_dev {
+	dev_t devid;				/* Device ID */
+	struct cdev cdev;			/* Character device */
+	struct class *class;		/* Device class */
+	struct device *device;		/* Device */
+	int major;					/* Major number */
+	int minor;					/* Minor number */
+	void __iomem *base;			/* Whole bank, mapped once */
+	bool fake;					/* base is a kmalloc block */
+	spinlock_t lock;			/* Protects MODER/OTYPER/OSPEEDR/PUPDR read-modify-write */
+};
+
+static struct gpiobank_dev gpiobank;
+
+/*
+ * @description		: Store one value into BSRR. On hardware this is a single
+ *					  write; with fake_mmio the set/reset semantics are
+ *					  modelled on ODR so the logic can run without a board.
+ * @param - dev 	: gpiobank device
+ * @param - val 	: BS[15:0] | BR[15:0] << 16
+ * @return 			: none
+ */
+static inline void gpiobank_bsrr_write(struct gpiobank_dev *dev, u32 val)
+{
+	u32 odr;
+
+	if (likely(!dev->fake)) {
+		writel(val, dev->base + GPIO_BSRR);
+		return;
+	}
+
+	/* BR is applied first so that BS wins when both bits are set */
+	odr = readl(dev->base + GPIO_ODR);
+	odr &= ~(val >> 16);
+	odr |= val & GPIOBANK_PIN_MASK;
+	writel(odr, dev->base + GPIO_ODR);
+	writel(odr, dev->base + GPIO_IDR);	/* Outputs loop back to the input register */
+}
+
+/*
+ * @description		: Apply one (set, clear) pair with a single BSRR store
+ * @param - dev 	: gpiobank device
+ * @param - up 		: update to apply
+ * @return 			: none
+ */
+static inline void gpiobank_apply(struct gpiobank_dev *dev, const struct gpiobank_update *up)
+{
+	u32 set = up->set_mask & GPIOBANK_PIN_MASK;
+	u32 clear = up->clear_mask & GPIOBANK_PIN_MASK;
+
+	gpiobank_bsrr_write(dev, set | (clear << 16));
+}
+
+/*
+ * @description		: Configure the pins in mask as push-pull, high-speed outputs
+ * @param - dev 	: gpiobank device
+ * @param - mask 	: pins to configure
+ * @return 			: none
+ */
+static void gpiobank_config_output(struct gpiobank_dev *dev, u32 mask)
+{
+	unsigned long flags;
+	u32 moder, otyper, ospeedr;
+	int pin;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	moder = readl(dev->base + GPIO_MODER);
+	otyper = readl(dev->base + GPIO_OTYPER);
+	ospeedr = readl(dev->base + GPIO_OSPEEDR);
+	for (pin = 0; pin < GPIOBANK_PINS; pin++) {
+		if (!(mask & (1 << pin)))
+			continue;
+		moder &= ~(0x3 << (pin * 2));
+		moder |= (0x1 << (pin * 2));		/* General purpose output */
+		otyper &= ~(0x1 << pin);			/* Push-pull */
+		ospeedr &= ~(0x3 << (pin * 2));
+		ospeedr |= (0x2 << (pin * 2));		/* High speed */
+	}
+	writel(moder, dev->base + GPIO_MODER);
+	writel(otyper, dev->base + GPIO_OTYPER);
+	writel(ospeedr, dev->base + GPIO_OSPEEDR);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/*
+ * @description		: Space two updates of a vector: ndelay() is only exact
+ *					  enough for short gaps, a long vector of them would
+ *					  hold the CPU for hundreds of ms, so sleep from 10us on
+ * @param - period_ns : gap in ns
+ * @return 			: none
+ */
+static void gpiobank_wait(u32 period_ns)
+{
+	u32 us = period_ns / NSEC_PER_USEC;
+
+	if (us < 10)
+		ndelay(period_ns);
+	else
+		usleep_range(us, us + us / 8);
+}
+
+/*
+ * @description		: Apply a user vector of updates, copied in chunks
+ * @param - dev 	: gpiobank device
+ * @param - uptr 	: user pointer to struct gpiobank_update[]
+ * @param - count 	: number of updates
+ * @param - period_ns : spacing between two updates, spun below 10us and
+ *					  slept from there on
+ * @return 			: number of updates applied, negative value on failure
+ */
+static long gpiobank_apply_vec(struct gpiobank_dev *dev, const struct gpiobank_update __user *uptr,
+							   size_t count, u32 period_ns)
+{
+	struct gpiobank_update chunk[GPIOBANK_CHUNK];
+	size_t done = 0, n, i;
+
+	while (done < count) {
+		n = min_t(size_t, count - done, GPIOBANK_CHUNK);
+		if (copy_from_user(chunk, uptr + done, n * sizeof(chunk[0])))
+			return done ? done : -EFAULT;
+
+		for (i = 0; i < n; i++) {
+			gpiobank_apply(dev, &chunk[i]);
+			if (period_ns && (done + i + 1) < count)
+				gpiobank_wait(period_ns);
+			cond_resched();
+		}
+		done += n;
+	}
+	return done;
+}
+
+/*
+ * @description		: Open the device
+ * @param - inode 	: inode passed to the driver
+ * @param - filp 	: file structure, private_data points to the device
+ * @return 			: 0 on success
+ */
+static int gpiobank_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = &gpiobank;
+	return 0;
+}
+
+/*
+ * @description		: Read the bank state (struct gpiobank_state)
+ * @param - filp 	: file structure
+ * @param - buf 	: user buffer
+ * @param - cnt 	: buffer length
+ * @param - offt 	: file offset
+ * @return 			: number of bytes read, negative value on failure
+ */
+static ssize_t gpiobank_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
+{
+	struct gpiobank_dev *dev = filp->private_data;
+	struct gpiobank_state st;
+
+	if (cnt < sizeof(st))
+		return -EINVAL;
+
+	st.idr = readl(dev->base + GPIO_IDR);
+	st.odr = readl(dev->base + GPIO_ODR);
+	if (copy_to_user(buf, &st, sizeof(st)))
+		return -EFAULT;
+	return sizeof(st);
+}
+
+/*
+ * @description		: Write an array of struct gpiobank_update, applied back to back
+ * @param - filp 	: file structure
+ * @param - buf 	: user data
+ * @param - cnt 	: length, must be a multiple of sizeof(struct gpiobank_update)
+ * @param - offt 	: file offset
+ * @return 			: number of bytes consumed, negative value on failure
+ */
+static ssize_t gpiobank_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
+{
+	struct gpiobank_dev *dev = filp->private_data;
+	long ret;
+
+	if (cnt == 0 || cnt % sizeof(struct gpiobank_update))
+		return -EINVAL;
+
+	ret = gpiobank_apply_vec(dev, (const struct gpiobank_update __user *)buf,
+							 cnt / sizeof(struct gpiobank_update), 0);
+	if (ret < 0)
+		return ret;
+	return ret * sizeof(struct gpiobank_update);
+}
+
+/*
+ * @description		: ioctl interface
+ * @param - filp 	: file structure
+ * @param - cmd 	: GPIOBANK_*_CMD
+ * @param - arg 	: user argument
+ * @return 			: 0 or number of applied updates on success, negative value on failure
+ */
+static long gpiobank_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct gpiobank_dev *dev = filp->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct gpiobank_update up;
+	struct gpiobank_batch batch;
+	struct gpiobank_state st;
+	u32 mask;
+
+	switch (cmd) {
+	case GPIOBANK_UPDATE_CMD:
+		if (copy_from_user(&up, uarg, sizeof(up)))
+			return -EFAULT;
+		gpiobank_apply(dev, &up);
+		return 0;
+	case GPIOBANK_BATCH_CMD:
+		if (copy_from_user(&batch, uarg, sizeof(batch)))
+			return -EFAULT;
+		if (batch.count == 0 || batch.count > GPIOBANK_BATCH_MAX ||
+			batch.period_ns > GPIOBANK_PERIOD_MAX)
+			return -EINVAL;
+		return gpiobank_apply_vec(dev, u64_to_user_ptr(batch.updates),
+								  batch.count, batch.period_ns);
+	case GPIOBANK_GET_CMD:
+		st.idr = readl(dev->base + GPIO_IDR);
+		st.odr = readl(dev->base + GPIO_ODR);
+		if (copy_to_user(uarg, &st, sizeof(st)))
+			return -EFAULT;
+		return 0;
+	case GPIOBANK_OUTPUT_CMD:
+		if (get_user(mask, (u32 __user *)uarg))
+			return -EFAULT;
+		gpiobank_config_output(dev, mask & GPIOBANK_PIN_MASK);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * @description		: Release the device
+ * @param - inode 	: inode passed to the driver
+ * @param - filp 	: file structure
+ * @return 			: 0 on success
+ */
+static int gpiobank_release(struct inode *inode, struct file *filp)
+{
+	return 0;
+}
+
+/* Device operations structure */
+static struct file_operations gpiobank_fops = {
+	.owner = THIS_MODULE,
+	.open = gpiobank_open,
+	.read = gpiobank_read,
+	.write = gpiobank_write,
+	.unlocked_ioctl = gpiobank_unlocked_ioctl,
+	.release = gpiobank_release,
+};
+
+/*
+ * @description		: Check the BSRR model on the fake bank: set, clear,
+ *					  set-priority and untouched pins
+ * @param - dev 	: gpiobank device (fake)
+ * @return 			: 0 on success, -EIO on mismatch
+ */
+static int gpiobank_selftest(struct gpiobank_dev *dev)
+{
+	static const struct {
+		struct gpiobank_update up;
+		u32 odr;
+	} steps[] = {
+		{ { 0x0001, 0x0000 }, 0x0001 },
+		{ { 0x00F0, 0x0001 }, 0x00F0 },
+		{ { 0x0000, 0x0030 }, 0x00C0 },
+		{ { 0x0100, 0x0100 }, 0x01C0 },	/* BS beats BR */
+		{ { 0xF0000, 0xF0000 }, 0x01C0 },	/* Bits above the bank are ignored */
+		{ { 0x0000, 0xFFFF }, 0x0000 },
+	};
+	int i;
+	u32 odr;
+
+	for (i = 0; i < ARRAY_SIZE(steps); i++) {
+		gpiobank_apply(dev, &steps[i].up);
+		odr = readl(dev->base + GPIO_ODR);
+		if (odr != steps[i].odr) {
+			printk("gpiobank: selftest step %d odr=0x%04x expected 0x%04x\r\n",
+				   i, odr, steps[i].odr);
+			return -EIO;
+		}
+	}
+	printk("gpiobank: selftest passed\r\n");
+	return 0;
+}
+
+/*
+ * @description		: Map the bank and enable its clock
+ * @param - dev 	: gpiobank device
+ * @return 			: 0 on success, negative value on failure
+ */
+static int gpiobank_map(struct gpiobank_dev *dev)
+{
+	void __iomem *rcc;
+
+	if (fake_mmio) {
+		dev->base = (void __iomem *)kzalloc(GPIO_BANK_SIZE, GFP_KERNEL);
+		if (!dev->base)
+			return -ENOMEM;
+		dev->fake = true;
+		return gpiobank_selftest(dev);
+	}
+
+	/* Enable the bank clock; RCC_MP_AHB4ENSETR is a set register */
+	rcc = ioremap(RCC_MP_AHB4ENSETR, 4);
+	if (!rcc)
+		return -ENOMEM;
+	writel(0x1 << bank_clk, rcc);
+	iounmap(rcc);
+
+	dev->base = ioremap(bank_base, GPIO_BANK_SIZE);
+	if (!dev->base)
+		return -ENOMEM;
+	return 0;
+}
+
+static void gpiobank_unmap(struct gpiobank_dev *dev)
+{
+	if (!dev->base)
+		return;
+	if (dev->fake)
+		kfree((void __force *)dev->base);
+	else
+		iounmap(dev->base);
+	dev->base = NULL;
+}
+
+/* Initialization function */
+static int __init gpiobank_init(void)
+{
+	int ret;
+
+	spin_lock_init(&gpiobank.lock);
+
+	ret = gpiobank_map(&gpiobank);
+	if (ret < 0)
+		goto fail_map;
+
+	/* Register character device driver */
+	if (gpiobank.major) {
+		gpiobank.devid = MKDEV(gpiobank.major, 0);
+		ret = register_chrdev_region(gpiobank.devid, GPIOBANK_CNT, GPIOBANK_NAME);
+		if (ret < 0) {
+			pr_err("cannot register %s char driver [ret=%d]\n", GPIOBANK_NAME, GPIOBANK_CNT);
+			goto fail_map;
+		}
+	} else {
+		ret = alloc_chrdev_region(&gpiobank.devid, 0, GPIOBANK_CNT, GPIOBANK_NAME);
+		if (ret < 0) {
+			pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", GPIOBANK_NAME, ret);
+			goto fail_map;
+		}
+		gpiobank.major = MAJOR(gpiobank.devid);
+		gpiobank.minor = MINOR(gpiobank.devid);
+	}
+
+	/* Initialize and add cdev */
+	gpiobank.cdev.owner = THIS_MODULE;
+	cdev_init(&gpiobank.cdev, &gpiobank_fops);
+	ret = cdev_add(&gpiobank.cdev, gpiobank.devid, GPIOBANK_CNT);
+	if (ret < 0)
+		goto del_unregister;
+
+	/* Create class */
+	gpiobank.class = class_create(THIS_MODULE, GPIOBANK_NAME);
+	if (IS_ERR(gpiobank.class)) {
+		ret = PTR_ERR(gpiobank.class);
+		goto del_cdev;
+	}
+
+	/* Create device */
+	gpiobank.device = device_create(gpiobank.class, NULL, gpiobank.devid, NULL, GPIOBANK_NAME);
+	if (IS_ERR(gpiobank.device)) {
+		ret = PTR_ERR(gpiobank.device);
+		goto destroy_class;
+	}
+
+	printk("gpiobank: bank 0x%08lx mapped%s\r\n", bank_base, gpiobank.fake ? " (fake)" : "");
+	return 0;
+
+destroy_class:
+	class_destroy(gpiobank.class);
+del_cdev:
+	cdev_del(&gpiobank.cdev);
+del_unregister:
+	unregister_chrdev_region(gpiobank.devid, GPIOBANK_CNT);
+fail_map:
+	gpiobank_unmap(&gpiobank);
+	return ret;
+}
+
+/* Exit function */
+static void __exit gpiobank_exit(void)
+{
+	device_destroy(gpiobank.class, gpiobank.devid);
+	class_destroy(gpiobank.class);
+	cdev_del(&gpiobank.cdev);
+	unregister_chrdev_region(gpiobank.devid, GPIOBANK_CNT);
+	gpiobank_unmap(&gpiobank);
+}
+
+module_init(gpiobank_init);
+module_exit(gpiobank_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
@@ -0,0 +1,50 @@
+#ifndef GPIOBANK_H
+#define GPIOBANK_H
+
+/*
+ * Userspace ABI shared by gpiobank.c and gpiobankApp.c.
+ * Every update is applied with one BSRR store: set_mask goes to BS[15:0],
+ * clear_mask goes to BR[15:0]. A pin present in both masks ends up set,
+ * because BS has priority over BR in the STM32 GPIO block.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+#define GPIOBANK_PINS		16
+#define GPIOBANK_PIN_MASK	0xFFFF
+#define GPIOBANK_BATCH_MAX	4096	/* Max updates per GPIOBANK_BATCH_CMD */
+#define GPIOBANK_PERIOD_MAX	100000	/* Max spacing between batch steps, ns */
+
+/* One atomic bank update */
+struct gpiobank_update {
+	__u32 set_mask;		/* Pins driven high */
+	__u32 clear_mask;	/* Pins driven low */
+};
+
+/* Vector of updates for bit-banged waveforms */
+struct gpiobank_batch {
+	__u64 updates;		/* User pointer to struct gpiobank_update[] */
+	__u32 count;		/* Number of updates */
+	__u32 period_ns;	/* Spacing between two updates, 0 = back to back */
+};
+
+/* Snapshot of the bank */
+struct gpiobank_state {
+	__u32 idr;			/* Input data register */
+	__u32 odr;			/* Output data register */
+};
+
+#define GPIOBANK_UPDATE_CMD		(_IOW(0XEF, 0x10, struct gpiobank_update))
+#define GPIOBANK_BATCH_CMD		(_IOW(0XEF, 0x11, struct gpiobank_batch))
+#define GPIOBANK_GET_CMD		(_IOR(0XEF, 0x12, struct gpiobank_state))
+#define GPIOBANK_OUTPUT_CMD		(_IOW(0XEF, 0x13, __u32))	/* Configure masked pins as push-pull outputs */
+
+#endif
@@ -0,0 +1,90 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <sys/ioctl.h>
+#include "gpiobank.h"
+
+/*
+ * Usage:
+ *   ./gpiobankApp /dev/gpiobank output <mask>
+ *   ./gpiobankApp /dev/gpiobank set <set_mask> <clear_mask>
+ *   ./gpiobankApp /dev/gpiobank get
+ *   ./gpiobankApp /dev/gpiobank wave <mask> <cycles> <period_ns>
+ */
+int main(int argc, char *argv[])
+{
+	int fd, ret = 0;
+	char *filename;
+	struct gpiobank_update up;
+	struct gpiobank_state st;
+	struct gpiobank_batch batch;
+	struct gpiobank_update *wave;
+	unsigned int mask, cycles, i;
+
+	if (argc < 3) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	filename = argv[1];
+
+	fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		printf("Can't open file %s\r\n", filename);
+		return -1;
+	}
+
+	if (!strcmp(argv[2], "output") && argc == 4) {
+		mask = strtoul(argv[3], NULL, 0);
+		ret = ioctl(fd, GPIOBANK_OUTPUT_CMD, &mask);
+	} else if (!strcmp(argv[2], "set") && argc == 5) {
+		up.set_mask = strtoul(argv[3], NULL, 0);
+		up.clear_mask = strtoul(argv[4], NULL, 0);
+		ret = ioctl(fd, GPIOBANK_UPDATE_CMD, &up);
+	} else if (!strcmp(argv[2], "get")) {
+		ret = ioctl(fd, GPIOBANK_GET_CMD, &st);
+		if (ret == 0)
+			printf("IDR = 0x%04x, ODR = 0x%04x\r\n", st.idr, st.odr);
+	} else if (!strcmp(argv[2], "wave") && argc == 6) {
+		/* Square wave on the masked pins, two BSRR stores per cycle */
+		mask = strtoul(argv[3], NULL, 0);
+		cycles = strtoul(argv[4], NULL, 0);
+		if (cycles == 0 || cycles * 2 > GPIOBANK_BATCH_MAX) {
+			printf("cycles must be 1..%d\r\n", GPIOBANK_BATCH_MAX / 2);
+			close(fd);
+			return -1;
+		}
+		wave = malloc(cycles * 2 * sizeof(*wave));
+		if (wave == NULL) {
+			close(fd);
+			return -1;
+		}
+		for (i = 0; i < cycles; i++) {
+			wave[i * 2].set_mask = mask;
+			wave[i * 2].clear_mask = 0;
+			wave[i * 2 + 1].set_mask = 0;
+			wave[i * 2 + 1].clear_mask = mask;
+		}
+		batch.updates = (uintptr_t)wave;
+		batch.count = cycles * 2;
+		batch.period_ns = strtoul(argv[5], NULL, 0);
+		ret = ioctl(fd, GPIOBANK_BATCH_CMD, &batch);
+		if (ret >= 0)
+			printf("%d updates applied\r\n", ret);
+		free(wave);
+	} else {
+		printf("Error Usage!\r\n");
+		close(fd);
+		return -1;
+	}
+
+	if (ret < 0)
+		perror("gpiobank");
+
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,420 @@
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/ide.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/gpio.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <asm/uaccess.h>
+#include <asm/io.h>
+#include "lockbench.h"
+
+#define LOCKBENCH_NAME		"lockbench"
+#define LEDOFF 				0
+#define LEDON 				1
+
+static int led_gpio = -1;
+module_param(led_gpio, int, 0444);
+MODULE_PARM_DESC(led_gpio, "GPIO driven by state updates, -1 to benchmark the locking alone");
+
+static const char * const lockbench_names[LOCKBENCH_MODES] = {
+	"atomic", "spinlock", "semaphore", "mutex", "rwsem", "seqlock", "rcu",
+};
+
+/* LED state guarded by the primitive under test */
+struct lockbench_state {
+	u8 stat;
+	u64 writes;
+	struct rcu_head rcu;
+};
+
+/* One minor per primitive */
+struct lockbench_dev {
+	int mode;								/* enum lockbench_mode */
+	struct device *device;
+	atomic_t lock;							/* LOCKBENCH_ATOMIC */
+	spinlock_t spin;						/* LOCKBENCH_SPINLOCK, RCU updaters */
+	int dev_stats;							/* LOCKBENCH_SPINLOCK open count */
+	struct semaphore sem;					/* LOCKBENCH_SEMAPHORE */
+	struct mutex mtx;						/* LOCKBENCH_MUTEX */
+	struct rw_semaphore rwsem;				/* LOCKBENCH_RWSEM */
+	seqlock_t seqlock;						/* LOCKBENCH_SEQLOCK */
+	struct lockbench_state state;			/* All modes but RCU */
+	struct lockbench_state __rcu *rcu_state;	/* LOCKBENCH_RCU */
+	atomic64_t opens;
+	atomic64_t busy;
+};
+
+struct lockbench_ctl {
+	dev_t devid;
+	struct cdev cdev;
+	struct class *class;
+	int major;
+	struct lockbench_dev devs[LOCKBENCH_MODES];
+};
+
+static struct lockbench_ctl lockbench;
+
+/*
+ * @description		: Open handler, takes the exclusive lock for the
+ *					  atomic/spinlock/semaphore/mutex minors
+ * @param - inode 	: inode, the minor selects the primitive
+ * @param - filp 	: file structure
+ * @return 			: 0 on success, -EBUSY or -ERESTARTSYS on failure
+ */
+static int lockbench_open(struct inode *inode, struct file *filp)
+{
+	struct lockbench_dev *dev = &lockbench.devs[iminor(inode)];
+	unsigned long flags;
+
+	switch (dev->mode) {
+	case LOCKBENCH_ATOMIC:
+		if (!atomic_dec_and_test(&dev->lock)) {
+			atomic_inc(&dev->lock);
+			atomic64_inc(&dev->busy);
+			return -EBUSY;
+		}
+		break;
+	case LOCKBENCH_SPINLOCK:
+		spin_lock_irqsave(&dev->spin, flags);
+		if (dev->dev_stats) {
+			spin_unlock_irqrestore(&dev->spin, flags);
+			atomic64_inc(&dev->busy);
+			return -EBUSY;
+		}
+		dev->dev_stats++;
+		spin_unlock_irqrestore(&dev->spin, flags);
+		break;
+	case LOCKBENCH_SEMAPHORE:
+		if (down_interruptible(&dev->sem))
+			return -ERESTARTSYS;
+		break;
+	case LOCKBENCH_MUTEX:
+		if (mutex_lock_interruptible(&dev->mtx))
+			return -ERESTARTSYS;
+		break;
+	default:
+		break;
+	}
+
+	atomic64_inc(&dev->opens);
+	filp->private_data = dev;
+	return 0;
+}
+
+/*
+ * @description		: Take a consistent snapshot of the LED state
+ * @param - dev 	: lockbench device
+ * @param - snap 	: output snapshot
+ * @return 			: none
+ */
+static void lockbench_snapshot(struct lockbench_dev *dev, struct lockbench_state *snap)
+{
+	struct lockbench_state *p;
+	unsigned int seq;
+
+	switch (dev->mode) {
+	case LOCKBENCH_RWSEM:
+		down_read(&dev->rwsem);
+		*snap = dev->state;
+		up_read(&dev->rwsem);
+		break;
+	case LOCKBENCH_SEQLOCK:
+		do {
+			seq = read_seqbegin(&dev->seqlock);
+			*snap = dev->state;
+		} while (read_seqretry(&dev->seqlock, seq));
+		break;
+	case LOCKBENCH_RCU:
+		rcu_read_lock();
+		p = rcu_dereference(dev->rcu_state);
+		*snap = *p;
+		rcu_read_unlock();
+		break;
+	default:
+		/* Exclusive minors: the open() lock already serialises us */
+		*snap = dev->state;
+		break;
+	}
+}
+
+/*
+ * @description		: Update the LED state
+ * @param - dev 	: lockbench device
+ * @param - stat 	: LEDON or LEDOFF
+ * @return 			: 0 on success, negative value on failure
+ */
+static int lockbench_update(struct lockbench_dev *dev, u8 stat)
+{
+	struct lockbench_state *new, *old;
+
+	switch (dev->mode) {
+	case LOCKBENCH_RWSEM:
+		down_write(&dev->rwsem);
+		dev->state.stat = stat;
+		dev->state.writes++;
+		up_write(&dev->rwsem);
+		break;
+	case LOCKBENCH_SEQLOCK:
+		write_seqlock(&dev->seqlock);
+		dev->state.stat = stat;
+		dev->state.writes++;
+		write_sequnlock(&dev->seqlock);
+		break;
+	case LOCKBENCH_RCU:
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+		spin_lock(&dev->spin);
+		old = rcu_dereference_protected(dev->rcu_state, lockdep_is_held(&dev->spin));
+		new->stat = stat;
+		new->writes = old->writes + 1;
+		rcu_assign_pointer(dev->rcu_state, new);
+		spin_unlock(&dev->spin);
+		kfree_rcu(old, rcu);
+		break;
+	default:
+		dev->state.stat = stat;
+		dev->state.writes++;
+		break;
+	}
+
+	if (gpio_is_valid(led_gpio))
+		gpio_set_value(led_gpio, stat == LEDON ? 0 : 1);
+	return 0;
+}
+
+/*
+ * @description		: Read the LED status (struct lockbench_status)
+ * @param - filp 	: file structure
+ * @param - buf 	: user buffer
+ * @param - cnt 	: buffer length
+ * @param - offt 	: file offset, ignored so the status can be re-read
+ * @return 			: number of bytes read, negative value on failure
+ */
+static ssize_t lockbench_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
+{
+	struct lockbench_dev *dev = filp->private_data;
+	struct lockbench_state snap;
+	struct lockbench_status st;
+
+	if (cnt < sizeof(st))
+		return -EINVAL;
+
+	lockbench_snapshot(dev, &snap);
+	st.mode = dev->mode;
+	st.stat = snap.stat;
+	st.writes = snap.writes;
+	st.opens = atomic64_read(&dev->opens);
+	st.busy = atomic64_read(&dev->busy);
+
+	if (copy_to_user(buf, &st, sizeof(st)))
+		return -EFAULT;
+	return sizeof(st);
+}
+
+/*
+ * @description		: Write one byte, LEDON or LEDOFF
+ * @param - filp 	: file structure
+ * @param - buf 	: user data
+ * @param - cnt 	: data length
+ * @param - offt 	: file offset
+ * @return 			: number of bytes consumed, negative value on failure
+ */
+static ssize_t lockbench_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
+{
+	struct lockbench_dev *dev = filp->private_data;
+	unsigned char ledstat;
+	int ret;
+
+	if (cnt < 1)
+		return -EINVAL;
+	if (get_user(ledstat, buf))
+		return -EFAULT;
+	if (ledstat != LEDON && ledstat != LEDOFF)
+		return -EINVAL;
+
+	ret = lockbench_update(dev, ledstat);
+	if (ret < 0)
+		return ret;
+	return 1;
+}
+
+/*
+ * @description		: Release handler, drops the exclusive lock
+ * @param - inode 	: inode
+ * @param - filp 	: file structure
+ * @return 			: 0 on success
+ */
+static int lockbench_release(struct inode *inode, struct file *filp)
+{
+	struct lockbench_dev *dev = filp->private_data;
+	unsigned long flags;
+
+	switch (dev->mode) {
+	case LOCKBENCH_ATOMIC:
+		atomic_inc(&dev->lock);
+		break;
+	case LOCKBENCH_SPINLOCK:
+		spin_lock_irqsave(&dev->spin, flags);
+		if (dev->dev_stats)
+			dev->dev_stats--;
+		spin_unlock_irqrestore(&dev->spin, flags);
+		break;
+	case LOCKBENCH_SEMAPHORE:
+		up(&dev->sem);
+		break;
+	case LOCKBENCH_MUTEX:
+		mutex_unlock(&dev->mtx);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static struct file_operations lockbench_fops = {
+	.owner = THIS_MODULE,
+	.open = lockbench_open,
+	.read = lockbench_read,
+	.write = lockbench_write,
+	.release = lockbench_release,
+};
+
+/*
+ * @description		: Initialise every primitive of one minor
+ * @param - dev 	: lockbench device
+ * @param - mode 	: enum lockbench_mode
+ * @return 			: 0 on success, negative value on failure
+ */
+static int lockbench_dev_init(struct lockbench_dev *dev, int mode)
+{
+	struct lockbench_state *st;
+
+	dev->mode = mode;
+	atomic_set(&dev->lock, 1);
+	spin_lock_init(&dev->spin);
+	sema_init(&dev->sem, 1);
+	mutex_init(&dev->mtx);
+	init_rwsem(&dev->rwsem);
+	seqlock_init(&dev->seqlock);
+	atomic64_set(&dev->opens, 0);
+	atomic64_set(&dev->busy, 0);
+	dev->state.stat = LEDOFF;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+	st->stat = LEDOFF;
+	RCU_INIT_POINTER(dev->rcu_state, st);
+	return 0;
+}
+
+static void lockbench_free_states(void)
+{
+	int i;
+
+	for (i = 0; i < LOCKBENCH_MODES; i++)
+		kfree(rcu_dereference_protected(lockbench.devs[i].rcu_state, 1));
+}
+
+static int __init lockbench_init(void)
+{
+	int ret, i;
+
+	for (i = 0; i < LOCKBENCH_MODES; i++) {
+		ret = lockbench_dev_init(&lockbench.devs[i], i);
+		if (ret < 0)
+			goto free_states;
+	}
+
+	if (gpio_is_valid(led_gpio)) {
+		ret = gpio_request(led_gpio, "led");
+		if (ret) {
+			printk("lockbench: Failed to request led-gpio\n");
+			goto free_states;
+		}
+		gpio_direction_output(led_gpio, 1);
+	}
+
+	ret = alloc_chrdev_region(&lockbench.devid, 0, LOCKBENCH_MODES, LOCKBENCH_NAME);
+	if (ret < 0) {
+		pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", LOCKBENCH_NAME, ret);
+		goto free_gpio;
+	}
+	lockbench.major = MAJOR(lockbench.devid);
+
+	lockbench.cdev.owner = THIS_MODULE;
+	cdev_init(&lockbench.cdev, &lockbench_fops);
+	ret = cdev_add(&lockbench.cdev, lockbench.devid, LOCKBENCH_MODES);
+	if (ret < 0)
+		goto del_unregister;
+
+	lockbench.class = class_create(THIS_MODULE, LOCKBENCH_NAME);
+	if (IS_ERR(lockbench.class)) {
+		ret = PTR_ERR(lockbench.class);
+		goto del_cdev;
+	}
+
+	/* /dev/lockbench_atomic, /dev/lockbench_spinlock, ... */
+	for (i = 0; i < LOCKBENCH_MODES; i++) {
+		lockbench.devs[i].device = device_create(lockbench.class, NULL,
+							MKDEV(lockbench.major, i), NULL,
+							LOCKBENCH_NAME "_%s", lockbench_names[i]);
+		if (IS_ERR(lockbench.devs[i].device)) {
+			ret = PTR_ERR(lockbench.devs[i].device);
+			goto destroy_devices;
+		}
+	}
+	return 0;
+
+destroy_devices:
+	while (--i >= 0)
+		device_destroy(lockbench.class, MKDEV(lockbench.major, i));
+	class_destroy(lockbench.class);
+del_cdev:
+	cdev_del(&lockbench.cdev);
+del_unregister:
+	unregister_chrdev_region(lockbench.devid, LOCKBENCH_MODES);
+free_gpio:
+	if (gpio_is_valid(led_gpio))
+		gpio_free(led_gpio);
+free_states:
+	lockbench_free_states();
+	return ret;
+}
+
+static void __exit lockbench_exit(void)
+{
+	int i;
+
+	for (i = 0; i < LOCKBENCH_MODES; i++)
+		device_destroy(lockbench.class, MKDEV(lockbench.major, i));
+	class_destroy(lockbench.class);
+	cdev_del(&lockbench.cdev);
+	unregister_chrdev_region(lockbench.devid, LOCKBENCH_MODES);
+	if (gpio_is_valid(led_gpio)) {
+		gpio_set_value(led_gpio, 1);
+		gpio_free(led_gpio);
+	}
+
+	/* Wait for pending kfree_rcu() before the module text goes away */
+	rcu_barrier();
+	lockbench_free_states();
+}
+
+module_init(lockbench_init);
+module_exit(lockbench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
@@ -0,0 +1,40 @@
+#ifndef LOCKBENCH_H
+#define LOCKBENCH_H
+
+/*
+ * Userspace ABI shared by lockbench.c and lockbenchApp.c.
+ * Each minor of /dev/lockbench_* guards the same LED state with a
+ * different primitive. The first four reproduce the exclusive open() of
+ * 07_atomic .. 10_mutex; the last three allow any number of openers and
+ * protect only the state path, so read-mostly status queries can scale.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+enum lockbench_mode {
+	LOCKBENCH_ATOMIC = 0,	/* Exclusive open, atomic_t (07_atomic) */
+	LOCKBENCH_SPINLOCK,		/* Exclusive open, spinlock + counter (08_spinlock) */
+	LOCKBENCH_SEMAPHORE,	/* Exclusive open, binary semaphore (09_semaphore) */
+	LOCKBENCH_MUTEX,		/* Exclusive open, mutex (10_mutex) */
+	LOCKBENCH_RWSEM,		/* Shared open, state under rw_semaphore */
+	LOCKBENCH_SEQLOCK,		/* Shared open, state under seqlock */
+	LOCKBENCH_RCU,			/* Shared open, state published through RCU */
+	LOCKBENCH_MODES,
+};
+
+/* Returned by read() on every minor */
+struct lockbench_status {
+	__u32 mode;				/* enum lockbench_mode */
+	__u32 stat;				/* Current LED state, LEDON/LEDOFF */
+	__u64 writes;			/* State updates since load */
+	__u64 opens;			/* Successful open() calls */
+	__u64 busy;				/* open() calls rejected with -EBUSY */
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "lockbench.h"
+
+/*
+ * Contention benchmark for /dev/lockbench_*.
+ *
+ * Usage: ./lockbenchApp [-t threads] [-d seconds] [-m cycle|status] [-w N] <dev> [dev...]
+ *   cycle  : every operation is open() + write() + close(), as the LED
+ *            apps of 07_atomic .. 10_mutex do
+ *   status : every thread keeps the device open and issues read() status
+ *            queries, with one write() every N operations (-w, 0 = never)
+ *
+ * One line per device: throughput, Jain fairness index over the per-thread
+ * operation counts (1.0 = perfectly fair) and latency percentiles.
+ * -EBUSY results are counted separately and are not part of the latency.
+ */
+
+#define LEDOFF 			0
+#define LEDON 			1
+#define HIST_SUB_BITS	4						/* 16 sub-buckets per power of two, ~6% error */
+#define HIST_BUCKETS	(64 << HIST_SUB_BITS)
+
+enum { MODE_CYCLE, MODE_STATUS };
+
+struct worker {
+	pthread_t tid;
+	const char *path;
+	int mode;
+	int write_every;
+	unsigned long long ops;
+	unsigned long long busy;
+	unsigned long long errors;
+	unsigned int hist[HIST_BUCKETS];
+};
+
+static volatile int stop;
+static volatile int go;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Log-linear bucket: exponent in the high bits, next HIST_SUB_BITS mantissa bits below */
+static inline unsigned int hist_index(uint64_t v)
+{
+	unsigned int msb;
+
+	if (v < (1u << HIST_SUB_BITS))
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) |
+		   ((v >> (msb - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static inline uint64_t hist_value(unsigned int idx)
+{
+	unsigned int exp = idx >> HIST_SUB_BITS;
+	uint64_t mant = idx & ((1u << HIST_SUB_BITS) - 1);
+
+	if (exp == 0)
+		return mant;
+	return ((1ull << HIST_SUB_BITS) | mant) << (exp - 1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct lockbench_status st;
+	unsigned char databuf[1];
+	uint64_t t0, t1;
+	int fd = -1, ret;
+
+	if (w->mode == MODE_STATUS) {
+		fd = open(w->path, O_RDWR);
+		if (fd < 0) {
+			w->errors++;
+			return NULL;
+		}
+	}
+
+	while (!go)
+		;
+
+	while (!stop) {
+		databuf[0] = (w->ops & 1) ? LEDON : LEDOFF;
+		t0 = now_ns();
+		if (w->mode == MODE_CYCLE) {
+			fd = open(w->path, O_RDWR);
+			if (fd < 0) {
+				if (errno == EBUSY)
+					w->busy++;
+				else
+					w->errors++;
+				continue;
+			}
+			ret = write(fd, databuf, 1);
+			close(fd);
+		} else if (w->write_every && (w->ops % w->write_every) == 0) {
+			ret = write(fd, databuf, 1);
+		} else {
+			ret = read(fd, &st, sizeof(st));
+		}
+		t1 = now_ns();
+
+		if (ret < 0) {
+			w->errors++;
+			continue;
+		}
+		w->hist[hist_index(t1 - t0)]++;
+		w->ops++;
+	}
+
+	if (w->mode == MODE_STATUS)
+		close(fd);
+	return NULL;
+}
+
+static uint64_t percentile(const unsigned long long *hist, unsigned long long total, double p)
+{
+	unsigned long long target = (unsigned long long)(total * p), acc = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		acc += hist[i];
+		if (acc > target)
+			return hist_value(i);
+	}
+	return 0;
+}
+
+static int run_one(const char *path, int nthreads, int seconds, int mode, int write_every)
+{
+	struct worker *workers;
+	static unsigned long long hist[HIST_BUCKETS];
+	unsigned long long total = 0, busy = 0, errors = 0;
+	double sum = 0, sumsq = 0, fairness, elapsed;
+	uint64_t t0, max = 0;
+	int i, j;
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (workers == NULL)
+		return -1;
+
+	stop = 0;
+	go = 0;
+	for (i = 0; i < nthreads; i++) {
+		workers[i].path = path;
+		workers[i].mode = mode;
+		workers[i].write_every = write_every;
+		pthread_create(&workers[i].tid, NULL, worker_fn, &workers[i]);
+	}
+
+	t0 = now_ns();
+	go = 1;
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = (now_ns() - t0) / 1e9;
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < nthreads; i++) {
+		total += workers[i].ops;
+		busy += workers[i].busy;
+		errors += workers[i].errors;
+		sum += workers[i].ops;
+		sumsq += (double)workers[i].ops * workers[i].ops;
+		for (j = 0; j < HIST_BUCKETS; j++) {
+			hist[j] += workers[i].hist[j];
+			if (workers[i].hist[j] && hist_value(j) > max)
+				max = hist_value(j);
+		}
+	}
+	fairness = sumsq ? (sum * sum) / (nthreads * sumsq) : 0;
+
+	printf("%-28s threads=%d mode=%s ops/s=%.0f fairness=%.3f "
+		   "p50=%lluns p99=%lluns p99.9=%lluns max=%lluns busy=%llu errors=%llu\r\n",
+		   path, nthreads, mode == MODE_CYCLE ? "cycle" : "status", total / elapsed, fairness,
+		   (unsigned long long)percentile(hist, total, 0.50),
+		   (unsigned long long)percentile(hist, total, 0.99),
+		   (unsigned long long)percentile(hist, total, 0.999),
+		   (unsigned long long)max, busy, errors);
+
+	free(workers);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nthreads = 4, seconds = 5, mode = MODE_CYCLE, write_every = 100;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:m:w:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			mode = strcmp(optarg, "status") ? MODE_CYCLE : MODE_STATUS;
+			break;
+		case 'w':
+			write_every = atoi(optarg);
+			break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+
+	if (optind >= argc || nthreads <= 0 || seconds <= 0) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	for (; optind < argc; optind++)
+		run_one(argv[optind], nthreads, seconds, mode, write_every);
+
+	return 0;
+}
@@ -0,0 +1,213 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "stdlib.h"
+#include "string.h"
+
+/*
+ * Boot time report from a kernel log captured with initcall_debug.
+ *
+ * Boot with "initcall_debug" on the command line (add "printk.time=1" if
+ * timestamps are off), then save "dmesg > boot.log". With one log the tool
+ * lists the slowest initcalls and probes; with two logs (before / after a
+ * change) it prints the per-entry and total difference in milliseconds.
+ *
+ * Usage: ./boottimeApp [-n top] <before.log> [after.log]
+ *
+ * Recognised lines (Linux 5.4 format):
+ *   [    1.234567] initcall gt9147_i2c_driver_init+0x0/0x1000 [gt9147] returned 0 after 301234 usecs
+ *   [    1.234567] probe of 0-0014 returned 1 after 300987 usecs
+ * The boot end is the "Run /sbin/init" (or "Freeing unused kernel memory")
+ * timestamp, i.e. when userspace starts.
+ */
+
+#define NAME_LEN		64
+#define MAX_ENTRIES		4096
+
+enum { KIND_INITCALL, KIND_PROBE };
+static const char *kind_names[] = { "initcall", "probe" };
+
+struct entry {
+	char name[NAME_LEN];
+	int kind;
+	long usecs;
+};
+
+struct bootlog {
+	struct entry e[MAX_ENTRIES];
+	int cnt;
+	double end_s;			/* Timestamp of the hand-over to userspace */
+	long initcall_us;		/* Sum of all initcall durations */
+	long probe_us;			/* Sum of all probe durations */
+};
+
+static struct bootlog logs[2];
+
+static struct entry *find_entry(struct bootlog *log, const char *name, int kind)
+{
+	int i;
+
+	for (i = 0; i < log->cnt; i++)
+		if (log->e[i].kind == kind && !strcmp(log->e[i].name, name))
+			return &log->e[i];
+	return NULL;
+}
+
+/* The same driver may probe several devices: accumulate by name */
+static void add_entry(struct bootlog *log, const char *name, int kind, long usecs)
+{
+	struct entry *e = find_entry(log, name, kind);
+
+	if (e == NULL) {
+		if (log->cnt == MAX_ENTRIES)
+			return;
+		e = &log->e[log->cnt++];
+		snprintf(e->name, sizeof(e->name), "%s", name);
+		e->kind = kind;
+		e->usecs = 0;
+	}
+	e->usecs += usecs;
+	if (kind == KIND_INITCALL)
+		log->initcall_us += usecs;
+	else
+		log->probe_us += usecs;
+}
+
+static int parse_log(const char *path, struct bootlog *log)
+{
+	char line[512], name[NAME_LEN], *p, *plus;
+	double ts;
+	long usecs;
+	int ret;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Can't open file %s\r\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		p = line;
+		ts = -1;
+		if (*p == '[') {
+			ts = strtod(p + 1, NULL);
+			p = strchr(p, ']');
+			if (p == NULL)
+				continue;
+			p++;
+		}
+		while (*p == ' ')
+			p++;
+
+		if (sscanf(p, "initcall %63s", name) == 1 && strstr(p, " returned ")) {
+			p = strstr(p, " after ");
+			if (p == NULL || sscanf(p, " after %ld usecs", &usecs) != 1)
+				continue;
+			plus = strchr(name, '+');			/* Drop the +0x0/0x.. offset */
+			if (plus)
+				*plus = '\0';
+			add_entry(log, name, KIND_INITCALL, usecs);
+		} else if (sscanf(p, "probe of %63s returned %d after %ld usecs", name, &ret, &usecs) == 3) {
+			add_entry(log, name, KIND_PROBE, usecs);
+		} else if (ts >= 0 && (!strncmp(p, "Run ", 4) || !strncmp(p, "Freeing unused kernel memory", 28))) {
+			log->end_s = ts;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static int cmp_usecs(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	return (y->usecs > x->usecs) - (y->usecs < x->usecs);
+}
+
+static void report_one(struct bootlog *log, int top)
+{
+	int i;
+
+	qsort(log->e, log->cnt, sizeof(log->e[0]), cmp_usecs);
+	printf("userspace at %.3f s, initcalls %.1f ms, probes %.1f ms\r\n",
+		   log->end_s, log->initcall_us / 1000.0, log->probe_us / 1000.0);
+	for (i = 0; i < log->cnt && i < top; i++)
+		printf("%10.3f ms  %-8s %s\r\n", log->e[i].usecs / 1000.0,
+			   kind_names[log->e[i].kind], log->e[i].name);
+}
+
+static int cmp_delta(const void *a, const void *b)
+{
+	const long *x = a, *y = b;
+
+	/* Sort on the saved time, biggest saving first */
+	return (y[1] > x[1]) - (y[1] < x[1]);
+}
+
+static void report_diff(struct bootlog *before, struct bootlog *after, int top)
+{
+	long (*delta)[3];			/* { index in before, saved usecs, after usecs } */
+	struct entry *e;
+	int i, n = 0;
+
+	delta = calloc(before->cnt, sizeof(*delta));
+	if (delta == NULL)
+		return;
+
+	for (i = 0; i < before->cnt; i++) {
+		e = find_entry(after, before->e[i].name, before->e[i].kind);
+		delta[n][0] = i;
+		delta[n][2] = e ? e->usecs : 0;
+		delta[n][1] = before->e[i].usecs - delta[n][2];
+		n++;
+	}
+	qsort(delta, n, sizeof(*delta), cmp_delta);
+
+	printf("%12s %12s %12s\r\n", "before ms", "after ms", "saved ms");
+	for (i = 0; i < n && i < top; i++) {
+		e = &before->e[delta[i][0]];
+		printf("%12.3f %12.3f %12.3f  %-8s %s\r\n", e->usecs / 1000.0,
+			   delta[i][2] / 1000.0, delta[i][1] / 1000.0, kind_names[e->kind], e->name);
+	}
+	printf("initcalls: %.1f -> %.1f ms, saved %.1f ms\r\n", before->initcall_us / 1000.0,
+		   after->initcall_us / 1000.0, (before->initcall_us - after->initcall_us) / 1000.0);
+	printf("probes   : %.1f -> %.1f ms, saved %.1f ms\r\n", before->probe_us / 1000.0,
+		   after->probe_us / 1000.0, (before->probe_us - after->probe_us) / 1000.0);
+	if (before->end_s > 0 && after->end_s > 0)
+		printf("userspace: %.3f -> %.3f s, saved %.1f ms\r\n", before->end_s, after->end_s,
+			   (before->end_s - after->end_s) * 1000.0);
+	free(delta);
+}
+
+int main(int argc, char *argv[])
+{
+	int top = 20, opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			top = atoi(optarg);
+			break;
+		default:
+			printf("Error Usage!\r\n");
+			return -1;
+		}
+	}
+	if (optind >= argc || argc - optind > 2) {
+		printf("Error Usage!\r\n");
+		return -1;
+	}
+
+	if (parse_log(argv[optind], &logs[0]) < 0)
+		return -1;
+	if (argc - optind == 1) {
+		report_one(&logs[0], top);
+		return 0;
+	}
+
+	if (parse_log(argv[optind + 1], &logs[1]) < 0)
+		return -1;
+	report_diff(&logs[0], &logs[1], top);
+	return 0;
+}
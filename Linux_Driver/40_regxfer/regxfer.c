@@ -0,0 +1,395 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/i2c.h>
+#include <linux/spi/spi.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "regxfer.h"
+
+/*
+ * Combined-transaction register access for I2C and SPI sensors, see
+ * regxfer.h.
+ *
+ * Op i of a sequence owns bytes [off, off + reg_bytes + len) of both
+ * bounce buffers: the address and any write data are laid out in txbuf,
+ * read data comes back in rxbuf at the same offset. I2C sends a write op as
+ * one message and a read op as an address write plus a read message; SPI
+ * sends every op as one full-duplex transfer with chip select released
+ * after it. Adapters without plain I2C (i2c-stub, SMBus-only controllers)
+ * fall back to one SMBus call per register block, which is slower but
+ * lets the drivers run there unchanged.
+ */
+
+static struct dentry *regxfer_root;
+
+/* Address bytes of one op, MSB first, read/write flag in the first byte */
+static u8 *regxfer_put_addr(struct regxfer *rx, u8 *p, const struct regxfer_op *op)
+{
+	u8 flag = op->read ? rx->cfg.read_flag : rx->cfg.write_flag;
+
+	if (rx->cfg.reg_bytes == 2) {
+		*p++ = (op->reg >> 8) | flag;
+		*p++ = op->reg & 0xff;
+	} else {
+		*p++ = op->reg | flag;
+	}
+	return p;
+}
+
+static int regxfer_i2c_run(struct regxfer *rx, const struct regxfer_op *ops, int n,
+			   int *calls)
+{
+	struct i2c_client *client = rx->client;
+	struct i2c_msg *msg = rx->msgs;
+	u16 flags = (client->flags & I2C_M_TEN) | I2C_M_DMA_SAFE;
+	unsigned int off = 0;
+	int i, nmsg = 0, ret;
+
+	for (i = 0; i < n; i++) {
+		u8 *p = regxfer_put_addr(rx, rx->txbuf + off, &ops[i]);
+
+		msg[nmsg].addr = client->addr;
+		msg[nmsg].flags = flags;
+		msg[nmsg].buf = rx->txbuf + off;
+		if (ops[i].read) {
+			/* Address write, then a repeated START into the read */
+			msg[nmsg++].len = rx->cfg.reg_bytes;
+			msg[nmsg].addr = client->addr;
+			msg[nmsg].flags = flags | I2C_M_RD;
+			msg[nmsg].buf = rx->rxbuf + off + rx->cfg.reg_bytes;
+			msg[nmsg++].len = ops[i].len;
+		} else {
+			memcpy(p, ops[i].buf, ops[i].len);
+			msg[nmsg++].len = rx->cfg.reg_bytes + ops[i].len;
+		}
+		off += rx->cfg.reg_bytes + ops[i].len;
+	}
+
+	*calls = 1;
+	ret = i2c_transfer(client->adapter, msg, nmsg);
+	if (ret == nmsg)
+		return 0;
+	return ret < 0 ? ret : -EREMOTEIO;
+}
+
+static int regxfer_spi_run(struct regxfer *rx, const struct regxfer_op *ops, int n,
+			   int *calls)
+{
+	struct spi_transfer *t = rx->msgs;
+	struct spi_message m;
+	unsigned int off = 0;
+	int i;
+
+	spi_message_init(&m);
+	for (i = 0; i < n; i++) {
+		u8 *p = regxfer_put_addr(rx, rx->txbuf + off, &ops[i]);
+
+		if (ops[i].read)
+			memset(p, 0, ops[i].len);		/* Dummy bytes clocked out during the read */
+		else
+			memcpy(p, ops[i].buf, ops[i].len);
+
+		memset(&t[i], 0, sizeof(t[i]));
+		t[i].tx_buf = rx->txbuf + off;
+		t[i].rx_buf = ops[i].read ? rx->rxbuf + off : NULL;
+		t[i].len = rx->cfg.reg_bytes + ops[i].len;
+		t[i].cs_change = i < n - 1;			/* Each op is its own register access */
+		spi_message_add_tail(&t[i], &m);
+		off += t[i].len;
+	}
+
+	*calls = 1;
+	return spi_sync(rx->spi, &m);
+}
+
+/*
+ * One SMBus call per block of up to 32 registers, 8-bit addresses only.
+ * Reads land in rxbuf at the op's offset like on the other buses.
+ */
+static int regxfer_smbus_run(struct regxfer *rx, const struct regxfer_op *ops, int n,
+			     int *calls)
+{
+	struct i2c_client *client = rx->client;
+	bool block = i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_I2C_BLOCK);
+	unsigned int done, chunk, off = 0;
+	int i, ret;
+	u8 *buf, cmd;
+
+	*calls = 0;
+	for (i = 0; i < n; i++) {
+		buf = ops[i].read ? rx->rxbuf + off + rx->cfg.reg_bytes : ops[i].buf;
+		off += rx->cfg.reg_bytes + ops[i].len;
+		for (done = 0; done < ops[i].len; done += chunk) {
+			chunk = block ? min_t(unsigned int, ops[i].len - done, I2C_SMBUS_BLOCK_MAX) : 1;
+			cmd = (ops[i].reg + done) |
+			      (ops[i].read ? rx->cfg.read_flag : rx->cfg.write_flag);
+
+			if (ops[i].read && chunk == 1) {
+				ret = i2c_smbus_read_byte_data(client, cmd);
+				if (ret >= 0) {
+					buf[done] = ret;
+					ret = 0;
+				}
+			} else if (ops[i].read) {
+				ret = i2c_smbus_read_i2c_block_data(client, cmd, chunk, buf + done);
+				if (ret >= 0)
+					ret = ret == chunk ? 0 : -EIO;
+			} else if (chunk == 1) {
+				ret = i2c_smbus_write_byte_data(client, cmd, buf[done]);
+			} else {
+				ret = i2c_smbus_write_i2c_block_data(client, cmd, chunk, buf + done);
+			}
+			(*calls)++;
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * regxfer_run - Run a sequence of register reads and writes as one transaction
+ * @rx: Context from devm_regxfer_init_i2c() or devm_regxfer_init_spi()
+ * @ops: The sequence, executed in order
+ * @n: Number of ops, at most cfg.max_ops
+ *
+ * Read data is copied to the callers' buffers only if the whole
+ * transaction succeeded. May sleep.
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int regxfer_run(struct regxfer *rx, const struct regxfer_op *ops, int n)
+{
+	unsigned int bytes = 0, off = 0;
+	int i, calls = 0, ret;
+	ktime_t t0;
+	u64 ns;
+
+	if (n < 1 || n > rx->cfg.max_ops)
+		return -EINVAL;
+	for (i = 0; i < n; i++)
+		bytes += rx->cfg.reg_bytes + ops[i].len;
+	if (bytes > rx->cfg.max_bytes)
+		return -EINVAL;
+
+	mutex_lock(&rx->lock);
+	t0 = ktime_get();
+	if (rx->spi)
+		ret = regxfer_spi_run(rx, ops, n, &calls);
+	else if (i2c_check_functionality(rx->client->adapter, I2C_FUNC_I2C))
+		ret = regxfer_i2c_run(rx, ops, n, &calls);
+	else
+		ret = regxfer_smbus_run(rx, ops, n, &calls);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	rx->st.xfers += calls;
+	rx->st.ops += n;
+	rx->st.bytes += bytes;
+	rx->st.sum_ns += ns;
+	if (ns > rx->st.max_ns)
+		rx->st.max_ns = ns;
+
+	if (ret) {
+		rx->st.errors++;
+	} else {
+		for (i = 0; i < n; i++) {
+			if (ops[i].read)
+				memcpy(ops[i].buf, rx->rxbuf + off + rx->cfg.reg_bytes, ops[i].len);
+			off += rx->cfg.reg_bytes + ops[i].len;
+		}
+	}
+	mutex_unlock(&rx->lock);
+
+	if (ret)
+		dev_err_ratelimited(rx->dev, "%d register op(s) from 0x%x failed: %d\n",
+				    n, ops[0].reg, ret);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(regxfer_run);
+
+int regxfer_read(struct regxfer *rx, unsigned int reg, void *buf, u16 len)
+{
+	struct regxfer_op op = REGXFER_READ(reg, buf, len);
+
+	return regxfer_run(rx, &op, 1);
+}
+EXPORT_SYMBOL_GPL(regxfer_read);
+
+int regxfer_write(struct regxfer *rx, unsigned int reg, const void *buf, u16 len)
+{
+	struct regxfer_op op = REGXFER_WRITE(reg, buf, len);
+
+	return regxfer_run(rx, &op, 1);
+}
+EXPORT_SYMBOL_GPL(regxfer_write);
+
+int regxfer_write_u8(struct regxfer *rx, unsigned int reg, u8 val)
+{
+	return regxfer_write(rx, reg, &val, 1);
+}
+EXPORT_SYMBOL_GPL(regxfer_write_u8);
+
+void regxfer_get_stats(struct regxfer *rx, struct regxfer_stats *st)
+{
+	mutex_lock(&rx->lock);
+	*st = rx->st;
+	mutex_unlock(&rx->lock);
+}
+EXPORT_SYMBOL_GPL(regxfer_get_stats);
+
+void regxfer_reset_stats(struct regxfer *rx)
+{
+	mutex_lock(&rx->lock);
+	memset(&rx->st, 0, sizeof(rx->st));
+	mutex_unlock(&rx->lock);
+}
+EXPORT_SYMBOL_GPL(regxfer_reset_stats);
+
+static int regxfer_stats_show(struct seq_file *m, void *v)
+{
+	struct regxfer *rx = m->private;
+	struct regxfer_stats st;
+
+	regxfer_get_stats(rx, &st);
+	seq_printf(m, "xfers %llu\nops %llu\nbytes %llu\nerrors %llu\n",
+		   st.xfers, st.ops, st.bytes, st.errors);
+	seq_printf(m, "avg_us %llu\nmax_us %llu\n",
+		   st.xfers ? div64_u64(st.sum_ns, st.xfers * NSEC_PER_USEC) : 0,
+		   div_u64(st.max_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static int regxfer_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, regxfer_stats_show, inode->i_private);
+}
+
+/* Any write resets the counters */
+static ssize_t regxfer_stats_write(struct file *file, const char __user *buf,
+				   size_t cnt, loff_t *off)
+{
+	regxfer_reset_stats(((struct seq_file *)file->private_data)->private);
+	return cnt;
+}
+
+static const struct file_operations regxfer_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= regxfer_stats_open,
+	.read		= seq_read,
+	.write		= regxfer_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void regxfer_release(void *data)
+{
+	struct regxfer *rx = data;
+
+	debugfs_remove_recursive(rx->dir);
+	kfree(rx->txbuf);
+	kfree(rx->rxbuf);
+}
+
+static struct regxfer *regxfer_init(struct device *dev, const struct regxfer_config *cfg,
+				    size_t msg_size)
+{
+	struct regxfer *rx;
+	int ret;
+
+	if ((cfg->reg_bytes != 1 && cfg->reg_bytes != 2) || !cfg->max_ops ||
+	    cfg->max_bytes < cfg->reg_bytes)
+		return ERR_PTR(-EINVAL);
+
+	rx = devm_kzalloc(dev, sizeof(*rx), GFP_KERNEL);
+	if (!rx)
+		return ERR_PTR(-ENOMEM);
+	rx->dev = dev;
+	rx->cfg = *cfg;
+	mutex_init(&rx->lock);
+
+	rx->msgs = devm_kcalloc(dev, cfg->max_ops, msg_size, GFP_KERNEL);
+	if (!rx->msgs)
+		return ERR_PTR(-ENOMEM);
+
+	/*
+	 * Plain kmalloc, not devm_kmalloc: the controller may DMA straight
+	 * from and into these, so they get slab alignment and cache lines of
+	 * their own rather than sharing one with a devres header.
+	 */
+	rx->txbuf = kzalloc(cfg->max_bytes, GFP_KERNEL);
+	rx->rxbuf = kzalloc(cfg->max_bytes, GFP_KERNEL);
+	ret = devm_add_action_or_reset(dev, regxfer_release, rx);
+	if (ret)
+		return ERR_PTR(ret);
+	if (!rx->txbuf || !rx->rxbuf)
+		return ERR_PTR(-ENOMEM);
+
+	/* debugfs is optional, the counters work without it */
+	rx->dir = debugfs_create_dir(dev_name(dev), regxfer_root);
+	debugfs_create_file("stats", 0600, rx->dir, rx, &regxfer_stats_fops);
+	return rx;
+}
+
+/**
+ * devm_regxfer_init_i2c - Set up register access for an I2C client
+ * @client: The device
+ * @cfg: Address format and the largest sequence the driver will run
+ *
+ * Returns: The context or an ERR_PTR(); everything is released with the device
+ */
+struct regxfer *devm_regxfer_init_i2c(struct i2c_client *client,
+				      const struct regxfer_config *cfg)
+{
+	struct regxfer *rx;
+
+	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C) &&
+	    (cfg->reg_bytes != 1 ||
+	     !i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_BYTE_DATA)))
+		return ERR_PTR(-EOPNOTSUPP);
+
+	/* A read op takes two messages */
+	rx = regxfer_init(&client->dev, cfg, 2 * sizeof(struct i2c_msg));
+	if (!IS_ERR(rx))
+		rx->client = client;
+	return rx;
+}
+EXPORT_SYMBOL_GPL(devm_regxfer_init_i2c);
+
+/**
+ * devm_regxfer_init_spi - Set up register access for an SPI device
+ * @spi: The device
+ * @cfg: Address format and the largest sequence the driver will run
+ *
+ * Returns: The context or an ERR_PTR(); everything is released with the device
+ */
+struct regxfer *devm_regxfer_init_spi(struct spi_device *spi,
+				      const struct regxfer_config *cfg)
+{
+	struct regxfer *rx;
+
+	rx = regxfer_init(&spi->dev, cfg, sizeof(struct spi_transfer));
+	if (!IS_ERR(rx))
+		rx->spi = spi;
+	return rx;
+}
+EXPORT_SYMBOL_GPL(devm_regxfer_init_spi);
+
+static int __init regxfer_mod_init(void)
+{
+	regxfer_root = debugfs_create_dir("regxfer", NULL);
+	return 0;
+}
+
+static void __exit regxfer_mod_exit(void)
+{
+	debugfs_remove_recursive(regxfer_root);
+}
+
+module_init(regxfer_mod_init);
+module_exit(regxfer_mod_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");
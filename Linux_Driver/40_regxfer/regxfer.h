@@ -0,0 +1,84 @@
+#ifndef REGXFER_H
+#define REGXFER_H
+
+/*
+ * Register access helpers for small I2C and SPI sensors, implemented in
+ * regxfer.ko.
+ *
+ * A driver describes a sequence of register reads and writes as an array
+ * of struct regxfer_op and regxfer_run() turns the whole array into one
+ * bus transaction: one i2c_transfer() with repeated STARTs between the
+ * messages, or one spi_message with chip select toggled between the ops.
+ * The register addresses and the data travel through kmalloc'ed bounce
+ * buffers allocated once at init, so callers can pass stack buffers and
+ * nothing is allocated per call.
+ *
+ * Every context counts its transactions, ops, bus bytes and the time spent
+ * in the bus call, in /sys/kernel/debug/regxfer/<device>/stats (write to
+ * the file to reset it).
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+
+struct i2c_client;
+struct spi_device;
+struct device;
+struct dentry;
+
+struct regxfer_op {
+	unsigned int reg;				/* First register */
+	void *buf;						/* Read destination or write source */
+	u16 len;						/* Data bytes */
+	bool read;
+};
+
+#define REGXFER_READ(_reg, _buf, _len) \
+	{ .reg = (_reg), .buf = (_buf), .len = (_len), .read = true }
+#define REGXFER_WRITE(_reg, _buf, _len) \
+	{ .reg = (_reg), .buf = (void *)(_buf), .len = (_len), .read = false }
+
+struct regxfer_config {
+	u8 reg_bytes;					/* Register address width, 1 or 2 (sent MSB first) */
+	u8 read_flag;					/* OR'ed into the first address byte of reads (SPI) */
+	u8 write_flag;					/* OR'ed into the first address byte of writes */
+	u8 max_ops;						/* Longest regxfer_run() sequence */
+	u16 max_bytes;					/* Address + data bytes of the largest sequence */
+};
+
+struct regxfer_stats {
+	u64 xfers;						/* i2c_transfer()/spi_sync() calls */
+	u64 ops;
+	u64 bytes;						/* Address and data bytes on the bus */
+	u64 errors;
+	u64 sum_ns;						/* Time spent in the bus calls */
+	u64 max_ns;
+};
+
+struct regxfer {
+	struct device *dev;
+	struct i2c_client *client;		/* One of client and spi is set */
+	struct spi_device *spi;
+	struct regxfer_config cfg;
+	struct mutex lock;				/* Bounce buffers, message vector, stats */
+	u8 *txbuf;						/* cfg.max_bytes each, DMA safe */
+	u8 *rxbuf;
+	void *msgs;						/* i2c_msg or spi_transfer vector */
+	struct regxfer_stats st;
+	struct dentry *dir;
+};
+
+struct regxfer *devm_regxfer_init_i2c(struct i2c_client *client,
+				      const struct regxfer_config *cfg);
+struct regxfer *devm_regxfer_init_spi(struct spi_device *spi,
+				      const struct regxfer_config *cfg);
+
+int regxfer_run(struct regxfer *rx, const struct regxfer_op *ops, int n);
+int regxfer_read(struct regxfer *rx, unsigned int reg, void *buf, u16 len);
+int regxfer_write(struct regxfer *rx, unsigned int reg, const void *buf, u16 len);
+int regxfer_write_u8(struct regxfer *rx, unsigned int reg, u8 val);
+
+void regxfer_get_stats(struct regxfer *rx, struct regxfer_stats *st);
+void regxfer_reset_stats(struct regxfer *rx);
+
+#endif
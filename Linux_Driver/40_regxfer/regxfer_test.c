@@ -0,0 +1,448 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/platform_device.h>
+#include <linux/i2c.h>
+#include <linux/spi/spi.h>
+#include <linux/string.h>
+#include <linux/err.h>
+#include "regxfer.h"
+
+/*
+ * Self test of regxfer.ko, run once at load time.
+ *
+ * Registers a fake I2C adapter with two register-file slaves (0x50 with
+ * 8-bit and 0x51 with 16-bit register addresses, auto-increment) and a
+ * fake SPI controller with an ICM20608-style slave (bit 7 of the address
+ * byte selects a read, chip select starts a new access). The adapter and
+ * the controller count bus calls, messages and chip-select frames, so the
+ * tests check both the data and that a sequence really went out as one
+ * transaction.
+ *
+ * With i2c_bus=N the SMBus fallback is tested as well, against i2c-stub:
+ *   modprobe i2c-stub chip_addr=0x50
+ *   insmod regxfer_test.ko i2c_bus=<i2c-stub adapter number>
+ *
+ * The result goes to the kernel log; loading fails with -EINVAL if any
+ * check failed.
+ */
+
+#define RT_ADDR8		0x50
+#define RT_ADDR16		0x51
+#define RT_ADDR_NONE	0x52			/* Nobody answers */
+
+static int i2c_bus = -1;
+module_param(i2c_bus, int, 0444);
+MODULE_PARM_DESC(i2c_bus, "Adapter number of an i2c-stub instance, -1 = skip the SMBus test");
+
+static unsigned short stub_addr = 0x50;
+module_param(stub_addr, ushort, 0444);
+MODULE_PARM_DESC(stub_addr, "chip_addr given to i2c-stub");
+
+struct regxfer_test {
+	struct platform_device *pdev;
+	struct i2c_adapter adap;
+	struct spi_master *master;
+	u8 regs8[0x100];
+	u8 regs16[0x10000];
+	u8 ptr8;
+	u16 ptr16;
+	u8 spi_regs[0x80];
+	u8 spi_ptr;
+	bool spi_read;
+	int spi_pos;						/* Byte index in the current CS frame */
+	int i2c_calls, i2c_msgs, spi_frames;
+};
+
+static struct regxfer_test rt;
+static int rt_checks, rt_failed;
+
+#define RT_CHECK(cond) do {										\
+	rt_checks++;												\
+	if (!(cond)) {												\
+		rt_failed++;											\
+		pr_err("regxfer_test: %s:%d: %s\n", __func__, __LINE__, #cond);	\
+	}															\
+} while (0)
+
+static int rt_i2c_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	int i, j;
+
+	rt.i2c_calls++;
+	rt.i2c_msgs += num;
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *m = &msgs[i];
+		bool wide = m->addr == RT_ADDR16;
+
+		if (m->addr != RT_ADDR8 && m->addr != RT_ADDR16)
+			return -ENXIO;
+
+		if (m->flags & I2C_M_RD) {
+			for (j = 0; j < m->len; j++)
+				m->buf[j] = wide ? rt.regs16[rt.ptr16++] : rt.regs8[rt.ptr8++];
+		} else if (wide && m->len >= 2) {
+			rt.ptr16 = (m->buf[0] << 8) | m->buf[1];
+			for (j = 2; j < m->len; j++)
+				rt.regs16[rt.ptr16++] = m->buf[j];
+		} else if (!wide && m->len >= 1) {
+			rt.ptr8 = m->buf[0];
+			for (j = 1; j < m->len; j++)
+				rt.regs8[rt.ptr8++] = m->buf[j];
+		}
+	}
+	return num;
+}
+
+static u32 rt_i2c_func(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm rt_i2c_algo = {
+	.master_xfer	= rt_i2c_xfer,
+	.functionality	= rt_i2c_func,
+};
+
+/* level is the line level, false = asserted for our active-low slave */
+static void rt_spi_set_cs(struct spi_device *spi, bool level)
+{
+	if (!level) {
+		rt.spi_frames++;
+		rt.spi_pos = 0;
+	}
+}
+
+static int rt_spi_transfer_one(struct spi_master *master, struct spi_device *spi,
+			       struct spi_transfer *xfer)
+{
+	const u8 *tx = xfer->tx_buf;
+	u8 *rx = xfer->rx_buf;
+	unsigned int i;
+	u8 out;
+
+	for (i = 0; i < xfer->len; i++, rt.spi_pos++) {
+		if (rt.spi_pos == 0) {
+			rt.spi_read = tx[i] & 0x80;
+			rt.spi_ptr = tx[i] & 0x7f;
+			out = 0;
+		} else if (rt.spi_read) {
+			out = rt.spi_regs[rt.spi_ptr++ & 0x7f];
+		} else {
+			rt.spi_regs[rt.spi_ptr++ & 0x7f] = tx ? tx[i] : 0;
+			out = 0;
+		}
+		if (rx)
+			rx[i] = out;
+	}
+	return 0;
+}
+
+static void rt_fill(u8 *buf, int len, u8 seed)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = seed + i * 7;
+}
+
+/* Single reads and writes, then a mixed sequence in one i2c_transfer() */
+static void rt_test_i2c8(struct regxfer *rx)
+{
+	struct regxfer_stats st;
+	u8 w[4], r[4], a = 0x11, b = 0x22, c = 0x33, r2[3];
+	struct regxfer_op ops[] = {
+		REGXFER_WRITE(0x20, &a, 1),
+		REGXFER_WRITE(0x21, &b, 1),
+		REGXFER_WRITE(0x22, &c, 1),
+		REGXFER_READ(0x10, r, sizeof(r)),
+		REGXFER_READ(0x20, r2, sizeof(r2)),
+	};
+	int calls, msgs;
+
+	rt_fill(w, sizeof(w), 1);
+	RT_CHECK(regxfer_write(rx, 0x10, w, sizeof(w)) == 0);
+	RT_CHECK(!memcmp(&rt.regs8[0x10], w, sizeof(w)));
+	memset(r, 0, sizeof(r));
+	RT_CHECK(regxfer_read(rx, 0x10, r, sizeof(r)) == 0);
+	RT_CHECK(!memcmp(r, w, sizeof(w)));
+
+	regxfer_reset_stats(rx);
+	memset(r, 0, sizeof(r));
+	calls = rt.i2c_calls;
+	msgs = rt.i2c_msgs;
+	RT_CHECK(regxfer_run(rx, ops, ARRAY_SIZE(ops)) == 0);
+	RT_CHECK(rt.i2c_calls == calls + 1);
+	RT_CHECK(rt.i2c_msgs == msgs + 3 + 2 * 2);
+	RT_CHECK(!memcmp(r, w, sizeof(w)));
+	RT_CHECK(r2[0] == a && r2[1] == b && r2[2] == c);
+
+	regxfer_get_stats(rx, &st);
+	RT_CHECK(st.xfers == 1 && st.ops == 5 && st.errors == 0);
+	RT_CHECK(st.bytes == 5 + 3 + 4 + 3);
+}
+
+/* GT9147 style: a whole configuration block plus its checksum in one go */
+static void rt_test_i2c16(struct regxfer *rx)
+{
+	static u8 cfg[184], back[184];
+	u8 sum[2] = { 0x5a, 0x01 };
+	struct regxfer_op ops[] = {
+		REGXFER_WRITE(0x8047, cfg, sizeof(cfg)),
+		REGXFER_WRITE(0x80ff, sum, sizeof(sum)),
+	};
+	int calls = rt.i2c_calls;
+
+	rt_fill(cfg, sizeof(cfg), 3);
+	RT_CHECK(regxfer_run(rx, ops, ARRAY_SIZE(ops)) == 0);
+	RT_CHECK(rt.i2c_calls == calls + 1);
+	RT_CHECK(!memcmp(&rt.regs16[0x8047], cfg, sizeof(cfg)));
+	RT_CHECK(rt.regs16[0x80ff] == 0x5a && rt.regs16[0x8100] == 0x01);
+
+	RT_CHECK(regxfer_read(rx, 0x8047, back, sizeof(back)) == 0);
+	RT_CHECK(!memcmp(back, cfg, sizeof(cfg)));
+}
+
+/* Sequences beyond the configured size are refused before touching the bus */
+static void rt_test_limits(struct regxfer *rx, int max_ops, int max_bytes)
+{
+	static u8 big[512];
+	struct regxfer_op ops[8];
+	int i, calls = rt.i2c_calls;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++)
+		ops[i] = (struct regxfer_op)REGXFER_READ(i, big, 1);
+	RT_CHECK(regxfer_run(rx, ops, max_ops + 1) == -EINVAL);
+	RT_CHECK(regxfer_run(rx, ops, 0) == -EINVAL);
+	RT_CHECK(regxfer_read(rx, 0, big, max_bytes) == -EINVAL);
+	RT_CHECK(rt.i2c_calls == calls);
+}
+
+/* A NAK fails the whole sequence and leaves the read buffers alone */
+static void rt_test_i2c_error(struct regxfer *rx)
+{
+	struct regxfer_stats st;
+	u8 r[4];
+
+	memset(r, 0xaa, sizeof(r));
+	regxfer_reset_stats(rx);
+	RT_CHECK(regxfer_read(rx, 0x00, r, sizeof(r)) == -ENXIO);
+	RT_CHECK(r[0] == 0xaa && r[3] == 0xaa);
+	regxfer_get_stats(rx, &st);
+	RT_CHECK(st.xfers == 1 && st.errors == 1);
+}
+
+/* ICM20608 style init: four register accesses, one spi_sync(), four CS frames */
+static void rt_test_spi(struct regxfer *rx)
+{
+	u8 cfg[5] = { 0x00, 0x03, 0x18, 0x18, 0x03 }, data[14], id;
+	struct regxfer_op ops[] = {
+		REGXFER_WRITE(0x19, cfg, sizeof(cfg)),
+		REGXFER_WRITE(0x23, "\x00", 1),
+		REGXFER_WRITE(0x6a, "\x10", 1),
+		REGXFER_READ(0x75, &id, 1),
+	};
+	u64 msgs = rt.master->statistics.messages;
+	int frames = rt.spi_frames;
+
+	rt.spi_regs[0x75] = 0xaf;
+	RT_CHECK(regxfer_run(rx, ops, ARRAY_SIZE(ops)) == 0);
+	RT_CHECK(rt.master->statistics.messages == msgs + 1);
+	RT_CHECK(rt.spi_frames == frames + 4);
+	RT_CHECK(!memcmp(&rt.spi_regs[0x19], cfg, sizeof(cfg)));
+	RT_CHECK(rt.spi_regs[0x23] == 0x00 && rt.spi_regs[0x6a] == 0x10);
+	RT_CHECK(id == 0xaf);
+
+	rt_fill(&rt.spi_regs[0x3b], sizeof(data), 9);
+	RT_CHECK(regxfer_read(rx, 0x3b, data, sizeof(data)) == 0);
+	RT_CHECK(!memcmp(data, &rt.spi_regs[0x3b], sizeof(data)));
+}
+
+/* i2c-stub only speaks SMBus: one call per 32-byte block, no combining */
+static void rt_test_smbus(void)
+{
+	const struct regxfer_config cfg8 = { .reg_bytes = 1, .max_ops = 2, .max_bytes = 64 };
+	const struct regxfer_config cfg16 = { .reg_bytes = 2, .max_ops = 2, .max_bytes = 64 };
+	struct i2c_adapter *adap;
+	struct i2c_client *client;
+	struct regxfer_stats st;
+	struct regxfer *rx;
+	u8 w[40], r[40], v = 0x5c, rv = 0;
+	struct regxfer_op ops[] = {
+		REGXFER_WRITE(0x80, &v, 1),
+		REGXFER_READ(0x80, &rv, 1),
+	};
+	int blocks;
+
+	adap = i2c_get_adapter(i2c_bus);
+	if (!adap) {
+		pr_err("regxfer_test: no i2c adapter %d\n", i2c_bus);
+		rt_failed++;
+		return;
+	}
+	client = i2c_new_dummy_device(adap, stub_addr);
+	if (IS_ERR(client)) {
+		pr_err("regxfer_test: no client at 0x%02x: %ld\n", stub_addr, PTR_ERR(client));
+		rt_failed++;
+		goto put;
+	}
+
+	RT_CHECK(IS_ERR(devm_regxfer_init_i2c(client, &cfg16)));
+	rx = devm_regxfer_init_i2c(client, &cfg8);
+	RT_CHECK(!IS_ERR(rx));
+	if (IS_ERR(rx))
+		goto unregister;
+
+	blocks = i2c_check_functionality(adap, I2C_FUNC_SMBUS_I2C_BLOCK) ? 2 : sizeof(w);
+	rt_fill(w, sizeof(w), 5);
+	RT_CHECK(regxfer_write(rx, 0x00, w, sizeof(w)) == 0);
+	RT_CHECK(regxfer_read(rx, 0x00, r, sizeof(r)) == 0);
+	RT_CHECK(!memcmp(r, w, sizeof(w)));
+	regxfer_get_stats(rx, &st);
+	RT_CHECK(st.xfers == 2 * blocks && st.errors == 0);
+
+	/* i2c-stub cuts the second block short at 0xff: nothing reaches the caller */
+	if (blocks == 2) {
+		memset(r, 0xa5, sizeof(r));
+		RT_CHECK(regxfer_read(rx, 0xdc, r, sizeof(r)) == -EIO);
+		RT_CHECK(!memchr_inv(r, 0xa5, sizeof(r)));
+	}
+
+	regxfer_reset_stats(rx);
+	RT_CHECK(regxfer_run(rx, ops, ARRAY_SIZE(ops)) == 0);
+	RT_CHECK(rv == v);
+	regxfer_get_stats(rx, &st);
+	RT_CHECK(st.xfers == 2);
+
+unregister:
+	i2c_unregister_device(client);
+put:
+	i2c_put_adapter(adap);
+}
+
+static int rt_setup(void)
+{
+	int ret;
+
+	rt.pdev = platform_device_register_simple("regxfer_test", -1, NULL, 0);
+	if (IS_ERR(rt.pdev))
+		return PTR_ERR(rt.pdev);
+
+	rt.adap.owner = THIS_MODULE;
+	rt.adap.algo = &rt_i2c_algo;
+	rt.adap.dev.parent = &rt.pdev->dev;
+	strlcpy(rt.adap.name, "regxfer_test", sizeof(rt.adap.name));
+	ret = i2c_add_adapter(&rt.adap);
+	if (ret)
+		goto unregister_pdev;
+
+	rt.master = spi_alloc_master(&rt.pdev->dev, 0);
+	if (!rt.master) {
+		ret = -ENOMEM;
+		goto del_adapter;
+	}
+	rt.master->bus_num = -1;
+	rt.master->num_chipselect = 1;
+	rt.master->set_cs = rt_spi_set_cs;
+	rt.master->transfer_one = rt_spi_transfer_one;
+	ret = spi_register_master(rt.master);
+	if (ret) {
+		spi_master_put(rt.master);
+		goto del_adapter;
+	}
+	return 0;
+
+del_adapter:
+	i2c_del_adapter(&rt.adap);
+unregister_pdev:
+	platform_device_unregister(rt.pdev);
+	return ret;
+}
+
+static void rt_teardown(void)
+{
+	spi_unregister_master(rt.master);
+	i2c_del_adapter(&rt.adap);
+	platform_device_unregister(rt.pdev);
+}
+
+static int __init regxfer_test_init(void)
+{
+	const struct regxfer_config cfg8 = { .reg_bytes = 1, .max_ops = 5, .max_bytes = 32 };
+	const struct regxfer_config cfg16 = { .reg_bytes = 2, .max_ops = 2, .max_bytes = 256 };
+	const struct regxfer_config cfg_spi = {
+		.reg_bytes = 1, .read_flag = 0x80, .max_ops = 4, .max_bytes = 16,
+	};
+	struct spi_board_info info = {
+		.modalias = "regxfer_test",
+		.max_speed_hz = 1000000,
+	};
+	struct i2c_client *c8, *c16, *cnone;
+	struct spi_device *spi;
+	struct regxfer *rx;
+	int ret;
+
+	ret = rt_setup();
+	if (ret)
+		return ret;
+
+	c8 = i2c_new_dummy_device(&rt.adap, RT_ADDR8);
+	c16 = i2c_new_dummy_device(&rt.adap, RT_ADDR16);
+	cnone = i2c_new_dummy_device(&rt.adap, RT_ADDR_NONE);
+	spi = spi_new_device(rt.master, &info);
+	if (IS_ERR(c8) || IS_ERR(c16) || IS_ERR(cnone) || !spi) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	rx = devm_regxfer_init_i2c(c8, &cfg8);
+	RT_CHECK(!IS_ERR(rx));
+	if (!IS_ERR(rx)) {
+		rt_test_i2c8(rx);
+		rt_test_limits(rx, cfg8.max_ops, cfg8.max_bytes);
+	}
+
+	rx = devm_regxfer_init_i2c(c16, &cfg16);
+	RT_CHECK(!IS_ERR(rx));
+	if (!IS_ERR(rx))
+		rt_test_i2c16(rx);
+
+	rx = devm_regxfer_init_i2c(cnone, &cfg8);
+	RT_CHECK(!IS_ERR(rx));
+	if (!IS_ERR(rx))
+		rt_test_i2c_error(rx);
+
+	rx = devm_regxfer_init_spi(spi, &cfg_spi);
+	RT_CHECK(!IS_ERR(rx));
+	if (!IS_ERR(rx))
+		rt_test_spi(rx);
+
+	if (i2c_bus >= 0)
+		rt_test_smbus();
+
+	pr_info("regxfer_test: %d checks, %d failed%s\n", rt_checks, rt_failed,
+		i2c_bus >= 0 ? "" : " (SMBus fallback skipped, no i2c_bus=)");
+	ret = rt_failed ? -EINVAL : 0;
+
+out:
+	if (spi)
+		spi_unregister_device(spi);
+	if (!IS_ERR(cnone))
+		i2c_unregister_device(cnone);
+	if (!IS_ERR(c16))
+		i2c_unregister_device(c16);
+	if (!IS_ERR(c8))
+		i2c_unregister_device(c8);
+	rt_teardown();
+	return ret;
+}
+
+static void __exit regxfer_test_exit(void)
+{
+}
+
+module_init(regxfer_test_init);
+module_exit(regxfer_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JetWen");
+MODULE_INFO(intree, "Y");